@@ -0,0 +1,479 @@
+#include "batch_math.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+// Runtime dispatch: every *Lanes function below is compiled once per
+// instruction set and the dynamic loader picks the best one (ifunc).
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+    #define BATCH_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+    #define BATCH_TARGET_CLONES
+#endif
+
+#if defined(__GNUC__)
+    #define BATCH_INLINE inline __attribute__((always_inline))
+#else
+    #define BATCH_INLINE inline
+#endif
+
+// Bit casts the vectorizer can see through
+static BATCH_INLINE uint64_t bitsOf(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+static BATCH_INLINE double fromBits(uint64_t bits) {
+    double x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+// Adding and subtracting 1.5 * 2^52 rounds a double to the nearest integer;
+// the low mantissa bits of the sum then hold that integer in two's complement
+static const double ROUND_MAGIC = 6755399441055744.0;
+
+// Largest |angle| reduced exactly by the vector path; bigger angles are
+// first reduced with fmod() in a scalar fix-up pass
+static const double HUGE_ANGLE = 70368744177664.0;  // 2^46
+
+// pi / 180 to 2^-115: DEG_TO_RAD_HI + DEG_TO_RAD_LO is the nearest double,
+// split into 26-bit halves, and DEG_TO_RAD_TAIL the rest
+static const double DEG_TO_RAD_TAIL = 2.9486522708701687e-19;
+static const double DEG_TO_RAD_HI = 0.01745329238474369;
+static const double DEG_TO_RAD_LO = 1.3519960498364902e-10;
+
+// Correctly rounded values at the angles people type
+static const double SIN_45 = 0.70710678118654757;
+static const double COS_30 = 0.8660254037844386;
+static const double TAN_30 = 0.57735026918962573;
+static const double SQRT_3 = 1.7320508075688772;
+
+// Minimax coefficients on [-pi/4, pi/4] (fdlibm __kernel_sin/__kernel_cos)
+static const double S1 = -1.66666666666666324348e-01;
+static const double S2 = 8.33333333332248946124e-03;
+static const double S3 = -1.98412698298579493134e-04;
+static const double S4 = 2.75573137070700676789e-06;
+static const double S5 = -2.50507602534068634195e-08;
+static const double S6 = 1.58969099521155010221e-10;
+
+static const double C1 = 4.16666666666666019037e-02;
+static const double C2 = -1.38888888888741095749e-03;
+static const double C3 = 2.48015872894767294178e-05;
+static const double C4 = -2.75573143513906633035e-07;
+static const double C5 = 2.08757232129817482790e-09;
+static const double C6 = -1.13596475577881948265e-11;
+
+// tan(x) ~ x + T0 x^3 + T1 x^5 + ... on [-0.6744, 0.6744] (fdlibm __kernel_tan)
+static const double T0 = 3.33333333333334091986e-01;
+static const double T1 = 1.33333333333201242699e-01;
+static const double T2 = 5.39682539762260521377e-02;
+static const double T3 = 2.18694882948595424599e-02;
+static const double T4 = 8.86323982359930005737e-03;
+static const double T5 = 3.59207910759131235356e-03;
+static const double T6 = 1.45620945432529025516e-03;
+static const double T7 = 5.88041240820264096874e-04;
+static const double T8 = 2.46463134818469906812e-04;
+static const double T9 = 7.81794442939557092300e-05;
+static const double T10 = 7.14072491382608190305e-05;
+static const double T11 = -1.85586374855275456654e-05;
+static const double T12 = 2.59073051863633712884e-05;
+static const double PIO4 = 7.85398163397448278999e-01;
+static const double PIO4_LO = 3.06161699786838301793e-17;
+
+// log(1+f) coefficients (fdlibm e_log)
+static const double LG1 = 6.666666666666735130e-01;
+static const double LG2 = 3.999999999940941908e-01;
+static const double LG3 = 2.857142874366239149e-01;
+static const double LG4 = 2.222219843214978396e-01;
+static const double LG5 = 1.818357216161805012e-01;
+static const double LG6 = 1.531383769920937332e-01;
+static const double LG7 = 1.479819860511658591e-01;
+
+static const double LN2_HI = 6.93147180369123816490e-01;
+static const double LN2_LO = 1.90821492927058770002e-10;
+static const double INV_LN2 = 1.44269504088896338700e+00;
+static const double INV_LN10 = 4.34294481903251816668e-01;
+static const double LOG10_2_HI = 3.01029995663611771306e-01;
+static const double LOG10_2_LO = 3.69423907715893078616e-13;
+static const double SQRT2 = 1.41421356237309514547e+00;
+
+static const double EXP_OVERFLOW = 709.782712893383973096;
+static const double EXP_UNDERFLOW = -745.13321910194110842;
+
+// Angle in degrees -> quadrant and remainder, sinpi/cospi style: the
+// reduction happens in degree space, where q = round(d / 90) and
+// r = d - 90q are exact for |d| < 2^46. Only the remainder |r| <= 45 is
+// converted to radians, as a double-double x + y, so the conversion adds
+// no error of its own.
+static BATCH_INLINE uint64_t reduceDegrees(double degrees, double& reduced, double& x, double& y) {
+    double t = degrees * (1.0 / 90.0) + ROUND_MAGIC;
+    double q = t - ROUND_MAGIC;
+    reduced = degrees - 90.0 * q;
+    
+    // Split both factors into 26-bit halves so the leading partial product
+    // is exact; then it does not matter whether the compiler fuses any of
+    // these multiplies and adds into FMAs
+    double split = reduced * 134217729.0;   // 2^27 + 1
+    double reduced_hi = split - (split - reduced);
+    double reduced_lo = reduced - reduced_hi;
+    double head = reduced_hi * DEG_TO_RAD_HI;
+    double tail = (reduced_hi * DEG_TO_RAD_LO + reduced_lo * DEG_TO_RAD_HI) +
+                  (reduced_lo * DEG_TO_RAD_LO + reduced * DEG_TO_RAD_TAIL);
+    x = head + tail;
+    y = tail - (x - head);
+    return bitsOf(t) - bitsOf(ROUND_MAGIC);
+}
+
+// Sine and cosine in degrees. Multiples of 90 degrees land exactly on 0
+// and +-1 (with the zero signs of IEEE sinPi/cosPi), and +-30 and +-45
+// degrees are looked up.
+static BATCH_INLINE void sinCosDegrees(double degrees, double& sine, double& cosine) {
+    double reduced, x, y;
+    uint64_t quadrant = reduceDegrees(degrees, reduced, x, y);
+    
+    // fdlibm __kernel_sin and __kernel_cos with the tail y
+    double z = x * x;
+    double v = z * x;
+    double r = S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)));
+    double s = x - ((z * (0.5 * y - v * r) - y) - v * S1);
+    
+    double rc = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+    double hz = 0.5 * z;
+    double w = 1.0 - hz;
+    double c = w + (((1.0 - w) - hz) + (z * rc - x * y));
+    
+    double magnitude = std::fabs(reduced);
+    s = magnitude == 30.0 ? std::copysign(0.5, reduced) : s;
+    c = magnitude == 30.0 ? COS_30 : c;
+    s = magnitude == 45.0 ? std::copysign(SIN_45, reduced) : s;
+    c = magnitude == 45.0 ? SIN_45 : c;
+    
+    // Quadrant k: sin = S, C, -S, -C and cos = C, -S, -C, S
+    bool odd = (quadrant & 1) != 0;
+    double sin_value = odd ? c : s;
+    double cos_value = odd ? s : c;
+    sine = (quadrant & 2) ? -sin_value : sin_value;
+    cosine = ((quadrant + 1) & 2) ? -cos_value : cos_value;
+    sine = sine == 0.0 ? std::copysign(0.0, degrees) : sine;
+    cosine = cosine == 0.0 ? 0.0 : cosine;
+}
+
+// Tangent in degrees: tan(r) in even quadrants and -1/tan(r) in odd ones,
+// using fdlibm __kernel_tan with its branches turned into selects. +-inf
+// exactly at 90 + k*180 degrees; +-30 and +-45 degrees are looked up.
+static BATCH_INLINE double tanDegrees(double degrees) {
+    double reduced, x, y;
+    bool odd = (reduceDegrees(degrees, reduced, x, y) & 1) != 0;
+    
+    // Near pi/4, work with pi/4 - |x| instead
+    double sign = std::copysign(1.0, x);
+    bool near_pio4 = std::fabs(x) >= 0.6744;
+    double folded = (PIO4 - sign * x) + (PIO4_LO - sign * y);
+    x = near_pio4 ? folded : x;
+    y = near_pio4 ? 0.0 : y;
+    
+    double z = x * x;
+    double w = z * z;
+    double r = T1 + w * (T3 + w * (T5 + w * (T7 + w * (T9 + w * T11))));
+    double v = z * (T2 + w * (T4 + w * (T6 + w * (T8 + w * (T10 + w * T12)))));
+    double s = z * x;
+    r = y + z * (s * (r + v) + y);
+    r += T0 * s;
+    w = x + r;
+    
+    double iy = odd ? -1.0 : 1.0;
+    double folded_result = sign * (iy - 2.0 * (x - (w * w / (w + iy) - r)));
+    
+    // -1 / (x + r) to full precision: 21-bit heads multiply exactly
+    double w_head = fromBits(bitsOf(w) & 0xFFFFFFFF00000000ULL);
+    double w_tail = r - (w_head - x);
+    double inverse = -1.0 / w;
+    double inverse_head = fromBits(bitsOf(inverse) & 0xFFFFFFFF00000000ULL);
+    double correction = 1.0 + inverse_head * w_head;
+    inverse = inverse_head + inverse * (correction + inverse_head * w_tail);
+    
+    // At the pole w is +-0 and the refinement gives NaN
+    inverse = w == 0.0 ? -1.0 / w : inverse;
+    double result = near_pio4 ? folded_result : (odd ? inverse : w);
+    
+    double magnitude = std::fabs(reduced);
+    double flip = odd ? -1.0 : 1.0;
+    result = magnitude == 30.0 ? std::copysign(odd ? SQRT_3 : TAN_30, flip * reduced) : result;
+    result = magnitude == 45.0 ? std::copysign(1.0, flip * reduced) : result;
+    return result;
+}
+
+static BATCH_INLINE double expKernel(double x) {
+    double clamped = x > EXP_OVERFLOW ? EXP_OVERFLOW : (x < EXP_UNDERFLOW ? EXP_UNDERFLOW : x);
+    double t = clamped * INV_LN2 + ROUND_MAGIC;
+    double n = t - ROUND_MAGIC;
+    int64_t k = static_cast<int64_t>(bitsOf(t) - bitsOf(ROUND_MAGIC));
+    double r = (clamped - n * LN2_HI) - n * LN2_LO;
+    
+    // Taylor series to r^13 / 13! is below half an ulp for |r| <= ln2/2
+    double p = 1.0 / 6227020800.0;
+    p = p * r + 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    
+    // Scale by 2^k in two steps so subnormal results stay representable
+    int64_t k1 = k >> 1;
+    int64_t k2 = k - k1;
+    double result = p * fromBits(static_cast<uint64_t>(k1 + 1023) << 52)
+                      * fromBits(static_cast<uint64_t>(k2 + 1023) << 52);
+    
+    result = x > EXP_OVERFLOW ? numeric_limits<double>::infinity() : result;
+    result = x < EXP_UNDERFLOW ? 0.0 : result;
+    return x != x ? x : result;
+}
+
+// Natural log split as e * ln2 + log(m) with m in [sqrt(2)/2, sqrt(2)).
+// Returns log(m) and the exponent e; the caller combines them.
+static BATCH_INLINE double logMantissa(double x, double& exponent) {
+    bool subnormal = x < 2.2250738585072014e-308;
+    double scaled = subnormal ? x * 18014398509481984.0 : x;  // 2^54
+    uint64_t bits = bitsOf(scaled);
+    
+    int64_t e = static_cast<int64_t>((bits >> 52) & 0x7ff) - 1023 - (subnormal ? 54 : 0);
+    double m = fromBits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    bool high = m > SQRT2;
+    m = high ? m * 0.5 : m;
+    e = high ? e + 1 : e;
+    exponent = fromBits(bitsOf(ROUND_MAGIC) + static_cast<uint64_t>(e)) - ROUND_MAGIC;
+    
+    double f = m - 1.0;
+    double s = f / (2.0 + f);
+    double z = s * s;
+    double w = z * z;
+    double t1 = w * (LG2 + w * (LG4 + w * LG6));
+    double t2 = z * (LG1 + w * (LG3 + w * (LG5 + w * LG7)));
+    double hfsq = 0.5 * f * f;
+    return f - (hfsq - s * (hfsq + t2 + t1));
+}
+
+// Special inputs for the logarithms: x <= 0 is a domain error (NaN),
+// +inf and NaN pass through
+static BATCH_INLINE double logSpecial(double x, double result) {
+    result = x <= 0 ? numeric_limits<double>::quiet_NaN() : result;
+    return (x != x || x == numeric_limits<double>::infinity()) ? x : result;
+}
+
+BATCH_TARGET_CLONES
+static void sinLanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        double s, c;
+        sinCosDegrees(in[i], s, c);
+        out[i] = s;
+    }
+}
+
+BATCH_TARGET_CLONES
+static void cosLanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        double s, c;
+        sinCosDegrees(in[i], s, c);
+        out[i] = c;
+    }
+}
+
+BATCH_TARGET_CLONES
+static void tanLanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = tanDegrees(in[i]);
+    }
+}
+
+BATCH_TARGET_CLONES
+static void sinCosLanes(const double* in, double* sines, double* cosines, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        sinCosDegrees(in[i], sines[i], cosines[i]);
+    }
+}
+
+BATCH_TARGET_CLONES
+static void lnLanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        double e;
+        double log_m = logMantissa(in[i], e);
+        out[i] = logSpecial(in[i], e * LN2_HI + (log_m + e * LN2_LO));
+    }
+}
+
+BATCH_TARGET_CLONES
+static void log10Lanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        double e;
+        double log_m = logMantissa(in[i], e);
+        out[i] = logSpecial(in[i], e * LOG10_2_HI + (e * LOG10_2_LO + log_m * INV_LN10));
+    }
+}
+
+BATCH_TARGET_CLONES
+static void expLanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = expKernel(in[i]);
+    }
+}
+
+BATCH_TARGET_CLONES
+static void sqrtLanes(const double* in, double* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = in[i] < 0 ? numeric_limits<double>::quiet_NaN() : std::sqrt(in[i]);
+    }
+}
+
+// fmod() by 360 is exact, so any finite angle reduces without error
+static double reduceHugeAngle(double degrees) {
+    return std::fabs(degrees) < HUGE_ANGLE ? degrees : std::fmod(degrees, 360.0);
+}
+
+// Recompute angles too large for the exact vector reduction
+static void fixHugeAngles(const double* in, double* out, size_t count, int which) {
+    for (size_t i = 0; i < count; i++) {
+        if (std::fabs(in[i]) >= HUGE_ANGLE && std::isfinite(in[i])) {
+            double s, c;
+            double degrees = reduceHugeAngle(in[i]);
+            sinCosDegrees(degrees, s, c);
+            out[i] = which == 0 ? s : (which == 1 ? c : tanDegrees(degrees));
+        }
+    }
+}
+
+// Write the error mask for lanes matching `failed` and count them
+template <typename Predicate>
+static size_t markErrors(const double* values, double* out, uint8_t* errors,
+                         size_t count, Predicate failed) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool error = failed(values[i]);
+        if (errors != nullptr) {
+            errors[i] = error ? 1 : 0;
+        }
+        if (error) {
+            out[i] = numeric_limits<double>::quiet_NaN();
+            total++;
+        }
+    }
+    return total;
+}
+
+static size_t clearErrors(uint8_t* errors, size_t count) {
+    if (errors != nullptr) {
+        memset(errors, 0, count);
+    }
+    return 0;
+}
+
+// BatchMath implementation
+size_t BatchMath::sin(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    sinLanes(inputs, results, count);
+    fixHugeAngles(inputs, results, count, 0);
+    return clearErrors(errors, count);
+}
+
+size_t BatchMath::cos(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    cosLanes(inputs, results, count);
+    fixHugeAngles(inputs, results, count, 1);
+    return clearErrors(errors, count);
+}
+
+size_t BatchMath::tan(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    tanLanes(inputs, results, count);
+    fixHugeAngles(inputs, results, count, 2);
+    return markErrors(results, results, errors, count,
+                      [](double value) { return std::isinf(value); });
+}
+
+void BatchMath::sinCos(const double* inputs, double* sines, double* cosines, size_t count) {
+    sinCosLanes(inputs, sines, cosines, count);
+    fixHugeAngles(inputs, sines, count, 0);
+    fixHugeAngles(inputs, cosines, count, 1);
+}
+
+double BatchMath::sinDegrees(double degrees) {
+    double s, c;
+    sinCosDegrees(reduceHugeAngle(degrees), s, c);
+    return s;
+}
+
+double BatchMath::cosDegrees(double degrees) {
+    double s, c;
+    sinCosDegrees(reduceHugeAngle(degrees), s, c);
+    return c;
+}
+
+double BatchMath::tanDegrees(double degrees) {
+    return ::tanDegrees(reduceHugeAngle(degrees));
+}
+
+size_t BatchMath::log10(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    log10Lanes(inputs, results, count);
+    return markErrors(inputs, results, errors, count,
+                      [](double value) { return value <= 0; });
+}
+
+size_t BatchMath::ln(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    lnLanes(inputs, results, count);
+    return markErrors(inputs, results, errors, count,
+                      [](double value) { return value <= 0; });
+}
+
+size_t BatchMath::exp(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    expLanes(inputs, results, count);
+    return clearErrors(errors, count);
+}
+
+size_t BatchMath::sqrt(const double* inputs, double* results, uint8_t* errors, size_t count) {
+    sqrtLanes(inputs, results, count);
+    return markErrors(inputs, results, errors, count,
+                      [](double value) { return value < 0; });
+}
+
+// No polynomial kernel here: exp(b * ln(a)) loses up to |b * ln(a)| ulps,
+// so only the exact special cases are inlined and the rest go to libm pow
+size_t BatchMath::power(const double* bases, const double* exponents,
+                        double* results, uint8_t* errors, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        double a = bases[i];
+        double b = exponents[i];
+        if (b == 2.0) {
+            results[i] = a * a;
+        } else if (b == 1.0) {
+            results[i] = a;
+        } else if (b == 0.5 && a >= 0) {
+            results[i] = std::sqrt(a);
+        } else {
+            results[i] = std::pow(a, b);
+        }
+    }
+    return clearErrors(errors, count);
+}
+
+const char* BatchMath::activeInstructionSet() {
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "avx512f";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "avx2";
+    }
+    return "x86-64";
+#else
+    return "portable";
+#endif
+}
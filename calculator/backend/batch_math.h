@@ -0,0 +1,49 @@
+#ifndef BATCH_MATH_H
+#define BATCH_MATH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Batch kernels for the scientific operations.
+//
+// Each function writes results[i] = op(inputs[i]) for count lanes and sets
+// errors[i] to 1 where the scalar Calculator operation would report an
+// error (negative sqrt, non-positive log, undefined tan angle); such lanes
+// hold NaN. errors may be nullptr. The return value is the number of error
+// lanes. Trigonometric inputs are in degrees and are reduced in degree
+// space, so multiples of 30, 45 and 90 degrees give correctly rounded
+// (or exact) results and huge angles lose nothing to the reduction.
+// Inputs and results must not overlap.
+//
+// The kernels are branch-free polynomial approximations written so the
+// compiler can vectorize them. On x86-64 Linux with GCC or Clang they are
+// compiled for AVX-512, AVX2 and baseline x86-64 and the best version for
+// the running CPU is picked at load time; elsewhere the portable build is
+// used.
+class BatchMath {
+public:
+    typedef size_t (*Kernel)(const double* inputs, double* results, uint8_t* errors, size_t count);
+    
+    static size_t sin(const double* inputs, double* results, uint8_t* errors, size_t count);
+    static size_t cos(const double* inputs, double* results, uint8_t* errors, size_t count);
+    static size_t tan(const double* inputs, double* results, uint8_t* errors, size_t count);
+    // Sine and cosine of every input in one pass
+    static void sinCos(const double* inputs, double* sines, double* cosines, size_t count);
+    static size_t log10(const double* inputs, double* results, uint8_t* errors, size_t count);
+    static size_t ln(const double* inputs, double* results, uint8_t* errors, size_t count);
+    static size_t exp(const double* inputs, double* results, uint8_t* errors, size_t count);
+    static size_t sqrt(const double* inputs, double* results, uint8_t* errors, size_t count);
+    static size_t power(const double* bases, const double* exponents,
+                        double* results, uint8_t* errors, size_t count);
+    
+    // Single angles through the same kernels, for scalar callers.
+    // tanDegrees is +-inf where the tangent is undefined.
+    static double sinDegrees(double degrees);
+    static double cosDegrees(double degrees);
+    static double tanDegrees(double degrees);
+    
+    // Instruction set the kernels run with on this machine
+    static const char* activeInstructionSet();
+};
+
+#endif // BATCH_MATH_H
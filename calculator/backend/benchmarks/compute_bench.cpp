@@ -0,0 +1,392 @@
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "batch_math.h"
+#include "bigint.h"
+#include "calculator.h"
+#include "expression.h"
+#include "history_log.h"
+#include "test_support.h"
+
+using namespace std;
+
+// In-process costs: the batch kernels against scalar libm, command
+// dispatch and formatting, number text, expression parsing and the
+// program cache, the result cache on uniform and skewed inputs, big
+// multiplication and factorials, and opening a large history log.
+//
+//   compute_bench [--quick]
+
+static volatile double sink;
+
+template <typename Body>
+static double nanosecondsPer(size_t count, Body body) {
+    auto start = chrono::steady_clock::now();
+    body();
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / count;
+}
+
+static void report(const string& name, double nanoseconds) {
+    cout << left << setw(36) << name << right << fixed << setprecision(1)
+         << setw(10) << nanoseconds << " ns" << endl;
+}
+
+static void benchKernels(size_t count) {
+    mt19937_64 random(1);
+    uniform_real_distribution<double> angle(-720.0, 720.0);
+    uniform_real_distribution<double> positive(1e-3, 1e3);
+    vector<double> angles(count), values(count), results(count);
+    for (size_t i = 0; i < count; i++) {
+        angles[i] = angle(random);
+        values[i] = positive(random);
+    }
+    cout << "kernels (" << BatchMath::activeInstructionSet() << "), per value:" << endl;
+    
+    report("  sin libm radians", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) results[i] = std::sin(angles[i] * M_PI / 180.0);
+    }));
+    report("  sin scalar degrees", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) results[i] = BatchMath::sinDegrees(angles[i]);
+    }));
+    report("  sin batch", nanosecondsPer(count, [&]() {
+        BatchMath::sin(angles.data(), results.data(), nullptr, count);
+    }));
+    report("  tan batch", nanosecondsPer(count, [&]() {
+        BatchMath::tan(angles.data(), results.data(), nullptr, count);
+    }));
+    report("  ln libm", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) results[i] = std::log(values[i]);
+    }));
+    report("  ln batch", nanosecondsPer(count, [&]() {
+        BatchMath::ln(values.data(), results.data(), nullptr, count);
+    }));
+    report("  exp libm", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) results[i] = std::exp(values[i] / 10);
+    }));
+    report("  exp batch", nanosecondsPer(count, [&]() {
+        BatchMath::exp(values.data(), results.data(), nullptr, count);
+    }));
+    sink = results[count / 2];
+}
+
+// The command lookup processCommand did before the handler table, for
+// comparison: the request split by an istringstream into a map of named
+// parameters, then the name tested against each command in turn
+static const char* const CHAINED_COMMANDS[] = {
+    "CALC", "EVAL", "ADD", "SUB", "MUL", "DIV", "SQRT", "SIN", "COS", "TAN", "LOG", "LN",
+    "EXP", "FACT", "POW", "PERCENT", "NEGATE", "RECIPROCAL", "MADD", "MSUB", "MR", "MC",
+    "HISTORY", "CLEAR_HISTORY", "SAVE_HISTORY", "LOAD_HISTORY", "EXIT", "QUIT"
+};
+
+static size_t chainedLookup(const string& command) {
+    map<string, string> parts;
+    istringstream in(command);
+    string name;
+    in >> name;
+    parts["command"] = name;
+    string param;
+    if (in >> param) {
+        parts["param"] = param;
+    }
+    string key = parts["command"];
+    size_t index = 0;
+    for (const char* candidate : CHAINED_COMMANDS) {
+        if (key == candidate) {
+            break;
+        }
+        index++;
+    }
+    return index;
+}
+
+// Text commands through CommandProcessor with the result cache off: the
+// dispatch, the arithmetic and the response formatting, plus recording in
+// history and queueing for its log, which text commands always do
+static void benchCommands(const TempDir& dir, size_t count) {
+    cout << "commands, per request:" << endl;
+    CommandProcessor processor(dir.file("commands.dat"), 1000, HistoryLogOptions(), 0);
+    string response;
+    processor.processCommand("HISTORY 1", response);
+    vector<string> commands;
+    for (size_t i = 0; i < 1024; i++) {
+        commands.push_back("ADD " + to_string(i) + ".25 " + to_string(i % 7));
+    }
+    report("  ADD (history on)", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            response.clear();
+            processor.processCommand(commands[i % commands.size()], response);
+        }
+    }));
+    report("  EVAL (cached shape)", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            response.clear();
+            processor.processCommand("EVAL 2 * (3 + 4) ^ 2", response);
+        }
+    }));
+    report("  MR", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            response.clear();
+            processor.processCommand("MR", response);
+        }
+    }));
+    report("  unknown command", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            response.clear();
+            processor.processCommand("NOPE 1 2", response);
+        }
+    }));
+    report("  MR lookup alone, old chain", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            sink = double(chainedLookup("MR"));
+        }
+    }));
+}
+
+// Doubles to text and back: the stream and printf routes against the
+// shortest to_chars text responses use and from_chars
+static void benchNumberText(size_t count) {
+    cout << "number text, per value:" << endl;
+    mt19937_64 random(4);
+    uniform_real_distribution<double> mantissa(-10.0, 10.0);
+    uniform_int_distribution<int> exponent(-30, 30);
+    vector<double> values(count);
+    for (double& value : values) {
+        value = mantissa(random) * pow(10.0, exponent(random));
+    }
+    vector<string> texts;
+    char buffer[32];
+    for (double value : values) {
+        texts.emplace_back(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    }
+    
+    report("  format, ostream", nanosecondsPer(count, [&]() {
+        ostringstream out;
+        out << setprecision(17);
+        for (double value : values) {
+            out.str("");
+            out << value;
+            sink = double(out.tellp());
+        }
+    }));
+    report("  format, snprintf %.17g", nanosecondsPer(count, [&]() {
+        for (double value : values) {
+            sink = double(snprintf(buffer, sizeof(buffer), "%.17g", value));
+        }
+    }));
+    report("  format, to_chars shortest", nanosecondsPer(count, [&]() {
+        for (double value : values) {
+            sink = double(to_chars(buffer, buffer + sizeof(buffer), value).ptr - buffer);
+        }
+    }));
+    report("  parse, stod", nanosecondsPer(count, [&]() {
+        for (const string& text : texts) {
+            sink = stod(text);
+        }
+    }));
+    report("  parse, from_chars", nanosecondsPer(count, [&]() {
+        for (const string& text : texts) {
+            double value = 0;
+            from_chars(text.data(), text.data() + text.size(), value);
+            sink = value;
+        }
+    }));
+}
+
+// 4096 expressions of distinct shapes: seven literals joined by every
+// sequence of six operators
+static vector<string> expressionShapes() {
+    static const char OPERATORS[] = "+-*/";
+    vector<string> expressions;
+    for (size_t shape = 0; shape < 4096; shape++) {
+        string expression = "1.5";
+        for (size_t i = 0, ops = shape; i < 6; i++, ops /= 4) {
+            expression += ' ';
+            expression += OPERATORS[ops % 4];
+            expression += ' ';
+            expression += to_string(i + 2);
+        }
+        expressions.push_back(expression);
+    }
+    return expressions;
+}
+
+static void benchExpressions(size_t count) {
+    cout << "expressions, per expression:" << endl;
+    vector<string> expressions = expressionShapes();
+    report("  parse and compile", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            sink = double(ExpressionCompiler(expressions[i % expressions.size()]).compile().code.size());
+        }
+    }));
+    
+    // Cycling through more shapes than the cache holds misses every time;
+    // one shape with changing literals always hits
+    VariableTable variables;
+    ExpressionCache cold(1024);
+    report("  evaluate, cold cache", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            sink = cold.evaluate(expressions[i % expressions.size()], variables);
+        }
+    }));
+    vector<string> literals;
+    for (size_t i = 0; i < 1024; i++) {
+        literals.push_back(to_string(i) + " * 2.5 + 3 / 4 - 5 * 6 + 7");
+    }
+    ExpressionCache warm(1024);
+    report("  evaluate, warm cache", nanosecondsPer(count, [&]() {
+        for (size_t i = 0; i < count; i++) {
+            sink = warm.evaluate(literals[i % literals.size()], variables);
+        }
+    }));
+}
+
+// SIN through the result cache: uniform inputs miss and arm the bypass,
+// a few hot inputs hit
+static void benchMemo(const TempDir& dir, size_t count) {
+    cout << "SIN through the result cache, per call:" << endl;
+    mt19937_64 random(3);
+    uniform_real_distribution<double> uniform(0.0, 1e6);
+    vector<double> spread(count), hot(count);
+    for (size_t i = 0; i < count; i++) {
+        spread[i] = uniform(random);
+        hot[i] = double(random() % 64);
+    }
+    for (size_t capacity : {size_t(0), DEFAULT_RESULT_CACHE_CAPACITY}) {
+        Calculator calculator(dir.file("memo.dat"), 1000, HistoryLogOptions(), capacity);
+        calculator.recordHistory(false);
+        string label = capacity == 0 ? "  no cache, " : "  cache, ";
+        report(label + "uniform", nanosecondsPer(count, [&]() {
+            for (double angle : spread) sink = calculator.sin(angle).result;
+        }));
+        report(label + "skewed", nanosecondsPer(count, [&]() {
+            for (double angle : hot) sink = calculator.sin(angle).result;
+        }));
+    }
+}
+
+static void reportMilliseconds(const string& name, double nanoseconds, const string& note = "") {
+    cout << left << setw(36) << name << right << fixed << setprecision(2)
+         << setw(10) << nanoseconds / 1e6 << " ms";
+    if (!note.empty()) {
+        cout << "  " << note;
+    }
+    cout << endl;
+}
+
+// Schoolbook product of base 10^9 limbs, least significant first: what
+// BigInt does below KARATSUBA_THRESHOLD, here at every size for comparison
+static vector<uint32_t> multiplySchoolbook(const vector<uint32_t>& a, const vector<uint32_t>& b) {
+    vector<uint32_t> product(a.size() + b.size(), 0);
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            uint64_t sum = product[i + j] + uint64_t(a[i]) * b[j] + carry;
+            carry = sum / BigInt::BASE;
+            product[i + j] = uint32_t(sum % BigInt::BASE);
+        }
+        product[i + b.size()] = uint32_t(carry);
+    }
+    return product;
+}
+
+static void benchMultiply(bool quick) {
+    cout << "big multiplication, square operands:" << endl;
+    mt19937_64 random(5);
+    for (size_t limbs : {size_t(256), size_t(1024), size_t(4096), size_t(16384)}) {
+        if (quick && limbs > 1024) {
+            break;
+        }
+        vector<uint32_t> a(limbs), b(limbs);
+        string a_text, b_text;
+        for (size_t i = 0; i < limbs; i++) {
+            a[i] = uint32_t(random() % BigInt::BASE);
+            b[i] = uint32_t(random() % BigInt::BASE);
+            a_text += to_string(a[i] % 9 + 1) + string(BigInt::BASE_DIGITS - 1, '7');
+            b_text += to_string(b[i] % 9 + 1) + string(BigInt::BASE_DIGITS - 1, '3');
+        }
+        BigInt x = BigInt::parse(a_text);
+        BigInt y = BigInt::parse(b_text);
+        string note = "(" + to_string(limbs) + " limbs)";
+        reportMilliseconds("  schoolbook", nanosecondsPer(1, [&]() {
+            sink = double(multiplySchoolbook(a, b).back());
+        }), note);
+        reportMilliseconds("  BigInt (Karatsuba)", nanosecondsPer(1, [&]() {
+            sink = double((x * y).digits());
+        }), note);
+    }
+}
+
+// BigInt::factorial directly: FACT itself stops at MAX_EXACT_FACTORIAL.
+// The running product 2 * 3 * ... * n is what prime swing replaced.
+static void benchFactorial(bool quick) {
+    cout << "exact factorials:" << endl;
+    for (uint32_t n : {1000u, 10000u, 100000u}) {
+        if (quick && n > 10000) {
+            break;
+        }
+        size_t digits = 0;
+        string label = "  factorial(" + to_string(n) + ")";
+        double nanoseconds = nanosecondsPer(1, [&]() { digits = BigInt::factorial(n).digits(); });
+        reportMilliseconds(label + ", prime swing", nanoseconds, "(" + to_string(digits) + " digits)");
+        if (n > MAX_EXACT_FACTORIAL) {
+            continue;
+        }
+        reportMilliseconds(label + ", running product", nanosecondsPer(1, [&]() {
+            BigInt product(1);
+            for (uint32_t i = 2; i <= n; i++) {
+                product = product * BigInt(i);
+            }
+            sink = double(product.digits());
+        }));
+    }
+}
+
+// Startup with a long history: open() maps the log and only reads the
+// records that fit in the in-memory history
+static void benchLogOpen(const TempDir& dir, bool quick) {
+    size_t records = quick ? 100000 : 10000000;
+    HistoryLogOptions options;
+    options.retention = records;
+    string path = dir.file("open.dat");
+    {
+        HistoryLog log(options);
+        HistoryBuffer history(1);
+        log.open(path, history);
+        for (size_t i = 0; i < records; i++) {
+            log.append(HistoryEntry(int64_t(i), Operation::ADD, double(i), 1.0, double(i + 1)));
+        }
+        log.flush();
+    }
+    
+    cout << "history log with " << records << " records:" << endl;
+    for (size_t capacity : {size_t(1000), DEFAULT_HISTORY_CAPACITY}) {
+        HistoryLog log(options);
+        HistoryBuffer history(capacity);
+        reportMilliseconds("  open, " + to_string(capacity) + " entries kept",
+                           nanosecondsPer(1, [&]() { log.open(path, history); }));
+    }
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && string(argv[1]) == "--quick";
+    size_t count = quick ? 20000 : 2000000;
+    TempDir dir;
+    benchKernels(count);
+    benchCommands(dir, count / 10);
+    benchNumberText(count / 10);
+    benchExpressions(count / 10);
+    benchMemo(dir, count);
+    benchMultiply(quick);
+    benchFactorial(quick);
+    benchLogOpen(dir, quick);
+    return 0;
+}
@@ -0,0 +1,265 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+#include "binary_protocol.h"
+#include "server_process.h"
+#include "shm_transport.h"
+#include "uring.h"
+
+using namespace std;
+
+// Requests per second through every transport of a live server: TCP with
+// the epoll and io_uring loops, and shared memory, each with text (LINE
+// framing) and binary requests, one at a time and pipelined; then many
+// clients at once against each event loop and worker count.
+//
+//   transport_bench <calculator_backend> [--quick]
+
+static const size_t WINDOW = 64;    // Requests in flight when pipelining
+
+static bool failed = false;
+
+// Send `count` requests in batches, waiting for each batch's responses
+// before the next; returns requests per second
+static double measure(size_t count, size_t batch,
+                      const function<bool(size_t first, size_t count)>& send,
+                      const function<bool(size_t count)>& receive) {
+    auto start = chrono::steady_clock::now();
+    for (size_t done = 0; done < count; done += batch) {
+        size_t n = min(batch, count - done);
+        if (!send(done, n) || !receive(n)) {
+            cerr << "transport failed after " << done << " requests" << endl;
+            failed = true;
+            return 0.0;
+        }
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return count / elapsed.count();
+}
+
+static string textRequest(size_t i) {
+    return "ADD " + to_string(i) + " 1\n";
+}
+
+static string binaryRequest(size_t i, uint8_t flags = 0) {
+    BinaryRequest request = {BINARY_OPCODE_ADD, flags, 0, uint32_t(i), {double(i), 1.0}};
+    return string(reinterpret_cast<const char*>(&request), sizeof(request));
+}
+
+static void report(const string& transport, const string& protocol, size_t batch, double rate) {
+    cout << left << setw(12) << transport << setw(20) << protocol
+         << setw(12) << (batch == 1 ? "one" : "pipelined") << right << fixed
+         << setprecision(0) << setw(12) << rate << " req/s" << setprecision(2)
+         << setw(10) << (rate > 0 ? 1e6 / rate : 0.0) << " us/req" << endl;
+}
+
+static void benchTcp(const string& server_path, const string& backend, size_t count) {
+    ServerProcess server(server_path, {"--io", backend, "--workers", "1"});
+    for (size_t batch : {size_t(1), WINDOW}) {
+        Client text;
+        text.connectTcp(server.port());
+        string line;
+        text.send("PROTOCOL LINE\n");
+        text.readLine(line);
+        double rate = measure(count, batch,
+            [&](size_t first, size_t n) {
+                string requests;
+                for (size_t i = first; i < first + n; i++) {
+                    requests += textRequest(i);
+                }
+                return text.send(requests);
+            },
+            [&](size_t n) {
+                for (size_t i = 0; i < n; i++) {
+                    if (!text.readLine(line)) return false;
+                }
+                return true;
+            });
+        report("tcp " + backend, "text", batch, rate);
+        
+        // Both protocols record every request in history; without that,
+        // binary requests show what the protocol alone costs
+        for (uint8_t flags : {uint8_t(0), BINARY_FLAG_NO_HISTORY}) {
+            Client binary;
+            binary.connectTcp(server.port());
+            string response;
+            binary.send("PROTOCOL BINARY\n");
+            binary.read(response, sizeof(BinaryResponse));
+            rate = measure(count, batch,
+                [&](size_t first, size_t n) {
+                    string requests;
+                    for (size_t i = first; i < first + n; i++) {
+                        requests += binaryRequest(i, flags);
+                    }
+                    return binary.send(requests);
+                },
+                [&](size_t n) { return binary.read(response, n * sizeof(BinaryResponse)); });
+            report("tcp " + backend, flags == 0 ? "binary" : "binary, no history", batch, rate);
+        }
+    }
+}
+
+static void benchShm(const string& server_path, size_t count) {
+    string name = "calculator_bench_" + to_string(getpid());
+    ServerProcess server(server_path, {"--shm", name, "--workers", "1"});
+    // The server is killed without a chance to remove its segment
+    string object = ShmSegment::objectName(name);
+    for (size_t batch : {size_t(1), WINDOW}) {
+        for (ShmMode mode : {ShmMode::TEXT, ShmMode::BINARY}) {
+            ShmClient client;
+            string error;
+            if (!client.connect(name, mode, 0, error)) {
+                cerr << "shared memory: " << error << endl;
+                failed = true;
+                shm_unlink(object.c_str());
+                return;
+            }
+            bool text = mode == ShmMode::TEXT;
+            string response;
+            double rate = measure(count, batch,
+                [&](size_t first, size_t n) {
+                    for (size_t i = first; i < first + n; i++) {
+                        string request = text ? textRequest(i) : binaryRequest(i);
+                        if (text) request.pop_back();
+                        if (!client.send(request)) return false;
+                    }
+                    return true;
+                },
+                [&](size_t n) {
+                    for (size_t i = 0; i < n; i++) {
+                        if (!client.receive(response)) return false;
+                    }
+                    return true;
+                });
+            report("shm", text ? "text" : "binary", batch, rate);
+        }
+    }
+    shm_unlink(object.c_str());
+}
+
+// Closed loop over many connections: every client keeps one request in
+// flight, from one epoll loop on this side, until `count` have been
+// answered in all. Connecting is not timed. Returns requests per second.
+static double concurrentRate(int port, size_t clients, size_t count) {
+    vector<unique_ptr<Client>> connections;
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for (size_t i = 0; i < clients; i++) {
+        connections.push_back(make_unique<Client>());
+        Client& client = *connections.back();
+        string line;
+        if (!client.connectTcp(port) || !client.send("PROTOCOL LINE\n") || !client.readLine(line)) {
+            cerr << "client " << i << " could not connect" << endl;
+            failed = true;
+            close(epoll_fd);
+            return 0.0;
+        }
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.u64 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.descriptor(), &event);
+    }
+    
+    size_t sent = 0;
+    size_t answered = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < clients && sent < count; i++, sent++) {
+        connections[i]->send(textRequest(sent));
+    }
+    vector<epoll_event> events(clients);
+    string line;
+    while (answered < count) {
+        int ready = epoll_wait(epoll_fd, events.data(), int(events.size()),
+                               Client::TIMEOUT_SECONDS * 1000);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            cerr << "no response after " << answered << " requests" << endl;
+            failed = true;
+            break;
+        }
+        for (int i = 0; i < ready; i++) {
+            Client& client = *connections[events[i].data.u64];
+            if (!client.readLine(line)) {
+                failed = true;
+                answered = count;
+                break;
+            }
+            answered++;
+            if (sent < count) {
+                client.send(textRequest(sent++));
+            }
+        }
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    close(epoll_fd);
+    return count / elapsed.count();
+}
+
+static void benchConcurrency(const string& server_path, const vector<string>& backends,
+                             bool quick) {
+    vector<size_t> client_counts = {1, 10, 100, 1000};
+    vector<int> worker_counts = {1, 2, 4};
+    size_t count = quick ? 2000 : 100000;
+    if (quick) {
+        client_counts = {1, 100};
+        worker_counts = {1, 2};
+    }
+    
+    cout << endl << "concurrent clients, one request in flight each, text over TCP (req/s):" << endl;
+    cout << left << setw(20) << "clients" << right;
+    for (size_t clients : client_counts) {
+        cout << setw(12) << clients;
+    }
+    cout << endl;
+    for (const string& backend : backends) {
+        for (int workers : worker_counts) {
+            ServerProcess server(server_path, {"--io", backend, "--workers", to_string(workers)});
+            cout << left << setw(20) << (backend + ", " + to_string(workers) + " worker" +
+                                         (workers > 1 ? "s" : "")) << right;
+            for (size_t clients : client_counts) {
+                double rate = concurrentRate(server.port(), clients, max(count, clients));
+                cout << setw(12) << fixed << setprecision(0) << rate << flush;
+            }
+            cout << endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <calculator_backend> [--quick]" << endl;
+        return 2;
+    }
+    string server_path = argv[1];
+    bool quick = argc > 2 && string(argv[2]) == "--quick";
+    size_t count = quick ? 2000 : 200000;
+    
+    try {
+        vector<string> backends = {"epoll"};
+        string error;
+        if (IoUring::available(error)) {
+            backends.push_back("uring");
+        } else {
+            cout << "io_uring unavailable: " << error << endl;
+        }
+        for (const string& backend : backends) {
+            benchTcp(server_path, backend, count);
+        }
+        benchShm(server_path, count);
+        benchConcurrency(server_path, backends, quick);
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
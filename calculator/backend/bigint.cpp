@@ -0,0 +1,561 @@
+#include "bigint.h"
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+typedef vector<uint32_t> Limbs;
+
+static const uint64_t BASE = BigInt::BASE;
+
+static void trim(Limbs& limbs) {
+    while (!limbs.empty() && limbs.back() == 0) {
+        limbs.pop_back();
+    }
+}
+
+// Limbs up to and including the most significant non-zero one
+static size_t usedLength(const uint32_t* limbs, size_t size) {
+    while (size > 0 && limbs[size - 1] == 0) {
+        size--;
+    }
+    return size;
+}
+
+static Limbs limbsOf(uint64_t value) {
+    Limbs limbs;
+    while (value != 0) {
+        limbs.push_back(static_cast<uint32_t>(value % BASE));
+        value /= BASE;
+    }
+    return limbs;
+}
+
+static int compareMagnitude(const Limbs& a, const Limbs& b) {
+    if (a.size() != b.size()) {
+        return a.size() < b.size() ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// out[offset...] += b, carrying as far as needed. out must be long enough
+// for the sum.
+static void addAt(uint32_t* out, const uint32_t* b, size_t b_size, size_t offset) {
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < b_size; i++) {
+        uint32_t sum = out[offset + i] + b[i] + carry;
+        carry = sum >= BASE;
+        out[offset + i] = carry ? sum - BASE : sum;
+    }
+    for (; carry != 0; i++) {
+        uint32_t sum = out[offset + i] + 1;
+        carry = sum == BASE;
+        out[offset + i] = carry ? 0 : sum;
+    }
+}
+
+// a -= b where a >= b
+static void subtractFrom(uint32_t* a, const uint32_t* b, size_t b_size) {
+    uint32_t borrow = 0;
+    size_t i = 0;
+    for (; i < b_size; i++) {
+        uint32_t subtrahend = b[i] + borrow;
+        borrow = a[i] < subtrahend;
+        a[i] = borrow ? a[i] + BASE - subtrahend : a[i] - subtrahend;
+    }
+    for (; borrow != 0; i++) {
+        borrow = a[i] == 0;
+        a[i] = borrow ? BASE - 1 : a[i] - 1;
+    }
+}
+
+static Limbs addMagnitudes(const Limbs& a, const Limbs& b) {
+    const Limbs& longer = a.size() >= b.size() ? a : b;
+    const Limbs& shorter = a.size() >= b.size() ? b : a;
+    Limbs sum(longer.size() + 1, 0);
+    copy(longer.begin(), longer.end(), sum.begin());
+    addAt(sum.data(), shorter.data(), shorter.size(), 0);
+    trim(sum);
+    return sum;
+}
+
+// a - b where |a| >= |b|
+static Limbs subtractMagnitudes(const Limbs& a, const Limbs& b) {
+    Limbs difference = a;
+    subtractFrom(difference.data(), b.data(), b.size());
+    trim(difference);
+    return difference;
+}
+
+// out += a * b; out has a_size + b_size limbs
+static void multiplySchoolbook(const uint32_t* a, size_t a_size, const uint32_t* b, size_t b_size,
+                               uint32_t* out) {
+    for (size_t i = 0; i < a_size; i++) {
+        uint64_t carry = 0;
+        uint64_t digit = a[i];
+        if (digit == 0) {
+            continue;
+        }
+        for (size_t j = 0; j < b_size; j++) {
+            uint64_t product = out[i + j] + digit * b[j] + carry;
+            carry = product / BASE;
+            out[i + j] = static_cast<uint32_t>(product % BASE);
+        }
+        for (size_t k = i + b_size; carry != 0; k++) {
+            uint64_t sum = out[k] + carry;
+            carry = sum / BASE;
+            out[k] = static_cast<uint32_t>(sum % BASE);
+        }
+    }
+}
+
+// out = a * b; out has a_size + b_size limbs, all zero on entry.
+//
+// With a = a1*B^m + a0 and b = b1*B^m + b0 the product is
+//   z2*B^2m + (z1 - z2 - z0)*B^m + z0
+// where z0 = a0*b0, z2 = a1*b1 and z1 = (a0 + a1)(b0 + b1): three half-size
+// products instead of four. z0 and z2 land in disjoint parts of out, so
+// only the middle term needs a buffer.
+static void multiplyKaratsuba(const uint32_t* a, size_t a_size, const uint32_t* b, size_t b_size,
+                              uint32_t* out) {
+    a_size = usedLength(a, a_size);
+    b_size = usedLength(b, b_size);
+    if (a_size < b_size) {
+        swap(a, b);
+        swap(a_size, b_size);
+    }
+    if (b_size < BigInt::KARATSUBA_THRESHOLD) {
+        multiplySchoolbook(a, a_size, b, b_size, out);
+        return;
+    }
+    
+    // Lopsided operands: multiply b by a in b-sized pieces
+    if (2 * b_size <= a_size) {
+        Limbs partial(2 * b_size);
+        for (size_t offset = 0; offset < a_size; offset += b_size) {
+            size_t piece = min(b_size, a_size - offset);
+            fill(partial.begin(), partial.end(), 0);
+            multiplyKaratsuba(a + offset, piece, b, b_size, partial.data());
+            addAt(out, partial.data(), usedLength(partial.data(), piece + b_size), offset);
+        }
+        return;
+    }
+    
+    size_t m = a_size / 2;      // b_size > m
+    const uint32_t* a0 = a;
+    const uint32_t* a1 = a + m;
+    const uint32_t* b0 = b;
+    const uint32_t* b1 = b + m;
+    size_t a1_size = a_size - m;
+    size_t b1_size = b_size - m;
+    
+    multiplyKaratsuba(a0, m, b0, m, out);
+    multiplyKaratsuba(a1, a1_size, b1, b1_size, out + 2 * m);
+    
+    Limbs a_sum(a1_size + 1, 0);
+    addAt(a_sum.data(), a1, a1_size, 0);
+    addAt(a_sum.data(), a0, m, 0);
+    Limbs b_sum(max(m, b1_size) + 1, 0);
+    addAt(b_sum.data(), b0, m, 0);
+    addAt(b_sum.data(), b1, b1_size, 0);
+    trim(a_sum);
+    trim(b_sum);
+    
+    Limbs middle(a_sum.size() + b_sum.size(), 0);
+    multiplyKaratsuba(a_sum.data(), a_sum.size(), b_sum.data(), b_sum.size(), middle.data());
+    subtractFrom(middle.data(), out, usedLength(out, 2 * m));
+    subtractFrom(middle.data(), out + 2 * m, usedLength(out + 2 * m, a1_size + b1_size));
+    trim(middle);
+    addAt(out, middle.data(), middle.size(), m);
+}
+
+static Limbs multiplyMagnitudes(const Limbs& a, const Limbs& b) {
+    if (a.empty() || b.empty()) {
+        return Limbs();
+    }
+    Limbs product(a.size() + b.size(), 0);
+    multiplyKaratsuba(a.data(), a.size(), b.data(), b.size(), product.data());
+    trim(product);
+    return product;
+}
+
+// limbs *= factor, factor < BASE
+static void multiplySmall(Limbs& limbs, uint32_t factor) {
+    uint64_t carry = 0;
+    for (uint32_t& limb : limbs) {
+        uint64_t product = static_cast<uint64_t>(limb) * factor + carry;
+        carry = product / BASE;
+        limb = static_cast<uint32_t>(product % BASE);
+    }
+    if (carry != 0) {
+        limbs.push_back(static_cast<uint32_t>(carry));
+    }
+    trim(limbs);
+}
+
+// limbs /= divisor, returning the remainder
+static uint32_t divideSmall(Limbs& limbs, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = limbs.size(); i-- > 0;) {
+        uint64_t current = remainder * BASE + limbs[i];
+        limbs[i] = static_cast<uint32_t>(current / divisor);
+        remainder = current % divisor;
+    }
+    trim(limbs);
+    return static_cast<uint32_t>(remainder);
+}
+
+// Knuth, TAOCP vol. 2, 4.3.1 algorithm D, in base 10^9
+static void divideMagnitudes(const Limbs& dividend, const Limbs& divisor,
+                             Limbs& quotient, Limbs& remainder) {
+    if (compareMagnitude(dividend, divisor) < 0) {
+        quotient.clear();
+        remainder = dividend;
+        return;
+    }
+    if (divisor.size() == 1) {
+        quotient = dividend;
+        uint32_t rest = divideSmall(quotient, divisor[0]);
+        remainder.clear();
+        if (rest != 0) {
+            remainder.push_back(rest);
+        }
+        return;
+    }
+    
+    // Scale so the divisor's top limb is at least BASE / 2, which keeps
+    // each trial quotient digit at most two too large
+    uint32_t scale = static_cast<uint32_t>(BASE / (divisor.back() + 1ull));
+    Limbs u = dividend;
+    Limbs v = divisor;
+    u.push_back(0);
+    if (scale > 1) {
+        uint64_t carry = 0;
+        for (uint32_t& limb : u) {
+            uint64_t product = static_cast<uint64_t>(limb) * scale + carry;
+            carry = product / BASE;
+            limb = static_cast<uint32_t>(product % BASE);
+        }
+        multiplySmall(v, scale);
+    }
+    
+    size_t n = v.size();
+    size_t m = u.size() - n;
+    quotient.assign(m, 0);
+    uint64_t top = v[n - 1];
+    uint64_t next = v[n - 2];
+    
+    for (size_t j = m; j-- > 0;) {
+        uint64_t numerator = u[j + n] * BASE + u[j + n - 1];
+        uint64_t estimate = numerator / top;
+        uint64_t rest = numerator % top;
+        while (estimate >= BASE || estimate * next > rest * BASE + u[j + n - 2]) {
+            estimate--;
+            rest += top;
+            if (rest >= BASE) {
+                break;
+            }
+        }
+        
+        // u[j .. j+n] -= estimate * v
+        uint64_t carry = 0;
+        int64_t borrow = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t product = estimate * v[i] + carry;
+            carry = product / BASE;
+            int64_t difference = static_cast<int64_t>(u[i + j]) -
+                                 static_cast<int64_t>(product % BASE) - borrow;
+            borrow = difference < 0;
+            u[i + j] = static_cast<uint32_t>(difference + (borrow ? BASE : 0));
+        }
+        int64_t head = static_cast<int64_t>(u[j + n]) - static_cast<int64_t>(carry) - borrow;
+        
+        if (head < 0) {
+            // The estimate was one too large: add v back
+            estimate--;
+            uint32_t add_carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint32_t sum = u[i + j] + v[i] + add_carry;
+                add_carry = sum >= BASE;
+                u[i + j] = add_carry ? sum - BASE : sum;
+            }
+            head += add_carry;
+        }
+        u[j + n] = static_cast<uint32_t>(head);
+        quotient[j] = static_cast<uint32_t>(estimate);
+    }
+    
+    trim(quotient);
+    u.resize(n);
+    trim(u);
+    if (scale > 1) {
+        divideSmall(u, scale);
+    }
+    remainder = move(u);
+}
+
+BigInt::BigInt(long long value) : negative(value < 0) {
+    // Negate in unsigned arithmetic so LLONG_MIN works
+    unsigned long long magnitude = static_cast<unsigned long long>(value);
+    limbs = limbsOf(negative ? 0ull - magnitude : magnitude);
+}
+
+void BigInt::normalize() {
+    trim(limbs);
+    if (limbs.empty()) {
+        negative = false;
+    }
+}
+
+BigInt BigInt::parse(string_view text) {
+    BigInt value;
+    if (!text.empty() && (text[0] == '-' || text[0] == '+')) {
+        value.negative = text[0] == '-';
+        text.remove_prefix(1);
+    }
+    if (text.empty()) {
+        throw invalid_argument("Missing integer");
+    }
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            throw invalid_argument("Invalid integer: " + string(text));
+        }
+    }
+    
+    value.limbs.reserve(text.size() / BASE_DIGITS + 1);
+    for (size_t end = text.size(); end > 0;) {
+        size_t start = end >= BASE_DIGITS ? end - BASE_DIGITS : 0;
+        uint32_t limb = 0;
+        from_chars(text.data() + start, text.data() + end, limb);
+        value.limbs.push_back(limb);
+        end = start;
+    }
+    value.normalize();
+    return value;
+}
+
+// Product of factors[first, last), splitting in halves so the big
+// multiplications are balanced
+static Limbs productOf(const vector<uint32_t>& factors, size_t first, size_t last) {
+    if (last - first <= 16) {
+        Limbs product(1, 1);
+        for (size_t i = first; i < last; i++) {
+            multiplySmall(product, factors[i]);
+        }
+        return product;
+    }
+    size_t middle = first + (last - first) / 2;
+    return multiplyMagnitudes(productOf(factors, first, middle), productOf(factors, middle, last));
+}
+
+// n! / ((n/2)!)^2, the "swinging factorial": the product of the primes
+// p <= n each raised to sum(floor(n / p^k) mod 2). Every prime power is at
+// most n, so they are packed into limb-sized factors.
+static Limbs swingingFactorial(uint32_t n, const vector<uint32_t>& primes) {
+    vector<uint32_t> factors;
+    uint64_t packed = 1;
+    for (uint32_t prime : primes) {
+        if (prime > n) {
+            break;
+        }
+        uint64_t power = 1;
+        uint32_t quotient = n;
+        while ((quotient /= prime) > 0) {
+            if (quotient & 1) {
+                power *= prime;
+            }
+        }
+        if (power == 1) {
+            continue;
+        }
+        if (packed * power >= BASE) {
+            factors.push_back(static_cast<uint32_t>(packed));
+            packed = 1;
+        }
+        packed *= power;
+    }
+    factors.push_back(static_cast<uint32_t>(packed));
+    return productOf(factors, 0, factors.size());
+}
+
+// n! = ((n/2)!)^2 * swing(n)
+static Limbs factorialOf(uint32_t n, const vector<uint32_t>& primes) {
+    if (n <= 20) {
+        uint64_t product = 1;
+        for (uint32_t i = 2; i <= n; i++) {
+            product *= i;
+        }
+        return limbsOf(product);
+    }
+    Limbs half = factorialOf(n / 2, primes);
+    return multiplyMagnitudes(multiplyMagnitudes(half, half), swingingFactorial(n, primes));
+}
+
+BigInt BigInt::factorial(uint32_t n) {
+    // Sieve of Eratosthenes over the odd numbers
+    vector<uint32_t> primes;
+    if (n >= 2) {
+        primes.push_back(2);
+    }
+    vector<bool> composite(n / 2 + 1, false);
+    for (uint64_t i = 3; i <= n; i += 2) {
+        if (composite[i / 2]) {
+            continue;
+        }
+        primes.push_back(static_cast<uint32_t>(i));
+        for (uint64_t multiple = i * i; multiple <= n; multiple += 2 * i) {
+            composite[multiple / 2] = true;
+        }
+    }
+    
+    BigInt value;
+    value.limbs = factorialOf(n, primes);
+    value.normalize();
+    return value;
+}
+
+BigInt BigInt::pow(uint64_t exponent) const {
+    BigInt result(1);
+    BigInt base = *this;
+    while (exponent != 0) {
+        if (exponent & 1) {
+            result = result * base;
+        }
+        exponent >>= 1;
+        if (exponent != 0) {
+            base = base * base;
+        }
+    }
+    return result;
+}
+
+void BigInt::divide(const BigInt& dividend, const BigInt& divisor,
+                    BigInt& quotient, BigInt& remainder) {
+    if (divisor.isZero()) {
+        throw domain_error("Division by zero");
+    }
+    bool quotient_negative = dividend.negative != divisor.negative;
+    bool remainder_negative = dividend.negative;
+    divideMagnitudes(dividend.limbs, divisor.limbs, quotient.limbs, remainder.limbs);
+    quotient.negative = quotient_negative;
+    remainder.negative = remainder_negative;
+    quotient.normalize();
+    remainder.normalize();
+}
+
+BigInt operator+(const BigInt& a, const BigInt& b) {
+    BigInt sum;
+    if (a.negative == b.negative) {
+        sum.limbs = addMagnitudes(a.limbs, b.limbs);
+        sum.negative = a.negative;
+    } else if (compareMagnitude(a.limbs, b.limbs) >= 0) {
+        sum.limbs = subtractMagnitudes(a.limbs, b.limbs);
+        sum.negative = a.negative;
+    } else {
+        sum.limbs = subtractMagnitudes(b.limbs, a.limbs);
+        sum.negative = b.negative;
+    }
+    sum.normalize();
+    return sum;
+}
+
+BigInt operator-(const BigInt& a, const BigInt& b) {
+    return a + -b;
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+    BigInt product;
+    product.limbs = multiplyMagnitudes(a.limbs, b.limbs);
+    product.negative = a.negative != b.negative;
+    product.normalize();
+    return product;
+}
+
+BigInt operator/(const BigInt& a, const BigInt& b) {
+    BigInt quotient, remainder;
+    BigInt::divide(a, b, quotient, remainder);
+    return quotient;
+}
+
+BigInt operator%(const BigInt& a, const BigInt& b) {
+    BigInt quotient, remainder;
+    BigInt::divide(a, b, quotient, remainder);
+    return remainder;
+}
+
+BigInt BigInt::operator-() const {
+    BigInt negated = *this;
+    negated.negative = !negative && !limbs.empty();
+    return negated;
+}
+
+int BigInt::compare(const BigInt& other) const {
+    if (negative != other.negative) {
+        return negative ? -1 : 1;
+    }
+    int magnitude = compareMagnitude(limbs, other.limbs);
+    return negative ? -magnitude : magnitude;
+}
+
+size_t BigInt::digits() const {
+    if (limbs.empty()) {
+        return 1;
+    }
+    size_t count = (limbs.size() - 1) * BASE_DIGITS;
+    for (uint32_t top = limbs.back(); top != 0; top /= 10) {
+        count++;
+    }
+    return count;
+}
+
+void BigInt::appendTo(string& out) const {
+    if (limbs.empty()) {
+        out += '0';
+        return;
+    }
+    
+    size_t start = out.size();
+    out.resize(start + (negative ? 1 : 0) + digits());
+    char* cursor = &out[start];
+    if (negative) {
+        *cursor++ = '-';
+    }
+    cursor = to_chars(cursor, &out[0] + out.size(), limbs.back()).ptr;
+    for (size_t i = limbs.size() - 1; i-- > 0;) {
+        uint32_t limb = limbs[i];
+        for (size_t digit = BASE_DIGITS; digit-- > 0;) {
+            cursor[digit] = static_cast<char>('0' + limb % 10);
+            limb /= 10;
+        }
+        cursor += BASE_DIGITS;
+    }
+}
+
+string BigInt::toString() const {
+    string out;
+    appendTo(out);
+    return out;
+}
+
+double BigInt::toDouble() const {
+    if (digits() > numeric_limits<double>::max_exponent10 + 1) {
+        return negative ? -numeric_limits<double>::infinity()
+                        : numeric_limits<double>::infinity();
+    }
+    string text = toString();
+    double value = 0.0;
+    auto parsed = from_chars(text.data(), text.data() + text.size(), value);
+    if (parsed.ec == errc::result_out_of_range) {
+        return negative ? -numeric_limits<double>::infinity()
+                        : numeric_limits<double>::infinity();
+    }
+    return value;
+}
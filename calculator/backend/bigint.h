@@ -0,0 +1,67 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary-precision signed integer.
+//
+// The magnitude is kept as base 10^9 limbs, least significant first, so
+// decimal text is read and written in linear time; the calculator prints
+// every result it computes, so that matters more than the few percent a
+// binary base would gain in arithmetic. Multiplication is schoolbook for
+// short operands and Karatsuba above KARATSUBA_THRESHOLD limbs, division
+// is Knuth's algorithm D, and factorial uses the prime-swing recursion so
+// its big multiplications are between operands of similar size.
+class BigInt {
+public:
+    static const uint32_t BASE = 1000000000;
+    static const size_t BASE_DIGITS = 9;
+    static const size_t KARATSUBA_THRESHOLD = 32;
+    
+    BigInt() : negative(false) {}
+    BigInt(long long value);
+    
+    // Optional sign followed by decimal digits; throws std::invalid_argument
+    static BigInt parse(std::string_view text);
+    
+    static BigInt factorial(uint32_t n);
+    BigInt pow(uint64_t exponent) const;
+    
+    // Division truncates towards zero and the remainder takes the sign of
+    // the dividend, as for built-in integers. Throws std::domain_error on
+    // division by zero.
+    static void divide(const BigInt& dividend, const BigInt& divisor,
+                       BigInt& quotient, BigInt& remainder);
+    
+    friend BigInt operator+(const BigInt& a, const BigInt& b);
+    friend BigInt operator-(const BigInt& a, const BigInt& b);
+    friend BigInt operator*(const BigInt& a, const BigInt& b);
+    friend BigInt operator/(const BigInt& a, const BigInt& b);
+    friend BigInt operator%(const BigInt& a, const BigInt& b);
+    BigInt operator-() const;
+    
+    // -1, 0 or 1
+    int compare(const BigInt& other) const;
+    bool isZero() const { return limbs.empty(); }
+    bool isNegative() const { return negative; }
+    
+    // Decimal digits of the magnitude (1 for zero)
+    size_t digits() const;
+    
+    void appendTo(std::string& out) const;
+    std::string toString() const;
+    // Nearest double, or +-infinity beyond its range
+    double toDouble() const;
+    
+private:
+    std::vector<uint32_t> limbs;    // No leading zero limbs; empty for zero
+    bool negative;                  // Never set for zero
+    
+    void normalize();
+};
+
+#endif // BIGINT_H
@@ -0,0 +1,86 @@
+#ifndef BINARY_PROTOCOL_H
+#define BINARY_PROTOCOL_H
+
+#include <cstdint>
+
+// Binary wire protocol, for clients that send many fixed operations and
+// want neither to format nor to parse text.
+//
+// After "PROTOCOL BINARY" every request is a 24-byte BinaryRequest and
+// every response a 16-byte BinaryResponse, back to back with no
+// delimiters, in the server's native byte order (little-endian on x86-64)
+// like BATCH BIN. Requests are answered strictly in order; the tag is
+// echoed so clients can match responses anyway. There is no way back to
+// text: a binary connection ends with BINARY_OPCODE_EXIT or a close.
+//
+// Opcodes are the BINARY_OPCODE_* numbers below. Operands that an
+// operation does not take are ignored; FACT needs an integral operand.
+//
+// The aim was five times the requests per second of pipelined text
+// commands. Recorded in history (the default), both protocols pay for
+// the history log, and transport_bench puts pipelined binary ADD at only
+// 1.5 to 2 times pipelined text; with NO_HISTORY it is 3.5 to 5 times.
+
+const uint32_t BINARY_PROTOCOL_VERSION = 1;
+
+// Opcodes. They are part of the protocol and never change or get reused,
+// whatever happens to Operation; the numbers were its values when the
+// protocol was introduced (0 and 5, EXPRESSION and MODULUS, have no
+// binary form).
+const uint8_t BINARY_OPCODE_ADD = 1;
+const uint8_t BINARY_OPCODE_SUB = 2;
+const uint8_t BINARY_OPCODE_MUL = 3;
+const uint8_t BINARY_OPCODE_DIV = 4;
+const uint8_t BINARY_OPCODE_POW = 6;
+const uint8_t BINARY_OPCODE_SQRT = 7;
+const uint8_t BINARY_OPCODE_SIN = 8;
+const uint8_t BINARY_OPCODE_COS = 9;
+const uint8_t BINARY_OPCODE_TAN = 10;
+const uint8_t BINARY_OPCODE_LOG = 11;
+const uint8_t BINARY_OPCODE_LN = 12;
+const uint8_t BINARY_OPCODE_EXP = 13;
+const uint8_t BINARY_OPCODE_FACT = 14;
+const uint8_t BINARY_OPCODE_MADD = 15;
+const uint8_t BINARY_OPCODE_MSUB = 16;
+const uint8_t BINARY_OPCODE_MR = 17;
+const uint8_t BINARY_OPCODE_MC = 18;
+const uint8_t BINARY_OPCODE_PERCENT = 19;
+const uint8_t BINARY_OPCODE_NEGATE = 20;
+const uint8_t BINARY_OPCODE_RECIPROCAL = 21;
+// Closes the connection once its response has been sent
+const uint8_t BINARY_OPCODE_EXIT = 0xFF;
+
+// Request flags. Like BATCH without HISTORY, NO_HISTORY leaves the
+// calculation out of history and its log, the bulk of the cost of the
+// cheap operations.
+const uint8_t BINARY_FLAG_NO_HISTORY = 0x01;
+
+enum class BinaryStatus : uint8_t {
+    OK,
+    FAILURE,        // The calculation failed (division by zero, domain error, ...)
+    BAD_REQUEST     // Unknown opcode or flag, nonzero reserved bits, invalid operand
+};
+
+struct BinaryRequest {
+    uint8_t opcode;
+    uint8_t flags;          // BINARY_FLAG_*; undefined bits must be 0
+    uint16_t reserved;      // Must be 0
+    uint32_t tag;           // Echoed in the response
+    double operands[2];
+};
+
+// The acknowledgement of PROTOCOL BINARY is an OK response with opcode 0,
+// tag 0 and BINARY_PROTOCOL_VERSION as result. Unsuccessful responses
+// carry a NaN result.
+struct BinaryResponse {
+    BinaryStatus status;
+    uint8_t opcode;         // Of the request
+    uint16_t reserved;
+    uint32_t tag;           // Of the request
+    double result;
+};
+
+static_assert(sizeof(BinaryRequest) == 24, "BinaryRequest must be 24 bytes");
+static_assert(sizeof(BinaryResponse) == 16, "BinaryResponse must be 16 bytes");
+
+#endif // BINARY_PROTOCOL_H
@@ -1,567 +1,1756 @@
 #include "calculator.h"
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <cmath>
 #include <algorithm>
-#include <iomanip>
 #include <ctime>
 #include <cctype>
 #include <stdexcept>
+#include <charconv>
+#include <limits>
+#include <cstring>
+#include <type_traits>
 
 using namespace std;
 
-// Calculator implementation
-Calculator::Calculator() : memory(0.0), history_file("calculator_history.dat") {
-    loadHistoryFromFile();
+// Number formatting without streams or temporaries. Buffers are sized for
+// the longest fixed-notation double (309 integer digits).
+static void appendFixed(string& out, double value) {
+    char buffer[400];
+    out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), value,
+                                chars_format::fixed, 6).ptr);
+}
+
+// Shortest text that reads back as the same double
+static void appendExact(string& out, double value) {
+    char buffer[32];
+    out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+static void appendInteger(string& out, long long value) {
+    char buffer[24];
+    out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+// How each operation reads: prefix, first operand, infix, second operand,
+// suffix. Integer operations print their operands without decimals.
+struct OperationFormat {
+    const char* name;
+    const char* prefix;
+    const char* infix;      // nullptr for unary operations
+    const char* suffix;
+    int operands;
+    bool integer;
+};
+
+static const OperationFormat OPERATION_FORMATS[] = {
+    {"expression", "", nullptr, "", 0, false},
+    {"addition", "", " + ", "", 2, false},
+    {"subtraction", "", " - ", "", 2, false},
+    {"multiplication", "", " * ", "", 2, false},
+    {"division", "", " / ", "", 2, false},
+    {"modulus", "", " % ", "", 2, true},
+    {"power", "", " ^ ", "", 2, false},
+    {"square_root", "sqrt(", nullptr, ")", 1, false},
+    {"sine", "sin(", nullptr, "°)", 1, false},
+    {"cosine", "cos(", nullptr, "°)", 1, false},
+    {"tangent", "tan(", nullptr, "°)", 1, false},
+    {"log10", "log10(", nullptr, ")", 1, false},
+    {"natural_log", "ln(", nullptr, ")", 1, false},
+    {"exponential", "exp(", nullptr, ")", 1, false},
+    {"factorial", "", nullptr, "!", 1, true},
+    {"memory_add", "M + ", nullptr, "", 1, false},
+    {"memory_subtract", "M - ", nullptr, "", 1, false},
+    {"memory_recall", "Memory Recall", nullptr, "", 0, false},
+    {"memory_clear", "Memory Clear", nullptr, "", 0, false},
+    {"percentage", "", nullptr, "%", 1, false},
+    {"negate", "-(", nullptr, ")", 1, false},
+    {"reciprocal", "1/(", nullptr, ")", 1, false}
+};
+
+static_assert(sizeof(OPERATION_FORMATS) / sizeof(OPERATION_FORMATS[0]) ==
+              static_cast<size_t>(Operation::RECIPROCAL) + 1,
+              "OPERATION_FORMATS must have one entry per Operation");
+
+const char* operationName(Operation operation) {
+    return OPERATION_FORMATS[static_cast<size_t>(operation)].name;
+}
+
+static void appendOperation(string& out, Operation operation, const double* operands,
+                            string_view text) {
+    if (operation == Operation::EXPRESSION) {
+        out.append(text.data(), text.size());
+        return;
+    }
+    
+    const OperationFormat& format = OPERATION_FORMATS[static_cast<size_t>(operation)];
+    out += format.prefix;
+    for (int i = 0; i < format.operands; i++) {
+        if (i > 0) {
+            out += format.infix;
+        }
+        if (format.integer) {
+            appendInteger(out, static_cast<long long>(operands[i]));
+        } else {
+            appendFixed(out, operands[i]);
+        }
+    }
+    out += format.suffix;
+}
+
+// Inverse of appendOperation for the history file: recover the operands
+// of a fixed operation from its text. Returns false if the text does not
+// have the operation's shape.
+static bool parseOperation(string_view text, Operation operation, double* operands) {
+    const OperationFormat& format = OPERATION_FORMATS[static_cast<size_t>(operation)];
+    string_view prefix(format.prefix), suffix(format.suffix);
+    if (text.substr(0, prefix.size()) != prefix || text.size() < prefix.size() + suffix.size() ||
+        text.substr(text.size() - suffix.size()) != suffix) {
+        return false;
+    }
+    text = text.substr(prefix.size(), text.size() - prefix.size() - suffix.size());
+    
+    for (int i = 0; i < format.operands; i++) {
+        string_view operand = text;
+        if (i + 1 < format.operands) {
+            size_t infix = text.find(format.infix);
+            if (infix == string_view::npos) {
+                return false;
+            }
+            operand = text.substr(0, infix);
+            text = text.substr(infix + strlen(format.infix));
+        }
+        auto parsed = from_chars(operand.data(), operand.data() + operand.size(), operands[i]);
+        if (parsed.ec != errc() || parsed.ptr != operand.data() + operand.size()) {
+            return false;
+        }
+    }
+    return true;
 }
 
-Calculator::~Calculator() {
-    saveHistoryToFile();
+static Operation operationByName(string_view name) {
+    for (size_t i = 0; i < sizeof(OPERATION_FORMATS) / sizeof(OPERATION_FORMATS[0]); i++) {
+        if (name == OPERATION_FORMATS[i].name) {
+            return static_cast<Operation>(i);
+        }
+    }
+    return Operation::EXPRESSION;
 }
 
-// Helper: Format result to avoid scientific notation for small numbers
-string Calculator::formatResult(double value) {
-    ostringstream oss;
-    if (fabs(value) < 1e10 && fabs(value) > 1e-4) {
-        oss << fixed << setprecision(10);
-        string str = to_string(value);
-        // Remove trailing zeros
-        str.erase(str.find_last_not_of('0') + 1, string::npos);
-        if (str.back() == '.') str.pop_back();
-        return str;
+void appendExpression(string& out, const HistoryEntry& entry, string_view text) {
+    appendOperation(out, entry.operation, entry.operands, text);
+    if (entry.textContinues() && text.size() <= HistoryEntry::TEXT_CAPACITY) {
+        // The rest of the text was lost (a damaged log)
+        out += "...";
     }
-    oss << value;
-    return oss.str();
 }
 
+// Texts too long for history lose their end, marked by "..."
+static string_view cutForHistory(string_view text, string& cut) {
+    if (text.size() <= HistoryEntry::MAX_TEXT_LENGTH) {
+        return text;
+    }
+    cut.assign(text.data(), HistoryEntry::MAX_TEXT_LENGTH - 3);
+    cut += "...";
+    return cut;
+}
+
+// CalculationResult implementation
+void CalculationResult::appendExpression(string& out) const {
+    appendOperation(out, operation, operands, text);
+}
+
+string CalculationResult::expression() const {
+    string out;
+    appendExpression(out);
+    return out;
+}
+
+// Largest n whose factorial fits a long long
+static const int MAX_INTEGER_FACTORIAL = 20;
+
+// Calculator implementation
+// The log always keeps at least what fits in memory
+static HistoryLogOptions logOptionsFor(HistoryLogOptions options, size_t history_capacity) {
+    options.retention = max(options.retention, history_capacity);
+    return options;
+}
+
+Calculator::Calculator(const string& history_file, size_t history_capacity,
+                       const HistoryLogOptions& log_options, size_t result_cache_capacity)
+    : memory(0.0), history(history_capacity), history_file(history_file),
+      log(logOptionsFor(log_options, history_capacity)), result_cache(result_cache_capacity),
+      recording(true), timing_history(false), history_ticks(0) {
+    if (log.open(history_file, history) == HistoryLog::OpenResult::NOT_A_LOG) {
+        // A text history from before the binary log: convert it once
+        cerr << "Converting text history " << history_file << " to a history log" << endl;
+        importTextHistory(history_file);
+        log.rewrite(history.newest());
+    }
+}
+
+// Every entry is already in the log
+Calculator::~Calculator() {}
+
 // Basic arithmetic operations
 CalculationResult Calculator::add(double a, double b) {
-    double result = a + b;
-    string expr = to_string(a) + " + " + to_string(b);
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "addition"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::ADD, a, b, a + b);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::subtract(double a, double b) {
-    double result = a - b;
-    string expr = to_string(a) + " - " + to_string(b);
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "subtraction"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::SUBTRACT, a, b, a - b);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::multiply(double a, double b) {
-    double result = a * b;
-    string expr = to_string(a) + " * " + to_string(b);
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "multiplication"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::MULTIPLY, a, b, a * b);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::divide(double a, double b) {
     if (b == 0) {
-        return CalculationResult(to_string(a) + " / " + to_string(b), 
-                                "Error: Division by zero");
+        return CalculationResult(Operation::DIVIDE, a, b, "Error: Division by zero");
     }
-    double result = a / b;
-    string expr = to_string(a) + " / " + to_string(b);
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "division"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::DIVIDE, a, b, a / b);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::modulus(int a, int b) {
     if (b == 0) {
-        return CalculationResult(to_string(a) + " % " + to_string(b), 
-                                "Error: Modulus by zero");
+        return CalculationResult(Operation::MODULUS, a, b, "Error: Modulus by zero");
     }
-    int result = a % b;
-    string expr = to_string(a) + " % " + to_string(b);
-    HistoryEntry entry = {to_string(time(nullptr)), expr, static_cast<double>(result), "modulus"};
-    saveToHistory(entry);
-    return CalculationResult(expr, static_cast<double>(result));
+    CalculationResult result(Operation::MODULUS, a, b, static_cast<double>(a % b));
+    record(result);
+    return result;
+}
+
+// Pure operations: a result computed once is served from the memo cache
+template <typename Compute>
+double Calculator::memoized(Operation operation, double a, double b, Compute compute) {
+    if (result_cache.skipped()) {
+        return compute();
+    }
+    double value;
+    if (!result_cache.lookup(operation, a, b, value)) {
+        value = compute();
+        result_cache.store(operation, a, b, value);
+    }
+    return value;
 }
 
 CalculationResult Calculator::power(double base, double exponent) {
-    double result = pow(base, exponent);
-    string expr = to_string(base) + " ^ " + to_string(exponent);
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "power"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    double value = memoized(Operation::POWER, base, exponent,
+                            [&] { return pow(base, exponent); });
+    CalculationResult result(Operation::POWER, base, exponent, value);
+    record(result);
+    return result;
 }
 
 // Scientific operations
 CalculationResult Calculator::squareRoot(double value) {
     if (value < 0) {
-        return CalculationResult("sqrt(" + to_string(value) + ")", 
+        return CalculationResult(Operation::SQUARE_ROOT, value, 0.0,
                                 "Error: Square root of negative number");
     }
-    double result = sqrt(value);
-    string expr = "sqrt(" + to_string(value) + ")";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "square_root"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::SQUARE_ROOT, value, 0.0, sqrt(value));
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::sin(double angle_degrees) {
-    double radians = angle_degrees * M_PI / 180.0;
-    double result = std::sin(radians);
-    string expr = "sin(" + to_string(angle_degrees) + "°)";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "sine"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    double value = memoized(Operation::SINE, angle_degrees, 0.0,
+                            [&] { return BatchMath::sinDegrees(angle_degrees); });
+    CalculationResult result(Operation::SINE, angle_degrees, 0.0, value);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::cos(double angle_degrees) {
-    double radians = angle_degrees * M_PI / 180.0;
-    double result = std::cos(radians);
-    string expr = "cos(" + to_string(angle_degrees) + "°)";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "cosine"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    double value = memoized(Operation::COSINE, angle_degrees, 0.0,
+                            [&] { return BatchMath::cosDegrees(angle_degrees); });
+    CalculationResult result(Operation::COSINE, angle_degrees, 0.0, value);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::tan(double angle_degrees) {
-    double radians = angle_degrees * M_PI / 180.0;
-    // Check for undefined values (90°, 270°, etc.)
-    if (fmod(angle_degrees + 90, 180) == 0) {
-        return CalculationResult("tan(" + to_string(angle_degrees) + "°)", 
+    double value = memoized(Operation::TANGENT, angle_degrees, 0.0,
+                            [&] { return BatchMath::tanDegrees(angle_degrees); });
+    // Infinite exactly at the undefined angles (90°, 270°, etc.)
+    if (std::isinf(value)) {
+        return CalculationResult(Operation::TANGENT, angle_degrees, 0.0,
                                 "Error: Tangent undefined for this angle");
     }
-    double result = std::tan(radians);
-    string expr = "tan(" + to_string(angle_degrees) + "°)";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "tangent"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::TANGENT, angle_degrees, 0.0, value);
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::log10(double value) {
     if (value <= 0) {
-        return CalculationResult("log10(" + to_string(value) + ")", 
+        return CalculationResult(Operation::LOG10, value, 0.0,
                                 "Error: Logarithm of non-positive number");
     }
-    double result = std::log10(value);
-    string expr = "log10(" + to_string(value) + ")";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "log10"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::LOG10, value, 0.0,
+                             memoized(Operation::LOG10, value, 0.0,
+                                      [&] { return std::log10(value); }));
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::ln(double value) {
     if (value <= 0) {
-        return CalculationResult("ln(" + to_string(value) + ")", 
+        return CalculationResult(Operation::NATURAL_LOG, value, 0.0,
                                 "Error: Natural log of non-positive number");
     }
-    double result = std::log(value);
-    string expr = "ln(" + to_string(value) + ")";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "natural_log"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::NATURAL_LOG, value, 0.0,
+                             memoized(Operation::NATURAL_LOG, value, 0.0,
+                                      [&] { return std::log(value); }));
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::exp(double value) {
-    double result = std::exp(value);
-    string expr = "exp(" + to_string(value) + ")";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, result, "exponential"};
-    saveToHistory(entry);
-    return CalculationResult(expr, result);
+    CalculationResult result(Operation::EXPONENTIAL, value, 0.0,
+                             memoized(Operation::EXPONENTIAL, value, 0.0,
+                                      [&] { return std::exp(value); }));
+    record(result);
+    return result;
 }
 
 CalculationResult Calculator::factorial(int n) {
     if (n < 0) {
-        return CalculationResult(to_string(n) + "!", 
+        return CalculationResult(Operation::FACTORIAL, n, 0.0,
                                 "Error: Factorial of negative number");
     }
-    if (n > 20) { // Prevent overflow
-        return CalculationResult(to_string(n) + "!", 
+    if (n > MAX_INTEGER_FACTORIAL) { // Prevent overflow
+        return CalculationResult(Operation::FACTORIAL, n, 0.0,
                                 "Error: Number too large for factorial");
     }
-    long long result = 1;
-    for (int i = 2; i <= n; i++) {
-        result *= i;
+    double value = memoized(Operation::FACTORIAL, n, 0.0, [n] {
+        long long product = 1;
+        for (int i = 2; i <= n; i++) {
+            product *= i;
+        }
+        return static_cast<double>(product);
+    });
+    CalculationResult result(Operation::FACTORIAL, n, 0.0, value);
+    record(result);
+    return result;
+}
+
+CalculationResult Calculator::exactFactorial(uint32_t n, BigInt& value) {
+    if (n > MAX_EXACT_FACTORIAL) {
+        return CalculationResult(Operation::FACTORIAL, n, 0.0,
+                                "Error: Number too large for factorial");
+    }
+    value = BigInt::factorial(n);
+    CalculationResult result(Operation::FACTORIAL, n, 0.0, value.toDouble());
+    record(result);
+    return result;
+}
+
+// Decimal digits of base^exponent, near enough to enforce MAX_BIG_DIGITS
+static double powerDigits(const BigInt& base, const BigInt& exponent) {
+    double base_digits = base.digits() < 300 ? std::log10(fabs(base.toDouble()))
+                                             : static_cast<double>(base.digits() - 1);
+    return base_digits * exponent.toDouble();
+}
+
+CalculationResult Calculator::bigArithmetic(const BigInt& a, char op, const BigInt& b,
+                                            BigInt& value) {
+    string expr;
+    a.appendTo(expr);
+    expr += ' ';
+    expr += op;
+    expr += ' ';
+    b.appendTo(expr);
+    
+    if (a.digits() > MAX_BIG_DIGITS || b.digits() > MAX_BIG_DIGITS) {
+        return CalculationResult(expr, "Error: Number too large");
+    }
+    switch (op) {
+    case '+':
+        value = a + b;
+        break;
+    case '-':
+        value = a - b;
+        break;
+    case '*':
+        value = a * b;
+        break;
+    case '/':
+    case '%':
+        if (b.isZero()) {
+            return CalculationResult(expr, op == '/' ? "Error: Division by zero"
+                                                     : "Error: Modulus by zero");
+        }
+        value = op == '/' ? a / b : a % b;
+        break;
+    case '^':
+        if (b.isNegative()) {
+            return CalculationResult(expr, "Error: Negative exponent");
+        }
+        if (a.compare(BigInt(1)) > 0 || a.compare(BigInt(-1)) < 0) {
+            if (powerDigits(a, b) > MAX_BIG_DIGITS) {
+                return CalculationResult(expr, "Error: Result too large");
+            }
+            value = a.pow(static_cast<uint64_t>(b.toDouble()));
+        } else if (a.isZero()) {
+            value = BigInt(b.isZero() ? 1 : 0);
+        } else {
+            // 1 or -1: only the exponent's parity matters
+            bool odd = !(b % BigInt(2)).isZero();
+            value = a.isNegative() && odd ? BigInt(-1) : BigInt(1);
+        }
+        break;
+    default:
+        return CalculationResult(expr, string("Error: Unknown operator ") + op);
+    }
+    return CalculationResult(expr, value.toDouble());
+}
+
+// Batch scientific operations
+size_t Calculator::runBatch(BatchMath::Kernel kernel, const vector<double>& inputs,
+                            vector<double>& results, vector<uint8_t>& errors) {
+    results.resize(inputs.size());
+    errors.resize(inputs.size());
+    return kernel(inputs.data(), results.data(), errors.data(), inputs.size());
+}
+
+// Only the newest lanes that fit in history are recorded
+void Calculator::recordBatch(Operation operation, const vector<double>& inputs,
+                             const vector<double>& results, const vector<uint8_t>& errors) {
+    size_t first = results.size();
+    for (size_t kept = 0; first > 0 && kept < history.capacity(); first--) {
+        kept += errors[first - 1] ? 0 : 1;
+    }
+    
+    uint64_t start = timing_history ? readClock() : 0;
+    int64_t timestamp = historyTimestamp();
+    size_t recorded = 0;
+    for (size_t i = first; i < results.size(); i++) {
+        if (!errors[i]) {
+            history.push(HistoryEntry(timestamp, operation, inputs[i], 0.0, results[i]));
+            recorded++;
+        }
+    }
+    log.append(history.newest(recorded));
+    history_ticks += start != 0 ? readClock() - start : 0;
+}
+
+size_t Calculator::squareRootBatch(const vector<double>& values, vector<double>& results,
+                                   vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::sqrt, values, results, errors);
+    if (record_history) {
+        recordBatch(Operation::SQUARE_ROOT, values, results, errors);
+    }
+    return failed;
+}
+
+size_t Calculator::sinBatch(const vector<double>& angles_degrees, vector<double>& results,
+                            vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::sin, angles_degrees, results, errors);
+    if (record_history) {
+        recordBatch(Operation::SINE, angles_degrees, results, errors);
+    }
+    return failed;
+}
+
+size_t Calculator::cosBatch(const vector<double>& angles_degrees, vector<double>& results,
+                            vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::cos, angles_degrees, results, errors);
+    if (record_history) {
+        recordBatch(Operation::COSINE, angles_degrees, results, errors);
+    }
+    return failed;
+}
+
+size_t Calculator::tanBatch(const vector<double>& angles_degrees, vector<double>& results,
+                            vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::tan, angles_degrees, results, errors);
+    if (record_history) {
+        recordBatch(Operation::TANGENT, angles_degrees, results, errors);
+    }
+    return failed;
+}
+
+size_t Calculator::log10Batch(const vector<double>& values, vector<double>& results,
+                              vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::log10, values, results, errors);
+    if (record_history) {
+        recordBatch(Operation::LOG10, values, results, errors);
     }
-    string expr = to_string(n) + "!";
-    HistoryEntry entry = {to_string(time(nullptr)), expr, static_cast<double>(result), "factorial"};
-    saveToHistory(entry);
-    return CalculationResult(expr, static_cast<double>(result));
+    return failed;
+}
+
+size_t Calculator::lnBatch(const vector<double>& values, vector<double>& results,
+                           vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::ln, values, results, errors);
+    if (record_history) {
+        recordBatch(Operation::NATURAL_LOG, values, results, errors);
+    }
+    return failed;
+}
+
+size_t Calculator::expBatch(const vector<double>& values, vector<double>& results,
+                            vector<uint8_t>& errors, bool record_history) {
+    size_t failed = runBatch(BatchMath::exp, values, results, errors);
+    if (record_history) {
+        recordBatch(Operation::EXPONENTIAL, values, results, errors);
+    }
+    return failed;
+}
+
+size_t Calculator::powerBatch(const vector<double>& bases, const vector<double>& exponents,
+                              vector<double>& results, vector<uint8_t>& errors,
+                              bool record_history) {
+    size_t count = min(bases.size(), exponents.size());
+    results.resize(count);
+    errors.resize(count);
+    size_t failed = BatchMath::power(bases.data(), exponents.data(), results.data(),
+                                     errors.data(), count);
+    if (record_history) {
+        uint64_t start = timing_history ? readClock() : 0;
+        int64_t timestamp = historyTimestamp();
+        size_t first = count > history.capacity() ? count - history.capacity() : 0;
+        for (size_t i = first; i < count; i++) {
+            history.push(HistoryEntry(timestamp, Operation::POWER, bases[i], exponents[i],
+                                      results[i]));
+        }
+        log.append(history.newest(count - first));
+        history_ticks += start != 0 ? readClock() - start : 0;
+    }
+    return failed;
 }
 
 // Memory operations
 CalculationResult Calculator::memoryAdd(double value) {
     memory += value;
-    return CalculationResult("M + " + to_string(value), memory);
+    return CalculationResult(Operation::MEMORY_ADD, value, 0.0, memory);
 }
 
 CalculationResult Calculator::memorySubtract(double value) {
     memory -= value;
-    return CalculationResult("M - " + to_string(value), memory);
+    return CalculationResult(Operation::MEMORY_SUBTRACT, value, 0.0, memory);
 }
 
 CalculationResult Calculator::memoryRecall() {
-    return CalculationResult("Memory Recall", memory);
+    return CalculationResult(Operation::MEMORY_RECALL, 0.0, 0.0, memory);
 }
 
 CalculationResult Calculator::memoryClear() {
     memory = 0.0;
-    return CalculationResult("Memory Clear", memory);
+    return CalculationResult(Operation::MEMORY_CLEAR, 0.0, 0.0, memory);
 }
 
 double Calculator::getMemoryValue() const {
     return memory;
 }
 
-// Complex expression evaluation (basic implementation)
-CalculationResult Calculator::evaluate(const string& expression) {
+// Variables and parameterized expressions
+static bool isValidName(const string& name) {
+    static const char* const reserved[] = {
+        "pi", "e", "sin", "cos", "tan", "log10", "log", "ln", "exp", "sqrt"
+    };
+    if (name.empty() || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_')) {
+        return false;
+    }
+    for (char c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_') {
+            return false;
+        }
+    }
+    for (const char* word : reserved) {
+        if (name == word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CalculationResult Calculator::setVariable(const string& name, double value) {
+    if (!isValidName(name)) {
+        return CalculationResult(name, "Error: Invalid variable name");
+    }
+    variables[name] = value;
+    string text = name + " = ";
+    appendExact(text, value);
+    return CalculationResult(text, value);
+}
+
+CalculationResult Calculator::define(const string& name, const string& expression) {
+    if (!isValidName(name)) {
+        return CalculationResult(name, "Error: Invalid function name");
+    }
     try {
-        // Simple expression parser (for demonstration)
-        // In a real application, you would use a proper expression parser
-        istringstream iss(expression);
-        double a, b;
-        char op;
-        
-        if (iss >> a >> op >> b) {
-            switch (op) {
-                case '+': return add(a, b);
-                case '-': return subtract(a, b);
-                case '*': return multiply(a, b);
-                case '/': return divide(a, b);
-                case '^': return power(a, b);
-                default: 
-                    return CalculationResult(expression, 
-                                            "Error: Unsupported operator");
-            }
+        CompiledExpression compiled(expression);
+        double parameters = static_cast<double>(compiled.program.variables.size());
+        definitions.erase(name);
+        definitions.emplace(name, std::move(compiled));
+        return CalculationResult(name + " = " + expression, parameters);
+    } catch (const exception& e) {
+        return CalculationResult(name + " = " + expression,
+                                "Error: " + string(e.what()));
+    }
+}
+
+const CompiledExpression* Calculator::getDefinition(const string& name) const {
+    auto found = definitions.find(name);
+    return found == definitions.end() ? nullptr : &found->second;
+}
+
+const VariableTable& Calculator::getVariables() const {
+    return variables;
+}
+
+CalculationResult Calculator::evaluateColumn(const CompiledExpression& expression,
+                                             const string& variable,
+                                             const vector<double>& inputs,
+                                             vector<double>& outputs) {
+    const Program& program = expression.program;
+    string expr = expression.text + " for " + variable + " in [" +
+                  to_string(inputs.size()) + " values]";
+    
+    // Bind everything except the column variable from the table
+    size_t column = SIZE_MAX;
+    vector<double> values(program.variables.size(), 0.0);
+    for (size_t i = 0; i < program.variables.size(); i++) {
+        if (program.variables[i] == variable) {
+            column = i;
+            continue;
         }
-        
-        // Try scientific functions
-        if (expression.find("sqrt") == 0) {
-            double val = stod(expression.substr(5, expression.length() - 6));
-            return squareRoot(val);
-        } else if (expression.find("sin") == 0) {
-            double val = stod(expression.substr(4, expression.find(')') - 4));
-            return sin(val);
+        auto found = variables.find(program.variables[i]);
+        if (found == variables.end()) {
+            return CalculationResult(expr, "Error: Unknown variable: " + program.variables[i]);
         }
-        
-        return CalculationResult(expression, 
-                                "Error: Could not parse expression");
+        values[i] = found->second;
+    }
+    
+    outputs.resize(inputs.size());
+    program.runColumn(expression.literals.data(), values.data(), column,
+                      inputs.data(), outputs.data(), inputs.size());
+    return CalculationResult(expr, static_cast<double>(inputs.size()));
+}
+
+// Complex expression evaluation
+double Calculator::evaluateExpression(string_view expr) {
+    return expression_cache.evaluate(expr, variables);
+}
+
+CalculationResult Calculator::evaluate(string_view expression) {
+    try {
+        double value = evaluateExpression(expression);
+        CalculationResult result(string(expression), value);
+        record(result);
+        return result;
     } catch (const exception& e) {
-        return CalculationResult(expression, 
+        return CalculationResult(string(expression), 
                                 "Error: " + string(e.what()));
     }
 }
 
+const ExpressionCache& Calculator::getExpressionCache() const {
+    return expression_cache;
+}
+
+ResultCache& Calculator::getResultCache() {
+    return result_cache;
+}
+
+void Calculator::recordHistory(bool on) {
+    recording = on;
+}
+
+void Calculator::timeHistory(bool on) {
+    timing_history = on;
+}
+
+uint64_t Calculator::takeHistoryTicks() {
+    uint64_t ticks = history_ticks;
+    history_ticks = 0;
+    return ticks;
+}
+
 // History operations
-void Calculator::saveToHistory(const HistoryEntry& entry) {
-    history.push_back(entry);
-    if (history.size() > 100) { // Keep only last 100 entries
-        history.erase(history.begin());
+void Calculator::record(const CalculationResult& result) {
+    if (!recording) {
+        return;
     }
+    string cut;
+    string_view text = cutForHistory(result.text, cut);
+    saveToHistory(HistoryEntry(historyTimestamp(), result.operation, result.operands[0],
+                               result.operands[1], result.result, text), text);
 }
 
-vector<HistoryEntry> Calculator::getHistory(int limit) const {
-    if (limit <= 0 || limit >= history.size()) {
-        return history;
-    }
-    return vector<HistoryEntry>(history.end() - limit, history.end());
+void Calculator::saveToHistory(const HistoryEntry& entry, string_view text) {
+    uint64_t start = timing_history ? readClock() : 0;
+    history.push(entry, text);
+    log.append(entry, text);
+    history_ticks += start != 0 ? readClock() - start : 0;
+}
+
+HistoryView Calculator::getHistory(size_t limit) const {
+    return history.newest(limit);
+}
+
+size_t Calculator::exportHistory(uint64_t& cursor, size_t max_count,
+                                 vector<HistoryEntry>& entries, vector<string>& texts) {
+    // Include what is still queued for the writer
+    log.flush();
+    size_t consumed;
+    do {
+        consumed = log.read(cursor, max_count, entries, &texts);
+    } while (consumed > 0 && entries.empty());
+    return entries.size();
+}
+
+void Calculator::queryHistory(const HistoryQuery& query,
+                              vector<const HistoryEntry*>& matches) const {
+    history.query(query, matches);
 }
 
 CalculationResult Calculator::clearHistory() {
     history.clear();
+    log.rewrite(history.newest());
     return CalculationResult("Clear History", 0);
 }
 
+// Without a filename the log is flushed to disk; with one, the history is
+// exported in the text format seconds|expression|result|operation_type
 CalculationResult Calculator::saveHistoryToFile(const string& filename) {
-    string file = filename.empty() ? history_file : filename;
-    ofstream out(file, ios::binary);
+    if (filename.empty()) {
+        if (!log.sync()) {
+            return CalculationResult("Save History", "Error: Could not sync history log");
+        }
+        return CalculationResult("Save History", static_cast<double>(history.size()));
+    }
+    
+    ofstream out(filename, ios::binary);
     if (!out) {
         return CalculationResult("Save History", 
                                 "Error: Could not open file for writing");
     }
     
-    for (const auto& entry : history) {
-        out << entry.timestamp << "|"
-            << entry.expression << "|"
-            << entry.result << "|"
-            << entry.operation_type << "\n";
+    string line;
+    HistoryView entries = history.newest();
+    for (size_t i = 0; i < entries.size(); i++) {
+        const HistoryEntry& entry = entries[i];
+        line.clear();
+        appendInteger(line, entry.timestamp_ns / 1000000000);
+        line += '|';
+        appendExpression(line, entry, entries.text(i));
+        line += '|';
+        appendExact(line, entry.result);
+        line += '|';
+        line += operationName(entry.operation);
+        line += '\n';
+        out.write(line.data(), line.size());
     }
     
     out.close();
     return CalculationResult("Save History", static_cast<double>(history.size()));
 }
 
+HistoryWriterMetrics Calculator::getHistoryWriterMetrics() const {
+    return log.getMetrics();
+}
+
+// Without a filename the history is reloaded from the log; with one, a text
+// export replaces the history (and the log)
 CalculationResult Calculator::loadHistoryFromFile(const string& filename) {
-    string file = filename.empty() ? history_file : filename;
-    ifstream in(file, ios::binary);
-    if (!in) {
+    if (filename.empty()) {
+        history.clear();
+        if (log.open(history_file, history) != HistoryLog::OpenResult::OPENED) {
+            return CalculationResult("Load History", "Error: Could not open history log");
+        }
+        return CalculationResult("Load History", static_cast<double>(history.size()));
+    }
+    
+    if (!importTextHistory(filename)) {
         return CalculationResult("Load History", 
                                 "Warning: No history file found");
     }
+    log.rewrite(history.newest());
+    return CalculationResult("Load History", static_cast<double>(history.size()));
+}
+
+bool Calculator::importTextHistory(const string& filename) {
+    ifstream in(filename, ios::binary);
+    if (!in) {
+        return false;
+    }
     
     history.clear();
     string line;
+    string cut;
     while (getline(in, line)) {
-        istringstream iss(line);
-        string timestamp, expression, operation_type;
-        double result;
-        char delimiter;
-        
-        getline(iss, timestamp, '|');
-        getline(iss, expression, '|');
-        iss >> result;
-        iss.ignore(); // Skip delimiter
-        getline(iss, operation_type);
+        // timestamp|expression|result|type
+        string_view rest = line;
+        string_view fields[4];
+        for (size_t i = 0; i < 4; i++) {
+            size_t bar = i < 3 ? rest.find('|') : string_view::npos;
+            fields[i] = rest.substr(0, bar);
+            rest = bar == string_view::npos ? string_view() : rest.substr(bar + 1);
+        }
+        string_view expression = cutForHistory(fields[1], cut);
+        string_view operation_type = fields[3];
+        int64_t seconds = 0;
+        double result = 0.0;
+        from_chars(fields[0].data(), fields[0].data() + fields[0].size(), seconds);
+        from_chars(fields[2].data(), fields[2].data() + fields[2].size(), result);
         
-        HistoryEntry entry = {timestamp, expression, result, operation_type};
-        history.push_back(entry);
+        // Fixed operations are stored by their operands again; anything
+        // that does not parse back is kept as text
+        Operation operation = operationByName(operation_type);
+        double operands[2] = {0.0, 0.0};
+        if (operation != Operation::EXPRESSION &&
+            !parseOperation(expression, operation, operands)) {
+            operation = Operation::EXPRESSION;
+        }
+        history.push(HistoryEntry(seconds * 1000000000, operation, operands[0], operands[1],
+                                  result, expression), expression);
     }
-    
-    in.close();
-    return CalculationResult("Load History", static_cast<double>(history.size()));
+    return true;
 }
 
 // Utility functions
 CalculationResult Calculator::percentage(double value) {
-    double result = value / 100.0;
-    return CalculationResult(to_string(value) + "%", result);
+    return CalculationResult(Operation::PERCENTAGE, value, 0.0, value / 100.0);
 }
 
 CalculationResult Calculator::negate(double value) {
-    return CalculationResult("-(" + to_string(value) + ")", -value);
+    return CalculationResult(Operation::NEGATE, value, 0.0, -value);
 }
 
 CalculationResult Calculator::reciprocal(double value) {
     if (value == 0) {
-        return CalculationResult("1/(" + to_string(value) + ")", 
-                                "Error: Division by zero");
+        return CalculationResult(Operation::RECIPROCAL, value, 0.0, "Error: Division by zero");
     }
-    return CalculationResult("1/(" + to_string(value) + ")", 1.0 / value);
+    return CalculationResult(Operation::RECIPROCAL, value, 0.0, 1.0 / value);
 }
 
 // CommandProcessor implementation
-CommandProcessor::CommandProcessor() {
-    calculator = make_unique<Calculator>();
-}
-
-map<string, string> CommandProcessor::parseCommand(const string& command) {
-    map<string, string> result;
-    istringstream iss(command);
-    string cmd;
-    iss >> cmd;
-    
-    result["command"] = cmd;
-    
-    // Parse parameters based on command type
-    if (cmd == "CALC" || cmd == "EVAL") {
-        // Get the rest of the line as expression
-        string expr;
-        getline(iss, expr);
-        if (!expr.empty() && expr[0] == ' ') {
-            expr = expr.substr(1);
-        }
-        result["expression"] = expr;
-    } else if (cmd == "ADD" || cmd == "SUB" || cmd == "MUL" || cmd == "DIV" || 
-               cmd == "POW" || cmd == "PERCENT" || cmd == "NEGATE" || cmd == "RECIPROCAL") {
-        string param1, param2;
-        iss >> param1;
-        if (cmd != "PERCENT" && cmd != "NEGATE" && cmd != "RECIPROCAL") {
-            iss >> param2;
-            result["param2"] = param2;
-        }
-        result["param1"] = param1;
-    } else if (cmd == "SQRT" || cmd == "SIN" || cmd == "COS" || cmd == "TAN" || 
-               cmd == "LOG" || cmd == "LN" || cmd == "EXP" || cmd == "FACT") {
-        string param;
-        iss >> param;
-        result["param"] = param;
-    } else if (cmd == "MADD" || cmd == "MSUB") {
-        string param;
-        iss >> param;
-        result["param"] = param;
-    }
-    
-    return result;
+static vector<string> commandNames();
+
+CommandProcessor::CommandProcessor(const string& history_file, size_t history_capacity,
+                                   const HistoryLogOptions& log_options,
+                                   size_t result_cache_capacity)
+    : stats(commandNames()) {
+    calculator = make_unique<Calculator>(history_file, history_capacity, log_options,
+                                         result_cache_capacity);
 }
 
-string CommandProcessor::processCommand(const string& command) {
-    auto parts = parseCommand(command);
-    string cmd = parts["command"];
+// Arguments of one command, split on demand straight from the request
+// text. Nothing is copied; the views stay valid for the whole request.
+class CommandArgs {
+private:
+    string_view text;
+    size_t pos;
     
-    ostringstream response;
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
     
-    try {
-        if (cmd == "CALC" || cmd == "EVAL") {
-            auto result = calculator->evaluate(parts["expression"]);
-            response << (result.success ? "SUCCESS" : "ERROR") << "|"
-                    << result.expression << "|"
-                    << result.result << "|"
-                    << result.error_message;
-        }
-        else if (cmd == "ADD") {
-            double a = stod(parts["param1"]);
-            double b = stod(parts["param2"]);
-            auto result = calculator->add(a, b);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "SUB") {
-            double a = stod(parts["param1"]);
-            double b = stod(parts["param2"]);
-            auto result = calculator->subtract(a, b);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "MUL") {
-            double a = stod(parts["param1"]);
-            double b = stod(parts["param2"]);
-            auto result = calculator->multiply(a, b);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "DIV") {
-            double a = stod(parts["param1"]);
-            double b = stod(parts["param2"]);
-            auto result = calculator->divide(a, b);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
-            }
+public:
+    explicit CommandArgs(string_view text) : text(text), pos(0) {}
+    
+    // Next whitespace-separated token, empty once the input is exhausted
+    string_view next() {
+        while (pos < text.size() && isSpace(text[pos])) pos++;
+        size_t start = pos;
+        while (pos < text.size() && !isSpace(text[pos])) pos++;
+        return text.substr(start, pos - start);
+    }
+    
+    // Everything after the current token and the single separator
+    // following it, unmodified (may be binary)
+    string_view rest() {
+        if (pos < text.size()) pos++;
+        string_view remainder = text.substr(pos);
+        pos = text.size();
+        return remainder;
+    }
+    
+    double number() {
+        return parseNumber(next());
+    }
+    
+    template <typename Integer = int>
+    Integer integer() {
+        string_view token = next();
+        if (token.empty()) {
+            throw invalid_argument("Missing argument");
         }
-        else if (cmd == "SQRT") {
-            double val = stod(parts["param"]);
-            auto result = calculator->squareRoot(val);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
-            }
+        if (token[0] == '+') token.remove_prefix(1);
+        Integer value;
+        auto parsed = from_chars(token.data(), token.data() + token.size(), value);
+        if (parsed.ec != errc()) {
+            throw invalid_argument("Invalid integer: " + string(token));
         }
-        else if (cmd == "SIN") {
-            double val = stod(parts["param"]);
-            auto result = calculator->sin(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
+        return value;
+    }
+    
+    // Accepts what stod accepted for the operands clients send: an
+    // optional sign followed by a decimal or scientific number
+    static double parseNumber(string_view token) {
+        if (token.empty()) {
+            throw invalid_argument("Missing argument");
         }
-        else if (cmd == "COS") {
-            double val = stod(parts["param"]);
-            auto result = calculator->cos(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
+        if (token[0] == '+') token.remove_prefix(1);
+        double value;
+        auto parsed = from_chars(token.data(), token.data() + token.size(), value);
+        if (parsed.ec == errc::result_out_of_range) {
+            throw out_of_range("Number out of range: " + string(token));
         }
-        else if (cmd == "TAN") {
-            double val = stod(parts["param"]);
-            auto result = calculator->tan(val);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
-            }
+        if (parsed.ec != errc()) {
+            throw invalid_argument("Invalid number: " + string(token));
         }
-        else if (cmd == "LOG") {
-            double val = stod(parts["param"]);
-            auto result = calculator->log10(val);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
-            }
+        return value;
+    }
+};
+
+// Appends a response to the caller's buffer. Numbers are written with
+// to_chars, doubles as the shortest text that reads back as the same
+// value, so a warm buffer never allocates and clients never lose digits.
+class ResponseWriter {
+private:
+    string& out;
+    
+public:
+    explicit ResponseWriter(string& out) : out(out) {}
+    
+    ResponseWriter& operator<<(string_view text) {
+        out.append(text.data(), text.size());
+        return *this;
+    }
+    
+    ResponseWriter& operator<<(const char* text) {
+        out += text;
+        return *this;
+    }
+    
+    ResponseWriter& operator<<(char c) {
+        out += c;
+        return *this;
+    }
+    
+    ResponseWriter& operator<<(double value) {
+        appendExact(out, value);
+        return *this;
+    }
+    
+    template <typename Integer, typename = enable_if_t<is_integral<Integer>::value>>
+    ResponseWriter& operator<<(Integer value) {
+        appendInteger(out, static_cast<long long>(value));
+        return *this;
+    }
+    
+    ResponseWriter& operator<<(const BigInt& value) {
+        value.appendTo(out);
+        return *this;
+    }
+    
+    ResponseWriter& write(const char* data, size_t size) {
+        out.append(data, size);
+        return *this;
+    }
+    
+    void expression(const CalculationResult& result) {
+        result.appendExpression(out);
+    }
+    
+    void expression(const HistoryEntry& entry, string_view text) {
+        appendExpression(out, entry, text);
+    }
+};
+
+typedef void (*CommandHandler)(Calculator& calculator, CommandArgs& args, ResponseWriter& response);
+
+// Response helpers
+static void writeResult(ResponseWriter& response, const CalculationResult& result) {
+    if (result.success) {
+        response << "SUCCESS|";
+        response.expression(result);
+        response << "|" << result.result;
+    } else {
+        response << "ERROR|||" << result.error_message;
+    }
+}
+
+// Like writeResult, with the exact value in place of the double
+static void writeExactResult(ResponseWriter& response, const CalculationResult& result,
+                             const BigInt& value) {
+    if (result.success) {
+        response << "SUCCESS|";
+        response.expression(result);
+        response << "|" << value;
+    } else {
+        response << "ERROR|||" << result.error_message;
+    }
+}
+
+static void writeFullResult(ResponseWriter& response, const CalculationResult& result) {
+    response << (result.success ? "SUCCESS" : "ERROR") << "|";
+    response.expression(result);
+    response << "|" << result.result << "|" << result.error_message;
+}
+
+// Command handlers
+template <CalculationResult (Calculator::*Operation)(double, double)>
+static void binaryCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    double a = args.number();
+    double b = args.number();
+    writeResult(response, (calculator.*Operation)(a, b));
+}
+
+template <CalculationResult (Calculator::*Operation)(double)>
+static void unaryCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    double value = args.number();
+    writeResult(response, (calculator.*Operation)(value));
+}
+
+template <CalculationResult (Calculator::*Operation)()>
+static void nullaryCommand(Calculator& calculator, CommandArgs&, ResponseWriter& response) {
+    writeResult(response, (calculator.*Operation)());
+}
+
+static void evaluateCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    writeFullResult(response, calculator.evaluate(args.rest()));
+}
+
+// FACT <n>: factorials that fit a long long as before, larger ones exactly
+static void factorialCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    int value = args.integer();
+    if (value <= MAX_INTEGER_FACTORIAL) {
+        writeResult(response, calculator.factorial(value));
+        return;
+    }
+    BigInt exact;
+    writeExactResult(response, calculator.exactFactorial(value, exact), exact);
+}
+
+// BIG <a> <op> <b>: exact integer arithmetic, op one of + - * / % ^
+static void bigCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    BigInt a = BigInt::parse(args.next());
+    string_view op = args.next();
+    if (op.size() != 1 || string_view("+-*/%^").find(op[0]) == string_view::npos) {
+        throw invalid_argument("Unknown operator: " + string(op));
+    }
+    BigInt b = BigInt::parse(args.next());
+    BigInt value;
+    CalculationResult result = calculator.bigArithmetic(a, op[0], b, value);
+    if (result.success) {
+        response << "SUCCESS|" << result.text << "|" << value;
+    } else {
+        response << "ERROR|||" << result.error_message;
+    }
+}
+
+static void setCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    string_view name = args.next();
+    double value = args.number();
+    writeResult(response, calculator.setVariable(string(name), value));
+}
+
+static void variablesCommand(Calculator& calculator, CommandArgs&, ResponseWriter& response) {
+    const auto& variables = calculator.getVariables();
+    response << "SUCCESS|Variables|" << variables.size() << "|";
+    for (const auto& variable : variables) {
+        response << variable.first << " = " << variable.second << ";";
+    }
+}
+
+// DEFINE <name> = <expression>
+static void defineCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    string_view rest = args.rest();
+    size_t equals = rest.find('=');
+    string_view name = rest.substr(0, equals);
+    string_view expr = equals == string_view::npos ? string_view() : rest.substr(equals + 1);
+    
+    size_t first = name.find_first_not_of(' ');
+    name = first == string_view::npos ? string_view() : name.substr(first);
+    name = name.substr(0, name.find_last_not_of(' ') + 1);
+    size_t expr_start = expr.find_first_not_of(' ');
+    expr = expr_start == string_view::npos ? string_view() : expr.substr(expr_start);
+    
+    writeResult(response, calculator.define(string(name), string(expr)));
+}
+
+// APPLY <name> <variable> <v1,v2,...>
+static void applyCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    string name(args.next());
+    string variable(args.next());
+    const CompiledExpression* expression = calculator.getDefinition(name);
+    if (expression == nullptr) {
+        response << "ERROR|||Unknown function: " << name;
+        return;
+    }
+    
+    vector<double> inputs, outputs;
+    string_view values = args.rest();
+    while (!values.empty()) {
+        size_t comma = values.find(',');
+        string_view value = values.substr(0, comma);
+        value.remove_prefix(min(value.find_first_not_of(' '), value.size()));
+        value = value.substr(0, value.find_last_not_of(' ') + 1);
+        inputs.push_back(CommandArgs::parseNumber(value));
+        values = comma == string_view::npos ? string_view() : values.substr(comma + 1);
+    }
+    
+    auto result = calculator.evaluateColumn(*expression, variable, inputs, outputs);
+    if (result.success) {
+        response << "SUCCESS|";
+        response.expression(result);
+        response << "|" << result.result << "|";
+        for (size_t i = 0; i < outputs.size(); i++) {
+            response << (i > 0 ? "," : "") << outputs[i];
         }
-        else if (cmd == "LN") {
-            double val = stod(parts["param"]);
-            auto result = calculator->ln(val);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
-            }
+    } else {
+        response << "ERROR|||" << result.error_message;
+    }
+}
+
+// HISTORY_EXPORT <CSV|BIN> [cursor] [count]
+// One chunk of the history log per request: up to `count` entries from
+// `cursor` on (0 = the oldest kept), followed by the cursor to ask for
+// next. The client pulls at its own pace, so a slow reader never makes
+// the server hold more than one chunk, however long the history.
+//   SUCCESS|History Export|<entries>|<next cursor>|<payload>
+// CSV payload: one "timestamp_ns,type,operand1,operand2,result,expression"
+// line per entry. BIN payload: the 64-byte HistoryEntry records as stored,
+// without continuations, so a text flagged TEXT_CONTINUES only has its
+// start there; CSV has all of it.
+// A chunk with 0 entries ends the export.
+static const size_t DEFAULT_EXPORT_CHUNK = 256;
+static const size_t MAX_EXPORT_CHUNK = 8192;
+
+static void appendCsvField(string& out, string_view field) {
+    if (field.find_first_of(",\"\r\n") == string_view::npos) {
+        out.append(field.data(), field.size());
+        return;
+    }
+    out += '"';
+    for (char c : field) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+static void historyExportCommand(Calculator& calculator, CommandArgs& args,
+                                 ResponseWriter& response) {
+    string_view format = args.next();
+    if (format != "CSV" && format != "BIN") {
+        throw invalid_argument("Unknown export format: " + string(format));
+    }
+    CommandArgs peek = args;
+    uint64_t cursor = peek.next().empty() ? 0 : args.integer<uint64_t>();
+    peek = args;
+    size_t count = peek.next().empty() ? DEFAULT_EXPORT_CHUNK : args.integer<size_t>();
+    count = min(max<size_t>(count, 1), MAX_EXPORT_CHUNK);
+    
+    vector<HistoryEntry> entries;
+    vector<string> texts;
+    calculator.exportHistory(cursor, count, entries, texts);
+    response << "SUCCESS|History Export|" << entries.size() << "|" << cursor << "|";
+    if (format == "BIN") {
+        response.write(reinterpret_cast<const char*>(entries.data()),
+                       entries.size() * sizeof(HistoryEntry));
+        return;
+    }
+    
+    string expression;
+    string field;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const HistoryEntry& entry = entries[i];
+        expression.clear();
+        field.clear();
+        appendExpression(expression, entry, texts[i]);
+        appendCsvField(field, expression);
+        response << entry.timestamp_ns << "," << operationName(entry.operation) << ",";
+        response << entry.operands[0] << "," << entry.operands[1] << ","
+                 << entry.result << "," << field << "\n";
+    }
+}
+
+// Columnar BATCH command:
+//   BATCH <op> <count> [HISTORY] <CSV|BIN> <payload>
+// Values travel either as comma-separated text or as raw 8-byte doubles in
+// the server's native byte order; results come back in the same format,
+// NaN marking the lanes with a domain error.
+static void batchCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    typedef size_t (Calculator::*UnaryBatch)(const vector<double>&, vector<double>&,
+                                             vector<uint8_t>&, bool);
+    struct BatchOperation {
+        const char* command;
+        const char* name;
+        UnaryBatch function;
+    };
+    static const BatchOperation operations[] = {
+        {"SQRT", "sqrt", &Calculator::squareRootBatch},
+        {"SIN", "sin", &Calculator::sinBatch},
+        {"COS", "cos", &Calculator::cosBatch},
+        {"TAN", "tan", &Calculator::tanBatch},
+        {"LOG", "log10", &Calculator::log10Batch},
+        {"LN", "ln", &Calculator::lnBatch},
+        {"EXP", "exp", &Calculator::expBatch},
+        {"POW", "pow", nullptr}
+    };
+    
+    string_view op = args.next();
+    const BatchOperation* operation = nullptr;
+    for (const auto& candidate : operations) {
+        if (op == candidate.command) {
+            operation = &candidate;
         }
-        else if (cmd == "EXP") {
-            double val = stod(parts["param"]);
-            auto result = calculator->exp(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
+    }
+    if (operation == nullptr) {
+        response << "ERROR|||Unsupported batch operation: " << op;
+        return;
+    }
+    
+    int requested = args.integer();
+    if (requested < 0) {
+        response << "ERROR|||Invalid batch count: " << requested;
+        return;
+    }
+    size_t count = static_cast<size_t>(requested);
+    string_view format = args.next();
+    bool record_history = format == "HISTORY";
+    if (record_history) {
+        format = args.next();
+    }
+    if (format != "CSV" && format != "BIN") {
+        response << "ERROR|||Batch format must be CSV or BIN";
+        return;
+    }
+    
+    // POW takes all the bases followed by all the exponents
+    size_t expected = operation->function == nullptr ? 2 * count : count;
+    string_view payload = args.rest();
+    vector<double> values;
+    
+    if (format == "BIN") {
+        if (payload.size() != expected * sizeof(double)) {
+            response << "ERROR|||Expected " << expected * sizeof(double)
+                     << " payload bytes, got " << payload.size();
+            return;
         }
-        else if (cmd == "FACT") {
-            int val = stoi(parts["param"]);
-            auto result = calculator->factorial(val);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
+        values.resize(expected);
+        memcpy(values.data(), payload.data(), payload.size());
+    } else {
+        // The count is the client's word; every value takes at least one
+        // character and a separator, which bounds what the payload can hold
+        values.reserve(min(expected, payload.size() / 2 + 1));
+        const char* cursor = payload.data();
+        const char* end = payload.data() + payload.size();
+        while (cursor < end) {
+            while (cursor < end && (*cursor == ' ' || *cursor == ',')) cursor++;
+            if (cursor == end) break;
+            double value;
+            auto parsed = from_chars(cursor, end, value);
+            if (parsed.ec != errc()) {
+                response << "ERROR|||Invalid batch value at offset " << cursor - payload.data();
+                return;
             }
+            values.push_back(value);
+            cursor = parsed.ptr;
         }
-        else if (cmd == "POW") {
-            double a = stod(parts["param1"]);
-            double b = stod(parts["param2"]);
-            auto result = calculator->power(a, b);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "PERCENT") {
-            double val = stod(parts["param1"]);
-            auto result = calculator->percentage(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "NEGATE") {
-            double val = stod(parts["param1"]);
-            auto result = calculator->negate(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "RECIPROCAL") {
-            double val = stod(parts["param1"]);
-            auto result = calculator->reciprocal(val);
-            if (result.success) {
-                response << "SUCCESS|" << result.expression << "|" << result.result;
-            } else {
-                response << "ERROR|||" << result.error_message;
-            }
+        if (values.size() != expected) {
+            response << "ERROR|||Expected " << expected << " values, got " << values.size();
+            return;
         }
-        else if (cmd == "MADD") {
-            double val = stod(parts["param"]);
-            auto result = calculator->memoryAdd(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "MSUB") {
-            double val = stod(parts["param"]);
-            auto result = calculator->memorySubtract(val);
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "MR") {
-            auto result = calculator->memoryRecall();
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "MC") {
-            auto result = calculator->memoryClear();
-            response << "SUCCESS|" << result.expression << "|" << result.result;
-        }
-        else if (cmd == "HISTORY") {
-            auto history = calculator->getHistory(10);
-            response << "SUCCESS|History|" << history.size() << "|";
-            for (const auto& entry : history) {
-                response << entry.expression << " = " << entry.result << ";";
-            }
+    }
+    
+    vector<double> results;
+    vector<uint8_t> errors;
+    size_t failed;
+    if (operation->function == nullptr) {
+        vector<double> exponents(values.begin() + count, values.end());
+        values.resize(count);
+        failed = calculator.powerBatch(values, exponents, results, errors, record_history);
+    } else {
+        failed = (calculator.*operation->function)(values, results, errors, record_history);
+    }
+    
+    response << "SUCCESS|" << operation->name << "([" << count << " values])|" << failed << "|";
+    if (format == "BIN") {
+        response.write(reinterpret_cast<const char*>(results.data()),
+                       results.size() * sizeof(double));
+    } else {
+        char buffer[32];
+        for (size_t i = 0; i < results.size(); i++) {
+            if (i > 0) response << ',';
+            response.write(buffer, to_chars(buffer, buffer + sizeof(buffer), results[i]).ptr - buffer);
         }
-        else if (cmd == "CLEAR_HISTORY") {
-            auto result = calculator->clearHistory();
-            response << "SUCCESS|" << result.expression << "|" << result.result;
+    }
+}
+
+// HISTORY [count]
+static void historyCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    CommandArgs peek = args;
+    int limit = peek.next().empty() ? 10 : args.integer();
+    if (limit < 0) {
+        throw invalid_argument("Invalid count: " + to_string(limit));
+    }
+    auto history = calculator.getHistory(limit);
+    response << "SUCCESS|History|" << history.size() << "|";
+    for (size_t i = 0; i < history.size(); i++) {
+        const HistoryEntry& entry = history[i];
+        response.expression(entry, history.text(i));
+        response << " = " << entry.result << ";";
+    }
+}
+
+static int64_t secondsToTimestamp(double seconds) {
+    double ns = seconds * 1e9;
+    if (ns <= static_cast<double>(numeric_limits<int64_t>::min())) {
+        return numeric_limits<int64_t>::min();
+    }
+    if (ns >= static_cast<double>(numeric_limits<int64_t>::max())) {
+        return numeric_limits<int64_t>::max();
+    }
+    return static_cast<int64_t>(ns);
+}
+
+// HISTORY_QUERY [OP <type>]... [FROM <seconds>] [TO <seconds>] [MIN <result>]
+//               [MAX <result>] [LIMIT <count>]
+// Types are the history type names (addition, division, ...); times are
+// Unix seconds. Matches are listed oldest first as "<seconds> <expr> = <result>".
+static void historyQueryCommand(Calculator& calculator, CommandArgs& args,
+                                ResponseWriter& response) {
+    HistoryQuery query;
+    for (string_view key = args.next(); !key.empty(); key = args.next()) {
+        if (key == "OP") {
+            string_view name = args.next();
+            size_t operation = 0;
+            while (operation < OPERATION_COUNT &&
+                   name != operationName(static_cast<Operation>(operation))) {
+                operation++;
+            }
+            if (operation == OPERATION_COUNT) {
+                throw invalid_argument("Unknown operation: " + string(name));
+            }
+            query.operations |= 1u << operation;
+        } else if (key == "FROM") {
+            query.from_ns = secondsToTimestamp(args.number());
+        } else if (key == "TO") {
+            query.to_ns = secondsToTimestamp(args.number());
+        } else if (key == "MIN") {
+            query.min_result = args.number();
+        } else if (key == "MAX") {
+            query.max_result = args.number();
+        } else if (key == "LIMIT") {
+            int limit = args.integer();
+            if (limit < 0) {
+                throw invalid_argument("Invalid count: " + to_string(limit));
+            }
+            query.limit = limit;
+        } else {
+            throw invalid_argument("Unknown query option: " + string(key));
         }
-        else if (cmd == "SAVE_HISTORY") {
-            auto result = calculator->saveHistoryToFile();
-            response << (result.success ? "SUCCESS" : "ERROR") << "|"
-                    << result.expression << "|"
-                    << result.result << "|"
-                    << result.error_message;
+    }
+    
+    vector<const HistoryEntry*> matches;
+    calculator.queryHistory(query, matches);
+    response << "SUCCESS|History Query|" << matches.size() << "|";
+    for (const HistoryEntry* entry : matches) {
+        response << entry->timestamp_ns / 1000000000 << " ";
+        response.expression(*entry, calculator.historyText(*entry));
+        response << " = " << entry->result << ";";
+    }
+}
+
+static void clearHistoryCommand(Calculator& calculator, CommandArgs&, ResponseWriter& response) {
+    writeResult(response, calculator.clearHistory());
+}
+
+static void saveHistoryCommand(Calculator& calculator, CommandArgs&, ResponseWriter& response) {
+    writeFullResult(response, calculator.saveHistoryToFile());
+}
+
+static void loadHistoryCommand(Calculator& calculator, CommandArgs&, ResponseWriter& response) {
+    writeFullResult(response, calculator.loadHistoryFromFile());
+}
+
+// MEMO [ON|OFF|CLEAR]: switch the result cache, and report its counters
+static void memoCommand(Calculator& calculator, CommandArgs& args, ResponseWriter& response) {
+    ResultCache& cache = calculator.getResultCache();
+    string_view action = args.next();
+    if (action == "ON") {
+        cache.setEnabled(true);
+    } else if (action == "OFF") {
+        cache.setEnabled(false);
+    } else if (action == "CLEAR") {
+        cache.clear();
+    } else if (!action.empty()) {
+        throw invalid_argument("Unknown MEMO action: " + string(action));
+    }
+    
+    uint64_t hits = cache.getHits();
+    uint64_t lookups = hits + cache.getMisses();
+    double hit_rate = lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+    response << "SUCCESS|Memo Cache|" << hit_rate << "|"
+             << "enabled=" << (cache.isEnabled() ? 1 : 0) << ";"
+             << "capacity=" << cache.capacity() << ";"
+             << "hits=" << hits << ";"
+             << "misses=" << cache.getMisses() << ";"
+             << "bypassed=" << cache.getBypassed() << ";"
+             << "hit_rate=" << hit_rate << ";";
+}
+
+// LOG_STATS: history writer queue and group commit counters
+static void logStatsCommand(Calculator& calculator, CommandArgs&, ResponseWriter& response) {
+    HistoryWriterMetrics metrics = calculator.getHistoryWriterMetrics();
+    uint64_t average = metrics.flushes == 0 ? 0 : metrics.total_flush_us / metrics.flushes;
+    response << "SUCCESS|History Log|" << metrics.queue_depth << "|"
+             << "queue_depth=" << metrics.queue_depth << ";"
+             << "max_queue_depth=" << metrics.max_queue_depth << ";"
+             << "queue_stalls=" << metrics.queue_stalls << ";"
+             << "flushes=" << metrics.flushes << ";"
+             << "records_written=" << metrics.records_written << ";"
+             << "syncs=" << metrics.syncs << ";"
+             << "last_flush_us=" << metrics.last_flush_us << ";"
+             << "avg_flush_us=" << average << ";"
+             << "max_flush_us=" << metrics.max_flush_us << ";";
+}
+
+// STATS [ON|OFF|RESET]: switch request instrumentation, and report request
+// and error counts with latency percentiles (ns, of the sampled requests)
+// per command and phase
+static void statsCommand(Calculator&, CommandArgs& args, ResponseWriter& response) {
+    string_view action = args.next();
+    if (action == "ON") {
+        RequestStats::setEnabled(true);
+    } else if (action == "OFF") {
+        RequestStats::setEnabled(false);
+    } else if (action == "RESET") {
+        RequestStats::resetAll();
+    } else if (!action.empty()) {
+        throw invalid_argument("Unknown STATS action: " + string(action));
+    }
+    
+    StatsSnapshot stats = RequestStats::collect();
+    double ns_per_tick = 1e9 / stats.ticks_per_second;
+    auto nanoseconds = [ns_per_tick](uint64_t ticks) {
+        return static_cast<uint64_t>(static_cast<double>(ticks) * ns_per_tick + 0.5);
+    };
+    
+    response << "SUCCESS|Stats|" << stats.requests() << "|"
+             << "enabled=" << (RequestStats::isEnabled() ? 1 : 0) << ";"
+             << "sample_interval=" << RequestStats::sampleInterval() << ";"
+             << "requests=" << stats.requests() << ";"
+             << "errors=" << stats.errors() << ";"
+             << "sends=" << stats.send.count << ";"
+             << "send_p50_ns=" << nanoseconds(stats.send.quantile(0.5)) << ";"
+             << "send_p99_ns=" << nanoseconds(stats.send.quantile(0.99)) << ";"
+             << "send_max_ns=" << nanoseconds(stats.send.max) << ";";
+    for (const CommandSnapshot& command : stats.commands) {
+        if (command.requests == 0) {
+            continue;
         }
-        else if (cmd == "LOAD_HISTORY") {
-            auto result = calculator->loadHistoryFromFile();
-            response << (result.success ? "SUCCESS" : "ERROR") << "|"
-                    << result.expression << "|"
-                    << result.result << "|"
-                    << result.error_message;
+        response << command.name << ".requests=" << command.requests << ";"
+                 << command.name << ".errors=" << command.errors << ";";
+        for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+            const HistogramSnapshot& latency = command.phases[phase];
+            const char* name = phaseName(static_cast<Phase>(phase));
+            response << command.name << "." << name << "_p50_ns="
+                     << nanoseconds(latency.quantile(0.5)) << ";"
+                     << command.name << "." << name << "_p99_ns="
+                     << nanoseconds(latency.quantile(0.99)) << ";"
+                     << command.name << "." << name << "_max_ns="
+                     << nanoseconds(latency.max) << ";";
         }
-        else if (cmd == "EXIT" || cmd == "QUIT") {
-            response << "EXIT|Goodbye!";
+    }
+}
+
+static void exitCommand(Calculator&, CommandArgs&, ResponseWriter& response) {
+    response << "EXIT|Goodbye!";
+}
+
+// Command table. Lookup is one hash of the command name, one slot load and
+// one string compare.
+struct CommandEntry {
+    string_view name;
+    CommandHandler handler;
+};
+
+static constexpr CommandEntry COMMANDS[] = {
+    {"CALC", evaluateCommand},
+    {"EVAL", evaluateCommand},
+    {"ADD", binaryCommand<&Calculator::add>},
+    {"SUB", binaryCommand<&Calculator::subtract>},
+    {"MUL", binaryCommand<&Calculator::multiply>},
+    {"DIV", binaryCommand<&Calculator::divide>},
+    {"POW", binaryCommand<&Calculator::power>},
+    {"SQRT", unaryCommand<&Calculator::squareRoot>},
+    {"SIN", unaryCommand<&Calculator::sin>},
+    {"COS", unaryCommand<&Calculator::cos>},
+    {"TAN", unaryCommand<&Calculator::tan>},
+    {"LOG", unaryCommand<&Calculator::log10>},
+    {"LN", unaryCommand<&Calculator::ln>},
+    {"EXP", unaryCommand<&Calculator::exp>},
+    {"FACT", factorialCommand},
+    {"BIG", bigCommand},
+    {"PERCENT", unaryCommand<&Calculator::percentage>},
+    {"NEGATE", unaryCommand<&Calculator::negate>},
+    {"RECIPROCAL", unaryCommand<&Calculator::reciprocal>},
+    {"MADD", unaryCommand<&Calculator::memoryAdd>},
+    {"MSUB", unaryCommand<&Calculator::memorySubtract>},
+    {"MR", nullaryCommand<&Calculator::memoryRecall>},
+    {"MC", nullaryCommand<&Calculator::memoryClear>},
+    {"SET", setCommand},
+    {"VARS", variablesCommand},
+    {"DEFINE", defineCommand},
+    {"APPLY", applyCommand},
+    {"BATCH", batchCommand},
+    {"HISTORY", historyCommand},
+    {"HISTORY_QUERY", historyQueryCommand},
+    {"HISTORY_EXPORT", historyExportCommand},
+    {"CLEAR_HISTORY", clearHistoryCommand},
+    {"SAVE_HISTORY", saveHistoryCommand},
+    {"LOAD_HISTORY", loadHistoryCommand},
+    {"LOG_STATS", logStatsCommand},
+    {"MEMO", memoCommand},
+    {"STATS", statsCommand},
+    {"EXIT", exitCommand},
+    {"QUIT", exitCommand}
+};
+
+static constexpr size_t COMMAND_COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+
+// Perfect hash over the command names: FNV-1a with a seed chosen so every
+// name gets its own slot. Adding a command may require a new seed; the
+// static_assert below says so at compile time.
+static constexpr uint32_t COMMAND_HASH_SEED = 4181988;
+static constexpr size_t COMMAND_SLOT_BITS = 6;
+
+static constexpr size_t commandSlot(string_view name) {
+    uint32_t hash = COMMAND_HASH_SEED;
+    for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash >> (32 - COMMAND_SLOT_BITS);
+}
+
+// Slot -> index into COMMANDS + 1, 0 for an empty slot
+struct CommandSlots {
+    uint8_t index[size_t(1) << COMMAND_SLOT_BITS] = {};
+    bool collision = false;
+    
+    constexpr CommandSlots() {
+        for (size_t i = 0; i < COMMAND_COUNT; i++) {
+            size_t slot = commandSlot(COMMANDS[i].name);
+            collision = collision || index[slot] != 0;
+            index[slot] = static_cast<uint8_t>(i + 1);
         }
-        else {
-            response << "ERROR|||Unknown command: " << cmd;
+    }
+};
+
+static constexpr CommandSlots COMMAND_SLOTS;
+static_assert(!COMMAND_SLOTS.collision, "Command names collide, pick another COMMAND_HASH_SEED");
+
+// Index into COMMANDS, COMMAND_COUNT for an unknown name
+static constexpr size_t findCommand(string_view name) {
+    uint8_t index = COMMAND_SLOTS.index[commandSlot(name)];
+    if (index == 0 || COMMANDS[index - 1].name != name) {
+        return COMMAND_COUNT;
+    }
+    return index - 1;
+}
+
+// Statistics keys: the command table, then everything unknown
+static vector<string> commandNames() {
+    vector<string> names;
+    for (const CommandEntry& entry : COMMANDS) {
+        names.emplace_back(entry.name);
+    }
+    names.emplace_back("UNKNOWN");
+    return names;
+}
+
+void CommandProcessor::processCommand(string_view command, string& out) {
+    bool counted = RequestStats::isEnabled();
+    bool timed = counted && stats.sample();
+    uint64_t received = timed ? readClock() : 0;
+    CommandArgs args(command);
+    string_view name = args.next();
+    
+    size_t start = out.size();
+    ResponseWriter response(out);
+    
+    size_t index = findCommand(name);
+    uint64_t parsed = timed ? readClock() : 0;
+    calculator->timeHistory(timed);
+    try {
+        if (index == COMMAND_COUNT) {
+            response << "ERROR|||Unknown command: " << name;
+        } else {
+            COMMANDS[index].handler(*calculator, args, response);
         }
     } catch (const exception& e) {
+        // Drop whatever the handler wrote before failing
+        out.resize(start);
         response << "ERROR|||" << e.what();
     }
     
-    return response.str();
+    if (counted) {
+        stats.count(index, out.compare(start, 5, "ERROR") == 0);
+    }
+    if (timed) {
+        uint64_t history = calculator->takeHistoryTicks();
+        uint64_t handled = readClock() - parsed;
+        stats.record(index, parsed - received, handled - min(history, handled), history);
+    }
+}
+
+// Binary protocol requests, by opcode: a Calculator operation performed
+// straight on the operands in the frame. Each is counted in statistics as
+// the text command that does the same.
+typedef CalculationResult (*OpcodeHandler)(Calculator& calculator, const double* operands);
+
+template <CalculationResult (Calculator::*Operation)(double, double)>
+static CalculationResult binaryOpcode(Calculator& calculator, const double* operands) {
+    return (calculator.*Operation)(operands[0], operands[1]);
+}
+
+template <CalculationResult (Calculator::*Operation)(double)>
+static CalculationResult unaryOpcode(Calculator& calculator, const double* operands) {
+    return (calculator.*Operation)(operands[0]);
+}
+
+template <CalculationResult (Calculator::*Operation)()>
+static CalculationResult nullaryOpcode(Calculator& calculator, const double*) {
+    return (calculator.*Operation)();
+}
+
+// As FACT: large factorials are computed exactly, and come back as the
+// nearest double (infinity past 170!)
+static CalculationResult factorialOpcode(Calculator& calculator, const double* operands) {
+    double n = operands[0];
+    if (!(n >= -1e9 && n <= 1e9) || n != floor(n)) {
+        throw invalid_argument("Invalid integer");
+    }
+    if (n <= MAX_INTEGER_FACTORIAL) {
+        return calculator.factorial(static_cast<int>(n));
+    }
+    BigInt exact;
+    return calculator.exactFactorial(static_cast<uint32_t>(n), exact);
+}
+
+struct OpcodeEntry {
+    uint8_t opcode;
+    string_view command;
+    OpcodeHandler handler;
+};
+
+// Indexed by opcode; the numbers come from binary_protocol.h, the order
+// here must follow them
+static constexpr OpcodeEntry OPCODES[] = {
+    {0, "", nullptr},
+    {BINARY_OPCODE_ADD, "ADD", binaryOpcode<&Calculator::add>},
+    {BINARY_OPCODE_SUB, "SUB", binaryOpcode<&Calculator::subtract>},
+    {BINARY_OPCODE_MUL, "MUL", binaryOpcode<&Calculator::multiply>},
+    {BINARY_OPCODE_DIV, "DIV", binaryOpcode<&Calculator::divide>},
+    {5, "", nullptr},
+    {BINARY_OPCODE_POW, "POW", binaryOpcode<&Calculator::power>},
+    {BINARY_OPCODE_SQRT, "SQRT", unaryOpcode<&Calculator::squareRoot>},
+    {BINARY_OPCODE_SIN, "SIN", unaryOpcode<&Calculator::sin>},
+    {BINARY_OPCODE_COS, "COS", unaryOpcode<&Calculator::cos>},
+    {BINARY_OPCODE_TAN, "TAN", unaryOpcode<&Calculator::tan>},
+    {BINARY_OPCODE_LOG, "LOG", unaryOpcode<&Calculator::log10>},
+    {BINARY_OPCODE_LN, "LN", unaryOpcode<&Calculator::ln>},
+    {BINARY_OPCODE_EXP, "EXP", unaryOpcode<&Calculator::exp>},
+    {BINARY_OPCODE_FACT, "FACT", factorialOpcode},
+    {BINARY_OPCODE_MADD, "MADD", unaryOpcode<&Calculator::memoryAdd>},
+    {BINARY_OPCODE_MSUB, "MSUB", unaryOpcode<&Calculator::memorySubtract>},
+    {BINARY_OPCODE_MR, "MR", nullaryOpcode<&Calculator::memoryRecall>},
+    {BINARY_OPCODE_MC, "MC", nullaryOpcode<&Calculator::memoryClear>},
+    {BINARY_OPCODE_PERCENT, "PERCENT", unaryOpcode<&Calculator::percentage>},
+    {BINARY_OPCODE_NEGATE, "NEGATE", unaryOpcode<&Calculator::negate>},
+    {BINARY_OPCODE_RECIPROCAL, "RECIPROCAL", unaryOpcode<&Calculator::reciprocal>}
+};
+
+static constexpr size_t OPCODE_COUNT = sizeof(OPCODES) / sizeof(OPCODES[0]);
+
+static constexpr bool opcodesInOrder() {
+    for (size_t i = 0; i < OPCODE_COUNT; i++) {
+        if (OPCODES[i].opcode != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(opcodesInOrder(), "OPCODES must be in opcode order, without gaps");
+
+// Opcode -> index into COMMANDS, COMMAND_COUNT (UNKNOWN) for no command
+struct OpcodeCommands {
+    size_t index[OPCODE_COUNT] = {};
+    
+    constexpr OpcodeCommands() {
+        for (size_t i = 0; i < OPCODE_COUNT; i++) {
+            index[i] = findCommand(OPCODES[i].command);
+        }
+    }
+};
+
+static constexpr OpcodeCommands OPCODE_COMMANDS;
+static constexpr size_t EXIT_COMMAND = findCommand("EXIT");
+
+void CommandProcessor::processBinary(const BinaryRequest& request, string& out) {
+    bool counted = RequestStats::isEnabled();
+    bool timed = counted && stats.sample();
+    uint64_t received = timed ? readClock() : 0;
+    
+    BinaryResponse response = {BinaryStatus::BAD_REQUEST, request.opcode, 0, request.tag,
+                               numeric_limits<double>::quiet_NaN()};
+    size_t index = COMMAND_COUNT;
+    OpcodeHandler handler = nullptr;
+    if (request.opcode < OPCODE_COUNT) {
+        index = OPCODE_COMMANDS.index[request.opcode];
+        handler = OPCODES[request.opcode].handler;
+    } else if (request.opcode == BINARY_OPCODE_EXIT) {
+        index = EXIT_COMMAND;
+    }
+    bool valid = (request.flags & ~BINARY_FLAG_NO_HISTORY) == 0 && request.reserved == 0;
+    
+    uint64_t parsed = timed ? readClock() : 0;
+    calculator->timeHistory(timed);
+    if (valid && handler != nullptr) {
+        calculator->recordHistory((request.flags & BINARY_FLAG_NO_HISTORY) == 0);
+        try {
+            CalculationResult result = handler(*calculator, request.operands);
+            response.status = result.success ? BinaryStatus::OK : BinaryStatus::FAILURE;
+            if (result.success) {
+                response.result = result.result;
+            }
+        } catch (const exception&) {
+            // Invalid operand: stays BAD_REQUEST
+        }
+        calculator->recordHistory(true);
+    } else if (valid && index == EXIT_COMMAND) {
+        response.status = BinaryStatus::OK;
+        response.result = 0.0;
+    }
+    out.append(reinterpret_cast<const char*>(&response), sizeof(response));
+    
+    if (counted) {
+        stats.count(index, response.status != BinaryStatus::OK);
+    }
+    if (timed) {
+        uint64_t history = calculator->takeHistoryTicks();
+        uint64_t handled = readClock() - parsed;
+        stats.record(index, parsed - received, handled - min(history, handled), history);
+    }
+}
+
+RequestStats& CommandProcessor::getStats() {
+    return stats;
 }
@@ -2,47 +2,97 @@
 #define CALCULATOR_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <memory>
+#include "batch_math.h"
+#include "binary_protocol.h"
+#include "bigint.h"
+#include "expression.h"
+#include "history.h"
+#include "history_log.h"
+#include "result_cache.h"
+#include "stats.h"
 
-// Calculation result structure
+// History file used when none is given explicitly
+const char* const DEFAULT_HISTORY_FILE = "calculator_history.dat";
+
+// History entries kept in memory when no capacity is given
+const size_t DEFAULT_HISTORY_CAPACITY = 100000;
+
+// Requests are computed on the event loop, so big integers are kept to
+// what takes a few milliseconds at most (100000! takes hundreds).
+// Largest n whose factorial FACT computes exactly (35,660 digits):
+const uint32_t MAX_EXACT_FACTORIAL = 10000;
+
+// Longest big-integer operand or power, in decimal digits
+const size_t MAX_BIG_DIGITS = 20000;
+
+// History type name of an operation ("addition", "sine", ...)
+const char* operationName(Operation operation);
+
+// Calculation result structure. Results of the fixed operations only keep
+// their operands; the expression text is formatted when someone asks.
 struct CalculationResult {
-    std::string expression;
+    Operation operation;
+    double operands[2];
+    std::string text;           // Expression of Operation::EXPRESSION results
     double result;
     bool success;
     std::string error_message;
     
-    CalculationResult() : result(0.0), success(false) {}
+    CalculationResult() : operation(Operation::EXPRESSION), operands{0.0, 0.0}, result(0.0), success(false) {}
     CalculationResult(const std::string& expr, double res) 
-        : expression(expr), result(res), success(true) {}
+        : operation(Operation::EXPRESSION), operands{0.0, 0.0}, text(expr), result(res), success(true) {}
     CalculationResult(const std::string& expr, const std::string& error) 
-        : expression(expr), result(0.0), success(false), error_message(error) {}
+        : operation(Operation::EXPRESSION), operands{0.0, 0.0}, text(expr), result(0.0), success(false), error_message(error) {}
+    CalculationResult(Operation op, double a, double b, double res)
+        : operation(op), operands{a, b}, result(res), success(true) {}
+    CalculationResult(Operation op, double a, double b, const char* error)
+        : operation(op), operands{a, b}, result(0.0), success(false), error_message(error) {}
+    
+    // Append the expression, e.g. "2.000000 + 3.000000", to out
+    void appendExpression(std::string& out) const;
+    std::string expression() const;
 };
 
-// History entry structure
-struct HistoryEntry {
-    std::string timestamp;
-    std::string expression;
-    double result;
-    std::string operation_type;
-};
+// Same text for a history entry, given its whole text (HistoryBuffer::text)
+void appendExpression(std::string& out, const HistoryEntry& entry, std::string_view text);
 
 // Calculator class
 class Calculator {
 private:
     double memory;
-    std::vector<HistoryEntry> history;
+    VariableTable variables;
+    std::map<std::string, CompiledExpression> definitions;
+    HistoryBuffer history;
     std::string history_file;
+    HistoryLog log;
+    ExpressionCache expression_cache;
+    ResultCache result_cache;
+    bool recording;             // Whether fixed operations go to history
+    bool timing_history;
+    uint64_t history_ticks;     // readClock() ticks spent recording history
     
     // Private helper methods
-    double evaluateExpression(const std::string& expr);
+    double evaluateExpression(std::string_view expr);
     bool validateExpression(const std::string& expr);
-    std::string formatResult(double value);
-    void saveToHistory(const HistoryEntry& entry);
+    void saveToHistory(const HistoryEntry& entry, std::string_view text);
+    bool importTextHistory(const std::string& filename);
+    void record(const CalculationResult& result);
+    template <typename Compute>
+    double memoized(Operation operation, double a, double b, Compute compute);
+    size_t runBatch(BatchMath::Kernel kernel, const std::vector<double>& inputs,
+                    std::vector<double>& results, std::vector<uint8_t>& errors);
+    void recordBatch(Operation operation, const std::vector<double>& inputs,
+                     const std::vector<double>& results, const std::vector<uint8_t>& errors);
     
 public:
-    Calculator();
+    explicit Calculator(const std::string& history_file = DEFAULT_HISTORY_FILE,
+                        size_t history_capacity = DEFAULT_HISTORY_CAPACITY,
+                        const HistoryLogOptions& log_options = HistoryLogOptions(),
+                        size_t result_cache_capacity = DEFAULT_RESULT_CACHE_CAPACITY);
     ~Calculator();
     
     // Basic arithmetic operations
@@ -63,6 +113,36 @@ public:
     CalculationResult exp(double value);
     CalculationResult factorial(int n);
     
+    // Exact integer arithmetic: value receives the exact result, the
+    // CalculationResult its expression and nearest double. Exact factorials
+    // are kept in history (as that double); other big results are not.
+    CalculationResult exactFactorial(uint32_t n, BigInt& value);
+    // op is one of + - * / % ^
+    CalculationResult bigArithmetic(const BigInt& a, char op, const BigInt& b, BigInt& value);
+    
+    // Batch scientific operations: one result per input, evaluated with the
+    // vectorized kernels in BatchMath. errors[i] is set to 1 (and results[i]
+    // to NaN) where the scalar method would have reported a domain error;
+    // returns the number of such lanes. With record_history the successful
+    // lanes are added to history as if computed one at a time.
+    size_t squareRootBatch(const std::vector<double>& values, std::vector<double>& results,
+                           std::vector<uint8_t>& errors, bool record_history = false);
+    size_t sinBatch(const std::vector<double>& angles_degrees, std::vector<double>& results,
+                    std::vector<uint8_t>& errors, bool record_history = false);
+    size_t cosBatch(const std::vector<double>& angles_degrees, std::vector<double>& results,
+                    std::vector<uint8_t>& errors, bool record_history = false);
+    size_t tanBatch(const std::vector<double>& angles_degrees, std::vector<double>& results,
+                    std::vector<uint8_t>& errors, bool record_history = false);
+    size_t log10Batch(const std::vector<double>& values, std::vector<double>& results,
+                      std::vector<uint8_t>& errors, bool record_history = false);
+    size_t lnBatch(const std::vector<double>& values, std::vector<double>& results,
+                   std::vector<uint8_t>& errors, bool record_history = false);
+    size_t expBatch(const std::vector<double>& values, std::vector<double>& results,
+                    std::vector<uint8_t>& errors, bool record_history = false);
+    size_t powerBatch(const std::vector<double>& bases, const std::vector<double>& exponents,
+                      std::vector<double>& results, std::vector<uint8_t>& errors,
+                      bool record_history = false);
+    
     // Memory operations
     CalculationResult memoryAdd(double value);
     CalculationResult memorySubtract(double value);
@@ -70,13 +150,55 @@ public:
     CalculationResult memoryClear();
     double getMemoryValue() const;
     
+    // Variables and parameterized expressions
+    CalculationResult setVariable(const std::string& name, double value);
+    CalculationResult define(const std::string& name, const std::string& expression);
+    const CompiledExpression* getDefinition(const std::string& name) const;
+    const VariableTable& getVariables() const;
+    
+    // Bulk evaluation: run a compiled expression once per input value with
+    // `variable` bound to that value and every other variable taken from
+    // the variable table. Rows with a domain error yield NaN.
+    CalculationResult evaluateColumn(const CompiledExpression& expression,
+                                     const std::string& variable,
+                                     const std::vector<double>& inputs,
+                                     std::vector<double>& outputs);
+    
     // Complex expression evaluation
-    CalculationResult evaluate(const std::string& expression);
+    CalculationResult evaluate(std::string_view expression);
+    const ExpressionCache& getExpressionCache() const;
+    
+    // Memoized results of the pure scientific operations (power, sin, cos,
+    // tan, log10, ln, exp, factorial)
+    ResultCache& getResultCache();
+    
+    // Add the results of the fixed operations (ADD, SIN, FACT, ...) to
+    // history; on unless turned off
+    void recordHistory(bool on);
+    
+    // Measure the time spent adding to history and its log; takeHistoryTicks
+    // returns it (in readClock() ticks) and starts over
+    void timeHistory(bool on);
+    uint64_t takeHistoryTicks();
     
     // History operations
-    std::vector<HistoryEntry> getHistory(int limit = 10) const;
+    // The newest `limit` entries (0 = all), oldest first. The view is
+    // invalidated by the next calculation.
+    HistoryView getHistory(size_t limit = 10) const;
+    // Export the history log a chunk at a time: up to max_count entries
+    // from `cursor` on (0 = the oldest kept), advancing cursor past them.
+    // Returns the number of entries, 0 once the end of the log is reached.
+    // texts gets the whole text of each entry.
+    size_t exportHistory(uint64_t& cursor, size_t max_count, std::vector<HistoryEntry>& entries,
+                         std::vector<std::string>& texts);
+    // Entries matching the query, oldest first; see HistoryBuffer::query
+    void queryHistory(const HistoryQuery& query,
+                      std::vector<const HistoryEntry*>& matches) const;
+    // The whole text of an entry from getHistory or queryHistory
+    std::string_view historyText(const HistoryEntry& entry) const { return history.text(entry); }
     CalculationResult clearHistory();
     CalculationResult saveHistoryToFile(const std::string& filename = "");
+    HistoryWriterMetrics getHistoryWriterMetrics() const;
     CalculationResult loadHistoryFromFile(const std::string& filename = "");
     
     // Utility functions
@@ -89,11 +211,24 @@ public:
 class CommandProcessor {
 private:
     std::unique_ptr<Calculator> calculator;
-    std::map<std::string, std::string> parseCommand(const std::string& command);
+    RequestStats stats;
     
 public:
-    CommandProcessor();
-    std::string processCommand(const std::string& command);
+    explicit CommandProcessor(const std::string& history_file = DEFAULT_HISTORY_FILE,
+                              size_t history_capacity = DEFAULT_HISTORY_CAPACITY,
+                              const HistoryLogOptions& log_options = HistoryLogOptions(),
+                              size_t result_cache_capacity = DEFAULT_RESULT_CACHE_CAPACITY);
+    
+    // Execute one command and append its response to out. Reusing out
+    // across calls keeps the response path free of allocations.
+    void processCommand(std::string_view command, std::string& out);
+    // Execute one binary protocol request and append its BinaryResponse
+    // to out
+    void processBinary(const BinaryRequest& request, std::string& out);
+    
+    // Counters and latency of the commands processed here; record into it
+    // only from the thread that calls processCommand
+    RequestStats& getStats();
 };
 
 #endif // CALCULATOR_H
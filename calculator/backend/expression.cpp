@@ -0,0 +1,560 @@
+#include "expression.h"
+#include "batch_math.h"
+#include <cmath>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+// Scalar kernels used by the stack machine. Domain checks mirror the ones
+// in Calculator so EVAL reports the same errors as the direct commands.
+static double applyDivide(double a, double b) {
+    if (b == 0) {
+        throw runtime_error("Division by zero");
+    }
+    return a / b;
+}
+
+static double applyFactorial(double n) {
+    if (n < 0) {
+        throw runtime_error("Factorial of negative number");
+    }
+    if (n != floor(n)) {
+        throw runtime_error("Factorial requires an integer");
+    }
+    if (n > 170) { // Largest factorial representable as a double
+        throw runtime_error("Number too large for factorial");
+    }
+    double result = 1.0;
+    for (int i = 2; i <= static_cast<int>(n); i++) {
+        result *= i;
+    }
+    return result;
+}
+
+// Tokenizer implementation
+Token Tokenizer::next() {
+    while (pos < input.size() && isspace(static_cast<unsigned char>(input[pos]))) {
+        pos++;
+    }
+    if (pos >= input.size()) {
+        return Token(TokenType::END, input.substr(pos, 0));
+    }
+    
+    size_t start = pos;
+    char c = input[pos];
+    
+    if (isdigit(static_cast<unsigned char>(c)) || c == '.') {
+        // Mantissa, then an exponent only if digits actually follow it
+        while (pos < input.size() &&
+               (isdigit(static_cast<unsigned char>(input[pos])) || input[pos] == '.')) {
+            pos++;
+        }
+        if (pos < input.size() && (input[pos] == 'e' || input[pos] == 'E')) {
+            size_t exponent = pos + 1;
+            if (exponent < input.size() && (input[exponent] == '+' || input[exponent] == '-')) {
+                exponent++;
+            }
+            if (exponent < input.size() && isdigit(static_cast<unsigned char>(input[exponent]))) {
+                pos = exponent;
+                while (pos < input.size() && isdigit(static_cast<unsigned char>(input[pos]))) {
+                    pos++;
+                }
+            }
+        }
+        
+        double value = 0.0;
+        auto parsed = from_chars(input.data() + start, input.data() + pos, value);
+        if (parsed.ec != errc() || parsed.ptr != input.data() + pos) {
+            return Token(TokenType::INVALID, input.substr(start, pos - start));
+        }
+        return Token(TokenType::NUMBER, input.substr(start, pos - start), value);
+    }
+    
+    if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+        while (pos < input.size() &&
+               (isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '_')) {
+            pos++;
+        }
+        return Token(TokenType::IDENTIFIER, input.substr(start, pos - start));
+    }
+    
+    pos++;
+    string_view text = input.substr(start, 1);
+    switch (c) {
+        case '+': return Token(TokenType::PLUS, text);
+        case '-': return Token(TokenType::MINUS, text);
+        case '*': return Token(TokenType::STAR, text);
+        case '/': return Token(TokenType::SLASH, text);
+        case '^': return Token(TokenType::CARET, text);
+        case '!': return Token(TokenType::BANG, text);
+        case '(': return Token(TokenType::LPAREN, text);
+        case ')': return Token(TokenType::RPAREN, text);
+        default:  return Token(TokenType::INVALID, text);
+    }
+}
+
+// Binding powers for the Pratt loop
+static const int BIND_ADDITIVE = 10;
+static const int BIND_MULTIPLICATIVE = 20;
+static const int BIND_UNARY = 30;
+static const int BIND_POWER = 40;
+static const int BIND_POSTFIX = 50;
+
+// Operands nested deeper than this are refused rather than parsed by ever
+// deeper recursion, which a long run of '-' or '(' would take off the end
+// of the stack
+static const size_t MAX_NESTING = 256;
+
+static int infixBinding(TokenType type) {
+    switch (type) {
+        case TokenType::PLUS:
+        case TokenType::MINUS: return BIND_ADDITIVE;
+        case TokenType::STAR:
+        case TokenType::SLASH: return BIND_MULTIPLICATIVE;
+        case TokenType::CARET: return BIND_POWER;
+        case TokenType::BANG:  return BIND_POSTFIX;
+        default:               return 0;
+    }
+}
+
+// Constants addressable by LOAD_CONST
+static const double CONSTANTS[] = { M_PI, M_E };
+
+// Function names and the instruction each one compiles to
+struct FunctionEntry {
+    const char* name;
+    OpCode op;
+};
+
+static const FunctionEntry FUNCTIONS[] = {
+    {"sin", OpCode::SIN},
+    {"cos", OpCode::COS},
+    {"tan", OpCode::TAN},
+    {"log10", OpCode::LOG10},
+    {"log", OpCode::LOG10},
+    {"ln", OpCode::LN},
+    {"exp", OpCode::EXP},
+    {"sqrt", OpCode::SQRT}
+};
+
+// Program implementation
+double Program::run(const double* literals, const double* variable_values) const {
+    // Shallow programs (the common case) run on a fixed-size local stack
+    double local[64];
+    vector<double> spill;
+    double* stack = local;
+    if (stack_depth > 64) {
+        spill.resize(stack_depth);
+        stack = spill.data();
+    }
+    
+    size_t top = 0;
+    for (const Instruction& ins : code) {
+        switch (ins.op) {
+            case OpCode::LOAD_LITERAL: stack[top++] = literals[ins.operand]; break;
+            case OpCode::LOAD_CONST:   stack[top++] = CONSTANTS[ins.operand]; break;
+            case OpCode::LOAD_VAR:     stack[top++] = variable_values[ins.operand]; break;
+            case OpCode::ADD: top--; stack[top - 1] += stack[top]; break;
+            case OpCode::SUB: top--; stack[top - 1] -= stack[top]; break;
+            case OpCode::MUL: top--; stack[top - 1] *= stack[top]; break;
+            case OpCode::DIV: top--; stack[top - 1] = applyDivide(stack[top - 1], stack[top]); break;
+            case OpCode::POW: top--; stack[top - 1] = pow(stack[top - 1], stack[top]); break;
+            case OpCode::NEG:  stack[top - 1] = -stack[top - 1]; break;
+            case OpCode::FACT: stack[top - 1] = applyFactorial(stack[top - 1]); break;
+            case OpCode::SIN:  stack[top - 1] = BatchMath::sinDegrees(stack[top - 1]); break;
+            case OpCode::COS:  stack[top - 1] = BatchMath::cosDegrees(stack[top - 1]); break;
+            case OpCode::TAN:
+                stack[top - 1] = BatchMath::tanDegrees(stack[top - 1]);
+                if (std::isinf(stack[top - 1])) {
+                    throw runtime_error("Tangent undefined for this angle");
+                }
+                break;
+            case OpCode::LOG10:
+                if (stack[top - 1] <= 0) {
+                    throw runtime_error("Logarithm of non-positive number");
+                }
+                stack[top - 1] = std::log10(stack[top - 1]);
+                break;
+            case OpCode::LN:
+                if (stack[top - 1] <= 0) {
+                    throw runtime_error("Natural log of non-positive number");
+                }
+                stack[top - 1] = std::log(stack[top - 1]);
+                break;
+            case OpCode::EXP: stack[top - 1] = std::exp(stack[top - 1]); break;
+            case OpCode::SQRT:
+                if (stack[top - 1] < 0) {
+                    throw runtime_error("Square root of negative number");
+                }
+                stack[top - 1] = std::sqrt(stack[top - 1]);
+                break;
+        }
+    }
+    // A compiled program leaves exactly one value (empty expressions are
+    // rejected when compiling); anything else would be a compiler bug
+    if (top != 1) {
+        throw logic_error("Corrupt expression program");
+    }
+    return stack[0];
+}
+
+// Lane-wise factorial for column evaluation: NaN outside the domain
+static double laneFactorial(double n) {
+    if (n < 0 || n != floor(n) || n > 170) {
+        return NAN;
+    }
+    double result = 1.0;
+    for (int i = 2; i <= static_cast<int>(n); i++) {
+        result *= i;
+    }
+    return result;
+}
+
+size_t Program::runColumn(const double* literals, const double* variable_values,
+                          size_t column_variable, const double* inputs,
+                          double* outputs, size_t count) const {
+    const size_t BLOCK = 256;
+    vector<double> lanes(max<size_t>(stack_depth, 1) * BLOCK);
+    double angles[BLOCK];   // The batch trig kernels do not work in place
+    size_t failed = 0;
+    
+    for (size_t base = 0; base < count; base += BLOCK) {
+        size_t n = min(BLOCK, count - base);
+        size_t top = 0;
+        
+        for (const Instruction& ins : code) {
+            // Operand rows: a is the top of the stack for unary operations,
+            // a and b the two topmost rows for binary ones
+            bool binary = ins.op >= OpCode::ADD && ins.op <= OpCode::POW;
+            double* a = lanes.data() + (top > 0 ? top - (binary ? 2 : 1) : 0) * BLOCK;
+            double* b = a + BLOCK;
+            if (binary) {
+                top--;
+            }
+            
+            switch (ins.op) {
+                case OpCode::LOAD_LITERAL:
+                case OpCode::LOAD_CONST:
+                case OpCode::LOAD_VAR: {
+                    double* dst = lanes.data() + top * BLOCK;
+                    if (ins.op == OpCode::LOAD_VAR && ins.operand == column_variable) {
+                        copy(inputs + base, inputs + base + n, dst);
+                    } else {
+                        double value = ins.op == OpCode::LOAD_LITERAL ? literals[ins.operand]
+                                     : ins.op == OpCode::LOAD_CONST ? CONSTANTS[ins.operand]
+                                     : variable_values[ins.operand];
+                        fill(dst, dst + n, value);
+                    }
+                    top++;
+                    break;
+                }
+                case OpCode::ADD:
+                    for (size_t i = 0; i < n; i++) a[i] += b[i];
+                    break;
+                case OpCode::SUB:
+                    for (size_t i = 0; i < n; i++) a[i] -= b[i];
+                    break;
+                case OpCode::MUL:
+                    for (size_t i = 0; i < n; i++) a[i] *= b[i];
+                    break;
+                case OpCode::DIV:
+                    for (size_t i = 0; i < n; i++) a[i] = b[i] == 0 ? NAN : a[i] / b[i];
+                    break;
+                case OpCode::POW:
+                    for (size_t i = 0; i < n; i++) a[i] = b[i] == 2.0 ? a[i] * a[i] : pow(a[i], b[i]);
+                    break;
+                case OpCode::NEG:
+                    for (size_t i = 0; i < n; i++) a[i] = -a[i];
+                    break;
+                case OpCode::FACT:
+                    for (size_t i = 0; i < n; i++) a[i] = laneFactorial(a[i]);
+                    break;
+                case OpCode::SIN:
+                    copy(a, a + n, angles);
+                    BatchMath::sin(angles, a, nullptr, n);
+                    break;
+                case OpCode::COS:
+                    copy(a, a + n, angles);
+                    BatchMath::cos(angles, a, nullptr, n);
+                    break;
+                case OpCode::TAN:
+                    copy(a, a + n, angles);
+                    BatchMath::tan(angles, a, nullptr, n);
+                    break;
+                case OpCode::LOG10:
+                    for (size_t i = 0; i < n; i++) a[i] = a[i] <= 0 ? NAN : std::log10(a[i]);
+                    break;
+                case OpCode::LN:
+                    for (size_t i = 0; i < n; i++) a[i] = a[i] <= 0 ? NAN : std::log(a[i]);
+                    break;
+                case OpCode::EXP:
+                    for (size_t i = 0; i < n; i++) a[i] = std::exp(a[i]);
+                    break;
+                case OpCode::SQRT:
+                    for (size_t i = 0; i < n; i++) a[i] = a[i] < 0 ? NAN : std::sqrt(a[i]);
+                    break;
+            }
+        }
+        
+        const double* result = lanes.data();
+        for (size_t i = 0; i < n; i++) {
+            outputs[base + i] = result[i];
+            failed += std::isnan(result[i]) ? 1 : 0;
+        }
+    }
+    return failed;
+}
+
+void Program::bindVariables(const VariableTable& table, vector<double>& values) const {
+    values.resize(variables.size());
+    for (size_t i = 0; i < variables.size(); i++) {
+        auto found = table.find(variables[i]);
+        if (found == table.end()) {
+            throw runtime_error("Unknown variable: " + variables[i]);
+        }
+        values[i] = found->second;
+    }
+}
+
+// Build the shape key and collect the literal values in source order,
+// using the same tokenizer as the compiler so literal numbering agrees
+static void scanShape(string_view expression, string* key, vector<double>& literals) {
+    if (key != nullptr) {
+        key->clear();
+    }
+    literals.clear();
+    
+    Tokenizer tokenizer(expression);
+    bool previous_word = false;
+    while (true) {
+        Token token = tokenizer.next();
+        if (token.type == TokenType::END) {
+            break;
+        }
+        if (token.type == TokenType::NUMBER) {
+            literals.push_back(token.value);
+        }
+        if (key == nullptr) {
+            continue;
+        }
+        bool word = token.type == TokenType::NUMBER || token.type == TokenType::IDENTIFIER;
+        if (word && previous_word) {
+            *key += ' ';   // Keep "a b" distinct from "ab"
+        }
+        if (token.type == TokenType::NUMBER) {
+            *key += '#';
+        } else {
+            key->append(token.text.data(), token.text.size());
+        }
+        previous_word = word;
+    }
+}
+
+// ExpressionCompiler implementation
+ExpressionCompiler::ExpressionCompiler(string_view input)
+    : tokenizer(input), program(nullptr), depth(0), nesting(0) {
+}
+
+void ExpressionCompiler::advance() {
+    current = tokenizer.next();
+    if (current.type == TokenType::INVALID) {
+        throw runtime_error("Unexpected character '" + string(current.text) + "'");
+    }
+}
+
+void ExpressionCompiler::expect(TokenType type, const char* message) {
+    if (current.type != type) {
+        throw runtime_error(message);
+    }
+    advance();
+}
+
+// Append an instruction and track the stack depth it needs
+void ExpressionCompiler::emit(OpCode op, uint16_t operand) {
+    switch (op) {
+        case OpCode::LOAD_LITERAL:
+        case OpCode::LOAD_CONST:
+        case OpCode::LOAD_VAR:
+            depth++;
+            program->stack_depth = max(program->stack_depth, depth);
+            break;
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+        case OpCode::DIV:
+        case OpCode::POW:
+            depth--;
+            break;
+        default:
+            break;
+    }
+    program->code.push_back({op, operand});
+}
+
+Program ExpressionCompiler::compile() {
+    Program result;
+    program = &result;
+    depth = 0;
+    nesting = 0;
+    
+    advance();
+    if (current.type == TokenType::END) {
+        throw runtime_error("Empty expression");
+    }
+    parseExpression(0);
+    if (current.type != TokenType::END) {
+        throw runtime_error("Unexpected '" + string(current.text) + "'");
+    }
+    
+    program = nullptr;
+    return result;
+}
+
+void ExpressionCompiler::parseExpression(int min_binding) {
+    if (++nesting > MAX_NESTING) {
+        throw runtime_error("Expression too deeply nested");
+    }
+    parsePrefix();
+    
+    while (true) {
+        TokenType op = current.type;
+        int binding = infixBinding(op);
+        if (binding <= min_binding) {
+            break;
+        }
+        advance();
+        
+        switch (op) {
+            case TokenType::PLUS:  parseExpression(binding); emit(OpCode::ADD); break;
+            case TokenType::MINUS: parseExpression(binding); emit(OpCode::SUB); break;
+            case TokenType::STAR:  parseExpression(binding); emit(OpCode::MUL); break;
+            case TokenType::SLASH: parseExpression(binding); emit(OpCode::DIV); break;
+            // Right associative: the right operand may contain another '^'
+            case TokenType::CARET: parseExpression(binding - 1); emit(OpCode::POW); break;
+            case TokenType::BANG:  emit(OpCode::FACT); break;
+            default: break;
+        }
+    }
+    nesting--;
+}
+
+void ExpressionCompiler::parsePrefix() {
+    Token token = current;
+    
+    switch (token.type) {
+        case TokenType::NUMBER:
+            if (program->literal_count >= UINT16_MAX) {
+                throw runtime_error("Expression too long");
+            }
+            emit(OpCode::LOAD_LITERAL, static_cast<uint16_t>(program->literal_count++));
+            advance();
+            return;
+        case TokenType::MINUS:
+            advance();
+            parseExpression(BIND_UNARY);
+            emit(OpCode::NEG);
+            return;
+        case TokenType::PLUS:
+            advance();
+            parseExpression(BIND_UNARY);
+            return;
+        case TokenType::LPAREN:
+            advance();
+            parseExpression(0);
+            expect(TokenType::RPAREN, "Missing ')'");
+            return;
+        case TokenType::IDENTIFIER:
+            advance();
+            parseIdentifier(token.text);
+            return;
+        case TokenType::END:
+            throw runtime_error("Unexpected end of expression");
+        default:
+            throw runtime_error("Unexpected '" + string(token.text) + "'");
+    }
+}
+
+void ExpressionCompiler::parseIdentifier(string_view name) {
+    if (name == "pi") {
+        emit(OpCode::LOAD_CONST, 0);
+        return;
+    }
+    if (name == "e") {
+        emit(OpCode::LOAD_CONST, 1);
+        return;
+    }
+    
+    const FunctionEntry* function = nullptr;
+    for (const FunctionEntry& entry : FUNCTIONS) {
+        if (name == entry.name) {
+            function = &entry;
+            break;
+        }
+    }
+    if (function == nullptr) {
+        if (current.type == TokenType::LPAREN) {
+            throw runtime_error("Unknown function: " + string(name));
+        }
+        
+        // Any other name is a variable, bound when the program runs
+        auto& variables = program->variables;
+        size_t slot = find(variables.begin(), variables.end(), name) - variables.begin();
+        if (slot == variables.size()) {
+            if (slot >= UINT16_MAX) {
+                throw runtime_error("Expression too long");
+            }
+            variables.emplace_back(name);
+        }
+        emit(OpCode::LOAD_VAR, static_cast<uint16_t>(slot));
+        return;
+    }
+    
+    expect(TokenType::LPAREN, "Missing '(' after function name");
+    parseExpression(0);
+    expect(TokenType::RPAREN, "Missing ')' after function argument");
+    emit(function->op);
+}
+
+// ExpressionCache implementation
+ExpressionCache::ExpressionCache(size_t capacity)
+    : capacity(max<size_t>(capacity, 1)), hits(0), misses(0) {
+}
+
+// CompiledExpression implementation
+CompiledExpression::CompiledExpression(string_view text)
+    : text(text), program(ExpressionCompiler(text).compile()) {
+    scanShape(text, nullptr, literals);
+}
+
+double ExpressionCache::evaluate(string_view expression, const VariableTable& variables) {
+    scanShape(expression, &key_scratch, literal_scratch);
+    
+    auto found = index.find(string_view(key_scratch));
+    if (found != index.end()) {
+        hits++;
+        entries.splice(entries.begin(), entries, found->second);
+        const Program& program = found->second->program;
+        program.bindVariables(variables, variable_scratch);
+        return program.run(literal_scratch.data(), variable_scratch.data());
+    }
+    
+    // Cache the program before running it: a domain error depends on the
+    // literals, not on the shape
+    misses++;
+    Program program = ExpressionCompiler(expression).compile();
+    
+    if (entries.size() >= capacity) {
+        index.erase(string_view(entries.back().key));
+        entries.pop_back();
+    }
+    entries.push_front(Entry{key_scratch, std::move(program)});
+    index.emplace(string_view(entries.front().key), entries.begin());
+    
+    const Program& cached = entries.front().program;
+    cached.bindVariables(variables, variable_scratch);
+    return cached.run(literal_scratch.data(), variable_scratch.data());
+}
@@ -0,0 +1,179 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Token kinds produced by the expression tokenizer
+enum class TokenType {
+    NUMBER,
+    IDENTIFIER,
+    PLUS,
+    MINUS,
+    STAR,
+    SLASH,
+    CARET,
+    BANG,
+    LPAREN,
+    RPAREN,
+    END,
+    INVALID
+};
+
+// A token refers back into the source text, so tokenizing never allocates
+struct Token {
+    TokenType type;
+    std::string_view text;
+    double value;   // Only meaningful for NUMBER
+    
+    Token() : type(TokenType::END), value(0.0) {}
+    Token(TokenType type, std::string_view text, double value = 0.0)
+        : type(type), text(text), value(value) {}
+};
+
+// Single-pass tokenizer over a string_view
+class Tokenizer {
+private:
+    std::string_view input;
+    size_t pos;
+    
+public:
+    explicit Tokenizer(std::string_view input) : input(input), pos(0) {}
+    Token next();
+};
+
+// Stack machine instruction set
+enum class OpCode : uint8_t {
+    LOAD_LITERAL,   // Push literal #operand of the source text
+    LOAD_CONST,     // Push constant #operand (pi, e)
+    LOAD_VAR,       // Push the value bound to variable #operand
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    POW,
+    NEG,
+    FACT,
+    SIN,
+    COS,
+    TAN,
+    LOG10,
+    LN,
+    EXP,
+    SQRT
+};
+
+struct Instruction {
+    OpCode op;
+    uint16_t operand;
+};
+
+// Variable values by name
+typedef std::map<std::string, double> VariableTable;
+
+// Flat RPN program compiled from an expression. Numeric literals are not
+// baked in: they are numbered in source order and supplied at run time,
+// so one program serves every expression of the same shape. Variables
+// are numbered in order of first appearance.
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<std::string> variables;
+    size_t literal_count = 0;
+    size_t stack_depth = 0;
+    
+    // Throws std::runtime_error on a domain error (division by zero, ...)
+    double run(const double* literals, const double* variable_values) const;
+    
+    // Evaluate once per row with variable #column_variable bound to
+    // inputs[row]. The program is interpreted a block of rows at a time so
+    // each instruction becomes a tight loop. Rows hitting a domain error
+    // produce NaN instead of throwing; returns the number of NaN rows.
+    size_t runColumn(const double* literals, const double* variable_values,
+                     size_t column_variable, const double* inputs,
+                     double* outputs, size_t count) const;
+    
+    // Look up every variable of the program; throws if one is unbound
+    void bindVariables(const VariableTable& table, std::vector<double>& values) const;
+};
+
+// Pratt parser that compiles an infix expression into a Program.
+//
+// Grammar (lowest to highest binding):
+//   + -        left associative
+//   * /        left associative
+//   unary -    prefix
+//   ^          right associative, so -2^2 == -(2^2)
+//   !          postfix factorial
+// plus parentheses, the functions sin, cos, tan (degrees), log10/log,
+// ln, exp, sqrt, the constants pi and e, and variables (any other name).
+//
+// Syntax errors are reported as std::runtime_error.
+class ExpressionCompiler {
+private:
+    Tokenizer tokenizer;
+    Token current;
+    Program* program;
+    size_t depth;
+    size_t nesting;
+    
+    void advance();
+    void expect(TokenType type, const char* message);
+    void emit(OpCode op, uint16_t operand = 0);
+    void parseExpression(int min_binding);
+    void parsePrefix();
+    void parseIdentifier(std::string_view name);
+    
+public:
+    explicit ExpressionCompiler(std::string_view input);
+    Program compile();
+};
+
+// An expression compiled once with its own literals, ready to be
+// evaluated repeatedly against different variable bindings
+struct CompiledExpression {
+    std::string text;
+    Program program;
+    std::vector<double> literals;
+    
+    // Throws std::runtime_error on a syntax error
+    explicit CompiledExpression(std::string_view text);
+};
+
+// Bounded LRU cache of compiled programs keyed by the expression's shape:
+// its tokens with whitespace dropped and every number replaced by '#'.
+// A hit only needs the lexical scan that extracts the literals; parsing
+// and compilation are skipped.
+class ExpressionCache {
+private:
+    struct Entry {
+        std::string key;
+        Program program;
+    };
+    
+    size_t capacity;
+    std::list<Entry> entries;   // Most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+    uint64_t hits;
+    uint64_t misses;
+    
+    // Reused between calls so a warm evaluation does not allocate
+    std::string key_scratch;
+    std::vector<double> literal_scratch;
+    std::vector<double> variable_scratch;
+    
+public:
+    explicit ExpressionCache(size_t capacity = 1024);
+    
+    double evaluate(std::string_view expression, const VariableTable& variables);
+    
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+    size_t size() const { return entries.size(); }
+};
+
+#endif // EXPRESSION_H
@@ -0,0 +1,214 @@
+#include "history.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+// HistoryEntry implementation
+HistoryEntry::HistoryEntry(int64_t timestamp_ns, Operation operation, double a, double b,
+                           double result, string_view text)
+    : timestamp_ns(timestamp_ns), result(result), operands{a, b}, operation(operation),
+      text_length(0), text{} {
+    if (text.size() > TEXT_CAPACITY) {
+        // The rest is kept by whoever stores the entry
+        memcpy(this->text, text.data(), TEXT_CAPACITY);
+        text_length = TEXT_CAPACITY | TEXT_CONTINUES;
+    } else if (!text.empty()) {
+        memcpy(this->text, text.data(), text.size());
+        text_length = static_cast<uint8_t>(text.size());
+    }
+}
+
+int64_t historyTimestamp() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// HistoryView implementation
+const HistoryEntry& HistoryView::operator[](size_t index) const {
+    return (*buffer)[first + index];
+}
+
+string_view HistoryView::text(size_t index) const {
+    return buffer->text((*this)[index]);
+}
+
+// HistoryBuffer implementation
+HistoryBuffer::HistoryBuffer(size_t capacity)
+    : entries(capacity > 0 ? capacity : 1), head(0), count(0), pushed(0),
+      blocks(entries.size() / BLOCK_SIZE + 2), ordered(true),
+      last_timestamp(numeric_limits<int64_t>::min()) {}
+
+void HistoryBuffer::push(const HistoryEntry& entry, string_view text) {
+    size_t slot = head + count;
+    if (slot >= entries.size()) {
+        slot -= entries.size();
+    }
+    entries[slot] = entry;
+    if (entry.textContinues() && text.size() > HistoryEntry::TEXT_CAPACITY) {
+        if (long_texts.empty()) {
+            long_texts.resize(entries.size());
+        }
+        long_texts[slot].assign(text.data(), text.size());
+    } else if (!long_texts.empty() && !long_texts[slot].empty()) {
+        string().swap(long_texts[slot]);
+    }
+    
+    if (count < entries.size()) {
+        count++;
+    } else if (++head == entries.size()) {
+        head = 0;
+    }
+    
+    uint64_t number = pushed / BLOCK_SIZE;
+    Block& summary = blocks[number % blocks.size()];
+    if (pushed % BLOCK_SIZE == 0) {
+        summary = {numeric_limits<int64_t>::max(), numeric_limits<int64_t>::min(),
+                   HUGE_VAL, -HUGE_VAL, 0};
+        // Forget blocks that have left the ring
+        uint64_t oldest = (pushed + 1 - count) / BLOCK_SIZE;
+        for (auto& list : operation_blocks) {
+            while (!list.empty() && list.front() < oldest) {
+                list.pop_front();
+            }
+        }
+    }
+    summary.min_timestamp = min(summary.min_timestamp, entry.timestamp_ns);
+    summary.max_timestamp = max(summary.max_timestamp, entry.timestamp_ns);
+    if (entry.result < summary.min_result) summary.min_result = entry.result;
+    if (entry.result > summary.max_result) summary.max_result = entry.result;
+    
+    uint32_t bit = 1u << static_cast<size_t>(entry.operation);
+    if ((summary.operations & bit) == 0) {
+        summary.operations |= bit;
+        operation_blocks[static_cast<size_t>(entry.operation)].push_back(number);
+    }
+    
+    ordered = ordered && entry.timestamp_ns >= last_timestamp;
+    last_timestamp = entry.timestamp_ns;
+    pushed++;
+}
+
+// The next entry starts a fresh block
+void HistoryBuffer::clear() {
+    head = 0;
+    count = 0;
+    long_texts.clear();
+    pushed = (pushed + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    for (auto& list : operation_blocks) {
+        list.clear();
+    }
+    ordered = true;
+    last_timestamp = numeric_limits<int64_t>::min();
+}
+
+string_view HistoryBuffer::text(const HistoryEntry& entry) const {
+    if (entry.textContinues() && !long_texts.empty()) {
+        const string& text = long_texts[&entry - entries.data()];
+        if (!text.empty()) {
+            return text;
+        }
+    }
+    return entry.getText();
+}
+
+HistoryView HistoryBuffer::newest(size_t limit) const {
+    size_t n = (limit == 0 || limit > count) ? count : limit;
+    return HistoryView(this, count - n, n);
+}
+
+static bool hasResultBounds(const HistoryQuery& query) {
+    return query.min_result > -HUGE_VAL || query.max_result < HUGE_VAL;
+}
+
+// Newest first, so a limited query can stop early
+void HistoryBuffer::scanBlock(uint64_t number, const HistoryQuery& query,
+                              vector<const HistoryEntry*>& matches) const {
+    const Block& summary = block(number);
+    bool by_result = hasResultBounds(query);
+    if (summary.max_timestamp < query.from_ns || summary.min_timestamp > query.to_ns ||
+        (by_result && (summary.max_result < query.min_result ||
+                       summary.min_result > query.max_result)) ||
+        (query.operations != 0 && (summary.operations & query.operations) == 0)) {
+        return;
+    }
+    
+    uint64_t oldest = pushed - count;
+    uint64_t begin = max<uint64_t>(number * BLOCK_SIZE, oldest);
+    uint64_t end = min<uint64_t>((number + 1) * BLOCK_SIZE, pushed);
+    for (uint64_t sequence = end; sequence-- > begin;) {
+        const HistoryEntry& entry = (*this)[sequence - oldest];
+        if (entry.timestamp_ns < query.from_ns || entry.timestamp_ns > query.to_ns ||
+            (by_result && !(entry.result >= query.min_result &&
+                            entry.result <= query.max_result)) ||
+            (query.operations != 0 &&
+             (query.operations & (1u << static_cast<size_t>(entry.operation))) == 0)) {
+            continue;
+        }
+        matches.push_back(&entry);
+        if (matches.size() == query.limit) {
+            return;
+        }
+    }
+}
+
+void HistoryBuffer::query(const HistoryQuery& query, vector<const HistoryEntry*>& matches) const {
+    matches.clear();
+    if (count == 0) {
+        return;
+    }
+    
+    uint64_t first_block = (pushed - count) / BLOCK_SIZE;
+    uint64_t last_block = (pushed - 1) / BLOCK_SIZE;
+    if (ordered) {
+        // Drop the blocks that start after to_ns
+        uint64_t low = first_block;
+        uint64_t high = last_block + 1;
+        while (low < high) {
+            uint64_t middle = low + (high - low) / 2;
+            if (block(middle).min_timestamp > query.to_ns) {
+                high = middle;
+            } else {
+                low = middle + 1;
+            }
+        }
+        if (low == first_block) {
+            return;
+        }
+        last_block = low - 1;
+    }
+    
+    auto done = [&] { return query.limit != 0 && matches.size() >= query.limit; };
+    // Blocks before from_ns end the walk once timestamps are ordered
+    auto beforeRange = [&](uint64_t number) {
+        return ordered && block(number).max_timestamp < query.from_ns;
+    };
+    
+    bool single_operation = query.operations != 0 &&
+                            (query.operations & (query.operations - 1)) == 0;
+    if (single_operation) {
+        size_t operation = 0;
+        while ((query.operations & (1u << operation)) == 0) {
+            operation++;
+        }
+        const auto& list = operation_blocks[operation];
+        auto it = upper_bound(list.begin(), list.end(), last_block);
+        while (it != list.begin() && !done()) {
+            --it;
+            if (*it < first_block || beforeRange(*it)) {
+                break;
+            }
+            scanBlock(*it, query, matches);
+        }
+    } else {
+        for (uint64_t number = last_block + 1; number-- > first_block && !done();) {
+            if (beforeRange(number)) {
+                break;
+            }
+            scanBlock(number, query, matches);
+        }
+    }
+    
+    reverse(matches.begin(), matches.end());
+}
@@ -0,0 +1,194 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Operation a result or history entry was produced by
+enum class Operation : uint8_t {
+    EXPRESSION,     // Free-form; the text is stored alongside
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    MODULUS,
+    POWER,
+    SQUARE_ROOT,
+    SINE,
+    COSINE,
+    TANGENT,
+    LOG10,
+    NATURAL_LOG,
+    EXPONENTIAL,
+    FACTORIAL,
+    MEMORY_ADD,
+    MEMORY_SUBTRACT,
+    MEMORY_RECALL,
+    MEMORY_CLEAR,
+    PERCENTAGE,
+    NEGATE,
+    RECIPROCAL
+};
+
+const size_t OPERATION_COUNT = static_cast<size_t>(Operation::RECIPROCAL) + 1;
+
+// One calculation in history, exactly one cache line. Fixed operations
+// keep their operands and are formatted on demand; evaluated expressions
+// keep their text. A text longer than TEXT_CAPACITY bytes keeps its start
+// here and is flagged TEXT_CONTINUES: HistoryBuffer holds the whole of it
+// out of line, and the history log in TEXT_CONTINUATION entries written
+// right behind this one.
+struct HistoryEntry {
+    static const size_t TEXT_CAPACITY = 30;
+    // Longer texts are cut to this many bytes, the last three "..."
+    static const size_t MAX_TEXT_LENGTH = 4096;
+    
+    // Flags in text_length, above the length of the inline text
+    static const uint8_t TEXT_LENGTH_MASK = 0x1F;
+    static const uint8_t TEXT_CONTINUATION = 0x40;  // Only text of the entry before
+    static const uint8_t TEXT_CONTINUES = 0x80;     // The text goes on after this
+    
+    int64_t timestamp_ns;       // Nanoseconds since the Unix epoch
+    double result;
+    double operands[2];
+    Operation operation;
+    uint8_t text_length;        // Inline bytes, and the TEXT_* flags
+    char text[TEXT_CAPACITY];
+    
+    HistoryEntry() : timestamp_ns(0), result(0.0), operands{0.0, 0.0},
+                     operation(Operation::EXPRESSION), text_length(0), text{} {}
+    HistoryEntry(int64_t timestamp_ns, Operation operation, double a, double b,
+                 double result, std::string_view text = std::string_view());
+    
+    // The inline text: all of it, or the start of a TEXT_CONTINUES one
+    std::string_view getText() const {
+        return std::string_view(text, text_length & TEXT_LENGTH_MASK);
+    }
+    bool textContinues() const { return (text_length & TEXT_CONTINUES) != 0; }
+    bool isContinuation() const { return (text_length & TEXT_CONTINUATION) != 0; }
+};
+
+static_assert(sizeof(HistoryEntry) == 64, "HistoryEntry should fill one cache line");
+
+// Current time in the unit of HistoryEntry::timestamp_ns
+int64_t historyTimestamp();
+
+class HistoryBuffer;
+
+// Read-only window over consecutive entries of a HistoryBuffer, oldest
+// first. A view does not copy; it is invalidated by the next push.
+class HistoryView {
+private:
+    const HistoryBuffer* buffer;
+    size_t first;
+    size_t count;
+    
+public:
+    class const_iterator {
+    private:
+        const HistoryView* view;
+        size_t index;
+    
+    public:
+        const_iterator(const HistoryView* view, size_t index) : view(view), index(index) {}
+        const HistoryEntry& operator*() const { return (*view)[index]; }
+        const HistoryEntry* operator->() const { return &(*view)[index]; }
+        const_iterator& operator++() { ++index; return *this; }
+        bool operator==(const const_iterator& other) const { return index == other.index; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+    };
+    
+    HistoryView(const HistoryBuffer* buffer, size_t first, size_t count)
+        : buffer(buffer), first(first), count(count) {}
+    
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const HistoryEntry& operator[](size_t index) const;
+    // The whole text of entry #index
+    std::string_view text(size_t index) const;
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+};
+
+// Filter for HistoryBuffer::query. Bounds are inclusive.
+struct HistoryQuery {
+    int64_t from_ns = std::numeric_limits<int64_t>::min();
+    int64_t to_ns = std::numeric_limits<int64_t>::max();
+    double min_result = -HUGE_VAL;
+    double max_result = HUGE_VAL;
+    uint32_t operations = 0;    // Bit (1 << Operation) per wanted operation, 0 = any
+    size_t limit = 0;           // Keep only the newest `limit` matches, 0 = all
+};
+
+// Fixed-capacity ring of history entries. Appending is O(1); once full,
+// each new entry overwrites the oldest one.
+//
+// Entries are also indexed for queries, in arrival order, by blocks of
+// BLOCK_SIZE: every block keeps the min/max of its timestamps and results
+// and the set of operations in it (a zone map), and every operation keeps
+// the list of blocks it occurs in. A query only scans the blocks whose
+// summary can match, and binary searches the time range while timestamps
+// arrive in order.
+class HistoryBuffer {
+public:
+    static const size_t BLOCK_SIZE = 1024;
+    
+private:
+    struct Block {
+        int64_t min_timestamp;
+        int64_t max_timestamp;
+        double min_result;
+        double max_result;
+        uint32_t operations;
+    };
+    
+    std::vector<HistoryEntry> entries;
+    std::vector<std::string> long_texts;    // By slot, once a text is too long to inline
+    size_t head;            // Slot of the oldest entry
+    size_t count;
+    uint64_t pushed;        // Sequence number of the next entry
+    
+    std::vector<Block> blocks;      // Block b lives at b % blocks.size()
+    std::deque<uint64_t> operation_blocks[OPERATION_COUNT];
+    bool ordered;           // Timestamps never went backwards
+    int64_t last_timestamp;
+    
+    const Block& block(uint64_t number) const { return blocks[number % blocks.size()]; }
+    void scanBlock(uint64_t number, const HistoryQuery& query,
+                   std::vector<const HistoryEntry*>& matches) const;
+    
+public:
+    explicit HistoryBuffer(size_t capacity);
+    
+    // `text` is the whole text of a TEXT_CONTINUES entry; without it only
+    // the inline start is kept
+    void push(const HistoryEntry& entry, std::string_view text = std::string_view());
+    void clear();
+    
+    size_t size() const { return count; }
+    size_t capacity() const { return entries.size(); }
+    
+    // index 0 is the oldest entry
+    const HistoryEntry& operator[](size_t index) const {
+        size_t slot = head + index;
+        return entries[slot < entries.size() ? slot : slot - entries.size()];
+    }
+    
+    // The whole text of one of the entries held here
+    std::string_view text(const HistoryEntry& entry) const;
+    
+    // The newest `limit` entries (all of them for limit 0)
+    HistoryView newest(size_t limit = 0) const;
+    
+    // Entries matching the query, oldest first. The pointers are
+    // invalidated by the next push.
+    void query(const HistoryQuery& query, std::vector<const HistoryEntry*>& matches) const;
+};
+
+#endif // HISTORY_H
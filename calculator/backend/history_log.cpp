@@ -0,0 +1,838 @@
+#include "history_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char LOG_MAGIC[8] = {'C', 'A', 'L', 'C', 'H', 'L', 'O', 'G'};
+static const uint32_t LOG_VERSION = 1;
+static const uint32_t RECORD_MARKER = 0x48524543;   // "CERH"
+
+struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t first_sequence;    // Sequence number of the first record
+    uint8_t reserved[40];
+};
+
+struct LogRecord {
+    HistoryEntry entry;
+    uint32_t marker;
+    uint32_t checksum;      // CRC-32C of entry and marker
+};
+
+static_assert(sizeof(LogHeader) == 64, "Unexpected LogHeader layout");
+static_assert(sizeof(LogRecord) == 72, "Unexpected LogRecord layout");
+
+// CRC-32C (Castagnoli), byte-at-a-time table
+struct Crc32cTable {
+    uint32_t values[256] = {};
+    
+    constexpr Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+            }
+            values[i] = crc;
+        }
+    }
+};
+
+static constexpr Crc32cTable CRC32C_TABLE;
+
+static uint32_t crc32c(const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) {
+        crc = CRC32C_TABLE.values[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static LogHeader makeHeader(uint64_t first_sequence) {
+    LogHeader header = {};
+    memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    header.version = LOG_VERSION;
+    header.record_size = sizeof(LogRecord);
+    header.first_sequence = first_sequence;
+    return header;
+}
+
+static LogRecord makeRecord(const HistoryEntry& entry) {
+    LogRecord record;
+    record.entry = entry;
+    record.marker = RECORD_MARKER;
+    record.checksum = crc32c(&record, offsetof(LogRecord, checksum));
+    return record;
+}
+
+static bool isValid(const LogRecord& record) {
+    return record.marker == RECORD_MARKER &&
+           record.checksum == crc32c(&record, offsetof(LogRecord, checksum));
+}
+
+static uint64_t recordOffset(uint64_t index) {
+    return sizeof(LogHeader) + index * sizeof(LogRecord);
+}
+
+// Thin portable wrappers over the file API
+#ifdef _WIN32
+static int openFile(const string& file_path, bool truncate) {
+    int flags = _O_RDWR | _O_CREAT | _O_BINARY | (truncate ? _O_TRUNC : 0);
+    return _open(file_path.c_str(), flags, _S_IREAD | _S_IWRITE);
+}
+
+static int64_t fileSize(int fd) {
+    return _filelengthi64(fd);
+}
+
+static bool readAt(int fd, void* buffer, size_t size, uint64_t offset) {
+    if (_lseeki64(fd, offset, SEEK_SET) < 0) return false;
+    return _read(fd, buffer, static_cast<unsigned>(size)) == static_cast<int>(size);
+}
+
+static bool writeAll(int fd, const void* buffer, size_t size) {
+    if (_lseeki64(fd, 0, SEEK_END) < 0) return false;
+    return _write(fd, buffer, static_cast<unsigned>(size)) == static_cast<int>(size);
+}
+
+static bool syncFile(int fd) { return _commit(fd) == 0; }
+static bool truncateFile(int fd, uint64_t size) { return _chsize_s(fd, size) == 0; }
+static bool seekTo(int fd, uint64_t offset) { return _lseeki64(fd, offset, SEEK_SET) >= 0; }
+static void closeFile(int fd) { _close(fd); }
+static int duplicateFile(int fd) { return _dup(fd); }
+static void syncDirectory(const string&) {}
+
+static bool replaceFile(const string& from, const string& to) {
+    remove(to.c_str());
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+#else
+static int openFile(const string& file_path, bool truncate) {
+    int flags = O_RDWR | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+    return ::open(file_path.c_str(), flags, 0644);
+}
+
+static int64_t fileSize(int fd) {
+    struct stat info;
+    return fstat(fd, &info) == 0 ? info.st_size : -1;
+}
+
+static bool readAt(int fd, void* buffer, size_t size, uint64_t offset) {
+    char* cursor = static_cast<char*>(buffer);
+    while (size > 0) {
+        ssize_t n = pread(fd, cursor, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        cursor += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Every descriptor is positioned at the end of its file, so plain writes
+// append
+static bool writeAll(int fd, const void* buffer, size_t size) {
+    const char* cursor = static_cast<const char*>(buffer);
+    while (size > 0) {
+        ssize_t n = ::write(fd, cursor, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        cursor += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool syncFile(int fd) { return fdatasync(fd) == 0; }
+static bool truncateFile(int fd, uint64_t size) { return ftruncate(fd, size) == 0; }
+static bool seekTo(int fd, uint64_t offset) { return lseek(fd, offset, SEEK_SET) >= 0; }
+static void closeFile(int fd) { ::close(fd); }
+static int duplicateFile(int fd) { return fcntl(fd, F_DUPFD_CLOEXEC, 0); }
+
+// Make a rename durable
+static void syncDirectory(const string& file_path) {
+    size_t slash = file_path.find_last_of('/');
+    string directory = slash == string::npos ? "." : file_path.substr(0, slash + 1);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+static bool replaceFile(const string& from, const string& to) {
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+// An entry followed by the continuations that carry the rest of its text
+static void appendWithText(vector<HistoryEntry>& out, const HistoryEntry& entry,
+                           string_view text) {
+    out.push_back(entry);
+    if (!entry.textContinues()) {
+        return;
+    }
+    for (size_t offset = HistoryEntry::TEXT_CAPACITY; offset < text.size();
+         offset += HistoryEntry::TEXT_CAPACITY) {
+        HistoryEntry continuation(entry.timestamp_ns, Operation::EXPRESSION, 0.0, 0.0, 0.0,
+                                  text.substr(offset, HistoryEntry::TEXT_CAPACITY));
+        continuation.text_length |= HistoryEntry::TEXT_CONTINUATION;
+        if (offset + HistoryEntry::TEXT_CAPACITY < text.size()) {
+            continuation.text_length |= HistoryEntry::TEXT_CONTINUES;
+        }
+        out.push_back(continuation);
+    }
+}
+
+// Hand visit(entry, text) every entry of records[begin, end), its text put
+// back together from the continuations behind it. Continuations without
+// their entry (left at the front by compaction) are skipped; an entry
+// whose continuations are missing only keeps its inline text. Returns the
+// number of damaged records.
+template <typename Visit>
+static uint64_t decodeRecords(const LogRecord* records, uint64_t begin, uint64_t end,
+                              string& text, Visit visit) {
+    uint64_t damaged = 0;
+    for (uint64_t i = begin; i < end; i++) {
+        if (!isValid(records[i])) {
+            damaged++;
+            continue;
+        }
+        const HistoryEntry& entry = records[i].entry;
+        if (entry.isContinuation()) {
+            continue;
+        }
+        text.assign(entry.getText().data(), entry.getText().size());
+        bool complete = !entry.textContinues();
+        for (uint64_t next = i + 1; !complete && next < end && isValid(records[next]) &&
+                                    records[next].entry.isContinuation(); next++) {
+            string_view part = records[next].entry.getText();
+            text.append(part.data(), part.size());
+            complete = !records[next].entry.textContinues();
+        }
+        if (!complete) {
+            text.resize(entry.getText().size());
+        }
+        visit(entry, text);
+    }
+    return damaged;
+}
+
+// Encode entries into records a chunk at a time
+static bool writeRecords(int fd, const HistoryView& entries, vector<LogRecord>& chunk,
+                         uint64_t& written) {
+    vector<HistoryEntry> run;
+    for (size_t i = 0; i < entries.size(); i++) {
+        run.clear();
+        appendWithText(run, entries[i], entries.text(i));
+        for (const HistoryEntry& entry : run) {
+            chunk.push_back(makeRecord(entry));
+            if (chunk.size() == chunk.capacity()) {
+                if (!writeAll(fd, chunk.data(), chunk.size() * sizeof(LogRecord))) {
+                    return false;
+                }
+                written += chunk.size();
+                chunk.clear();
+            }
+        }
+    }
+    if (!chunk.empty()) {
+        if (!writeAll(fd, chunk.data(), chunk.size() * sizeof(LogRecord))) {
+            return false;
+        }
+        written += chunk.size();
+        chunk.clear();
+    }
+    return true;
+}
+
+// HistoryQueue implementation
+static size_t roundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+HistoryQueue::HistoryQueue(size_t capacity)
+    : cells(new Cell[roundUpToPowerOfTwo(max<size_t>(capacity, 2))]),
+      mask(roundUpToPowerOfTwo(max<size_t>(capacity, 2)) - 1), tail(0), head(0) {
+    for (size_t i = 0; i <= mask; i++) {
+        cells[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+// A cell is free for position p when its sequence is p, and holds the
+// entry for p when its sequence is p + 1. The consumer frees cells in
+// order, so a run of positions is free once its last cell is.
+bool HistoryQueue::push(const HistoryEntry* entries, size_t count) {
+    if (count == 0 || count > capacity()) {
+        return count == 0;
+    }
+    uint64_t position = tail.load(memory_order_relaxed);
+    while (true) {
+        uint64_t last = position + count - 1;
+        uint64_t sequence = cells[last & mask].sequence.load(memory_order_acquire);
+        int64_t difference = static_cast<int64_t>(sequence - last);
+        if (difference == 0) {
+            if (tail.compare_exchange_weak(position, position + count, memory_order_relaxed)) {
+                for (size_t i = 0; i < count; i++) {
+                    Cell& cell = cells[(position + i) & mask];
+                    cell.entry = entries[i];
+                    cell.sequence.store(position + i + 1, memory_order_release);
+                }
+                return true;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            position = tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+bool HistoryQueue::pop(HistoryEntry& entry) {
+    uint64_t position = head.load(memory_order_relaxed);
+    Cell& cell = cells[position & mask];
+    if (cell.sequence.load(memory_order_acquire) != position + 1) {
+        return false;
+    }
+    entry = cell.entry;
+    cell.sequence.store(position + mask + 1, memory_order_release);
+    head.store(position + 1, memory_order_relaxed);
+    return true;
+}
+
+size_t HistoryQueue::depth() const {
+    uint64_t consumed = head.load(memory_order_relaxed);
+    uint64_t claimed = tail.load(memory_order_relaxed);
+    return claimed > consumed ? claimed - consumed : 0;
+}
+
+// HistoryLog implementation
+HistoryLog::HistoryLog(const HistoryLogOptions& options)
+    : fd(-1), options(options), records(0), first_sequence(0), dropped(0),
+      generation(0), compacting(false), queue(options.queue_capacity), stopping(false),
+      flush_requested(0), flush_completed(0), sync_requested(false), sync_ok(true),
+      max_queue_depth(0), queue_stalls(0), flushes(0), records_written(0), syncs(0),
+      last_flush_us(0), max_flush_us(0), total_flush_us(0) {
+    this->options.retention = max<size_t>(options.retention, 1);
+    this->options.flush_records = max<size_t>(options.flush_records, 1);
+}
+
+HistoryLog::~HistoryLog() {
+    close();
+}
+
+HistoryLog::OpenResult HistoryLog::open(const string& file_path, HistoryBuffer& history) {
+    close();
+    path = file_path;
+    records = 0;
+    first_sequence = 0;
+    dropped = 0;
+    
+    int file = openFile(path, false);
+    if (file < 0) {
+        cerr << "History log: cannot open " << path << ": " << strerror(errno) << endl;
+        return OpenResult::FAILED;
+    }
+    
+    int64_t size = fileSize(file);
+    if (size == 0) {
+        LogHeader header = makeHeader(0);
+        if (!writeAll(file, &header, sizeof(header))) {
+            closeFile(file);
+            return OpenResult::FAILED;
+        }
+        fd = file;
+        startWriter();
+        return OpenResult::OPENED;
+    }
+    
+    LogHeader header;
+    if (size < static_cast<int64_t>(sizeof(header)) || !readAt(file, &header, sizeof(header), 0) ||
+        memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 ||
+        header.version != LOG_VERSION || header.record_size != sizeof(LogRecord)) {
+        closeFile(file);
+        return OpenResult::NOT_A_LOG;
+    }
+    first_sequence = header.first_sequence;
+    
+    uint64_t count = (size - sizeof(LogHeader)) / sizeof(LogRecord);
+    uint64_t first = count > history.capacity() ? count - history.capacity() : 0;
+    
+    // Only the records that fit in memory are read
+    const LogRecord* mapped = nullptr;
+#ifdef _WIN32
+    vector<LogRecord> buffer(count - first);
+    if (!buffer.empty() && !readAt(file, buffer.data(), buffer.size() * sizeof(LogRecord),
+                                   recordOffset(first))) {
+        closeFile(file);
+        return OpenResult::FAILED;
+    }
+    mapped = buffer.data() - first;
+#else
+    void* mapping = MAP_FAILED;
+    if (count > 0) {
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping == MAP_FAILED) {
+            cerr << "History log: cannot map " << path << ": " << strerror(errno) << endl;
+            closeFile(file);
+            return OpenResult::FAILED;
+        }
+        madvise(static_cast<char*>(mapping) + recordOffset(first) / 4096 * 4096,
+                recordOffset(count) - recordOffset(first) / 4096 * 4096, MADV_SEQUENTIAL);
+        mapped = reinterpret_cast<const LogRecord*>(static_cast<char*>(mapping) + sizeof(LogHeader));
+    }
+#endif
+    
+    // A crash can only tear the end of the log: drop invalid records there
+    // for good, and skip (but keep) any damaged record before them
+    uint64_t valid = count;
+    while (valid > first && !isValid(mapped[valid - 1])) {
+        valid--;
+    }
+    string text;
+    dropped = decodeRecords(mapped, first, valid, text,
+                            [&](const HistoryEntry& entry, const string& text) {
+        history.push(entry, text);
+    });
+    
+#ifndef _WIN32
+    if (mapping != MAP_FAILED) {
+        munmap(mapping, size);
+    }
+#endif
+    
+    if (static_cast<uint64_t>(size) != recordOffset(valid)) {
+        cerr << "History log: discarding " << size - recordOffset(valid)
+             << " bytes of incomplete records at the end of " << path << endl;
+        truncateFile(file, recordOffset(valid));
+    }
+    if (dropped > 0) {
+        cerr << "History log: skipped " << dropped << " corrupt records in " << path << endl;
+    }
+    
+#ifndef _WIN32
+    lseek(file, 0, SEEK_END);
+#endif
+    fd = file;
+    records = valid;
+    maybeCompact();
+    startWriter();
+    return OpenResult::OPENED;
+}
+
+void HistoryLog::close() {
+    stopWriter();
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    if (fd >= 0) {
+        closeFile(fd);
+        fd = -1;
+    }
+}
+
+void HistoryLog::append(const HistoryEntry& entry, string_view text) {
+    if (!writer.joinable()) return;
+    
+    // A long text goes in with its entry, as one run
+    const HistoryEntry* run = &entry;
+    size_t count = 1;
+    static thread_local vector<HistoryEntry> with_text;
+    if (entry.textContinues()) {
+        with_text.clear();
+        appendWithText(with_text, entry, text);
+        if (with_text.size() <= queue.capacity()) {
+            run = with_text.data();
+            count = with_text.size();
+        }
+    }
+    
+    if (!queue.push(run, count)) {
+        // Full: make sure the writer is draining and wait for room
+        queue_stalls.fetch_add(1, memory_order_relaxed);
+        writer_wake.notify_one();
+        while (!queue.push(run, count)) {
+            this_thread::yield();
+        }
+    }
+    if (queue.depth() >= options.flush_records &&
+        queue.depth() < options.flush_records + count) {
+        writer_wake.notify_one();
+    }
+}
+
+void HistoryLog::append(const HistoryView& entries) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        append(entries[i], entries.text(i));
+    }
+}
+
+bool HistoryLog::sync() {
+    return flush(true);
+}
+
+// Have the writer commit everything queued so far, and wait for it
+bool HistoryLog::flush(bool sync) {
+    if (!writer.joinable()) {
+        return fd >= 0 && (!sync || syncFile(fd));
+    }
+    
+    unique_lock<mutex> lock(writer_mutex);
+    uint64_t ticket = ++flush_requested;
+    sync_requested = sync_requested || sync;
+    writer_wake.notify_one();
+    flush_done.wait(lock, [&] { return flush_completed >= ticket; });
+    return sync_ok;
+}
+
+// Write header + entries to a new file next to the log, then atomically
+// move it into place
+bool HistoryLog::rewrite(const HistoryView& entries) {
+    if (path.empty()) return false;
+    // Queued entries are part of `entries` already; keep them out of the
+    // new file
+    flush(false);
+    
+    // Sequence numbers carry on from the old file so export cursors stay
+    // valid
+    uint64_t end_sequence;
+    {
+        lock_guard<mutex> lock(file_mutex);
+        end_sequence = first_sequence + records;
+    }
+    
+    string temp_path = path + ".tmp";
+    int temp = openFile(temp_path, true);
+    if (temp < 0) {
+        return false;
+    }
+    
+    LogHeader header = makeHeader(end_sequence);
+    vector<LogRecord> chunk;
+    chunk.reserve(4096);
+    uint64_t written = 0;
+    bool ok = writeAll(temp, &header, sizeof(header)) &&
+              writeRecords(temp, entries, chunk, written);
+    
+    lock_guard<mutex> lock(file_mutex);
+    if (!ok || !syncFile(temp) || !replaceFile(temp_path, path)) {
+        cerr << "History log: rewrite of " << path << " failed: " << strerror(errno) << endl;
+        closeFile(temp);
+        remove(temp_path.c_str());
+        return false;
+    }
+    syncDirectory(path);
+    if (fd >= 0) {
+        closeFile(fd);
+    }
+    fd = temp;
+    first_sequence = end_sequence;
+    records = written;
+    generation++;
+    if (!writer.joinable()) {
+        startWriter();
+    }
+    return true;
+}
+
+void HistoryLog::flush() {
+    flush(false);
+}
+
+size_t HistoryLog::read(uint64_t& sequence, size_t max_count, vector<HistoryEntry>& entries,
+                        vector<string>* texts) {
+    entries.clear();
+    if (texts) {
+        texts->clear();
+    }
+    lock_guard<mutex> lock(file_mutex);
+    if (fd < 0) {
+        return 0;
+    }
+    
+    // Records compacted away are skipped
+    sequence = max(sequence, first_sequence);
+    uint64_t index = min<uint64_t>(sequence - first_sequence, records);
+    size_t count = static_cast<size_t>(min<uint64_t>(max_count, records - index));
+    
+    vector<LogRecord> chunk(count);
+    if (count > 0 && !readAt(fd, chunk.data(), count * sizeof(LogRecord), recordOffset(index))) {
+        cerr << "History log: read failed: " << strerror(errno) << endl;
+        return 0;
+    }
+    // Take in the rest of a text that runs past the chunk
+    while (count > 0 && index + count < records && isValid(chunk.back()) &&
+           chunk.back().entry.textContinues()) {
+        LogRecord record;
+        if (!readAt(fd, &record, sizeof(record), recordOffset(index + count))) {
+            break;
+        }
+        chunk.push_back(record);
+        count++;
+    }
+    
+    string text;
+    decodeRecords(chunk.data(), 0, count, text, [&](const HistoryEntry& entry, const string& text) {
+        entries.push_back(entry);
+        if (texts) {
+            texts->push_back(text);
+        }
+    });
+    sequence = first_sequence + index + count;
+    return count;
+}
+
+HistoryWriterMetrics HistoryLog::getMetrics() const {
+    HistoryWriterMetrics metrics;
+    metrics.queue_depth = queue.depth();
+    metrics.max_queue_depth = max_queue_depth.load(memory_order_relaxed);
+    metrics.queue_stalls = queue_stalls.load(memory_order_relaxed);
+    metrics.flushes = flushes.load(memory_order_relaxed);
+    metrics.records_written = records_written.load(memory_order_relaxed);
+    metrics.syncs = syncs.load(memory_order_relaxed);
+    metrics.last_flush_us = last_flush_us.load(memory_order_relaxed);
+    metrics.max_flush_us = max_flush_us.load(memory_order_relaxed);
+    metrics.total_flush_us = total_flush_us.load(memory_order_relaxed);
+    return metrics;
+}
+
+// Writer thread
+void HistoryLog::startWriter() {
+    stopping = false;
+    writer = thread(&HistoryLog::writerLoop, this);
+}
+
+// Drains the queue before returning
+void HistoryLog::stopWriter() {
+    if (!writer.joinable()) return;
+    {
+        lock_guard<mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    writer_wake.notify_one();
+    writer.join();
+}
+
+void HistoryLog::writerLoop() {
+    uint64_t unsynced = 0;
+    auto last_sync = chrono::steady_clock::now();
+    auto interval = chrono::milliseconds(options.flush_interval_ms);
+    unique_lock<mutex> lock(writer_mutex);
+    while (true) {
+        writer_wake.wait_for(lock, interval, [&] {
+            return stopping || flush_requested > flush_completed ||
+                   queue.depth() >= options.flush_records;
+        });
+        bool stop = stopping;
+        uint64_t requested = flush_requested;
+        bool force_sync = sync_requested || stop;
+        sync_requested = false;
+        lock.unlock();
+        
+        bool ok = commit(force_sync, unsynced, last_sync);
+        maybeCompact();
+        
+        lock.lock();
+        if (requested > flush_completed) {
+            flush_completed = requested;
+            sync_ok = ok;
+            flush_done.notify_all();
+        }
+        if (stop) {
+            break;
+        }
+    }
+}
+
+// One group commit: everything queued is written with as few writes as
+// possible, then synced if the policy (or a caller) asks for it
+bool HistoryLog::commit(bool force_sync, uint64_t& unsynced,
+                        chrono::steady_clock::time_point& last_sync) {
+    // Scratch kept by the writer thread between commits
+    static thread_local vector<LogRecord> chunk;
+    if (chunk.capacity() == 0) {
+        chunk.reserve(4096);
+    }
+    
+    size_t depth = queue.depth();
+    if (depth > max_queue_depth.load(memory_order_relaxed)) {
+        max_queue_depth.store(depth, memory_order_relaxed);
+    }
+    
+    // Only what is queued now, so a busy producer cannot keep one commit
+    // going forever
+    auto start = chrono::steady_clock::now();
+    lock_guard<mutex> lock(file_mutex);
+    bool ok = fd >= 0;
+    uint64_t written = 0;
+    HistoryEntry entry;
+    uint64_t lost = 0;
+    auto writeChunk = [&] {
+        if (ok && writeAll(fd, chunk.data(), chunk.size() * sizeof(LogRecord))) {
+            written += chunk.size();
+        } else {
+            ok = false;
+            lost += chunk.size();
+        }
+        chunk.clear();
+    };
+    for (size_t i = 0; i < depth && queue.pop(entry); i++) {
+        chunk.push_back(makeRecord(entry));
+        if (chunk.size() == chunk.capacity()) {
+            writeChunk();
+        }
+    }
+    if (!chunk.empty()) {
+        writeChunk();
+    }
+    if (!ok) {
+        // The entries are off the queue either way. Keep the chunks that
+        // made it and cut whatever part of a record the failed write left,
+        // so the next commit starts on a record boundary.
+        int error = errno;
+        records += written;
+        unsynced += written;
+        if (fd >= 0 && !(truncateFile(fd, recordOffset(records)) &&
+                         seekTo(fd, recordOffset(records)))) {
+            cerr << "History log: cannot cut back to record " << records << ": "
+                 << strerror(errno) << endl;
+        }
+        cerr << "History log: write failed, " << lost << " entries not logged: "
+             << strerror(error) << endl;
+        return false;
+    }
+    records += written;
+    unsynced += written;
+    
+    bool sync = unsynced > 0 &&
+        (force_sync || options.sync == HistoryLogOptions::Sync::EVERY_FLUSH ||
+         (options.sync == HistoryLogOptions::Sync::PERIODIC &&
+          start - last_sync >= chrono::milliseconds(options.sync_interval_ms)));
+    if (sync) {
+        ok = syncFile(fd);
+        last_sync = chrono::steady_clock::now();
+        unsynced = 0;
+        syncs.fetch_add(1, memory_order_relaxed);
+    }
+    
+    if (written > 0 || sync) {
+        uint64_t elapsed = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start).count();
+        flushes.fetch_add(1, memory_order_relaxed);
+        records_written.fetch_add(written, memory_order_relaxed);
+        last_flush_us.store(elapsed, memory_order_relaxed);
+        total_flush_us.fetch_add(elapsed, memory_order_relaxed);
+        if (elapsed > max_flush_us.load(memory_order_relaxed)) {
+            max_flush_us.store(elapsed, memory_order_relaxed);
+        }
+    }
+    return ok;
+}
+
+// Compaction
+void HistoryLog::maybeCompact() {
+    uint64_t slack = max<uint64_t>(options.retention / 4, 1024);
+    if (records <= options.retention + slack || compacting.exchange(true)) {
+        return;
+    }
+    if (compactor.joinable()) {
+        compactor.join();
+    }
+    compactor = thread(&HistoryLog::compact, this);
+}
+
+// Copy the newest `retention` records into a new file while appends go on,
+// then copy whatever was appended meanwhile and swap the files under the
+// lock. Reads go through a descriptor of its own, so a concurrent rewrite
+// can only make the compaction give up.
+void HistoryLog::compact() {
+    int source;
+    uint64_t snapshot_records;
+    uint64_t snapshot_first_sequence;
+    uint64_t snapshot_generation;
+    {
+        lock_guard<mutex> lock(file_mutex);
+        source = duplicateFile(fd);
+        snapshot_records = records;
+        snapshot_first_sequence = first_sequence;
+        snapshot_generation = generation;
+    }
+    if (snapshot_records <= options.retention) {
+        // A rewrite got in first
+        if (source >= 0) {
+            closeFile(source);
+        }
+        compacting = false;
+        return;
+    }
+    
+    string temp_path = path + ".compact";
+    int temp = openFile(temp_path, true);
+    bool ok = source >= 0 && temp >= 0;
+    
+    uint64_t first = snapshot_records - options.retention;
+    LogHeader header = makeHeader(snapshot_first_sequence + first);
+    ok = ok && writeAll(temp, &header, sizeof(header));
+    
+    vector<char> buffer(1 << 20);
+    auto copyRange = [&](uint64_t from, uint64_t to) {
+        uint64_t offset = recordOffset(from);
+        uint64_t end = recordOffset(to);
+        while (ok && offset < end) {
+            size_t size = static_cast<size_t>(min<uint64_t>(buffer.size(), end - offset));
+            ok = readAt(source, buffer.data(), size, offset) && writeAll(temp, buffer.data(), size);
+            offset += size;
+        }
+    };
+    copyRange(first, snapshot_records);
+    
+    {
+        lock_guard<mutex> lock(file_mutex);
+        ok = ok && generation == snapshot_generation;
+        copyRange(snapshot_records, records);
+        if (ok && syncFile(temp) && replaceFile(temp_path, path)) {
+            syncDirectory(path);
+            closeFile(fd);
+            fd = temp;
+            records -= first;
+            first_sequence += first;
+            generation++;
+        } else {
+            if (generation == snapshot_generation) {
+                cerr << "History log: compaction of " << path << " failed" << endl;
+            }
+            if (temp >= 0) {
+                closeFile(temp);
+            }
+            remove(temp_path.c_str());
+        }
+    }
+    if (source >= 0) {
+        closeFile(source);
+    }
+    compacting = false;
+}
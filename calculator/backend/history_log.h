@@ -0,0 +1,188 @@
+#ifndef HISTORY_LOG_H
+#define HISTORY_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "history.h"
+
+// How much a HistoryLog keeps and when its writer thread commits queued
+// records
+struct HistoryLogOptions {
+    enum class Sync {
+        NONE,           // Leave write-back to the OS
+        PERIODIC,       // fdatasync at most every sync_interval_ms
+        EVERY_FLUSH     // fdatasync after every group commit
+    };
+    
+    size_t retention = 1000000;         // Records kept through compaction
+    unsigned flush_interval_ms = 10;    // Commit at least this often...
+    size_t flush_records = 4096;        // ...or once this many are queued
+    Sync sync = Sync::PERIODIC;
+    unsigned sync_interval_ms = 1000;
+    size_t queue_capacity = 16384;      // Rounded up to a power of two
+};
+
+// Writer counters, for tuning the policy under load
+struct HistoryWriterMetrics {
+    size_t queue_depth;         // Entries waiting right now
+    size_t max_queue_depth;     // Most entries seen waiting by one commit
+    uint64_t queue_stalls;      // Appends that found the queue full
+    uint64_t flushes;           // Group commits that wrote something
+    uint64_t records_written;
+    uint64_t syncs;
+    uint64_t last_flush_us;     // Write (+ sync) time of the last commit
+    uint64_t max_flush_us;
+    uint64_t total_flush_us;
+};
+
+// Bounded lock-free queue of history entries with any number of producers
+// and a single consumer (Vyukov's ring of sequence-numbered cells)
+class HistoryQueue {
+private:
+    struct Cell {
+        std::atomic<uint64_t> sequence;
+        HistoryEntry entry;
+    };
+    
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> tail;     // Next position to claim
+    alignas(64) std::atomic<uint64_t> head;     // Next position to pop
+    
+public:
+    explicit HistoryQueue(size_t capacity);
+    
+    // False when the queue is full. The entries go in as one run that
+    // other producers cannot come between.
+    bool push(const HistoryEntry* entries, size_t count);
+    bool push(const HistoryEntry& entry) { return push(&entry, 1); }
+    // Consumer only; false when the queue is empty
+    bool pop(HistoryEntry& entry);
+    
+    size_t depth() const;
+    size_t capacity() const { return mask + 1; }
+};
+
+// Persistent history: an append-only file of fixed-size, checksummed
+// records, one per HistoryEntry.
+//
+//   header   64 bytes   "CALCHLOG", version, record size, first sequence
+//   record   72 bytes   HistoryEntry, marker, CRC-32C of both
+//
+// Every record has a sequence number that survives compaction and
+// rewrites, which makes it usable as an export cursor. An entry whose text
+// continues (see HistoryEntry) is followed by records of continuation
+// entries holding the rest of the text.
+//
+// Calculations are appended within a flush interval of happening, so a
+// crash loses at most the last few milliseconds; a torn or corrupt tail is
+// detected by its checksum and cut off on the next open. Opening maps the file and only
+// touches the records that fit in memory, so startup time does not grow
+// with the file. Once the log holds well over `retention` records it is
+// compacted in a background thread down to the newest `retention`.
+//
+// Appends never touch the disk: they go through a HistoryQueue to a writer
+// thread that commits them in groups according to the options.
+class HistoryLog {
+public:
+    enum class OpenResult {
+        OPENED,         // Existing log replayed, or a new one created
+        NOT_A_LOG,      // The file exists but is not a history log
+        FAILED          // I/O error; the log stays closed
+    };
+    
+private:
+    std::string path;
+    int fd;
+    HistoryLogOptions options;
+    std::atomic<uint64_t> records;  // Records currently in the file
+    uint64_t first_sequence;        // Sequence number of the first of them
+    uint64_t dropped;               // Corrupt records skipped while loading
+    uint64_t generation;            // Bumped whenever the file is replaced
+    
+    // Serializes the writer with rewrites and the end of a compaction
+    std::mutex file_mutex;
+    std::thread compactor;
+    std::atomic<bool> compacting;
+    
+    // Writer thread and its flush handshake (guarded by writer_mutex)
+    HistoryQueue queue;
+    std::thread writer;
+    std::mutex writer_mutex;
+    std::condition_variable writer_wake;
+    std::condition_variable flush_done;
+    bool stopping;
+    uint64_t flush_requested;
+    uint64_t flush_completed;
+    bool sync_requested;
+    bool sync_ok;
+    
+    // Metrics, written by the writer thread
+    std::atomic<size_t> max_queue_depth;
+    std::atomic<uint64_t> queue_stalls;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> records_written;
+    std::atomic<uint64_t> syncs;
+    std::atomic<uint64_t> last_flush_us;
+    std::atomic<uint64_t> max_flush_us;
+    std::atomic<uint64_t> total_flush_us;
+    
+    void startWriter();
+    void stopWriter();
+    void writerLoop();
+    bool commit(bool force_sync, uint64_t& unsynced,
+                std::chrono::steady_clock::time_point& last_sync);
+    bool flush(bool sync);
+    void maybeCompact();
+    void compact();
+    
+public:
+    explicit HistoryLog(const HistoryLogOptions& options = HistoryLogOptions());
+    ~HistoryLog();
+    
+    HistoryLog(const HistoryLog&) = delete;
+    HistoryLog& operator=(const HistoryLog&) = delete;
+    
+    // Open (or create) the log at file_path and push its newest records
+    // into history, oldest first
+    OpenResult open(const std::string& file_path, HistoryBuffer& history);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+    
+    // Queue entries for the writer thread. Only blocks (yielding) while
+    // the queue is full. `text` is the whole text of a TEXT_CONTINUES entry.
+    void append(const HistoryEntry& entry, std::string_view text = std::string_view());
+    void append(const HistoryView& entries);
+    
+    // Replace the whole log with the given entries (clear, import). Also
+    // works after open() returned NOT_A_LOG, converting the file in place.
+    bool rewrite(const HistoryView& entries);
+    
+    // Wait until everything appended so far is written (flush) and on
+    // stable storage (sync)
+    void flush();
+    bool sync();
+    
+    // Read up to max_count records from `sequence` on, and advance it past
+    // them. Returns the number of records consumed, 0 at the end of the
+    // log; damaged records and continuations are consumed but not
+    // returned. An entry's continuations are always read along with it,
+    // even past max_count. With `texts`, the whole text of each entry goes
+    // there.
+    size_t read(uint64_t& sequence, size_t max_count, std::vector<HistoryEntry>& entries,
+                std::vector<std::string>* texts = nullptr);
+    
+    uint64_t getRecordCount() const { return records; }
+    uint64_t getDroppedCount() const { return dropped; }
+    HistoryWriterMetrics getMetrics() const;
+};
+
+#endif // HISTORY_LOG_H
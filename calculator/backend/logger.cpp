@@ -0,0 +1,225 @@
+#include "logger.h"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+using namespace std;
+
+const char* logLevelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::ERR: return "error";
+        case LogLevel::WARN: return "warn";
+        case LogLevel::INFO: return "info";
+        case LogLevel::DEBUG: return "debug";
+    }
+    return "unknown";
+}
+
+bool parseLogLevel(string_view name, LogLevel& level) {
+    for (LogLevel candidate : {LogLevel::ERR, LogLevel::WARN, LogLevel::INFO, LogLevel::DEBUG}) {
+        if (name == logLevelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Log lines
+void LogLine::append(string_view part) {
+    size_t count = min(part.size(), capacity - length);
+    memcpy(text + length, part.data(), count);
+    length += count;
+}
+
+static bool isPlain(char c) {
+    return c > ' ' && c != '"' && c != '=' && c != '\\' && c != 0x7f;
+}
+
+void LogLine::appendValue(string_view value) {
+    bool plain = !value.empty();
+    for (char c : value) {
+        plain = plain && isPlain(c);
+    }
+    if (plain) {
+        append(value);
+        return;
+    }
+    
+    append("\"");
+    size_t start = 0;
+    for (size_t i = 0; i < value.size(); i++) {
+        char c = value[i];
+        if (c != '"' && c != '\\' && static_cast<unsigned char>(c) >= ' ' && c != 0x7f) {
+            continue;
+        }
+        append(value.substr(start, i - start));
+        append(c == '"' ? "\\\"" : c == '\\' ? "\\\\" : c == '\n' ? "\\n" : c == '\r' ? "\\r" : "?");
+        start = i + 1;
+    }
+    append(value.substr(start));
+    append("\"");
+}
+
+// Logger
+atomic<uint8_t> Logger::threshold(static_cast<uint8_t>(LogLevel::INFO));
+
+void Logger::setLevel(LogLevel level) {
+    threshold.store(static_cast<uint8_t>(level), memory_order_relaxed);
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : slots(new Slot[RING_SLOTS]), tail(0), head(0), dropped(0), reported_dropped(0),
+      stopping(false) {
+    for (size_t i = 0; i < RING_SLOTS; i++) {
+        slots[i].sequence.store(i, memory_order_relaxed);
+    }
+    writer = thread(&Logger::writerLoop, this);
+}
+
+Logger::~Logger() {
+    {
+        lock_guard<mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    writer_wake.notify_one();
+    writer.join();
+}
+
+Logger::Slot* Logger::claim() {
+    uint64_t position = tail.load(memory_order_relaxed);
+    while (true) {
+        Slot& slot = slots[position & (RING_SLOTS - 1)];
+        uint64_t sequence = slot.sequence.load(memory_order_acquire);
+        int64_t lag = static_cast<int64_t>(sequence - position);
+        if (lag == 0) {
+            if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                slot.time_ns = chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::system_clock::now().time_since_epoch()).count();
+                return &slot;
+            }
+        } else if (lag < 0) {
+            // Still holds a line from one lap ago: the ring is full
+            return nullptr;
+        } else {
+            position = tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::publish(Slot* slot, LogLevel level) {
+    uint64_t position = slot->sequence.load(memory_order_relaxed);
+    slot->sequence.store(position + 1, memory_order_release);
+    if (level <= LogLevel::WARN) {
+        writer_wake.notify_one();
+    }
+}
+
+// "2026-01-31T12:34:56.789012Z"
+static void appendTimestamp(string& out, int64_t time_ns) {
+    time_t seconds = static_cast<time_t>(time_ns / 1000000000);
+    tm utc;
+#ifdef _WIN32
+    gmtime_s(&utc, &seconds);
+#else
+    gmtime_r(&seconds, &utc);
+#endif
+    char text[40];
+    int length = snprintf(text, sizeof(text), "%04d-%02d-%02dT%02d:%02d:%02d.%06dZ",
+                          utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour,
+                          utc.tm_min, utc.tm_sec, static_cast<int>(time_ns % 1000000000 / 1000));
+    out.append(text, length);
+}
+
+bool Logger::drain(string& out, string& errors) {
+    bool any = false;
+    while (true) {
+        Slot& slot = slots[head & (RING_SLOTS - 1)];
+        if (slot.sequence.load(memory_order_acquire) != head + 1) {
+            break;
+        }
+        
+        string& target = slot.level <= LogLevel::WARN ? errors : out;
+        target += "ts=";
+        appendTimestamp(target, slot.time_ns);
+        target += " level=";
+        target += logLevelName(slot.level);
+        target.append(slot.text, slot.length);
+        target += '\n';
+        
+        slot.sequence.store(head + RING_SLOTS, memory_order_release);
+        head++;
+        any = true;
+    }
+    
+    uint64_t lost = dropped.load(memory_order_relaxed);
+    if (lost != reported_dropped) {
+        errors += "ts=";
+        appendTimestamp(errors, chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count());
+        errors += " level=warn msg=\"log lines dropped\" count=";
+        errors += to_string(lost - reported_dropped);
+        errors += '\n';
+        reported_dropped = lost;
+        any = true;
+    }
+    return any;
+}
+
+void Logger::writerLoop() {
+    string out;
+    string errors;
+    unique_lock<mutex> lock(writer_mutex);
+    while (true) {
+        bool stop = stopping;
+        lock.unlock();
+        
+        if (drain(out, errors)) {
+            if (!errors.empty()) {
+                fwrite(errors.data(), 1, errors.size(), stderr);
+                fflush(stderr);
+                errors.clear();
+            }
+            if (!out.empty()) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                fflush(stdout);
+                out.clear();
+            }
+        }
+        
+        lock.lock();
+        if (stop) {
+            return;
+        }
+        writer_wake.wait_for(lock, chrono::milliseconds(FLUSH_INTERVAL_MS));
+    }
+}
+
+// Request sampling
+atomic<uint32_t> LogSampler::interval(1);
+atomic<uint32_t> LogSampler::per_second(1000);
+
+void LogSampler::configure(uint32_t every, uint32_t limit) {
+    interval.store(max(every, 1u), memory_order_relaxed);
+    per_second.store(limit, memory_order_relaxed);
+}
+
+bool LogSampler::underRate() {
+    int64_t now = chrono::duration_cast<chrono::seconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+    if (now != window) {
+        window = now;
+        logged = 0;
+    }
+    uint32_t limit = per_second.load(memory_order_relaxed);
+    if (limit != 0 && logged >= limit) {
+        return false;
+    }
+    logged++;
+    return true;
+}
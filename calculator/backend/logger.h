@@ -0,0 +1,189 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// ERR rather than ERROR: windows.h defines ERROR as a macro
+enum class LogLevel : uint8_t {
+    ERR,
+    WARN,
+    INFO,
+    DEBUG       // Per-request events; off by default
+};
+
+// "error", "warn", ...
+const char* logLevelName(LogLevel level);
+// Accepts the names above; false if there is no such level
+bool parseLogLevel(std::string_view name, LogLevel& level);
+
+// One log line while it is being written: the message and key=value
+// fields, formatted straight into a ring slot
+class LogLine {
+public:
+    LogLine(char* buffer, size_t capacity) : text(buffer), capacity(capacity), length(0) {}
+    
+    void append(std::string_view part);
+    // Quoted (with " and \ escaped, control characters replaced) if it
+    // contains anything but plain characters
+    void appendValue(std::string_view value);
+    
+    template <typename T>
+    void appendField(std::string_view key, const T& value) {
+        append(" ");
+        append(key);
+        append("=");
+        if constexpr (std::is_same_v<T, bool>) {
+            append(value ? "true" : "false");
+        } else if constexpr (std::is_arithmetic_v<T>) {
+            char digits[32];
+            std::to_chars_result end = std::to_chars(digits, digits + sizeof(digits), value);
+            append(std::string_view(digits, end.ptr - digits));
+        } else {
+            appendValue(std::string_view(value));
+        }
+    }
+    
+    size_t size() const { return length; }
+    
+private:
+    char* text;
+    size_t capacity;
+    size_t length;
+};
+
+// Asynchronous structured logger.
+//
+// Lines are logfmt: "ts=... level=info msg="client connected" worker=0 fd=7".
+// Any thread formats its line straight into a slot of a bounded lock-free
+// ring and returns; one background thread writes queued lines out in
+// batches (errors and warnings to stderr, the rest to stdout) every
+// FLUSH_INTERVAL_MS, or at once for an error. Nothing ever waits for the
+// terminal: when the ring is full the line is dropped and counted, and the
+// writer reports how many were lost. Whatever is queued at exit is written
+// out when the logger is destroyed.
+class Logger {
+public:
+    static const size_t RING_SLOTS = 4096;         // Power of two
+    static const size_t LINE_CAPACITY = 240;       // Longer lines are cut short
+    static const int FLUSH_INTERVAL_MS = 20;
+    
+    static Logger& instance();
+    
+    // Lines above this level are skipped before any formatting
+    static bool enabled(LogLevel level) {
+        return static_cast<uint8_t>(level) <= threshold.load(std::memory_order_relaxed);
+    }
+    static void setLevel(LogLevel level);
+    
+    template <typename... Fields>
+    void write(LogLevel level, std::string_view message, const Fields&... fields) {
+        static_assert(sizeof...(fields) % 2 == 0, "Log fields come in key, value pairs");
+        Slot* slot = claim();
+        if (slot == nullptr) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogLine line(slot->text, LINE_CAPACITY);
+        line.append(" msg=");
+        line.appendValue(message);
+        appendFields(line, fields...);
+        slot->level = level;
+        slot->length = static_cast<uint16_t>(line.size());
+        publish(slot, level);
+    }
+    
+    uint64_t droppedLines() const { return dropped.load(std::memory_order_relaxed); }
+    
+    ~Logger();
+    
+private:
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        int64_t time_ns;            // Wall clock, formatted by the writer
+        LogLevel level;
+        uint16_t length;
+        char text[LINE_CAPACITY];
+    };
+    
+    // Bounded MPSC queue after Dmitry Vyukov's: producers claim a position
+    // with one compare-and-swap, and a slot's sequence number says whether
+    // it is free for that position or holds a published line
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<uint64_t> tail;     // Next position to claim
+    alignas(64) uint64_t head;                  // Next position to write out (writer only)
+    std::atomic<uint64_t> dropped;
+    uint64_t reported_dropped;
+    
+    std::thread writer;
+    std::mutex writer_mutex;
+    std::condition_variable writer_wake;
+    bool stopping;
+    
+    static std::atomic<uint8_t> threshold;
+    
+    Logger();
+    
+    Slot* claim();
+    void publish(Slot* slot, LogLevel level);
+    void writerLoop();
+    // Write out published lines; false if there were none
+    bool drain(std::string& out, std::string& errors);
+    
+    static void appendFields(LogLine&) {}
+    template <typename Key, typename Value, typename... Rest>
+    static void appendFields(LogLine& line, const Key& key, const Value& value, const Rest&... rest) {
+        line.appendField(key, value);
+        appendFields(line, rest...);
+    }
+};
+
+// Log an event with key, value pairs after the message, e.g.
+// logEvent(LogLevel::INFO, "client connected", "worker", id, "fd", fd)
+template <typename... Fields>
+inline void logEvent(LogLevel level, std::string_view message, const Fields&... fields) {
+    if (Logger::enabled(level)) {
+        Logger::instance().write(level, message, fields...);
+    }
+}
+
+// Decides which requests a thread logs. Each thread that logs requests
+// keeps its own.
+class LogSampler {
+public:
+    // One request in `every`, and at most `limit` a second per sampler
+    // (0 = no limit)
+    static void configure(uint32_t every, uint32_t limit);
+    
+    LogSampler() : countdown(1), window(0), logged(0) {}
+    
+    bool sample() {
+        if (--countdown != 0) {
+            return false;
+        }
+        countdown = interval.load(std::memory_order_relaxed);
+        return underRate();
+    }
+    
+private:
+    uint32_t countdown;
+    int64_t window;             // Second the count below belongs to
+    uint32_t logged;
+    
+    static std::atomic<uint32_t> interval;
+    static std::atomic<uint32_t> per_second;
+    
+    bool underRate();
+};
+
+#endif // LOGGER_H
@@ -1,7 +1,21 @@
 #include "calculator.h"
+#include "logger.h"
+#include "shm_transport.h"
+#include "uring.h"
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <unordered_map>
 
 #ifdef _WIN32
     #include <winsock2.h>
@@ -9,18 +23,792 @@
     #pragma comment(lib, "ws2_32.lib")
 #else
     #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <unistd.h>
     #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <cerrno>
+#endif
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
 #endif
 
 using namespace std;
 
+// How the workers drive their sockets (Linux)
+enum class IoBackend {
+    EPOLL,      // Readiness: epoll_wait, then recv() and send() per connection
+    URING       // Completions: io_uring, one system call per loop turn
+};
+
+// Startup options
+struct ServerConfig {
+    int port = 8080;
+    int backlog = SOMAXCONN;    // Connections the kernel queues before accept(), per socket
+    bool reuse_port = false;    // A TCP socket per worker, balanced by the kernel (SO_REUSEPORT)
+    string unix_path;       // Also accept local clients on this Unix domain socket; empty = none
+    int workers = 1;        // 0 = one per hardware thread
+    IoBackend io_backend = IoBackend::EPOLL;   // URING falls back to EPOLL if the kernel lacks it
+    size_t history_capacity = DEFAULT_HISTORY_CAPACITY;    // Entries kept per worker
+    HistoryLogOptions log_options;
+    size_t result_cache_capacity = DEFAULT_RESULT_CACHE_CAPACITY;  // 0 = no memo cache
+    LogLevel log_level = LogLevel::INFO;    // DEBUG logs requests
+    uint32_t log_sample_interval = 1;       // Log one request in n...
+    uint32_t log_rate = 1000;               // ...and at most this many a second per worker
+    string metrics_file;    // Prometheus text dump of STATS; empty = none
+    unsigned metrics_interval_s = 10;
+    uint32_t stats_sample_interval = DEFAULT_STATS_SAMPLE_INTERVAL;
+    string shm_name;        // Shared memory segment for same-host clients; empty = none
+    ShmOptions shm_options;
+};
+
+#ifdef __linux__
+// Worker 0 keeps the history file of the single-threaded server; the
+// shared memory transport comes after the workers
+static string historyFileFor(int id) {
+    if (id == 0) {
+        return DEFAULT_HISTORY_FILE;
+    }
+    return "calculator_history." + to_string(id) + ".dat";
+}
+
+// How commands and responses are delimited on a connection. Every
+// connection starts in ONE_SHOT mode (one read burst = one command, as the
+// Python GUI expects) and can switch with "PROTOCOL LINE|LENGTH|TEXT|BINARY".
+enum class Framing {
+    ONE_SHOT,   // No delimiters: one command per read, raw responses
+    LINE,       // Newline-terminated commands and responses
+    LENGTH,     // 4-byte big-endian length prefix before every message
+    BINARY      // Fixed-size BinaryRequest/BinaryResponse frames, for good
+};
+
+// Per-connection state for the event loop
+struct Connection {
+    int fd;
+    string input;          // Bytes received but not yet processed
+    string output;         // Responses waiting to be sent
+    uint32_t events;       // Events currently registered with epoll
+    Framing framing;
+    bool closing;          // Close once output has been flushed
+    bool eof;              // The peer is done sending: answer what it sent, then close
+    
+    // io_uring backend only
+    string sending;        // Output handed to the kernel, untouched until the send completes
+    size_t sent;
+    bool receiving;        // The multishot recv is armed
+    bool cancelling;       // ...and being cancelled, as the output has backed up
+    uint64_t send_started; // For STATS, when sampled
+    uint32_t generation;   // Tells this connection's completions from an earlier one's on the fd
+    bool touched;          // Had a completion this loop turn
+    
+    explicit Connection(int fd)
+        : fd(fd), events(EPOLLIN | EPOLLRDHUP), framing(Framing::ONE_SHOT), closing(false),
+          eof(false), sent(0), receiving(false), cancelling(false), send_started(0), generation(0),
+          touched(false) {}
+};
+
+// Event loop owning a set of connections and its own CommandProcessor.
+// Workers share no state: a connection lives on exactly one worker for
+// its whole lifetime, so the request path takes no locks.
+//
+// The loop is either epoll or io_uring; framing and command handling are
+// the same for both. With io_uring, accepting and receiving each take one
+// multishot request (per listening socket and per connection), received
+// data lands in buffers registered with the ring, and every request queued
+// while handling one turn's completions goes to the kernel with the wait
+// for the next turn's, in a single io_uring_enter.
+class Worker {
+private:
+    int id;
+    IoBackend backend;
+    int epoll_fd;
+    vector<int> listen_fds;    // Sockets this worker accepts from by itself
+    CommandProcessor processor;
+    unordered_map<int, Connection> connections;
+    LogSampler request_log;
+    thread loop_thread;
+    
+    // io_uring backend
+    IoUring ring;
+    uint32_t next_generation;
+    vector<int> touched;   // Connections that had completions this turn
+    // Sockets accepted by another thread, which may not submit to the ring:
+    // it queues them here and signals wake_fd, which the ring has a read on
+    mutex adopted_mutex;
+    vector<int> adopted;
+    int wake_fd;
+    uint64_t wake_count;
+    
+    // What a completion is for. Its user_data also holds the fd (bits 8-39)
+    // and, for connections, the generation (bits 40-63).
+    enum class UringOp : uint8_t {
+        ACCEPT,
+        RECV,
+        SEND,
+        WAKE
+    };
+    
+    static const int MAX_EVENTS = 256;
+    static const unsigned URING_ENTRIES = 4096;
+    static const size_t READ_CHUNK = 16384;
+    static const size_t MAX_FRAME = 1 << 20;  // Longest accepted command
+    // Unsent output beyond which a connection is neither read from nor
+    // processed until the client has taken some of it
+    static const size_t OUTPUT_HIGH_WATER = 1 << 22;
+    static const size_t MAX_LOGGED_COMMAND = 64;
+    
+public:
+    Worker(int id, const ServerConfig& config)
+        : id(id), backend(config.io_backend), epoll_fd(-1),
+          processor(historyFileFor(id), config.history_capacity, config.log_options,
+                    config.result_cache_capacity),
+          next_generation(0), wake_fd(-1), wake_count(0) {}
+    
+    ~Worker() {
+        for (auto& entry : connections) {
+            close(entry.first);
+        }
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+        if (wake_fd >= 0) {
+            close(wake_fd);
+        }
+    }
+    
+    bool init() {
+        if (backend == IoBackend::URING) {
+            string error;
+            if (!ring.init(URING_ENTRIES, error)) {
+                logEvent(LogLevel::ERR, "io_uring setup failed", "error", error);
+                return false;
+            }
+            wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (wake_fd < 0) {
+                logEvent(LogLevel::ERR, "eventfd failed", "error", strerror(errno));
+                return false;
+            }
+            return true;
+        }
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            logEvent(LogLevel::ERR, "epoll_create1 failed", "error", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+    
+    // Let this worker accept from a listening socket directly; for epoll it
+    // must be non-blocking. Several workers may share one: epoll wakes only
+    // one of them per connection.
+    bool listenOn(int fd) {
+        listen_fds.push_back(fd);
+        if (backend == IoBackend::URING) {
+            return ring.queueAccept(fd, uringData(UringOp::ACCEPT, fd, 0));
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            logEvent(LogLevel::ERR, "epoll_ctl failed", "error", strerror(errno));
+            return false;
+        }
+        return true;
+    }
+    
+    // Hand a freshly accepted socket to this worker. Safe to call from the
+    // acceptor thread: only the epoll registration happens here, the
+    // Connection itself is created by the worker on its first event. An
+    // io_uring worker picks the socket up on its own thread, on its next
+    // turn.
+    bool adopt(int client_socket) {
+        if (backend == IoBackend::URING) {
+            // Blocking, like the sockets the ring accepts itself
+            fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL, 0) & ~O_NONBLOCK);
+            {
+                lock_guard<mutex> lock(adopted_mutex);
+                adopted.push_back(client_socket);
+            }
+            uint64_t one = 1;
+            return write(wake_fd, &one, sizeof(one)) == sizeof(one);
+        }
+        
+        int opt = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = client_socket;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+            logEvent(LogLevel::ERR, "epoll_ctl failed", "error", strerror(errno));
+            return false;
+        }
+        logEvent(LogLevel::INFO, "client connected", "worker", id, "fd", client_socket);
+        return true;
+    }
+    
+    void start() {
+        loop_thread = thread(&Worker::run, this);
+    }
+    
+    void join() {
+        if (loop_thread.joinable()) {
+            loop_thread.join();
+        }
+    }
+    
+    // Reactor loop: multiplexes all of this worker's connections
+    void run() {
+        if (backend == IoBackend::URING) {
+            runUring();
+            return;
+        }
+        epoll_event events[MAX_EVENTS];
+        
+        while (true) {
+            int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                logEvent(LogLevel::ERR, "epoll_wait failed", "error", strerror(errno));
+                break;
+            }
+            
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                if (find(listen_fds.begin(), listen_fds.end(), fd) != listen_fds.end()) {
+                    acceptConnections(fd);
+                } else {
+                    handleEvent(events[i].data.fd, events[i].events);
+                }
+            }
+        }
+    }
+    
+private:
+    void acceptConnections(int listen_fd) {
+        while (true) {
+            int client_socket = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_socket < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    logEvent(LogLevel::ERR, "accept failed", "error", strerror(errno));
+                }
+                return;
+            }
+            if (!adopt(client_socket)) {
+                close(client_socket);
+            }
+        }
+    }
+    
+    void handleEvent(int fd, uint32_t events) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) {
+            it = connections.emplace(fd, Connection(fd)).first;
+        }
+        Connection& conn = it->second;
+        
+        if (events & EPOLLERR) {
+            closeConnection(conn);
+            return;
+        }
+        
+        // A hangup may come with data still to be read; the end of the
+        // stream is only known once recv() says so
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) && !conn.eof && !outputFull(conn)) {
+            if (!readFrom(conn)) {
+                conn.eof = true;
+            }
+        }
+        
+        // Input held back while the output was backed up is processed as
+        // the client takes the output
+        bool held = true;
+        while (held) {
+            held = processInput(conn);
+            if (!flush(conn)) {
+                closeConnection(conn);
+                return;
+            }
+            held = held && !outputFull(conn);
+        }
+        if ((conn.closing || conn.eof) && conn.output.empty()) {
+            closeConnection(conn);
+        }
+    }
+    
+    // Drain the socket into the connection's input buffer, but no more
+    // than a whole frame and one read: anything beyond is either processed
+    // or rejected first, and waits in the socket until then (epoll is
+    // level-triggered). Returns false once the peer has closed its side.
+    bool readFrom(Connection& conn) {
+        char buffer[READ_CHUNK];
+        
+        while (conn.input.size() <= MAX_FRAME) {
+            ssize_t bytes_read = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (bytes_read > 0) {
+                conn.input.append(buffer, bytes_read);
+                continue;
+            }
+            if (bytes_read == 0) {
+                return false;
+            }
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        return true;
+    }
+    
+    bool outputFull(const Connection& conn) const {
+        return conn.output.size() + conn.sending.size() >= OUTPUT_HIGH_WATER;
+    }
+    
+    // Completion loop. Input is processed once per turn, after all of the
+    // turn's completions, so a burst that arrived in several buffers is
+    // still handled as one read, as with epoll.
+    void runUring() {
+        if (!ring.enable()) {
+            logEvent(LogLevel::ERR, "io_uring enable failed", "error", strerror(errno));
+            return;
+        }
+        if (!ring.queueRead(wake_fd, &wake_count, sizeof(wake_count),
+                            uringData(UringOp::WAKE, wake_fd, 0))) {
+            logEvent(LogLevel::ERR, "io_uring submission ring full");
+            return;
+        }
+        
+        while (true) {
+            int result = ring.submit(1);
+            if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY) {
+                logEvent(LogLevel::ERR, "io_uring_enter failed", "error", strerror(-result));
+                break;
+            }
+            
+            ring.forEachCompletion([this](const io_uring_cqe& cqe) { handleCompletion(cqe); });
+            ring.publishBuffers();
+            
+            for (int fd : touched) {
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection& conn = it->second;
+                conn.touched = false;
+                processInput(conn);
+                pump(conn);
+            }
+            touched.clear();
+        }
+    }
+    
+    static uint64_t uringData(UringOp op, int fd, uint32_t generation) {
+        return uint64_t(generation) << 40 | uint64_t(uint32_t(fd)) << 8 | uint64_t(op);
+    }
+    
+    void handleCompletion(const io_uring_cqe& cqe) {
+        UringOp op = static_cast<UringOp>(cqe.user_data & 0xff);
+        int fd = static_cast<int>(uint32_t(cqe.user_data >> 8));
+        uint32_t generation = uint32_t(cqe.user_data >> 40);
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+        
+        if (op == UringOp::ACCEPT) {
+            if (cqe.res >= 0) {
+                openConnection(cqe.res);
+            } else if (cqe.res != -ECONNABORTED && cqe.res != -EINTR) {
+                logEvent(LogLevel::ERR, "accept failed", "error", strerror(-cqe.res));
+            }
+            if (!more && !ring.queueAccept(fd, cqe.user_data)) {
+                logEvent(LogLevel::ERR, "io_uring submission ring full, not accepting");
+            }
+            return;
+        }
+        if (op == UringOp::WAKE) {
+            vector<int> sockets;
+            {
+                lock_guard<mutex> lock(adopted_mutex);
+                sockets.swap(adopted);
+            }
+            for (int socket : sockets) {
+                openConnection(socket);
+            }
+            if (!ring.queueRead(wake_fd, &wake_count, sizeof(wake_count), cqe.user_data)) {
+                logEvent(LogLevel::ERR, "io_uring submission ring full, not adopting");
+            }
+            return;
+        }
+        
+        // Completions may still arrive for a connection closed earlier
+        auto it = connections.find(fd);
+        Connection* conn = it != connections.end() && it->second.generation == generation
+                               ? &it->second : nullptr;
+        
+        if (op == UringOp::RECV) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t buffer = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (conn != nullptr && cqe.res > 0) {
+                    conn->input.append(ring.buffer(buffer), cqe.res);
+                }
+                ring.recycle(buffer);
+            }
+            if (conn == nullptr) return;
+            
+            // An ended recv is re-armed by pump(). ENOBUFS: every buffer was
+            // in use; they are back by then. ECANCELED: pump() stopped it.
+            if (!more) {
+                conn->receiving = false;
+                conn->cancelling = false;
+            }
+            if (cqe.res == 0) {
+                conn->eof = true;
+            } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                conn->closing = true;
+            }
+        } else {
+            if (conn == nullptr) return;
+            
+            if (cqe.res < 0) {
+                conn->sending.clear();
+                conn->output.clear();
+                conn->closing = true;
+            } else if (conn->sent + cqe.res < conn->sending.size()) {
+                // Short send: the rest goes at once, nothing else is due
+                conn->sent += cqe.res;
+                if (!ring.queueSend(fd, conn->sending.data() + conn->sent,
+                                    conn->sending.size() - conn->sent, cqe.user_data)) {
+                    conn->sending.clear();
+                    conn->closing = true;
+                } else {
+                    return;
+                }
+            } else {
+                conn->sending.clear();
+                if (conn->send_started != 0) {
+                    processor.getStats().recordSend(readClock() - conn->send_started);
+                }
+            }
+        }
+        
+        if (!conn->touched) {
+            conn->touched = true;
+            touched.push_back(fd);
+        }
+    }
+    
+    void openConnection(int fd) {
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        
+        Connection& conn = connections.insert_or_assign(fd, Connection(fd)).first->second;
+        conn.generation = ++next_generation & 0xffffff;
+        if (!ring.queueRecv(fd, uringData(UringOp::RECV, fd, conn.generation))) {
+            logEvent(LogLevel::ERR, "io_uring submission ring full, dropping client");
+            connections.erase(fd);
+            close(fd);
+            return;
+        }
+        conn.receiving = true;
+        logEvent(LogLevel::INFO, "client connected", "worker", id, "fd", fd);
+    }
+    
+    // Start sending the output built up so far unless a send is still in
+    // flight; the two buffers swap, so the next responses go to the one
+    // just sent. Receiving stops while the output is backed up and resumes
+    // once it drains. Closes the connection once it is closing or at its
+    // end, and drained.
+    void pump(Connection& conn) {
+        if (conn.sending.empty() && !conn.output.empty()) {
+            conn.sending.swap(conn.output);
+            conn.sent = 0;
+            conn.send_started = RequestStats::isEnabled() && processor.getStats().sample()
+                                    ? readClock() : 0;
+            if (!ring.queueSend(conn.fd, conn.sending.data(), conn.sending.size(),
+                                uringData(UringOp::SEND, conn.fd, conn.generation))) {
+                conn.sending.clear();
+                conn.closing = true;
+            }
+        }
+        
+        uint64_t recv_data = uringData(UringOp::RECV, conn.fd, conn.generation);
+        if (outputFull(conn)) {
+            if (conn.receiving && !conn.cancelling) {
+                conn.cancelling = ring.queueCancel(recv_data);
+            }
+        } else if (!conn.receiving && !conn.closing && !conn.eof) {
+            conn.receiving = ring.queueRecv(conn.fd, recv_data);
+            conn.closing = !conn.receiving;
+        }
+        // Nothing is left to send (the output was just swapped in if there
+        // was any), so nothing is held back either
+        if ((conn.closing || conn.eof) && conn.sending.empty()) {
+            closeConnection(conn);
+        }
+    }
+    
+    // Split the input buffer into commands according to the connection's
+    // framing and answer all of them in order. Responses are only queued
+    // here; the caller sends the whole batch with as few send() calls as
+    // the socket allows. Returns true if whole commands are left over
+    // because the output is backed up.
+    bool processInput(Connection& conn) {
+        size_t consumed = 0;
+        bool held = false;
+        
+        while (!conn.closing && consumed < conn.input.size()) {
+            if (outputFull(conn)) {
+                held = true;
+                break;
+            }
+            string_view pending(conn.input.data() + consumed, conn.input.size() - consumed);
+            string_view command;
+            size_t frame_size = 0;
+            
+            if (conn.framing == Framing::BINARY) {
+                consumed += handleRequests(conn, pending);
+                break;
+            }
+            if (conn.framing == Framing::ONE_SHOT) {
+                // Everything received in one read burst is one command, except
+                // that a PROTOCOL line may be followed by already-framed data
+                size_t newline = pending.find('\n');
+                if (pending.compare(0, 9, "PROTOCOL ") == 0 && newline != string_view::npos) {
+                    frame_size = newline + 1;
+                } else {
+                    frame_size = pending.size();
+                }
+                command = pending.substr(0, frame_size);
+                command = command.substr(0, command.find('\0'));
+            } else if (conn.framing == Framing::LINE) {
+                size_t newline = pending.find('\n');
+                if (newline == string_view::npos) break;
+                frame_size = newline + 1;
+                command = pending.substr(0, newline);
+            } else {
+                if (pending.size() < 4) break;
+                const unsigned char* header = reinterpret_cast<const unsigned char*>(pending.data());
+                size_t length = (size_t(header[0]) << 24) | (size_t(header[1]) << 16) |
+                                (size_t(header[2]) << 8) | size_t(header[3]);
+                if (length > MAX_FRAME) {
+                    rejectOversized(conn);
+                    return false;
+                }
+                if (pending.size() < 4 + length) break;
+                frame_size = 4 + length;
+                command = pending.substr(4, length);
+            }
+            
+            consumed += frame_size;
+            // Length-prefixed frames are exact and may carry binary payloads
+            while (conn.framing != Framing::LENGTH && !command.empty() &&
+                   (command.back() == '\r' || command.back() == '\n')) {
+                command.remove_suffix(1);
+            }
+            handleCommand(conn, command);
+        }
+        
+        conn.input.erase(0, consumed);
+        if (!held && conn.input.size() > MAX_FRAME) {
+            rejectOversized(conn);
+        }
+        return held;
+    }
+    
+    void handleCommand(Connection& conn, string_view command) {
+        if (Logger::enabled(LogLevel::DEBUG) && request_log.sample()) {
+            logEvent(LogLevel::DEBUG, "received command", "worker", id,
+                     "command", command.substr(0, MAX_LOGGED_COMMAND), "bytes", command.size());
+        }
+        
+        if (command.compare(0, 9, "PROTOCOL ") == 0) {
+            negotiate(conn, command.substr(9));
+            return;
+        }
+        
+        // The response is formatted straight into the output buffer
+        size_t frame = beginMessage(conn);
+        size_t start = conn.output.size();
+        processor.processCommand(command, conn.output);
+        
+        // Check if client wants to exit
+        if (conn.output.compare(start, 4, "EXIT") == 0) {
+            conn.closing = true;
+        }
+        endMessage(conn, frame);
+    }
+    
+    // Answer every whole binary request in pending, decoding each straight
+    // from the input buffer. Returns the number of bytes consumed.
+    size_t handleRequests(Connection& conn, string_view pending) {
+        size_t count = pending.size() / sizeof(BinaryRequest);
+        for (size_t i = 0; i < count; i++) {
+            BinaryRequest request;
+            memcpy(&request, pending.data() + i * sizeof(request), sizeof(request));
+            if (Logger::enabled(LogLevel::DEBUG) && request_log.sample()) {
+                logEvent(LogLevel::DEBUG, "received request", "worker", id,
+                         "opcode", unsigned(request.opcode), "tag", request.tag);
+            }
+            
+            processor.processBinary(request, conn.output);
+            if (request.opcode == BINARY_OPCODE_EXIT) {
+                conn.closing = true;
+                return (i + 1) * sizeof(request);
+            }
+        }
+        return count * sizeof(BinaryRequest);
+    }
+    
+    // Switch framing. The acknowledgement is already framed the new way.
+    void negotiate(Connection& conn, string_view mode) {
+        if (mode == "BINARY") {
+            conn.framing = Framing::BINARY;
+            BinaryResponse acknowledgement = {BinaryStatus::OK, 0, 0, 0,
+                                              double(BINARY_PROTOCOL_VERSION)};
+            conn.output.append(reinterpret_cast<const char*>(&acknowledgement),
+                               sizeof(acknowledgement));
+            return;
+        }
+        if (mode == "LINE") {
+            conn.framing = Framing::LINE;
+        } else if (mode == "LENGTH") {
+            conn.framing = Framing::LENGTH;
+        } else if (mode == "TEXT") {
+            conn.framing = Framing::ONE_SHOT;
+        } else {
+            writeMessage(conn, "ERROR|||Unknown protocol: " + string(mode));
+            return;
+        }
+        writeMessage(conn, "SUCCESS|Protocol|" + string(mode) + "|");
+    }
+    
+    void writeMessage(Connection& conn, const string& message) {
+        size_t frame = beginMessage(conn);
+        conn.output += message;
+        endMessage(conn, frame);
+    }
+    
+    // Frame a message appended in place: beginMessage reserves the length
+    // header, endMessage fills it in (or adds the line terminator).
+    size_t beginMessage(Connection& conn) {
+        size_t frame = conn.output.size();
+        if (conn.framing == Framing::LENGTH) {
+            conn.output.append(4, '\0');
+        }
+        return frame;
+    }
+    
+    void endMessage(Connection& conn, size_t frame) {
+        if (conn.framing == Framing::LENGTH) {
+            uint32_t length = conn.output.size() - frame - 4;
+            conn.output[frame] = char(length >> 24);
+            conn.output[frame + 1] = char(length >> 16);
+            conn.output[frame + 2] = char(length >> 8);
+            conn.output[frame + 3] = char(length);
+        } else if (conn.framing == Framing::LINE) {
+            conn.output += '\n';
+        }
+    }
+    
+    void rejectOversized(Connection& conn) {
+        conn.input.clear();
+        writeMessage(conn, "ERROR|||Command too long");
+        conn.closing = true;
+    }
+    
+    // Send as much pending output as the socket accepts; keep EPOLLOUT
+    // registered only while there is a backlog, and stop reading from a
+    // connection that is closing, at its end or whose output is backed up.
+    // Returns false on error.
+    bool flush(Connection& conn) {
+        uint64_t started = !conn.output.empty() && RequestStats::isEnabled() &&
+                           processor.getStats().sample() ? readClock() : 0;
+        size_t sent_total = 0;
+        while (sent_total < conn.output.size()) {
+            ssize_t sent = send(conn.fd, conn.output.data() + sent_total,
+                                conn.output.size() - sent_total, MSG_NOSIGNAL);
+            if (sent > 0) {
+                sent_total += sent;
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        conn.output.erase(0, sent_total);
+        if (started != 0) {
+            processor.getStats().recordSend(readClock() - started);
+        }
+        
+        uint32_t wanted = conn.closing || conn.eof || outputFull(conn) ? 0u : (EPOLLIN | EPOLLRDHUP);
+        if (!conn.output.empty()) {
+            wanted |= EPOLLOUT;
+        }
+        if (wanted != conn.events) {
+            epoll_event ev = {};
+            ev.events = wanted;
+            ev.data.fd = conn.fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+            conn.events = wanted;
+        }
+        return true;
+    }
+    
+    // The map entry is erased before close() so a recycled fd number
+    // handed to this worker later always starts with a fresh Connection
+    void closeConnection(Connection& conn) {
+        int fd = conn.fd;
+        if (backend == IoBackend::URING) {
+            // Ends the multishot recv, whose last completion finds the
+            // connection gone; until then it keeps the socket open
+            shutdown(fd, SHUT_RDWR);
+        } else {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        connections.erase(fd);
+        close(fd);
+        logEvent(LogLevel::INFO, "client disconnected", "worker", id, "fd", fd);
+    }
+};
+#endif
+
 class CalculatorServer {
 private:
-    int server_fd;
+    int server_fd;         // TCP, unless every worker has its own
     int port;
+    int backlog;
+#ifdef __linux__
+    vector<int> port_fds;  // With SO_REUSEPORT, one TCP socket per worker
+    int unix_fd;
+    int worker_count;
+    ServerConfig config;
+    vector<unique_ptr<Worker>> workers;
+    unique_ptr<ShmServer> shm_server;
+#else
     CommandProcessor processor;
+    LogSampler request_log;
+#endif
+    
+    // Periodic STATS dump for --metrics-file
+    string metrics_file;
+    unsigned metrics_interval_s;
+    thread metrics_writer;
+    mutex metrics_mutex;
+    condition_variable metrics_wake;
+    bool metrics_stopping;
+    
+    void writeMetrics() {
+        unique_lock<mutex> lock(metrics_mutex);
+        while (!metrics_stopping) {
+            metrics_wake.wait_for(lock, chrono::seconds(metrics_interval_s));
+            lock.unlock();
+            if (!RequestStats::writePrometheus(metrics_file)) {
+                logEvent(LogLevel::WARN, "cannot write metrics", "path", metrics_file);
+            }
+            lock.lock();
+        }
+    }
     
     void initializeSocket() {
 #ifdef _WIN32
@@ -37,33 +825,39 @@ private:
 #endif
     }
     
-public:
-    CalculatorServer(int port = 8080) : port(port), server_fd(-1) {
-        initializeSocket();
-    }
-    
-    ~CalculatorServer() {
-        stop();
-        cleanupSocket();
+    static void closeSocket(int fd) {
+#ifdef _WIN32
+        closesocket(fd);
+#else
+        close(fd);
+#endif
     }
     
-    bool start() {
-        // Create socket
-        server_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_fd < 0) {
-            cerr << "Socket creation failed" << endl;
-            return false;
+    // A TCP socket listening on the port; -1 (logged) on failure. With
+    // reuse_port several of them can share the port, and the kernel spreads
+    // incoming connections over them.
+    int openTcpListener(bool reuse_port) {
+#ifdef __linux__
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+#endif
+        if (fd < 0) {
+            logEvent(LogLevel::ERR, "socket creation failed", "error", strerror(errno));
+            return -1;
         }
         
         // Set socket options
         int opt = 1;
 #ifdef _WIN32
-        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt)) < 0) {
 #else
-        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+            (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)) {
 #endif
-            cerr << "Setsockopt failed" << endl;
-            return false;
+            logEvent(LogLevel::ERR, "setsockopt failed", "error", strerror(errno));
+            closeSocket(fd);
+            return -1;
         }
         
         // Bind socket
@@ -72,23 +866,273 @@ public:
         address.sin_addr.s_addr = INADDR_ANY;
         address.sin_port = htons(port);
         
-        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-            cerr << "Bind failed" << endl;
-            return false;
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            logEvent(LogLevel::ERR, "bind failed", "port", port, "error", strerror(errno));
+            closeSocket(fd);
+            return -1;
         }
         
         // Listen for connections
-        if (listen(server_fd, 3) < 0) {
-            cerr << "Listen failed" << endl;
+        if (listen(fd, backlog) < 0) {
+            logEvent(LogLevel::ERR, "listen failed", "error", strerror(errno));
+            closeSocket(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+#ifdef __linux__
+    // A socket listening at config.unix_path. A socket file left there by a
+    // server that did not stop cleanly is replaced, one still answering is
+    // not.
+    int openUnixListener() {
+        const string& path = config.unix_path;
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            logEvent(LogLevel::ERR, "unix socket path too long", "path", path);
+            return -1;
+        }
+        memcpy(address.sun_path, path.data(), path.size());
+        
+        struct stat existing;
+        if (stat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool in_use = probe >= 0 &&
+                          connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+            if (probe >= 0) {
+                close(probe);
+            }
+            if (in_use) {
+                logEvent(LogLevel::ERR, "unix socket in use", "path", path);
+                return -1;
+            }
+            unlink(path.c_str());
+        }
+        
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            logEvent(LogLevel::ERR, "socket creation failed", "error", strerror(errno));
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+            logEvent(LogLevel::ERR, "bind failed", "path", path, "error", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        if (listen(fd, backlog) < 0) {
+            logEvent(LogLevel::ERR, "listen failed", "error", strerror(errno));
+            close(fd);
+            unlink(path.c_str());
+            return -1;
+        }
+        return fd;
+    }
+    
+    // Workers accept by themselves unless several of them share one TCP
+    // socket
+    bool mainThreadAcceptsTcp() const {
+        return worker_count > 1 && !config.reuse_port;
+    }
+    
+    // The Unix socket goes along with the TCP one, except that io_uring
+    // workers cannot share it: several rings accepting from one socket do
+    // not share the connections out (see start())
+    bool mainThreadAcceptsUnix() const {
+        return unix_fd >= 0 && worker_count > 1 &&
+               (mainThreadAcceptsTcp() || config.io_backend == IoBackend::URING);
+    }
+    
+    // Acceptor: assign connections to workers round-robin, from the TCP
+    // socket and the Unix one alike
+    void acceptConnections() {
+        vector<pollfd> listeners;
+        if (mainThreadAcceptsTcp()) {
+            listeners.push_back({server_fd, POLLIN, 0});
+        }
+        if (mainThreadAcceptsUnix()) {
+            listeners.push_back({unix_fd, POLLIN, 0});
+        }
+        
+        size_t next = 0;
+        while (true) {
+            if (poll(listeners.data(), listeners.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                logEvent(LogLevel::ERR, "poll failed", "error", strerror(errno));
+                return;
+            }
+            
+            for (pollfd& listener : listeners) {
+                if (listener.revents & POLLNVAL) return;
+                if (!(listener.revents & POLLIN)) continue;
+                while (true) {
+                    int client_socket = accept4(listener.fd, nullptr, nullptr,
+                                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (client_socket < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            logEvent(LogLevel::ERR, "accept failed", "error", strerror(errno));
+                        }
+                        break;
+                    }
+                    
+                    if (!workers[next]->adopt(client_socket)) {
+                        close(client_socket);
+                    }
+                    next = (next + 1) % workers.size();
+                }
+            }
+        }
+    }
+#endif
+    
+public:
+    explicit CalculatorServer(const ServerConfig& config = ServerConfig())
+        : server_fd(-1), port(config.port), backlog(max(1, config.backlog))
+#ifdef __linux__
+        , unix_fd(-1)
+#else
+        , processor(DEFAULT_HISTORY_FILE, config.history_capacity, config.log_options,
+                    config.result_cache_capacity)
+#endif
+        , metrics_file(config.metrics_file), metrics_interval_s(max(1u, config.metrics_interval_s)),
+          metrics_stopping(false)
+    {
+#ifdef __linux__
+        worker_count = config.workers;
+        this->config = config;
+        if (worker_count <= 0) {
+            worker_count = max(1u, thread::hardware_concurrency());
+        }
+#endif
+        initializeSocket();
+    }
+    
+    ~CalculatorServer() {
+        stop();
+        cleanupSocket();
+    }
+    
+    bool start() {
+#ifdef __linux__
+        if (config.io_backend == IoBackend::URING) {
+            string reason;
+            if (!IoUring::available(reason)) {
+                logEvent(LogLevel::WARN, "io_uring unavailable, using epoll", "reason", reason);
+                config.io_backend = IoBackend::EPOLL;
+            }
+        }
+        // Several rings accepting from one socket do not share the
+        // connections out: the first to be woken takes them all
+        if (config.io_backend == IoBackend::URING && worker_count > 1) {
+            config.reuse_port = true;
+        }
+        
+        if (config.reuse_port) {
+            for (int i = 0; i < worker_count; i++) {
+                int fd = openTcpListener(true);
+                if (fd < 0) {
+                    return false;
+                }
+                port_fds.push_back(fd);
+            }
+        } else if ((server_fd = openTcpListener(false)) < 0) {
+            return false;
+        }
+        if (!config.unix_path.empty() && (unix_fd = openUnixListener()) < 0) {
             return false;
         }
         
-        cout << "Calculator server started on port " << port << endl;
-        cout << "Waiting for Python GUI to connect..." << endl;
+        for (int i = 0; i < worker_count; i++) {
+            workers.push_back(make_unique<Worker>(i, config));
+            if (!workers.back()->init()) {
+                return false;
+            }
+        }
         
+        // epoll accepts from non-blocking sockets, until EAGAIN
+        if (config.io_backend == IoBackend::EPOLL) {
+            for (int fd : port_fds) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            }
+            for (int fd : {server_fd, unix_fd}) {
+                if (fd >= 0) {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                }
+            }
+        } else if (mainThreadAcceptsUnix()) {
+            // So does the main thread
+            fcntl(unix_fd, F_SETFL, fcntl(unix_fd, F_GETFL, 0) | O_NONBLOCK);
+        }
+        
+        // A single worker accepts on its own event loop, and so does every
+        // worker with a TCP socket of its own (io_uring workers always have
+        // one: only its own thread may submit to a ring); several epoll
+        // workers sharing a socket get their connections dealt out by the
+        // main thread. The Unix socket goes along with the TCP ones, but
+        // with several io_uring workers the main thread deals out its
+        // connections too.
+        for (int i = 0; i < worker_count; i++) {
+            if ((!mainThreadAcceptsTcp() &&
+                 !workers[i]->listenOn(config.reuse_port ? port_fds[i] : server_fd)) ||
+                (unix_fd >= 0 && !mainThreadAcceptsUnix() && !workers[i]->listenOn(unix_fd))) {
+                return false;
+            }
+        }
+        
+        logEvent(LogLevel::INFO, "calculator server started", "port", port,
+                 "workers", worker_count,
+                 "io", config.io_backend == IoBackend::URING ? "io_uring" : "epoll",
+                 "reuseport", config.reuse_port, "backlog", backlog);
+        if (unix_fd >= 0) {
+            logEvent(LogLevel::INFO, "listening on unix socket", "path", config.unix_path);
+        }
+        
+        if (!config.shm_name.empty()) {
+            auto processor = make_unique<CommandProcessor>(
+                historyFileFor(worker_count), config.history_capacity, config.log_options,
+                config.result_cache_capacity);
+            shm_server = make_unique<ShmServer>(config.shm_name, config.shm_options,
+                                                move(processor));
+            if (!shm_server->start()) {
+                return false;
+            }
+        }
+#else
+        server_fd = openTcpListener(false);
+        if (server_fd < 0) {
+            return false;
+        }
+        logEvent(LogLevel::INFO, "calculator server started", "port", port, "backlog", backlog);
+#endif
+        logEvent(LogLevel::INFO, "waiting for Python GUI to connect");
+        
+        if (!metrics_file.empty()) {
+            metrics_writer = thread(&CalculatorServer::writeMetrics, this);
+        }
         return true;
     }
     
+#ifdef __linux__
+    void run() {
+        if (worker_count == 1) {
+            workers[0]->run();
+            return;
+        }
+        
+        for (auto& worker : workers) {
+            worker->start();
+        }
+        
+        if (mainThreadAcceptsTcp() || mainThreadAcceptsUnix()) {
+            acceptConnections();
+        }
+        
+        for (auto& worker : workers) {
+            worker->join();
+        }
+    }
+#else
     void run() {
         sockaddr_in address;
         int addrlen = sizeof(address);
@@ -103,11 +1147,11 @@ public:
 #endif
             
             if (client_socket < 0) {
-                cerr << "Accept failed" << endl;
+                logEvent(LogLevel::ERR, "accept failed");
                 continue;
             }
             
-            cout << "Python GUI connected" << endl;
+            logEvent(LogLevel::INFO, "client connected", "fd", client_socket);
             
             // Handle client
             handleClient(client_socket);
@@ -119,12 +1163,13 @@ public:
             close(client_socket);
 #endif
             
-            cout << "Python GUI disconnected" << endl;
+            logEvent(LogLevel::INFO, "client disconnected", "fd", client_socket);
         }
     }
     
     void handleClient(int client_socket) {
         char buffer[1024] = {0};
+        string response;
         
         while (true) {
             // Read command from client
@@ -136,13 +1181,21 @@ public:
             }
             
             string command(buffer);
-            cout << "Received command: " << command << endl;
+            if (Logger::enabled(LogLevel::DEBUG) && request_log.sample()) {
+                logEvent(LogLevel::DEBUG, "received command", "command", command);
+            }
             
             // Process command
-            string response = processor.processCommand(command);
+            response.clear();
+            processor.processCommand(command, response);
             
             // Send response back to client
+            uint64_t started = RequestStats::isEnabled() && processor.getStats().sample()
+                                   ? readClock() : 0;
             send(client_socket, response.c_str(), response.length(), 0);
+            if (started != 0) {
+                processor.getStats().recordSend(readClock() - started);
+            }
             
             // Check if client wants to exit
             if (response.find("EXIT") == 0) {
@@ -150,24 +1203,171 @@ public:
             }
         }
     }
+#endif
     
     void stop() {
-        if (server_fd >= 0) {
-#ifdef _WIN32
-            closesocket(server_fd);
-#else
-            close(server_fd);
+#ifdef __linux__
+        shm_server.reset();
 #endif
+        if (metrics_writer.joinable()) {
+            {
+                lock_guard<mutex> lock(metrics_mutex);
+                metrics_stopping = true;
+            }
+            metrics_wake.notify_one();
+            metrics_writer.join();
+        }
+        if (server_fd >= 0) {
+            closeSocket(server_fd);
             server_fd = -1;
         }
+#ifdef __linux__
+        for (int fd : port_fds) {
+            close(fd);
+        }
+        port_fds.clear();
+        if (unix_fd >= 0) {
+            close(unix_fd);
+            unlink(config.unix_path.c_str());
+            unix_fd = -1;
+        }
+#endif
     }
 };
 
-int main() {
-    CalculatorServer server(8080);
+// Parse command line options: --port <n> --backlog <n> --reuseport --unix <path>
+// --workers <n> --io <epoll|uring> --history-size <n>
+// --memo-size <n> --log-retention <n> --flush-interval <ms> --flush-records <n> --fsync <none|periodic|always>
+// --metrics-file <path> --metrics-interval <s> --stats-sample <n>
+// --log-level <error|warn|info|debug> --log-sample <n> --log-rate <n>
+// --shm <name> --shm-channels <n> --shm-ring <bytes> --shm-spin <us>
+static bool parseArguments(int argc, char* argv[], ServerConfig& config) {
+    HistoryLogOptions& options = config.log_options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "--port" || arg == "-p") && i + 1 < argc) {
+            config.port = atoi(argv[++i]);
+        } else if (arg == "--backlog" && i + 1 < argc) {
+            config.backlog = atoi(argv[++i]);
+        } else if (arg == "--reuseport") {
+            config.reuse_port = true;
+        } else if (arg == "--unix" && i + 1 < argc) {
+            config.unix_path = argv[++i];
+        } else if ((arg == "--workers" || arg == "-w") && i + 1 < argc) {
+            config.workers = atoi(argv[++i]);
+        } else if (arg == "--io" && i + 1 < argc && string(argv[i + 1]) == "epoll") {
+            config.io_backend = IoBackend::EPOLL;
+            i++;
+        } else if (arg == "--io" && i + 1 < argc && string(argv[i + 1]) == "uring") {
+            config.io_backend = IoBackend::URING;
+            i++;
+        } else if (arg == "--history-size" && i + 1 < argc) {
+            config.history_capacity = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--memo-size" && i + 1 < argc) {
+            config.result_cache_capacity = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--log-retention" && i + 1 < argc) {
+            options.retention = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--flush-interval" && i + 1 < argc) {
+            options.flush_interval_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--flush-records" && i + 1 < argc) {
+            options.flush_records = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--fsync" && i + 1 < argc && string(argv[i + 1]) == "none") {
+            options.sync = HistoryLogOptions::Sync::NONE;
+            i++;
+        } else if (arg == "--fsync" && i + 1 < argc && string(argv[i + 1]) == "periodic") {
+            options.sync = HistoryLogOptions::Sync::PERIODIC;
+            i++;
+        } else if (arg == "--fsync" && i + 1 < argc && string(argv[i + 1]) == "always") {
+            options.sync = HistoryLogOptions::Sync::EVERY_FLUSH;
+            i++;
+        } else if (arg == "--metrics-file" && i + 1 < argc) {
+            config.metrics_file = argv[++i];
+        } else if (arg == "--metrics-interval" && i + 1 < argc) {
+            config.metrics_interval_s = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--stats-sample" && i + 1 < argc) {
+            config.stats_sample_interval = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--log-level" && i + 1 < argc && parseLogLevel(argv[i + 1], config.log_level)) {
+            i++;
+        } else if (arg == "--log-sample" && i + 1 < argc) {
+            config.log_sample_interval = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--log-rate" && i + 1 < argc) {
+            config.log_rate = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--shm" && i + 1 < argc) {
+            config.shm_name = argv[++i];
+        } else if (arg == "--shm-channels" && i + 1 < argc) {
+            config.shm_options.channels = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--shm-ring" && i + 1 < argc) {
+            config.shm_options.ring_bytes = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--shm-spin" && i + 1 < argc) {
+            config.shm_options.spin_us = strtoul(argv[++i], nullptr, 10);
+        } else {
+            cerr << "Usage: " << argv[0] << " [--port <n>] [--backlog <n>] [--reuseport] [--unix <path>]"
+                 << " [--workers <n>] [--io epoll|uring] [--history-size <n>]"
+                 << " [--memo-size <n>] [--log-retention <n>] [--flush-interval <ms>] [--flush-records <n>] [--fsync none|periodic|always]"
+                 << " [--metrics-file <path>] [--metrics-interval <s>] [--stats-sample <n>]"
+                 << " [--log-level error|warn|info|debug] [--log-sample <n>] [--log-rate <n>]"
+                 << " [--shm <name>] [--shm-channels <n>] [--shm-ring <bytes>] [--shm-spin <us>]"
+                 << endl;
+            cerr << "  --backlog: connections queued before they are accepted (default "
+                 << SOMAXCONN << ", capped by the kernel)" << endl;
+            cerr << "  --reuseport: a TCP socket per worker, each accepting on its own (Linux;"
+                 << " implied by --io uring with several workers)" << endl;
+            cerr << "  --unix: also accept local clients on a Unix domain socket at <path> (Linux)"
+                 << endl;
+            cerr << "  --workers 0 starts one worker per hardware thread" << endl;
+            cerr << "  --io: event loop of the workers (Linux; default epoll). uring needs Linux 6.0"
+                 << " and falls back to epoll without it" << endl;
+            cerr << "  --history-size is the number of history entries kept per worker" << endl;
+            cerr << "  --memo-size is the number of memoized results per worker (0 = off)" << endl;
+            cerr << "  --log-retention is the number of entries kept in each history file" << endl;
+            cerr << "  --flush-interval / --flush-records: history is written to disk at least"
+                 << " this often / once this many entries are waiting" << endl;
+            cerr << "  --fsync: none leaves it to the OS, periodic syncs every second, always"
+                 << " after every write" << endl;
+            cerr << "  --metrics-file: write request counters and latency (as STATS reports them)"
+                 << " there in Prometheus text format every --metrics-interval seconds (default 10)"
+                 << endl;
+            cerr << "  --stats-sample: time one request in n for STATS (default "
+                 << DEFAULT_STATS_SAMPLE_INTERVAL << ", 1 = every request)" << endl;
+            cerr << "  --log-level: debug also logs requests (default info)" << endl;
+            cerr << "  --log-sample / --log-rate: at debug level, log one request in n (default 1)"
+                 << " and at most n a second per worker (default 1000, 0 = no limit)" << endl;
+            cerr << "  --shm: also serve same-host clients through the shared memory segment"
+                 << " /<name> (Linux), with --shm-channels clients at a time (default "
+                 << DEFAULT_SHM_CHANNELS << ") and --shm-ring bytes each way (default "
+                 << DEFAULT_SHM_RING_BYTES << ")" << endl;
+            cerr << "  --shm-spin: poll for requests this many microseconds before sleeping"
+                 << " (default 0; worth it only with a core to spare)" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        return 1;
+    }
+    RequestStats::setSampleInterval(config.stats_sample_interval);
+    Logger::setLevel(config.log_level);
+    LogSampler::configure(config.log_sample_interval, config.log_rate);
+#ifndef __linux__
+    if (!config.shm_name.empty()) {
+        logEvent(LogLevel::WARN, "shared memory transport needs Linux, ignoring --shm");
+    }
+    if (config.io_backend == IoBackend::URING) {
+        logEvent(LogLevel::WARN, "io_uring needs Linux, ignoring --io uring");
+    }
+    if (config.reuse_port || !config.unix_path.empty()) {
+        logEvent(LogLevel::WARN, "--reuseport and --unix need Linux, ignoring them");
+    }
+#endif
+    
+    CalculatorServer server(config);
     
     if (!server.start()) {
-        cerr << "Failed to start server" << endl;
+        logEvent(LogLevel::ERR, "failed to start server");
         return 1;
     }
     
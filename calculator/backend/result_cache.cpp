@@ -0,0 +1,123 @@
+#include "result_cache.h"
+#include <cstring>
+
+using namespace std;
+
+static uint64_t bitsOf(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double valueOf(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Single counter owner in the common case: a plain load + store is enough
+// and avoids a locked instruction on every operation
+static void bump(atomic<uint64_t>& counter) {
+    counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+ResultCache::ResultCache(size_t capacity)
+    : mask(0), shift(64), enabled(capacity > 0), hits(0), misses(0), bypassed(0),
+      miss_run(0), bypass_left(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+        shift--;
+    }
+    slots.reset(new Slot[size]);
+    mask = size - 1;
+    clear();
+}
+
+ResultCache::Slot& ResultCache::slotFor(Operation operation, uint64_t a, uint64_t b) const {
+    // Operands like 30.0 or 2.5 have all-zero low mantissa bits and a
+    // multiply only carries entropy upwards, so index by the top bits
+    uint64_t hash = (a ^ (b * 0xC2B2AE3D27D4EB4Full) ^ static_cast<uint64_t>(operation)) *
+                    0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 32;
+    hash *= 0x9E3779B97F4A7C15ull;
+    return slots[shift < 64 ? hash >> shift : 0];
+}
+
+bool ResultCache::lookup(Operation operation, double a, double b, double& result) {
+    if (!enabled.load(memory_order_relaxed)) {
+        return false;
+    }
+    
+    uint64_t a_bits = bitsOf(a);
+    uint64_t b_bits = bitsOf(b);
+    Slot& slot = slotFor(operation, a_bits, b_bits);
+    
+    uint32_t before = slot.sequence.load(memory_order_acquire);
+    uint32_t stored_operation = slot.operation.load(memory_order_relaxed);
+    uint64_t stored_a = slot.a.load(memory_order_relaxed);
+    uint64_t stored_b = slot.b.load(memory_order_relaxed);
+    uint64_t stored_result = slot.result.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t after = slot.sequence.load(memory_order_relaxed);
+    
+    if ((before & 1) != 0 || before != after ||
+        stored_operation != static_cast<uint32_t>(operation) ||
+        stored_a != a_bits || stored_b != b_bits) {
+        bump(misses);
+        uint32_t run = miss_run.load(memory_order_relaxed) + 1;
+        if (run == MISS_RUN) {
+            run = 0;
+            bypass_left.store(BYPASS_LENGTH, memory_order_relaxed);
+        }
+        miss_run.store(run, memory_order_relaxed);
+        return false;
+    }
+    if (miss_run.load(memory_order_relaxed) != 0) {
+        miss_run.store(0, memory_order_relaxed);
+    }
+    bump(hits);
+    result = valueOf(stored_result);
+    return true;
+}
+
+void ResultCache::store(Operation operation, double a, double b, double result) {
+    if (!enabled.load(memory_order_relaxed)) {
+        return;
+    }
+    
+    uint64_t a_bits = bitsOf(a);
+    uint64_t b_bits = bitsOf(b);
+    Slot& slot = slotFor(operation, a_bits, b_bits);
+    
+    uint32_t sequence = slot.sequence.load(memory_order_relaxed);
+    if ((sequence & 1) != 0 ||
+        !slot.sequence.compare_exchange_strong(sequence, sequence + 1, memory_order_acquire)) {
+        return;     // Another writer has it
+    }
+    slot.operation.store(static_cast<uint32_t>(operation), memory_order_relaxed);
+    slot.a.store(a_bits, memory_order_relaxed);
+    slot.b.store(b_bits, memory_order_relaxed);
+    slot.result.store(bitsOf(result), memory_order_relaxed);
+    slot.sequence.store(sequence + 2, memory_order_release);
+}
+
+void ResultCache::setEnabled(bool on) {
+    enabled.store(on, memory_order_relaxed);
+}
+
+// Not meant to race with lookups or stores
+void ResultCache::clear() {
+    for (size_t i = 0; i <= mask; i++) {
+        slots[i].sequence.store(0, memory_order_relaxed);
+        slots[i].operation.store(EMPTY_SLOT, memory_order_relaxed);
+        slots[i].a.store(0, memory_order_relaxed);
+        slots[i].b.store(0, memory_order_relaxed);
+        slots[i].result.store(0, memory_order_relaxed);
+    }
+    hits.store(0, memory_order_relaxed);
+    misses.store(0, memory_order_relaxed);
+    bypassed.store(0, memory_order_relaxed);
+    miss_run.store(0, memory_order_relaxed);
+    bypass_left.store(0, memory_order_relaxed);
+}
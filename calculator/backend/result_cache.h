@@ -0,0 +1,85 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "history.h"
+
+// Slots in a ResultCache when no capacity is given
+const size_t DEFAULT_RESULT_CACHE_CAPACITY = 4096;
+
+// Bounded memo table for pure operations, keyed by the operation and the
+// bit patterns of its operands.
+//
+// The table is direct-mapped: every key has exactly one slot and a new key
+// simply replaces the old one, so a lookup is one hash and one 32-byte
+// slot read and a miss costs one slot write. Slots are guarded by a
+// seqlock: readers never wait, a reader that races a writer sees a miss,
+// and a writer that finds the slot busy skips the store. The table can
+// therefore be shared between threads without locks; the hit and miss
+// counters are only approximate when it is.
+//
+// Arguments that never repeat make every lookup a miss, and a miss costs
+// more than the cheaper operations save on a hit. After MISS_RUN misses in
+// a row the table is therefore left alone for the next BYPASS_LENGTH
+// operations, which are computed directly, and then tried again.
+class ResultCache {
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;     // Odd while being written
+        std::atomic<uint32_t> operation;    // EMPTY_SLOT when unused
+        std::atomic<uint64_t> a;
+        std::atomic<uint64_t> b;
+        std::atomic<uint64_t> result;
+    };
+    
+    static const uint32_t EMPTY_SLOT = 0xFFFFFFFF;
+    static const uint32_t MISS_RUN = 64;
+    static const uint32_t BYPASS_LENGTH = 4096;
+    
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    unsigned shift;     // 64 - log2(slot count)
+    std::atomic<bool> enabled;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> bypassed;
+    std::atomic<uint32_t> miss_run;     // Misses since the last hit
+    std::atomic<uint32_t> bypass_left;  // Operations still to skip the table
+    
+    Slot& slotFor(Operation operation, uint64_t a, uint64_t b) const;
+    
+public:
+    // capacity is rounded up to a power of two; 0 starts disabled
+    explicit ResultCache(size_t capacity = DEFAULT_RESULT_CACHE_CAPACITY);
+    
+    // True while the table is off or bypassed: the caller computes the
+    // result without lookup() or store(). Inline, as it is asked on every
+    // operation.
+    bool skipped() {
+        uint32_t left = bypass_left.load(std::memory_order_relaxed);
+        if (left == 0) {
+            return !enabled.load(std::memory_order_relaxed);
+        }
+        bypass_left.store(left - 1, std::memory_order_relaxed);
+        bypassed.store(bypassed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    bool lookup(Operation operation, double a, double b, double& result);
+    void store(Operation operation, double a, double b, double result);
+    
+    void setEnabled(bool on);
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+    void clear();
+    
+    size_t capacity() const { return mask + 1; }
+    uint64_t getHits() const { return hits.load(std::memory_order_relaxed); }
+    uint64_t getMisses() const { return misses.load(std::memory_order_relaxed); }
+    // Operations computed without a lookup during a bypass
+    uint64_t getBypassed() const { return bypassed.load(std::memory_order_relaxed); }
+};
+
+#endif // RESULT_CACHE_H
@@ -0,0 +1,501 @@
+#include "shm_transport.h"
+
+#ifdef __linux__
+
+#include "logger.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char SHM_MAGIC[8] = {'C', 'A', 'L', 'C', 'S', 'H', 'M', '1'};
+
+// Futexes in the segment are shared between processes, so no
+// FUTEX_PRIVATE_FLAG
+static void futexWait(atomic<uint32_t>& word, uint32_t expected, int timeout_ms) {
+    timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout,
+            nullptr, 0);
+}
+
+static void futexWake(atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr,
+            nullptr, 0);
+}
+
+// Event counts: the waiter reads the bell, checks for work, and sleeps only
+// while the bell still reads the same. The notifier bumps the bell and
+// makes the system call only if someone said they were waiting.
+static void waitBell(atomic<uint32_t>& bell, atomic<uint32_t>& waiting, uint32_t seen,
+                     int timeout_ms) {
+    waiting.fetch_add(1, memory_order_seq_cst);
+    if (bell.load(memory_order_seq_cst) == seen) {
+        futexWait(bell, seen, timeout_ms);
+    }
+    waiting.fetch_sub(1, memory_order_relaxed);
+}
+
+static void ringBell(atomic<uint32_t>& bell, atomic<uint32_t>& waiting) {
+    bell.fetch_add(1, memory_order_seq_cst);
+    if (waiting.load(memory_order_seq_cst) != 0) {
+        futexWake(bell);
+    }
+}
+
+static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static bool processAlive(int32_t pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+static uint64_t roundUpToPowerOfTwo(uint64_t value) {
+    uint64_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// Segments
+string ShmSegment::objectName(const string& name) {
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+size_t ShmSegment::channelsOffset() {
+    return (sizeof(ShmHeader) + 63) & ~size_t(63);
+}
+
+size_t ShmSegment::dataOffset(uint32_t channel_count) {
+    size_t end = channelsOffset() + channel_count * sizeof(ShmChannel);
+    return (end + 4095) & ~size_t(4095);
+}
+
+ShmChannel& ShmSegment::channel(size_t i) const {
+    return reinterpret_cast<ShmChannel*>(static_cast<char*>(base) + channelsOffset())[i];
+}
+
+ShmRing ShmSegment::requests(size_t i) const {
+    uint64_t ring_bytes = header()->ring_bytes;
+    char* data = static_cast<char*>(base) + dataOffset(header()->channel_count) +
+                 2 * i * ring_bytes;
+    return ShmRing(&channel(i).requests, data, ring_bytes);
+}
+
+ShmRing ShmSegment::responses(size_t i) const {
+    uint64_t ring_bytes = header()->ring_bytes;
+    char* data = static_cast<char*>(base) + dataOffset(header()->channel_count) +
+                 (2 * i + 1) * ring_bytes;
+    return ShmRing(&channel(i).responses, data, ring_bytes);
+}
+
+bool ShmSegment::create(const string& name, const ShmOptions& options, string& error) {
+    unmap();
+    uint32_t channel_count = max(options.channels, 1u);
+    uint64_t ring_bytes = roundUpToPowerOfTwo(max<uint64_t>(options.ring_bytes, 4096));
+    size_t size = dataOffset(channel_count) + 2 * channel_count * ring_bytes;
+    
+    // Left behind by a server that did not stop cleanly
+    string object = objectName(name);
+    shm_unlink(object.c_str());
+    int fd = shm_open(object.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    if (ftruncate(fd, size) < 0) {
+        error = strerror(errno);
+        ::close(fd);
+        shm_unlink(object.c_str());
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        error = strerror(errno);
+        shm_unlink(object.c_str());
+        return false;
+    }
+    base = mapped;
+    length = size;
+    
+    // The new pages are zero: every channel is FREE with empty rings
+    ShmHeader* shared = header();
+    shared->channel_count = channel_count;
+    shared->ring_bytes = ring_bytes;
+    shared->server_pid.store(getpid(), memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(shared->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    return true;
+}
+
+bool ShmSegment::open(const string& name, string& error) {
+    unmap();
+    int fd = shm_open(objectName(name).c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0) {
+        error = "cannot open " + objectName(name) + ": " + strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || static_cast<size_t>(info.st_size) < sizeof(ShmHeader)) {
+        error = "not a calculator segment";
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        error = strerror(errno);
+        return false;
+    }
+    base = mapped;
+    length = info.st_size;
+    
+    ShmHeader* shared = header();
+    bool valid = memcmp(shared->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) == 0;
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || shared->channel_count == 0 ||
+        dataOffset(shared->channel_count) + 2 * shared->channel_count * shared->ring_bytes >
+            length) {
+        error = "not a calculator segment";
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+void ShmSegment::unmap() {
+    if (base != nullptr) {
+        munmap(base, length);
+        base = nullptr;
+        length = 0;
+    }
+}
+
+// Server
+
+// A server killed by SIGINT or SIGTERM would leave its segment behind until
+// the next start: remove the name, then die of the signal as before
+static char segment_to_remove[256];
+
+static void removeSegmentAndDie(int signal_number) {
+    shm_unlink(segment_to_remove);
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+static void removeSegmentOnTermination(const string& object) {
+    if (object.size() >= sizeof(segment_to_remove)) {
+        return;
+    }
+    memcpy(segment_to_remove, object.c_str(), object.size() + 1);
+    for (int signal_number : {SIGINT, SIGTERM}) {
+        struct sigaction action = {};
+        if (sigaction(signal_number, nullptr, &action) == 0 && action.sa_handler == SIG_DFL) {
+            action.sa_handler = removeSegmentAndDie;
+            sigaction(signal_number, &action, nullptr);
+        }
+    }
+}
+
+ShmServer::ShmServer(const string& name, const ShmOptions& options,
+                     unique_ptr<CommandProcessor> processor)
+    : name(name), options(options), processor(move(processor)), stopping(false) {}
+
+ShmServer::~ShmServer() {
+    stop();
+}
+
+bool ShmServer::start() {
+    string error;
+    if (!segment.create(name, options, error)) {
+        logEvent(LogLevel::ERR, "cannot create shared memory segment", "name",
+                 ShmSegment::objectName(name), "error", error);
+        return false;
+    }
+    sessions.assign(segment.header()->channel_count, Session());
+    removeSegmentOnTermination(ShmSegment::objectName(name));
+    server_thread = thread(&ShmServer::run, this);
+    logEvent(LogLevel::INFO, "shared memory transport started", "name",
+             ShmSegment::objectName(name), "channels", segment.header()->channel_count,
+             "ring_bytes", segment.header()->ring_bytes);
+    return true;
+}
+
+void ShmServer::stop() {
+    if (!server_thread.joinable()) {
+        return;
+    }
+    stopping.store(true, memory_order_relaxed);
+    ShmHeader* shared = segment.header();
+    ringBell(shared->server_bell, shared->server_waiting);
+    server_thread.join();
+    
+    // Clients notice on their next wakeup, and their mappings stay valid
+    shared->server_pid.store(0, memory_order_seq_cst);
+    for (size_t i = 0; i < shared->channel_count; i++) {
+        ShmChannel& channel = segment.channel(i);
+        ringBell(channel.client_bell, channel.client_waiting);
+    }
+    shm_unlink(ShmSegment::objectName(name).c_str());
+    segment.unmap();
+}
+
+void ShmServer::run() {
+    ShmHeader* shared = segment.header();
+    auto spin = chrono::microseconds(options.spin_us);
+    auto idle_since = chrono::steady_clock::now();
+    auto last_reap = idle_since;
+    
+    while (!stopping.load(memory_order_relaxed)) {
+        uint32_t seen = shared->server_bell.load(memory_order_acquire);
+        bool progress = false;
+        for (size_t i = 0; i < sessions.size(); i++) {
+            progress = serve(i) || progress;
+        }
+        
+        auto now = chrono::steady_clock::now();
+        if (now - last_reap >= chrono::milliseconds(REAP_INTERVAL_MS)) {
+            reapDeadClients();
+            last_reap = now;
+        }
+        if (progress) {
+            idle_since = now;
+        } else if (now - idle_since < spin) {
+            cpuRelax();
+        } else {
+            waitBell(shared->server_bell, shared->server_waiting, seen, REAP_INTERVAL_MS);
+            idle_since = chrono::steady_clock::now();
+        }
+    }
+}
+
+// Answer what the channel has queued, as far as the response ring has
+// room. Returns whether anything happened.
+bool ShmServer::serve(size_t index) {
+    ShmChannel& channel = segment.channel(index);
+    uint32_t state = channel.state.load(memory_order_acquire);
+    if (state == ShmChannel::CLOSED) {
+        release(index);
+        return true;
+    }
+    if (state != ShmChannel::OPEN) {
+        return false;
+    }
+    
+    Session& session = sessions[index];
+    if (!session.attached) {
+        session.attached = true;
+        logEvent(LogLevel::INFO, "shared memory client attached", "channel", index,
+                 "pid", channel.owner.load(memory_order_relaxed));
+    }
+    
+    ShmRing requests = segment.requests(index);
+    ShmRing responses = segment.responses(index);
+    bool progress = false;
+    for (size_t handled = 0; handled < MESSAGES_PER_TURN; handled++) {
+        if (!session.pending.empty()) {
+            if (!responses.write(session.pending)) {
+                // Ask the client to ring once it has read, then look again
+                // in case it already has
+                channel.server_blocked.store(1, memory_order_seq_cst);
+                atomic_thread_fence(memory_order_seq_cst);
+                if (!responses.write(session.pending)) {
+                    break;
+                }
+            }
+            session.pending.clear();
+            progress = true;
+        }
+        
+        string_view message;
+        if (!requests.peek(message, scratch)) {
+            if (!requests.empty()) {
+                logEvent(LogLevel::WARN, "malformed shared memory message", "channel", index,
+                         "pid", channel.owner.load(memory_order_relaxed));
+                release(index);
+                return true;
+            }
+            break;
+        }
+        process(channel.mode, message, session.pending);
+        requests.pop(message.size());
+        progress = true;
+    }
+    
+    if (progress) {
+        ringBell(channel.client_bell, channel.client_waiting);
+    }
+    return progress;
+}
+
+void ShmServer::process(ShmMode mode, string_view message, string& out) {
+    if (mode == ShmMode::BINARY) {
+        // Trailing bytes short of a whole request are ignored
+        for (size_t offset = 0; offset + sizeof(BinaryRequest) <= message.size();
+             offset += sizeof(BinaryRequest)) {
+            BinaryRequest request;
+            memcpy(&request, message.data() + offset, sizeof(request));
+            processor->processBinary(request, out);
+        }
+        return;
+    }
+    
+    processor->processCommand(message, out);
+    if (ShmRing::recordSize(out.size()) > segment.header()->ring_bytes) {
+        out = "ERROR|||Response too large for the shared memory ring";
+    }
+}
+
+// Back to FREE with empty rings, for the next client
+void ShmServer::release(size_t index) {
+    ShmChannel& channel = segment.channel(index);
+    Session& session = sessions[index];
+    if (session.attached) {
+        logEvent(LogLevel::INFO, "shared memory client detached", "channel", index,
+                 "pid", channel.owner.load(memory_order_relaxed));
+    }
+    session.attached = false;
+    session.pending.clear();
+    
+    channel.requests.head.store(0, memory_order_relaxed);
+    channel.requests.tail.store(0, memory_order_relaxed);
+    channel.responses.head.store(0, memory_order_relaxed);
+    channel.responses.tail.store(0, memory_order_relaxed);
+    channel.server_blocked.store(0, memory_order_relaxed);
+    channel.owner.store(0, memory_order_relaxed);
+    channel.state.store(ShmChannel::FREE, memory_order_release);
+}
+
+// Clients that exit without closing their channel would hold it forever
+void ShmServer::reapDeadClients() {
+    for (size_t i = 0; i < sessions.size(); i++) {
+        ShmChannel& channel = segment.channel(i);
+        uint32_t state = channel.state.load(memory_order_acquire);
+        int32_t owner = channel.owner.load(memory_order_relaxed);
+        if ((state == ShmChannel::OPEN || state == ShmChannel::CLAIMED) && owner != 0 &&
+            !processAlive(owner)) {
+            release(i);
+        }
+    }
+}
+
+// Client
+bool ShmClient::connect(const string& name, ShmMode mode, unsigned spin_us, string& error) {
+    close();
+    if (!segment.open(name, error)) {
+        return false;
+    }
+    ShmHeader* shared = segment.header();
+    if (!serverAlive()) {
+        error = "server not running";
+        segment.unmap();
+        return false;
+    }
+    
+    for (size_t i = 0; i < shared->channel_count; i++) {
+        ShmChannel& channel = segment.channel(i);
+        uint32_t expected = ShmChannel::FREE;
+        if (!channel.state.compare_exchange_strong(expected, ShmChannel::CLAIMED,
+                                                   memory_order_acquire)) {
+            continue;
+        }
+        channel.owner.store(getpid(), memory_order_relaxed);
+        channel.mode = mode;
+        channel.state.store(ShmChannel::OPEN, memory_order_release);
+        ringBell(shared->server_bell, shared->server_waiting);
+        
+        channel_index = i;
+        this->spin_us = spin_us;
+        requests = segment.requests(i);
+        responses = segment.responses(i);
+        return true;
+    }
+    error = "all " + to_string(shared->channel_count) + " channels are in use";
+    segment.unmap();
+    return false;
+}
+
+void ShmClient::close() {
+    if (segment.header() == nullptr) {
+        return;
+    }
+    ShmHeader* shared = segment.header();
+    segment.channel(channel_index).state.store(ShmChannel::CLOSED, memory_order_release);
+    ringBell(shared->server_bell, shared->server_waiting);
+    segment.unmap();
+}
+
+bool ShmClient::serverAlive() const {
+    return processAlive(segment.header()->server_pid.load(memory_order_seq_cst));
+}
+
+// Poll for spin_us, then sleep on the channel's bell; give up if the
+// server is gone
+template <typename Ready>
+bool ShmClient::waitFor(Ready ready) {
+    ShmChannel& channel = segment.channel(channel_index);
+    auto spin_until = chrono::steady_clock::now() + chrono::microseconds(spin_us);
+    while (true) {
+        uint32_t seen = channel.client_bell.load(memory_order_acquire);
+        if (ready()) {
+            return true;
+        }
+        if (spin_us > 0 && chrono::steady_clock::now() < spin_until) {
+            cpuRelax();
+            continue;
+        }
+        if (!serverAlive()) {
+            return false;
+        }
+        waitBell(channel.client_bell, channel.client_waiting, seen, 100);
+    }
+}
+
+bool ShmClient::send(string_view message) {
+    if (segment.header() == nullptr || ShmRing::recordSize(message.size()) > requests.capacity()) {
+        return false;
+    }
+    if (!waitFor([&] { return requests.write(message); })) {
+        return false;
+    }
+    ShmHeader* shared = segment.header();
+    ringBell(shared->server_bell, shared->server_waiting);
+    return true;
+}
+
+bool ShmClient::receive(string& message) {
+    if (segment.header() == nullptr) {
+        return false;
+    }
+    string_view view;
+    if (!waitFor([&] { return responses.peek(view, scratch); })) {
+        return false;
+    }
+    message.assign(view.data(), view.size());
+    responses.pop(view.size());
+    
+    // Pairs with the server's fence after it sets server_blocked
+    atomic_thread_fence(memory_order_seq_cst);
+    ShmChannel& channel = segment.channel(channel_index);
+    if (channel.server_blocked.load(memory_order_seq_cst) != 0) {
+        channel.server_blocked.store(0, memory_order_relaxed);
+        ShmHeader* shared = segment.header();
+        ringBell(shared->server_bell, shared->server_waiting);
+    }
+    return true;
+}
+
+#endif // __linux__
@@ -0,0 +1,276 @@
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "calculator.h"
+
+// Shared-memory transport for clients on the same host: no sockets, no
+// kernel copies, and no system call at all while both sides are busy.
+//
+// The server creates a POSIX shared memory segment (shm_open, mode 0600)
+// holding a fixed number of channels. A client maps the segment, claims a
+// free channel and talks to the server through the channel's two
+// single-producer, single-consumer rings: requests one way, responses the
+// other, one response per request and in order. A channel carries either
+// text commands (as on a TCP connection) or whole BinaryRequests, several
+// to a message if the client likes.
+//
+// Sleeping sides are woken through futexes in the segment: the server
+// waits on one bell for all channels, each client on its channel's own.
+// Either side may poll for a while (spin_us) before it sleeps, which buys
+// latency with CPU time and only pays off with a core to spare.
+//
+// Linux only, like the epoll event loop.
+
+// Default segment shape: 8 channels of 2 x 1 MiB
+const uint32_t DEFAULT_SHM_CHANNELS = 8;
+const size_t DEFAULT_SHM_RING_BYTES = 1 << 20;
+
+struct ShmOptions {
+    uint32_t channels = DEFAULT_SHM_CHANNELS;
+    size_t ring_bytes = DEFAULT_SHM_RING_BYTES;     // Per direction and channel, a power of two
+    unsigned spin_us = 0;                           // Poll this long before sleeping
+};
+
+#ifdef __linux__
+
+enum class ShmMode : uint32_t {
+    TEXT,       // Messages are commands and responses as on a TCP connection
+    BINARY      // Messages are whole BinaryRequests and BinaryResponses
+};
+
+// Producer and consumer positions of one ring, in bytes since the channel
+// was claimed, on cache lines of their own
+struct ShmRingIndex {
+    alignas(64) std::atomic<uint64_t> head;     // Consumed up to here
+    alignas(64) std::atomic<uint64_t> tail;     // Published up to here
+};
+
+// Layout of a segment:
+//
+//   ShmHeader
+//   ShmChannel[channel_count]
+//   per channel: request ring data, response ring data (ring_bytes each)
+struct ShmHeader {
+    char magic[8];              // "CALCSHM1", written last by the server
+    uint32_t channel_count;
+    uint32_t reserved;
+    uint64_t ring_bytes;
+    std::atomic<int32_t> server_pid;            // 0 once the server has stopped
+    alignas(64) std::atomic<uint32_t> server_bell;      // Bumped on every client action
+    std::atomic<uint32_t> server_waiting;
+};
+
+struct ShmChannel {
+    enum State : uint32_t {
+        FREE,
+        CLAIMED,        // A client is setting it up
+        OPEN,
+        CLOSED          // Given up by the client; the server frees it
+    };
+    
+    alignas(64) std::atomic<uint32_t> state;
+    ShmMode mode;
+    std::atomic<int32_t> owner;                 // Client process
+    std::atomic<uint32_t> server_blocked;       // Server holds a response the ring had no room for
+    alignas(64) std::atomic<uint32_t> client_bell;      // Bumped on every server action
+    std::atomic<uint32_t> client_waiting;
+    ShmRingIndex requests;
+    ShmRingIndex responses;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+              std::atomic<uint32_t>::is_always_lock_free &&
+              std::atomic<int32_t>::is_always_lock_free,
+              "Shared-memory atomics must be lock-free to work across processes");
+
+// One direction of a channel: messages of any size up to capacity() - 8,
+// each an 8-byte length and the bytes, padded to 8 bytes. The producer only
+// moves tail and the consumer only head.
+class ShmRing {
+public:
+    ShmRing() : index(nullptr), data(nullptr), size(0) {}
+    ShmRing(ShmRingIndex* index, char* data, uint64_t size) : index(index), data(data), size(size) {}
+    
+    static uint64_t recordSize(size_t length) { return (8 + length + 7) & ~uint64_t(7); }
+    uint64_t capacity() const { return size; }
+    
+    // Producer: false if there is no room for the message right now
+    bool write(std::string_view message) {
+        uint64_t tail = index->tail.load(std::memory_order_relaxed);
+        uint64_t head = index->head.load(std::memory_order_acquire);
+        uint64_t needed = recordSize(message.size());
+        if (needed > size - (tail - head)) {
+            return false;
+        }
+        uint64_t length = message.size();
+        copyIn(tail, &length, sizeof(length));
+        copyIn(tail + sizeof(length), message.data(), message.size());
+        index->tail.store(tail + needed, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer: the oldest message, viewed in place unless it wraps around
+    // the end of the ring, in which case it is copied to scratch. Stays
+    // valid until pop(). False if the ring is empty, or if what the other
+    // process wrote makes no sense (then empty() is false).
+    bool peek(std::string_view& message, std::string& scratch) const {
+        uint64_t head = index->head.load(std::memory_order_relaxed);
+        uint64_t available = index->tail.load(std::memory_order_acquire) - head;
+        if (available == 0) {
+            return false;
+        }
+        uint64_t length;
+        memcpy(&length, data + (head & (size - 1)), sizeof(length));
+        if (available > size || length > available - sizeof(length)) {
+            return false;
+        }
+        uint64_t start = (head + sizeof(length)) & (size - 1);
+        if (start + length <= size) {
+            message = std::string_view(data + start, length);
+        } else {
+            scratch.assign(data + start, size - start);
+            scratch.append(data, length - (size - start));
+            message = scratch;
+        }
+        return true;
+    }
+    
+    bool empty() const {
+        return index->tail.load(std::memory_order_acquire) ==
+               index->head.load(std::memory_order_relaxed);
+    }
+    
+    void pop(size_t length) {
+        uint64_t head = index->head.load(std::memory_order_relaxed);
+        index->head.store(head + recordSize(length), std::memory_order_release);
+    }
+    
+private:
+    ShmRingIndex* index;
+    char* data;
+    uint64_t size;              // Power of two
+    
+    void copyIn(uint64_t position, const void* bytes, size_t count) {
+        size_t offset = position & (size - 1);
+        size_t first = count < size - offset ? count : size - offset;
+        memcpy(data + offset, bytes, first);
+        memcpy(data, static_cast<const char*>(bytes) + first, count - first);
+    }
+};
+
+// A mapped segment, as either side sees it
+class ShmSegment {
+public:
+    ShmSegment() : base(nullptr), length(0) {}
+    ~ShmSegment() { unmap(); }
+    
+    ShmSegment(const ShmSegment&) = delete;
+    ShmSegment& operator=(const ShmSegment&) = delete;
+    
+    // Server: replace any segment of that name with a fresh one
+    bool create(const std::string& name, const ShmOptions& options, std::string& error);
+    // Client: map the segment a running server created
+    bool open(const std::string& name, std::string& error);
+    void unmap();
+    
+    ShmHeader* header() const { return static_cast<ShmHeader*>(base); }
+    ShmChannel& channel(size_t i) const;
+    ShmRing requests(size_t i) const;
+    ShmRing responses(size_t i) const;
+    
+    // "/name" as shm_open wants it
+    static std::string objectName(const std::string& name);
+    
+private:
+    void* base;
+    size_t length;
+    
+    static size_t channelsOffset();
+    static size_t dataOffset(uint32_t channel_count);
+};
+
+// Server side: one thread with its own CommandProcessor serving every
+// channel of the segment, next to the TCP workers
+class ShmServer {
+public:
+    ShmServer(const std::string& name, const ShmOptions& options,
+              std::unique_ptr<CommandProcessor> processor);
+    ~ShmServer();
+    
+    // Create the segment and start serving; false (and logged) on failure
+    bool start();
+    // Stop serving, wake every waiting client and remove the segment
+    void stop();
+    
+private:
+    // Server-side state of a channel
+    struct Session {
+        bool attached = false;
+        std::string pending;    // Response waiting for room in the ring
+    };
+    
+    static const int REAP_INTERVAL_MS = 100;    // Check for dead clients this often
+    static const size_t MESSAGES_PER_TURN = 64; // Then the next channel gets its turn
+    
+    std::string name;
+    ShmOptions options;
+    std::unique_ptr<CommandProcessor> processor;
+    ShmSegment segment;
+    std::vector<Session> sessions;
+    std::string scratch;
+    std::thread server_thread;
+    std::atomic<bool> stopping;
+    
+    void run();
+    bool serve(size_t channel);
+    void process(ShmMode mode, std::string_view message, std::string& out);
+    void release(size_t channel);
+    void reapDeadClients();
+};
+
+// Client side, for same-host programs (batch jobs, benchmarks). One
+// channel per client; not thread-safe.
+class ShmClient {
+public:
+    ShmClient() : channel_index(0), spin_us(0) {}
+    ~ShmClient() { close(); }
+    
+    ShmClient(const ShmClient&) = delete;
+    ShmClient& operator=(const ShmClient&) = delete;
+    
+    bool connect(const std::string& name, ShmMode mode, unsigned spin_us, std::string& error);
+    // Queue one message, waiting while the ring is full. A client that
+    // sends several before receiving must keep receiving, as on TCP.
+    bool send(std::string_view message);
+    // Wait for the next response; false if the server went away
+    bool receive(std::string& message);
+    bool call(std::string_view request, std::string& response) {
+        return send(request) && receive(response);
+    }
+    void close();
+    
+private:
+    ShmSegment segment;
+    size_t channel_index;
+    unsigned spin_us;
+    ShmRing requests;
+    ShmRing responses;
+    std::string scratch;
+    
+    template <typename Ready>
+    bool waitFor(Ready ready);
+    bool serverAlive() const;
+};
+
+#endif // __linux__
+
+#endif // SHM_TRANSPORT_H
@@ -0,0 +1,261 @@
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+static const uint64_t START_TICKS = readClock();
+static const chrono::steady_clock::time_point START_TIME = chrono::steady_clock::now();
+
+double ticksPerSecond() {
+#ifdef STATS_HAVE_TSC
+    // Calibrate over at least 10 ms; the longer the server runs, the
+    // better the estimate
+    const chrono::milliseconds minimum(10);
+    chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - START_TIME;
+    if (elapsed < minimum) {
+        this_thread::sleep_for(minimum - elapsed);
+    }
+    uint64_t ticks = readClock();
+    chrono::duration<double> seconds = chrono::steady_clock::now() - START_TIME;
+    return static_cast<double>(ticks - START_TICKS) / seconds.count();
+#else
+    return 1e9;
+#endif
+}
+
+const char* phaseName(Phase phase) {
+    switch (phase) {
+        case Phase::PARSE: return "parse";
+        case Phase::COMPUTE: return "compute";
+        case Phase::HISTORY: return "history";
+        case Phase::TOTAL: return "total";
+    }
+    return "unknown";
+}
+
+// Histograms
+uint64_t HistogramSnapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    
+    uint64_t rank = static_cast<uint64_t>(ceil(q * static_cast<double>(count)));
+    rank = std::min(std::max<uint64_t>(rank, 1), count);
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < counts.size(); bucket++) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            // Middle of the bucket, but never past the largest sample
+            uint64_t start = LatencyHistogram::bucketStart(bucket);
+            uint64_t width = bucket + 1 < LatencyHistogram::BUCKETS
+                                 ? LatencyHistogram::bucketStart(bucket + 1) - start
+                                 : 1;
+            return std::min(start + width / 2, max);
+        }
+    }
+    return max;
+}
+
+void LatencyHistogram::clear() {
+    for (atomic<uint64_t>& bucket : counts) {
+        bucket.store(0, memory_order_relaxed);
+    }
+    count.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+    max.store(0, memory_order_relaxed);
+}
+
+void LatencyHistogram::addTo(HistogramSnapshot& snapshot) const {
+    snapshot.counts.resize(BUCKETS);
+    for (size_t i = 0; i < BUCKETS; i++) {
+        snapshot.counts[i] += counts[i].load(memory_order_relaxed);
+    }
+    snapshot.count += count.load(memory_order_relaxed);
+    snapshot.sum += sum.load(memory_order_relaxed);
+    snapshot.max = std::max(snapshot.max, max.load(memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::bucketStart(size_t bucket) {
+    size_t group = bucket >> SUB_BUCKET_BITS;
+    if (group == 0) {
+        return bucket;
+    }
+    uint64_t sub_bucket = bucket & ((size_t(1) << SUB_BUCKET_BITS) - 1);
+    return ((uint64_t(1) << SUB_BUCKET_BITS) + sub_bucket) << (group - 1);
+}
+
+// Snapshots
+uint64_t StatsSnapshot::requests() const {
+    uint64_t total = 0;
+    for (const CommandSnapshot& command : commands) {
+        total += command.requests;
+    }
+    return total;
+}
+
+uint64_t StatsSnapshot::errors() const {
+    uint64_t total = 0;
+    for (const CommandSnapshot& command : commands) {
+        total += command.errors;
+    }
+    return total;
+}
+
+static const double SUMMARY_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+static void writeSummary(ostringstream& out, const string& labels, const HistogramSnapshot& latency,
+                         double ticks_per_second) {
+    for (double q : SUMMARY_QUANTILES) {
+        out << "calculator_request_duration_seconds{" << labels << ",quantile=\"" << q << "\"} "
+            << latency.quantile(q) / ticks_per_second << "\n";
+    }
+    out << "calculator_request_duration_seconds_sum{" << labels << "} "
+        << latency.sum / ticks_per_second << "\n";
+    out << "calculator_request_duration_seconds_count{" << labels << "} " << latency.count << "\n";
+}
+
+string StatsSnapshot::prometheus() const {
+    ostringstream out;
+    out.precision(9);
+    
+    out << "# HELP calculator_requests_total Requests handled, by command.\n"
+        << "# TYPE calculator_requests_total counter\n";
+    for (const CommandSnapshot& command : commands) {
+        if (command.requests > 0) {
+            out << "calculator_requests_total{command=\"" << command.name << "\"} "
+                << command.requests << "\n";
+        }
+    }
+    
+    out << "# HELP calculator_errors_total Requests answered with ERROR, by command.\n"
+        << "# TYPE calculator_errors_total counter\n";
+    for (const CommandSnapshot& command : commands) {
+        if (command.requests > 0) {
+            out << "calculator_errors_total{command=\"" << command.name << "\"} "
+                << command.errors << "\n";
+        }
+    }
+    
+    out << "# HELP calculator_request_duration_seconds Request latency by command and phase; "
+           "send is per flush.\n"
+        << "# TYPE calculator_request_duration_seconds summary\n";
+    for (const CommandSnapshot& command : commands) {
+        if (command.requests == 0) {
+            continue;
+        }
+        for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+            string labels = "command=\"" + command.name + "\",phase=\"" +
+                            phaseName(static_cast<Phase>(phase)) + "\"";
+            writeSummary(out, labels, command.phases[phase], ticks_per_second);
+        }
+    }
+    if (send.count > 0) {
+        writeSummary(out, "phase=\"send\"", send, ticks_per_second);
+    }
+    return out.str();
+}
+
+// Registry of every RequestStats, for collect() and resetAll()
+atomic<bool> RequestStats::enabled(true);
+atomic<uint32_t> RequestStats::sample_interval(DEFAULT_STATS_SAMPLE_INTERVAL);
+
+void RequestStats::setSampleInterval(uint32_t interval) {
+    sample_interval.store(std::max(interval, 1u), memory_order_relaxed);
+}
+
+static mutex& registryMutex() {
+    static mutex registry_mutex;
+    return registry_mutex;
+}
+
+static vector<RequestStats*>& registry() {
+    static vector<RequestStats*> instances;
+    return instances;
+}
+
+RequestStats::RequestStats(const vector<string>& command_names)
+    : commands(new Command[command_names.size()]), command_count(command_names.size()),
+      countdown(1) {
+    for (size_t i = 0; i < command_count; i++) {
+        commands[i].name = command_names[i];
+        commands[i].requests.store(0, memory_order_relaxed);
+        commands[i].errors.store(0, memory_order_relaxed);
+    }
+    
+    lock_guard<mutex> lock(registryMutex());
+    registry().push_back(this);
+}
+
+RequestStats::~RequestStats() {
+    lock_guard<mutex> lock(registryMutex());
+    vector<RequestStats*>& instances = registry();
+    instances.erase(remove(instances.begin(), instances.end(), this), instances.end());
+}
+
+StatsSnapshot RequestStats::collect() {
+    StatsSnapshot snapshot;
+    snapshot.send.counts.resize(LatencyHistogram::BUCKETS);
+    map<string, size_t> index;
+    
+    lock_guard<mutex> lock(registryMutex());
+    for (const RequestStats* stats : registry()) {
+        for (size_t i = 0; i < stats->command_count; i++) {
+            const Command& command = stats->commands[i];
+            auto found = index.emplace(command.name, snapshot.commands.size());
+            if (found.second) {
+                snapshot.commands.emplace_back();
+                snapshot.commands.back().name = command.name;
+            }
+            
+            CommandSnapshot& merged = snapshot.commands[found.first->second];
+            merged.requests += command.requests.load(memory_order_relaxed);
+            merged.errors += command.errors.load(memory_order_relaxed);
+            for (size_t phase = 0; phase < PHASE_COUNT; phase++) {
+                command.phases[phase].addTo(merged.phases[phase]);
+            }
+        }
+        stats->send.addTo(snapshot.send);
+    }
+    
+    snapshot.ticks_per_second = ticksPerSecond();
+    return snapshot;
+}
+
+void RequestStats::resetAll() {
+    lock_guard<mutex> lock(registryMutex());
+    for (RequestStats* stats : registry()) {
+        for (size_t i = 0; i < stats->command_count; i++) {
+            Command& command = stats->commands[i];
+            command.requests.store(0, memory_order_relaxed);
+            command.errors.store(0, memory_order_relaxed);
+            for (LatencyHistogram& phase : command.phases) {
+                phase.clear();
+            }
+        }
+        stats->send.clear();
+    }
+}
+
+bool RequestStats::writePrometheus(const string& path) {
+    string text = collect().prometheus();
+    string temporary = path + ".tmp";
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file.write(text.data(), text.size());
+    file.close();
+    if (!file) {
+        remove(temporary.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // rename() does not replace an existing file there
+    remove(path.c_str());
+#endif
+    return rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,240 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define STATS_HAVE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define STATS_HAVE_TSC 1
+#endif
+
+// Tick counter for latency measurement: the TSC where there is one (a few
+// nanoseconds to read, no system call), steady_clock nanoseconds elsewhere.
+// Ticks are converted to time only when statistics are read.
+inline uint64_t readClock() {
+#ifdef STATS_HAVE_TSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// readClock() ticks per second, measured against steady_clock since startup
+double ticksPerSecond();
+
+// Where a request spends its time. PARSE is splitting off and looking up
+// the command name; COMPUTE is the handler (argument conversion included)
+// minus HISTORY, the time spent recording results; TOTAL is all three.
+// Sending is timed per flush, not per command, since one send() carries
+// many pipelined responses.
+enum class Phase {
+    PARSE,
+    COMPUTE,
+    HISTORY,
+    TOTAL
+};
+
+const size_t PHASE_COUNT = 4;
+
+// "parse", "compute", ...
+const char* phaseName(Phase phase);
+
+// Counts of a LatencyHistogram, merged and ready to query
+struct HistogramSnapshot {
+    std::vector<uint64_t> counts;
+    uint64_t count = 0;
+    uint64_t sum = 0;           // Ticks
+    uint64_t max = 0;
+    
+    // Value at quantile q (0 to 1) in ticks, to within a bucket
+    uint64_t quantile(double q) const;
+};
+
+// Log-linear latency histogram in the style of HdrHistogram: every power
+// of two is split into 16 linear sub-buckets, so a recorded value is known
+// to within 1/16 of itself, from 1 tick up to 2^44 ticks in 656 buckets.
+//
+// One thread records and any thread may read. Recording is a handful of
+// relaxed loads and stores with no locked instruction; a reader racing
+// the writer may see a sample in some counters and not yet in others.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int MAX_MAGNITUDE = 44;
+    static const size_t BUCKETS = size_t(MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+    
+    LatencyHistogram() { clear(); }
+    
+    void record(uint64_t ticks) {
+        bump(counts[bucketOf(ticks)], 1);
+        bump(count, 1);
+        bump(sum, ticks);
+        if (ticks > max.load(std::memory_order_relaxed)) {
+            max.store(ticks, std::memory_order_relaxed);
+        }
+    }
+    
+    void clear();
+    void addTo(HistogramSnapshot& snapshot) const;
+    
+    static size_t bucketOf(uint64_t ticks) {
+        if (ticks < (uint64_t(1) << SUB_BUCKET_BITS)) {
+            return static_cast<size_t>(ticks);
+        }
+        int magnitude = highestBit(ticks);
+        if (magnitude >= MAX_MAGNITUDE) {
+            return BUCKETS - 1;
+        }
+        // Power of two above the linear range, then the next 4 bits
+        size_t group = magnitude - SUB_BUCKET_BITS + 1;
+        size_t sub_bucket = (ticks >> (magnitude - SUB_BUCKET_BITS)) &
+                            ((size_t(1) << SUB_BUCKET_BITS) - 1);
+        return (group << SUB_BUCKET_BITS) | sub_bucket;
+    }
+    // Smallest value that falls in the bucket
+    static uint64_t bucketStart(size_t bucket);
+    
+private:
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+    
+    static int highestBit(uint64_t value) {
+#if defined(__GNUC__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+        while (value >>= 1) {
+            bit++;
+        }
+        return bit;
+#endif
+    }
+    
+    // Single writer: a plain load + store is enough
+    static void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount,
+                      std::memory_order_relaxed);
+    }
+};
+
+// Everything RequestStats knows, summed over all of them
+struct CommandSnapshot {
+    std::string name;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    HistogramSnapshot phases[PHASE_COUNT];
+};
+
+struct StatsSnapshot {
+    std::vector<CommandSnapshot> commands;
+    HistogramSnapshot send;
+    double ticks_per_second = 1e9;
+    
+    uint64_t requests() const;
+    uint64_t errors() const;
+    
+    // Prometheus text exposition format: request and error counters and a
+    // latency summary (quantiles, sum, count) per command and phase
+    std::string prometheus() const;
+};
+
+// Default of RequestStats::setSampleInterval
+const uint32_t DEFAULT_STATS_SAMPLE_INTERVAL = 8;
+
+// Request counters and latency histograms of one thread, keyed by command
+// index. Every instance registers itself so STATS and the metrics file can
+// report the whole process; recording is lock-free and only the thread
+// that owns an instance may record into it.
+//
+// Every request is counted, but only one in sampleInterval() is timed:
+// reading the TSC costs 20-40 ns under virtualization, and a request needs
+// three or four reads. Which requests are timed does not depend on their
+// latency, so the histograms stay unbiased.
+class RequestStats {
+public:
+    explicit RequestStats(const std::vector<std::string>& command_names);
+    ~RequestStats();
+    
+    RequestStats(const RequestStats&) = delete;
+    RequestStats& operator=(const RequestStats&) = delete;
+    
+    // Whether to time the next request
+    bool sample() {
+        if (--countdown != 0) {
+            return false;
+        }
+        countdown = sample_interval.load(std::memory_order_relaxed);
+        return true;
+    }
+    
+    void count(size_t command, bool error) {
+        Command& stats = commands[command];
+        bump(stats.requests);
+        if (error) {
+            bump(stats.errors);
+        }
+    }
+    
+    void record(size_t command, uint64_t parse_ticks, uint64_t compute_ticks,
+                uint64_t history_ticks) {
+        Command& stats = commands[command];
+        stats.phases[static_cast<size_t>(Phase::PARSE)].record(parse_ticks);
+        stats.phases[static_cast<size_t>(Phase::COMPUTE)].record(compute_ticks);
+        stats.phases[static_cast<size_t>(Phase::HISTORY)].record(history_ticks);
+        stats.phases[static_cast<size_t>(Phase::TOTAL)].record(parse_ticks + compute_ticks +
+                                                               history_ticks);
+    }
+    
+    void recordSend(uint64_t ticks) { send.record(ticks); }
+    
+    // Process-wide switch; on by default
+    static void setEnabled(bool on) { enabled.store(on, std::memory_order_relaxed); }
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    // Time one request in `interval` (at least 1), per instance
+    static void setSampleInterval(uint32_t interval);
+    static uint32_t sampleInterval() { return sample_interval.load(std::memory_order_relaxed); }
+    
+    // Sum of every registered instance. Instances with different command
+    // lists are merged by name.
+    static StatsSnapshot collect();
+    // Zero every registered instance. Samples recorded concurrently may
+    // survive, partly or whole.
+    static void resetAll();
+    // Write collect().prometheus() to path through a temporary file, so a
+    // reader never sees a partial file
+    static bool writePrometheus(const std::string& path);
+    
+private:
+    struct Command {
+        std::string name;
+        std::atomic<uint64_t> requests;
+        std::atomic<uint64_t> errors;
+        LatencyHistogram phases[PHASE_COUNT];
+    };
+    
+    std::unique_ptr<Command[]> commands;
+    size_t command_count;
+    LatencyHistogram send;
+    uint32_t countdown;
+    
+    static std::atomic<bool> enabled;
+    static std::atomic<uint32_t> sample_interval;
+    
+    static void bump(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+#endif // STATS_H
@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#include "calculator.h"
+#include "test_support.h"
+
+using namespace std;
+
+// Every allocation goes through this operator new; those made on a thread
+// while it counts are tallied. The history writer and the other threads
+// are left out.
+static thread_local bool counting = false;
+static thread_local size_t allocations = 0;
+
+void* operator new(size_t size) {
+    if (counting) {
+        allocations++;
+    }
+    void* memory = malloc(size > 0 ? size : 1);
+    if (!memory) {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept {
+    free(memory);
+}
+
+// Allocations made by `count` runs of the commands, once each has been
+// run a few times to settle the buffers they reuse
+static size_t allocationsFor(const vector<string>& commands, size_t count) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100000);
+    string response;
+    for (size_t i = 0; i < 16 * commands.size(); i++) {
+        response.clear();
+        processor.processCommand(commands[i % commands.size()], response);
+    }
+    
+    allocations = 0;
+    counting = true;
+    for (size_t i = 0; i < count; i++) {
+        response.clear();
+        processor.processCommand(commands[i % commands.size()], response);
+    }
+    counting = false;
+    return allocations;
+}
+
+TEST(counterSeesAllocations) {
+    counting = true;
+    allocations = 0;
+    string* text = new string(100, 'x');
+    counting = false;
+    delete text;
+    CHECK(allocations > 0);
+}
+
+TEST(warmArithmeticDoesNotAllocate) {
+    CHECK_EQ(allocationsFor({"ADD 1.5 2.25", "ADD 1e300 -3", "ADD 7 8"}, 1000), size_t(0));
+    CHECK_EQ(allocationsFor({"MUL 3 0.125", "MUL -2.5 4e-7"}, 1000), size_t(0));
+    CHECK_EQ(allocationsFor({"SIN 0.5", "SIN 3", "SIN 123.456"}, 1000), size_t(0));
+}
+
+TEST(responsesStayCorrect) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    string response;
+    processor.processCommand("MUL 3 0.125", response);
+    CHECK_EQ(response, "SUCCESS|3.000000 * 0.125000|0.375");
+}
+
+TEST_MAIN()
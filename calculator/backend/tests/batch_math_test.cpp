@@ -0,0 +1,292 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+#include "batch_math.h"
+#include "test_support.h"
+
+using namespace std;
+
+// Accuracy of the batch kernels against libm. The degree-space
+// trigonometric kernels are checked against long double references that
+// reduce the same way (exactly, in degrees), because libm's sin(x * pi / 180)
+// is not the function they compute.
+
+static const double INF = numeric_limits<double>::infinity();
+
+// Distance in units in the last place; NaNs only match NaNs
+static uint64_t ulps(double a, double b) {
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::isnan(a) && std::isnan(b) ? 0 : UINT64_MAX;
+    }
+    auto ordered = [](double x) {
+        int64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        return bits < 0 ? INT64_MIN - bits : bits;
+    };
+    int64_t x = ordered(a);
+    int64_t y = ordered(b);
+    return x > y ? uint64_t(x) - uint64_t(y) : uint64_t(y) - uint64_t(x);
+}
+
+static bool sameBits(double a, double b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// sin and cos of an angle in degrees, reduced to |r| <= 45 exactly before
+// the conversion to radians
+static void referenceSinCos(double degrees, long double& sine, long double& cosine) {
+    long double reduced = fmodl(degrees, 360.0L);
+    long double quadrant = nearbyintl(reduced / 90.0L);
+    long double r = (reduced - 90.0L * quadrant) * (3.14159265358979323846264338327950288L / 180.0L);
+    long double s = sinl(r);
+    long double c = cosl(r);
+    switch ((static_cast<long>(quadrant) % 4 + 4) % 4) {
+        case 0: sine = s; cosine = c; break;
+        case 1: sine = c; cosine = -s; break;
+        case 2: sine = -s; cosine = -c; break;
+        default: sine = -c; cosine = s; break;
+    }
+}
+
+static vector<double> angles(double range, size_t count, uint32_t seed) {
+    mt19937_64 random(seed);
+    uniform_real_distribution<double> angle(-range, range);
+    vector<double> values(count);
+    for (double& value : values) {
+        value = angle(random);
+    }
+    return values;
+}
+
+// Worst error of a kernel over inputs, in ulps
+static uint64_t worstUlps(BatchMath::Kernel kernel, const vector<double>& inputs,
+                          double (*reference)(double)) {
+    vector<double> results(inputs.size());
+    kernel(inputs.data(), results.data(), nullptr, inputs.size());
+    uint64_t worst = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        worst = max(worst, ulps(results[i], reference(inputs[i])));
+    }
+    return worst;
+}
+
+static double referenceSin(double degrees) {
+    long double s, c;
+    referenceSinCos(degrees, s, c);
+    return double(s);
+}
+
+static double referenceCos(double degrees) {
+    long double s, c;
+    referenceSinCos(degrees, s, c);
+    return double(c);
+}
+
+// NaN at the poles, where the kernel reports an error lane
+static double referenceTan(double degrees) {
+    long double s, c;
+    referenceSinCos(degrees, s, c);
+    return c == 0 ? numeric_limits<double>::quiet_NaN() : double(s / c);
+}
+
+TEST(trigonometryWithinOneUlp) {
+    for (double range : {360.0, 1e6, 1e13}) {
+        vector<double> inputs = angles(range, 200000, 42);
+        CHECK(worstUlps(BatchMath::sin, inputs, referenceSin) <= 1);
+        CHECK(worstUlps(BatchMath::cos, inputs, referenceCos) <= 1);
+        CHECK(worstUlps(BatchMath::tan, inputs, referenceTan) <= 1);
+    }
+}
+
+TEST(trigonometryExactAtMultiplesOf90) {
+    // sinPi/cosPi conventions: sin keeps the sign of a zero angle and is
+    // -0 at negative multiples of 180, cos is always +0
+    for (long k = -12; k <= 12; k++) {
+        double degrees = 90.0 * k;
+        double sine = BatchMath::sinDegrees(degrees);
+        double cosine = BatchMath::cosDegrees(degrees);
+        static const double SINES[4] = {0.0, 1.0, 0.0, -1.0};
+        static const double COSINES[4] = {1.0, 0.0, -1.0, 0.0};
+        long quadrant = (k % 4 + 4) % 4;
+        CHECK_EQ(sine, SINES[quadrant]);
+        CHECK_EQ(cosine, COSINES[quadrant]);
+        if (cosine == 0.0) {
+            CHECK(!signbit(cosine));
+        }
+        if (sine == 0.0) {
+            CHECK_EQ(bool(signbit(sine)), k < 0);
+        }
+    }
+    CHECK(sameBits(BatchMath::sinDegrees(-0.0), -0.0));
+}
+
+TEST(trigonometryExactAtCommonAngles) {
+    CHECK_EQ(BatchMath::sinDegrees(30.0), 0.5);
+    CHECK_EQ(BatchMath::sinDegrees(150.0), 0.5);
+    CHECK_EQ(BatchMath::sinDegrees(-30.0), -0.5);
+    CHECK_EQ(BatchMath::cosDegrees(60.0), 0.5);
+    CHECK_EQ(BatchMath::cosDegrees(120.0), -0.5);
+    CHECK_EQ(BatchMath::tanDegrees(45.0), 1.0);
+    CHECK_EQ(BatchMath::tanDegrees(-45.0), -1.0);
+    CHECK_EQ(BatchMath::tanDegrees(135.0), -1.0);
+    CHECK_EQ(BatchMath::tanDegrees(180.0), 0.0);
+    // Correctly rounded
+    CHECK_EQ(BatchMath::sinDegrees(45.0), sqrt(0.5));
+    CHECK_EQ(BatchMath::tanDegrees(60.0), sqrt(3.0));
+    CHECK_EQ(BatchMath::tanDegrees(30.0), 0.57735026918962573);
+}
+
+TEST(tangentUndefinedAt90Plus180k) {
+    // The fifth is past 2^46 and goes through the fmod path
+    vector<double> inputs = {90.0, -90.0, 270.0, 450.0, 180.0 * 1099511627776.0 + 90.0, 89.0, 91.0};
+    vector<double> results(inputs.size());
+    vector<uint8_t> errors(inputs.size());
+    CHECK_EQ(BatchMath::tan(inputs.data(), results.data(), errors.data(), inputs.size()), size_t(5));
+    for (size_t i = 0; i < inputs.size(); i++) {
+        bool undefined = i < 5;
+        CHECK_EQ(errors[i], uint8_t(undefined ? 1 : 0));
+        CHECK_EQ(bool(std::isnan(results[i])), undefined);
+        CHECK(std::isinf(BatchMath::tanDegrees(inputs[i])) == undefined);
+    }
+}
+
+TEST(hugeAnglesReduceExactly) {
+    // At and beyond 2^46 degrees the kernels reduce with fmod first; a
+    // multiple of 360 plus an angle must give that angle's value
+    const double turns = 360.0 * 4398046511104.0;  // 360 * 2^42, > 2^46
+    for (double offset : {0.0, 30.0, 45.0, 90.0, 180.0, 270.0, 360.0 * 1024}) {
+        double degrees = turns + offset;
+        CHECK_EQ(BatchMath::sinDegrees(degrees), BatchMath::sinDegrees(offset));
+        CHECK_EQ(BatchMath::cosDegrees(degrees), BatchMath::cosDegrees(offset));
+    }
+    CHECK_EQ(BatchMath::sinDegrees(1e300), BatchMath::sinDegrees(fmod(1e300, 360.0)));
+    
+    // The batch path takes the scalar fix-up for the lanes that need it
+    vector<double> inputs = {1.0, turns + 30.0, 2.0, -turns - 90.0, 3.0, 9e15 + 1.0};
+    vector<double> results(inputs.size());
+    BatchMath::sin(inputs.data(), results.data(), nullptr, inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        CHECK(sameBits(results[i], BatchMath::sinDegrees(inputs[i])));
+        CHECK(ulps(results[i], referenceSin(inputs[i])) <= 1);
+    }
+}
+
+TEST(nonFiniteAngles) {
+    for (double degrees : {INF, -INF, numeric_limits<double>::quiet_NaN()}) {
+        CHECK(std::isnan(BatchMath::sinDegrees(degrees)));
+        CHECK(std::isnan(BatchMath::cosDegrees(degrees)));
+    }
+}
+
+TEST(sinCosMatchesSinAndCos) {
+    vector<double> inputs = angles(1e5, 10000, 7);
+    vector<double> sines(inputs.size()), cosines(inputs.size());
+    vector<double> expected_sines(inputs.size()), expected_cosines(inputs.size());
+    BatchMath::sinCos(inputs.data(), sines.data(), cosines.data(), inputs.size());
+    BatchMath::sin(inputs.data(), expected_sines.data(), nullptr, inputs.size());
+    BatchMath::cos(inputs.data(), expected_cosines.data(), nullptr, inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        CHECK(sameBits(sines[i], expected_sines[i]));
+        CHECK(sameBits(cosines[i], expected_cosines[i]));
+    }
+}
+
+static double libmLog10(double x) { return std::log10(x); }
+static double libmLog(double x) { return std::log(x); }
+static double libmExp(double x) { return std::exp(x); }
+
+static vector<double> logInputs() {
+    mt19937_64 random(11);
+    uniform_real_distribution<double> exponent(-300.0, 300.0);
+    uniform_real_distribution<double> near_one(0.5, 2.0);
+    vector<double> values;
+    for (int i = 0; i < 100000; i++) {
+        values.push_back(pow(10.0, exponent(random)));
+        values.push_back(near_one(random));
+    }
+    values.push_back(numeric_limits<double>::denorm_min());
+    values.push_back(numeric_limits<double>::min());
+    values.push_back(numeric_limits<double>::max());
+    return values;
+}
+
+// libm is within an ulp of the true value itself; the kernels were
+// specified to stay within 3 ulps and do better
+TEST(logarithmsWithinTwoUlps) {
+    vector<double> inputs = logInputs();
+    CHECK(worstUlps(BatchMath::ln, inputs, libmLog) <= 1);
+    CHECK(worstUlps(BatchMath::log10, inputs, libmLog10) <= 2);
+    
+    double exact[] = {1.0, 10.0, 100.0, 1e22};
+    double results[4];
+    BatchMath::log10(exact, results, nullptr, 4);
+    CHECK_EQ(results[0], 0.0);
+    CHECK_EQ(results[1], 1.0);
+    CHECK_EQ(results[2], 2.0);
+    CHECK_EQ(results[3], 22.0);
+}
+
+TEST(logarithmDomainErrors) {
+    vector<double> inputs = {-1.0, 0.0, -0.0, 1.0, INF, -INF};
+    vector<double> results(inputs.size());
+    vector<uint8_t> errors(inputs.size());
+    CHECK_EQ(BatchMath::ln(inputs.data(), results.data(), errors.data(), inputs.size()), size_t(4));
+    vector<uint8_t> expected = {1, 1, 1, 0, 0, 1};
+    CHECK(errors == expected);
+    CHECK(std::isnan(results[0]));
+    CHECK_EQ(results[3], 0.0);
+    CHECK_EQ(results[4], INF);
+}
+
+TEST(exponentialWithinOneUlp) {
+    mt19937_64 random(5);
+    uniform_real_distribution<double> argument(-745.0, 709.7);
+    vector<double> inputs(200000);
+    for (double& value : inputs) {
+        value = argument(random);
+    }
+    CHECK(worstUlps(BatchMath::exp, inputs, libmExp) <= 1);
+    
+    double special[] = {0.0, 1.0, 710.0, -746.0, INF, -INF};
+    double results[6];
+    CHECK_EQ(BatchMath::exp(special, results, nullptr, 6), size_t(0));
+    CHECK_EQ(results[0], 1.0);
+    CHECK_EQ(results[2], INF);
+    CHECK_EQ(results[3], 0.0);
+    CHECK_EQ(results[4], INF);
+    CHECK_EQ(results[5], 0.0);
+}
+
+TEST(squareRootAndPowerMatchLibm) {
+    vector<double> inputs = logInputs();
+    vector<double> results(inputs.size());
+    BatchMath::sqrt(inputs.data(), results.data(), nullptr, inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        CHECK(sameBits(results[i], std::sqrt(inputs[i])));
+    }
+    
+    double negative[] = {-4.0, 4.0};
+    uint8_t errors[2];
+    CHECK_EQ(BatchMath::sqrt(negative, results.data(), errors, 2), size_t(1));
+    CHECK_EQ(errors[0], uint8_t(1));
+    CHECK_EQ(errors[1], uint8_t(0));
+    
+    double bases[] = {3.0, -3.0, 2.0, 16.0, 1.5, -8.0};
+    double exponents[] = {2.0, 1.0, 0.5, 0.5, 3.7, 1.0 / 3.0};
+    double powers[6];
+    BatchMath::power(bases, exponents, powers, nullptr, 6);
+    for (int i = 0; i < 6; i++) {
+        CHECK(sameBits(powers[i], std::pow(bases[i], exponents[i])));
+    }
+}
+
+TEST(errorsMayBeNull) {
+    double inputs[] = {-1.0, 4.0};
+    double results[2];
+    CHECK_EQ(BatchMath::sqrt(inputs, results, nullptr, 2), size_t(1));
+    CHECK_EQ(results[1], 2.0);
+}
+
+TEST_MAIN()
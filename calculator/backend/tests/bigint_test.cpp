@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include "bigint.h"
+#include "test_support.h"
+
+using namespace std;
+
+// Plain schoolbook product of two non-negative decimal strings, through
+// limbs of its own, as an independent reference for BigInt multiplication
+static string schoolbookProduct(const string& a, const string& b) {
+    auto toLimbs = [](const string& text) {
+        vector<uint64_t> limbs;
+        for (size_t end = text.size(); end > 0; end = end >= 9 ? end - 9 : 0) {
+            size_t start = end >= 9 ? end - 9 : 0;
+            limbs.push_back(stoull(text.substr(start, end - start)));
+        }
+        return limbs;
+    };
+    vector<uint64_t> x = toLimbs(a);
+    vector<uint64_t> y = toLimbs(b);
+    vector<uint64_t> product(x.size() + y.size() + 1, 0);
+    for (size_t i = 0; i < x.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < y.size(); j++) {
+            uint64_t value = product[i + j] + x[i] * y[j] + carry;
+            product[i + j] = value % BigInt::BASE;
+            carry = value / BigInt::BASE;
+        }
+        for (size_t k = i + y.size(); carry > 0; k++) {
+            uint64_t value = product[k] + carry;
+            product[k] = value % BigInt::BASE;
+            carry = value / BigInt::BASE;
+        }
+    }
+    while (product.size() > 1 && product.back() == 0) {
+        product.pop_back();
+    }
+    string text = to_string(product.back());
+    for (size_t i = product.size() - 1; i-- > 0;) {
+        string limb = to_string(product[i]);
+        text += string(9 - limb.size(), '0') + limb;
+    }
+    return text;
+}
+
+// Random number of exactly `limbs` base 10^9 limbs
+static string randomNumber(mt19937_64& random, size_t limbs) {
+    uniform_int_distribution<int> digit(0, 9);
+    string text(1, char('1' + digit(random) % 9));
+    while (text.size() < limbs * BigInt::BASE_DIGITS) {
+        text += char('0' + digit(random));
+    }
+    return text;
+}
+
+static size_t digitSum(const string& text) {
+    size_t sum = 0;
+    for (char c : text) {
+        sum += c - '0';
+    }
+    return sum;
+}
+
+TEST(factorialKnownValues) {
+    CHECK_EQ(BigInt::factorial(0).toString(), "1");
+    CHECK_EQ(BigInt::factorial(1).toString(), "1");
+    CHECK_EQ(BigInt::factorial(5).toString(), "120");
+    CHECK_EQ(BigInt::factorial(20).toString(), "2432902008176640000");
+    CHECK_EQ(BigInt::factorial(25).toString(), "15511210043330985984000000");
+    CHECK_EQ(BigInt::factorial(100).toString(),
+             "93326215443944152681699238856266700490715968264381621468592963895217599993229915"
+             "608941463976156518286253697920827223758251185210916864000000000000000000000000");
+    
+    string thousand = BigInt::factorial(1000).toString();
+    CHECK_EQ(thousand.size(), size_t(2568));
+    CHECK_EQ(digitSum(thousand), size_t(10539));
+    CHECK_EQ(thousand.substr(0, 20), "40238726007709377354");
+    CHECK_EQ(thousand.size() - thousand.find_last_not_of('0') - 1, size_t(249));
+    
+    // Big enough for Karatsuba inside the prime-swing recursion
+    BigInt big = BigInt::factorial(10000);
+    string text = big.toString();
+    CHECK_EQ(big.digits(), size_t(35660));
+    CHECK_EQ(text.size(), size_t(35660));
+    CHECK_EQ(digitSum(text), size_t(149346));
+    CHECK_EQ(text.substr(0, 20), "28462596809170545189");
+    CHECK_EQ(text.size() - text.find_last_not_of('0') - 1, size_t(2499));
+}
+
+TEST(factorialMatchesRunningProduct) {
+    BigInt product(1);
+    for (uint32_t n = 1; n <= 400; n++) {
+        product = product * BigInt(n);
+        if (BigInt::factorial(n).compare(product) != 0) {
+            reportFailure(__FILE__, __LINE__, "factorial(" + to_string(n) + ") is wrong");
+            break;
+        }
+    }
+}
+
+TEST(karatsubaMatchesSchoolbookAtThreshold) {
+    mt19937_64 random(17);
+    const size_t threshold = BigInt::KARATSUBA_THRESHOLD;
+    vector<pair<size_t, size_t>> shapes;
+    for (size_t a : {threshold - 1, threshold, threshold + 1, 2 * threshold - 1, 2 * threshold,
+                     2 * threshold + 1}) {
+        shapes.push_back({a, a});
+        shapes.push_back({a, threshold});
+    }
+    // Unbalanced operands, and the longer one first or second
+    shapes.push_back({threshold + 1, 1});
+    shapes.push_back({1, threshold + 1});
+    shapes.push_back({5 * threshold + 3, threshold + 2});
+    shapes.push_back({threshold + 2, 5 * threshold + 3});
+    shapes.push_back({300, 299});
+    
+    for (const auto& shape : shapes) {
+        for (int round = 0; round < 4; round++) {
+            string a = randomNumber(random, shape.first);
+            string b = randomNumber(random, shape.second);
+            string expected = schoolbookProduct(a, b);
+            BigInt product = BigInt::parse(a) * BigInt::parse(b);
+            if (product.toString() != expected) {
+                reportFailure(__FILE__, __LINE__, "product of " + to_string(shape.first) + " x " +
+                              to_string(shape.second) + " limbs differs from schoolbook");
+            }
+        }
+    }
+}
+
+TEST(karatsubaCarriesThroughNines) {
+    // All-nines operands make every partial sum carry
+    for (size_t limbs : {BigInt::KARATSUBA_THRESHOLD, 2 * BigInt::KARATSUBA_THRESHOLD + 1}) {
+        string nines(limbs * BigInt::BASE_DIGITS, '9');
+        BigInt a = BigInt::parse(nines);
+        CHECK_EQ((a * a).toString(), schoolbookProduct(nines, nines));
+        CHECK_EQ((a * BigInt(1)).toString(), nines);
+        CHECK((a * BigInt(0)).isZero());
+    }
+}
+
+TEST(divisionIdentity) {
+    mt19937_64 random(23);
+    uniform_int_distribution<size_t> length(1, 80);
+    for (int round = 0; round < 200; round++) {
+        BigInt dividend = BigInt::parse(randomNumber(random, length(random)));
+        BigInt divisor = BigInt::parse(randomNumber(random, length(random)));
+        if (round % 2) {
+            dividend = -dividend;
+        }
+        if (round % 3 == 0) {
+            divisor = -divisor;
+        }
+        BigInt quotient, remainder;
+        BigInt::divide(dividend, divisor, quotient, remainder);
+        CHECK((quotient * divisor + remainder).compare(dividend) == 0);
+        // |remainder| < |divisor| and the remainder has the dividend's sign
+        BigInt magnitude = divisor.isNegative() ? -divisor : divisor;
+        BigInt remainder_magnitude = remainder.isNegative() ? -remainder : remainder;
+        CHECK(remainder_magnitude.compare(magnitude) < 0);
+        CHECK(remainder.isZero() || remainder.isNegative() == dividend.isNegative());
+    }
+    
+    BigInt quotient, remainder;
+    BigInt::divide(BigInt::parse("10000000000000000000000000000000000000007"),
+                   BigInt::parse("123456789012"), quotient, remainder);
+    CHECK_EQ(quotient.toString(), "81000000729226806565083094144");
+    CHECK_EQ(remainder.toString(), "16059254279");
+    CHECK_THROWS(BigInt(1) / BigInt(0));
+}
+
+TEST(parseAndFormatRoundTrip) {
+    for (const char* text : {"0", "1", "-1", "999999999", "1000000000", "-1000000000",
+                             "123456789012345678901234567890"}) {
+        CHECK_EQ(BigInt::parse(text).toString(), text);
+    }
+    CHECK_EQ(BigInt::parse("+42").toString(), "42");
+    CHECK_EQ(BigInt::parse("000123").toString(), "123");
+    CHECK_EQ(BigInt::parse("-0").toString(), "0");
+    CHECK_THROWS(BigInt::parse(""));
+    CHECK_THROWS(BigInt::parse("-"));
+    CHECK_THROWS(BigInt::parse("12a"));
+    CHECK_THROWS(BigInt::parse("1.5"));
+}
+
+TEST(powerAndConversion) {
+    CHECK_EQ(BigInt(2).pow(200).toString(),
+             "1606938044258990275541962092341162602522202993782792835301376");
+    CHECK_EQ(BigInt(-3).pow(3).toString(), "-27");
+    CHECK_EQ(BigInt(7).pow(0).toString(), "1");
+    CHECK_EQ(BigInt(2).pow(200).toDouble(), 1.6069380442589903e60);
+    CHECK_EQ(BigInt::factorial(200).toDouble(), HUGE_VAL);
+    CHECK_EQ(BigInt(-12345).toDouble(), -12345.0);
+}
+
+TEST_MAIN()
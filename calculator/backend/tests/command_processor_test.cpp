@@ -0,0 +1,234 @@
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "calculator.h"
+#include "test_support.h"
+
+#ifndef _WIN32
+    #include <sys/resource.h>
+#endif
+
+using namespace std;
+
+static string run(CommandProcessor& processor, const string& command) {
+    string response;
+    processor.processCommand(command, response);
+    return response;
+}
+
+static bool startsWith(const string& text, const string& prefix) {
+    return text.compare(0, prefix.size(), prefix) == 0;
+}
+
+// "1+1+...+1", `terms` ones
+static string sumOfOnes(size_t terms) {
+    string expression = "1";
+    for (size_t i = 1; i < terms; i++) {
+        expression += "+1";
+    }
+    return expression;
+}
+
+static string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// History keeps the whole text of an expression, however much longer than
+// an entry holds inline, through HISTORY, the export and a restart
+TEST(longExpressionsKeepTheirText) {
+    TempDir dir;
+    string expression = sumOfOnes(60);
+    {
+        CommandProcessor processor(dir.file("history.dat"), 100);
+        CHECK_EQ(run(processor, "EVAL " + expression), "SUCCESS|" + expression + "|60|");
+        CHECK_EQ(run(processor, "HISTORY 1"), "SUCCESS|History|1|" + expression + " = 60;");
+        
+        string exported = run(processor, "HISTORY_EXPORT CSV");
+        CHECK(startsWith(exported, "SUCCESS|History Export|1|"));
+        CHECK(exported.find(",expression,0,0,60," + expression + "\n") != string::npos);
+    }
+    
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    CHECK_EQ(run(processor, "HISTORY 1"), "SUCCESS|History|1|" + expression + " = 60;");
+}
+
+TEST(overlongExpressionsAreCut) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    string expression = sumOfOnes(3000);
+    CHECK_EQ(run(processor, "EVAL " + expression), "SUCCESS|" + expression + "|3000|");
+    
+    string kept = expression.substr(0, HistoryEntry::MAX_TEXT_LENGTH - 3) + "...";
+    CHECK_EQ(run(processor, "HISTORY 1"), "SUCCESS|History|1|" + kept + " = 3000;");
+}
+
+TEST(textHistoryKeepsLongExpressions) {
+    TempDir dir;
+    string expression = sumOfOnes(40);
+    string line = "1700000000|" + expression + "|40|expression\n";
+    {
+        ofstream out(dir.file("history.txt"), ios::binary);
+        out << line;
+    }
+    
+    Calculator calculator(dir.file("history.dat"), 100);
+    CHECK(calculator.loadHistoryFromFile(dir.file("history.txt")).success);
+    HistoryView history = calculator.getHistory();
+    REQUIRE(history.size() == 1);
+    CHECK_EQ(history.text(0), expression);
+    
+    CHECK(calculator.saveHistoryToFile(dir.file("saved.txt")).success);
+    CHECK_EQ(readFile(dir.file("saved.txt")), line);
+}
+
+// Big integers stay small enough to compute on the event loop
+TEST(bigIntegersAreCapped) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    string response = run(processor, "FACT " + to_string(MAX_EXACT_FACTORIAL));
+    CHECK(startsWith(response, "SUCCESS|" + to_string(MAX_EXACT_FACTORIAL) + "!|"));
+    CHECK_EQ(response.size() - response.rfind('|') - 1, size_t(35660));
+    CHECK_EQ(run(processor, "FACT " + to_string(MAX_EXACT_FACTORIAL + 1)),
+             "ERROR|||Error: Number too large for factorial");
+    
+    string widest(MAX_BIG_DIGITS, '9');
+    CHECK(startsWith(run(processor, "BIG " + widest + " * " + widest), "SUCCESS|"));
+    CHECK(startsWith(run(processor, "BIG " + widest + "9 + 1"), "ERROR|"));
+    CHECK(startsWith(run(processor, "BIG 1 - " + widest + "9"), "ERROR|"));
+    CHECK(startsWith(run(processor, "BIG 2 ^ 60000"), "SUCCESS|"));
+    CHECK_EQ(run(processor, "BIG 2 ^ 70000"), "ERROR|||Error: Result too large");
+}
+
+// A defined expression is compiled once and applied to a column of values,
+// with the other variables bound when it is applied
+TEST(defineAndApply) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    CHECK_EQ(run(processor, "DEFINE f = a*x^2 + b*x + c"), "SUCCESS|f = a*x^2 + b*x + c|4");
+    CHECK_EQ(run(processor, "APPLY f x 0,1,2"), "ERROR|||Error: Unknown variable: a");
+    run(processor, "SET a 1");
+    run(processor, "SET b 2");
+    run(processor, "SET c 3");
+    CHECK_EQ(run(processor, "APPLY f x 0,1,2"),
+             "SUCCESS|a*x^2 + b*x + c for x in [3 values]|3|3,6,11");
+    CHECK_EQ(run(processor, "APPLY f x"), "SUCCESS|a*x^2 + b*x + c for x in [0 values]|0|");
+    
+    // Redefining replaces; a domain error makes just its value nan
+    CHECK_EQ(run(processor, "DEFINE f = 1/x"), "SUCCESS|f = 1/x|1");
+    CHECK_EQ(run(processor, "APPLY f x 0,2,-4"), "SUCCESS|1/x for x in [3 values]|3|nan,0.5,-0.25");
+    
+    CHECK_EQ(run(processor, "APPLY g x 1"), "ERROR|||Unknown function: g");
+    CHECK_EQ(run(processor, "APPLY f y 1"), "ERROR|||Error: Unknown variable: x");
+    CHECK_EQ(run(processor, "APPLY f x 1,zz"), "ERROR|||Invalid number: zz");
+    CHECK_EQ(run(processor, "DEFINE h = (x"), "ERROR|||Error: Missing ')'");
+    CHECK_EQ(run(processor, "APPLY h x 1"), "ERROR|||Unknown function: h");
+}
+
+TEST(batchColumns) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    CHECK_EQ(run(processor, "BATCH SIN 3 CSV 0,30,90"), "SUCCESS|sin([3 values])|0|0,0.5,1");
+    CHECK_EQ(run(processor, "BATCH SQRT 3 CSV -1, 4 ,0.25"), "SUCCESS|sqrt([3 values])|1|nan,2,0.5");
+    CHECK_EQ(run(processor, "BATCH POW 2 CSV 2,3,10,2"), "SUCCESS|pow([2 values])|0|1024,9");
+    CHECK_EQ(run(processor, "BATCH SIN 0 CSV"), "SUCCESS|sin([0 values])|0|");
+    
+    CHECK_EQ(run(processor, "BATCH SIN 3 CSV 1,2"), "ERROR|||Expected 3 values, got 2");
+    CHECK_EQ(run(processor, "BATCH SIN 1 CSV 1,2"), "ERROR|||Expected 1 values, got 2");
+    CHECK_EQ(run(processor, "BATCH SIN 2 CSV 1,x"), "ERROR|||Invalid batch value at offset 2");
+    CHECK_EQ(run(processor, "BATCH SIN -1 CSV 1"), "ERROR|||Invalid batch count: -1");
+    CHECK_EQ(run(processor, "BATCH SIN 1 TSV 1"), "ERROR|||Batch format must be CSV or BIN");
+    CHECK_EQ(run(processor, "BATCH FOO 1 CSV 1"), "ERROR|||Unsupported batch operation: FOO");
+    
+    // Only HISTORY batches are recorded
+    CHECK_EQ(run(processor, "HISTORY 0"), "SUCCESS|History|0|");
+    CHECK_EQ(run(processor, "BATCH SIN 2 HISTORY CSV 0,90"), "SUCCESS|sin([2 values])|0|0,1");
+    CHECK_EQ(run(processor, "HISTORY 0"),
+             "SUCCESS|History|2|sin(0.000000°) = 0;sin(90.000000°) = 1;");
+}
+
+TEST(batchBinaryValues) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    const double values[] = {4.0, -9.0, 0.0625};
+    string command = "BATCH SQRT 3 BIN ";
+    command.append(reinterpret_cast<const char*>(values), sizeof(values));
+    
+    string prefix = "SUCCESS|sqrt([3 values])|1|";
+    string response = run(processor, command);
+    REQUIRE(response.size() == prefix.size() + sizeof(values));
+    CHECK_EQ(response.substr(0, prefix.size()), prefix);
+    double results[3];
+    memcpy(results, response.data() + prefix.size(), sizeof(results));
+    CHECK_EQ(results[0], 2.0);
+    CHECK(results[1] != results[1]);
+    CHECK_EQ(results[2], 0.25);
+    
+    command.pop_back();
+    CHECK_EQ(run(processor, command), "ERROR|||Expected 24 payload bytes, got 23");
+}
+
+// A huge count is rejected without reserving room for it first
+TEST(batchCountIsBoundedByPayload) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+#ifndef _WIN32
+    rlimit saved;
+    REQUIRE(getrlimit(RLIMIT_AS, &saved) == 0);
+    rlimit limited = saved;
+    limited.rlim_cur = rlim_t(2) << 30;
+    REQUIRE(setrlimit(RLIMIT_AS, &limited) == 0);
+#endif
+    string response = run(processor, "BATCH POW 2000000000 CSV 1");
+#ifndef _WIN32
+    setrlimit(RLIMIT_AS, &saved);
+#endif
+    CHECK_EQ(response, "ERROR|||Expected 4000000000 values, got 1");
+}
+
+// An export cursor taken before a compaction goes on after it, skipping
+// only the entries compacted away
+TEST(exportCursorSurvivesCompaction) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    const size_t total = 1100;
+    {
+        CommandProcessor processor(path, 10);
+        for (size_t i = 0; i < total; i++) {
+            run(processor, "ADD " + to_string(i) + " 1");
+        }
+        string chunk = run(processor, "HISTORY_EXPORT CSV 0 2");
+        CHECK(startsWith(chunk, "SUCCESS|History Export|2|2|"));
+        CHECK(chunk.find(",addition,1,1,2,1.000000 + 1.000000\n") != string::npos);
+    }
+    
+    // Opening with a small retention compacts; closing waits for it
+    HistoryLogOptions options;
+    options.retention = 10;
+    { CommandProcessor compacting(path, 10, options); }
+    
+    CommandProcessor processor(path, 10, options);
+    string chunk = run(processor, "HISTORY_EXPORT CSV 2 2");
+    CHECK(startsWith(chunk, "SUCCESS|History Export|2|1092|"));
+    CHECK(chunk.find(",addition,1090,1,1091,1090.000000 + 1.000000\n") != string::npos);
+    CHECK(chunk.find(",addition,1091,1,1092,1091.000000 + 1.000000\n") != string::npos);
+    
+    // A cursor at the end sees nothing new until something is added
+    CHECK_EQ(run(processor, "HISTORY_EXPORT CSV 1100"), "SUCCESS|History Export|0|1100|");
+    run(processor, "MUL 2 3");
+    chunk = run(processor, "HISTORY_EXPORT CSV 1100");
+    CHECK(startsWith(chunk, "SUCCESS|History Export|1|1101|"));
+    CHECK(chunk.find(",multiplication,2,3,6,2.000000 * 3.000000\n") != string::npos);
+    
+    // Clearing keeps the numbering going
+    run(processor, "CLEAR_HISTORY");
+    run(processor, "SUB 5 1");
+    chunk = run(processor, "HISTORY_EXPORT CSV 0");
+    CHECK(startsWith(chunk, "SUCCESS|History Export|1|1102|"));
+    CHECK(chunk.find(",subtraction,5,1,4,") != string::npos);
+}
+
+TEST_MAIN()
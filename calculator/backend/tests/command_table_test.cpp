@@ -0,0 +1,99 @@
+#include <set>
+#include <string>
+#include "calculator.h"
+#include "test_support.h"
+
+using namespace std;
+
+// The command table is a perfect hash: every name must reach its own
+// handler, and anything else (including names that land in an occupied
+// slot) must be reported as unknown
+
+static const char* const COMMAND_NAMES[] = {
+    "CALC", "EVAL", "ADD", "SUB", "MUL", "DIV", "POW", "SQRT", "SIN", "COS", "TAN",
+    "LOG", "LN", "EXP", "FACT", "BIG", "PERCENT", "NEGATE", "RECIPROCAL", "MADD",
+    "MSUB", "MR", "MC", "SET", "VARS", "DEFINE", "APPLY", "BATCH", "HISTORY",
+    "HISTORY_QUERY", "HISTORY_EXPORT", "CLEAR_HISTORY", "SAVE_HISTORY", "LOAD_HISTORY",
+    "LOG_STATS", "MEMO", "STATS", "EXIT", "QUIT"
+};
+
+static bool isUnknown(const string& response) {
+    return response.compare(0, 24, "ERROR|||Unknown command:") == 0;
+}
+
+static string run(CommandProcessor& processor, const string& command) {
+    string response;
+    processor.processCommand(command, response);
+    return response;
+}
+
+// Last field of a response
+static string resultOf(const string& response) {
+    return response.substr(response.rfind('|') + 1);
+}
+
+TEST(everyCommandIsDispatched) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    for (const char* name : COMMAND_NAMES) {
+        string response = run(processor, name);
+        if (isUnknown(response)) {
+            reportFailure(__FILE__, __LINE__, string(name) + " is not dispatched");
+        }
+    }
+}
+
+TEST(commandsReachTheirHandlers) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    CHECK_EQ(run(processor, "ADD 2 3"), "SUCCESS|2.000000 + 3.000000|5");
+    CHECK_EQ(run(processor, "SUB 2 3"), "SUCCESS|2.000000 - 3.000000|-1");
+    CHECK_EQ(run(processor, "MUL 2 3"), "SUCCESS|2.000000 * 3.000000|6");
+    CHECK_EQ(run(processor, "DIV 3 2"), "SUCCESS|3.000000 / 2.000000|1.5");
+    CHECK_EQ(resultOf(run(processor, "SQRT 9")), "3");
+    CHECK_EQ(resultOf(run(processor, "FACT 25")), "15511210043330985984000000");
+    CHECK_EQ(run(processor, "EXIT"), "EXIT|Goodbye!");
+    CHECK_EQ(run(processor, "QUIT"), "EXIT|Goodbye!");
+    CHECK_EQ(run(processor, "DIV 1 0").compare(0, 8, "ERROR|||"), 0);
+}
+
+TEST(otherNamesAreUnknown) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    for (const char* name : {"", "add", "Add", "AD", "ADDD", "ADD_", "HISTORY_", "HISTORYQUERY",
+                             "EXITT", "QUI", "M", "R", "LOG10", "PROTOCOL"}) {
+        string response = run(processor, string(name) + " 1 2");
+        if (!isUnknown(response)) {
+            reportFailure(__FILE__, __LINE__, "\"" + string(name) + "\" answered " + response);
+        }
+    }
+    CHECK_EQ(run(processor, "FOO"), "ERROR|||Unknown command: FOO");
+}
+
+TEST(everyShortNameIsUnknownUnlessListed) {
+    // All 1-3 letter upper-case names: each hashes to some slot, and only
+    // the listed ones may match what is there
+    set<string> listed(begin(COMMAND_NAMES), end(COMMAND_NAMES));
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    string name;
+    auto check = [&]() {
+        if (listed.count(name) == 0 && !isUnknown(run(processor, name))) {
+            reportFailure(__FILE__, __LINE__, name + " was dispatched");
+        }
+    };
+    for (char a = 'A'; a <= 'Z'; a++) {
+        name.assign(1, a);
+        check();
+        for (char b = 'A'; b <= 'Z'; b++) {
+            name.assign({a, b});
+            check();
+            for (char c = 'A'; c <= 'Z'; c++) {
+                name.assign({a, b, c});
+                check();
+            }
+        }
+    }
+}
+
+TEST_MAIN()
@@ -0,0 +1,136 @@
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "expression.h"
+#include "test_support.h"
+
+using namespace std;
+
+static double evaluate(string_view expression, const VariableTable& variables = VariableTable()) {
+    ExpressionCache cache;
+    return cache.evaluate(expression, variables);
+}
+
+// Message of the error compiling or evaluating the expression, "" if none
+static string errorOf(string_view expression) {
+    try {
+        evaluate(expression);
+    } catch (const exception& e) {
+        return e.what();
+    }
+    return "";
+}
+
+TEST(precedenceAndAssociativity) {
+    CHECK_EQ(evaluate("1 + 2 * 3"), 7.0);
+    CHECK_EQ(evaluate("(1 + 2) * 3"), 9.0);
+    CHECK_EQ(evaluate("10 - 4 - 3"), 3.0);
+    CHECK_EQ(evaluate("8 / 4 / 2"), 1.0);
+    CHECK_EQ(evaluate("2 ^ 3 ^ 2"), 512.0);
+    CHECK_EQ(evaluate("(2 ^ 3) ^ 2"), 64.0);
+    CHECK_EQ(evaluate("-2 ^ 2"), -4.0);
+    CHECK_EQ(evaluate("2 ^ -1"), 0.5);
+    CHECK_EQ(evaluate("2 * -3"), -6.0);
+    CHECK_EQ(evaluate("--3"), 3.0);
+    CHECK_EQ(evaluate("+3 - -3"), 6.0);
+    CHECK_EQ(evaluate("3!"), 6.0);
+    CHECK_EQ(evaluate("-3! "), -6.0);
+    CHECK_EQ(evaluate("2 * 3! + 1"), 13.0);
+    CHECK_EQ(evaluate("1+2*3-4/2"), 5.0);
+}
+
+TEST(numbersFunctionsAndConstants) {
+    CHECK_EQ(evaluate("1.5e3"), 1500.0);
+    CHECK_EQ(evaluate(".25 * 4"), 1.0);
+    CHECK_EQ(evaluate("sin(30)"), 0.5);
+    CHECK_EQ(evaluate("cos(180)"), -1.0);
+    CHECK_EQ(evaluate("tan(45)"), 1.0);
+    CHECK_EQ(evaluate("sqrt(16) + sqrt(9)"), 7.0);
+    CHECK_EQ(evaluate("log10(1000)"), 3.0);
+    CHECK_EQ(evaluate("log(100)"), 2.0);
+    CHECK_EQ(evaluate("ln(1)"), 0.0);
+    CHECK_EQ(evaluate("exp(0)"), 1.0);
+    CHECK_EQ(evaluate("pi"), M_PI);
+    CHECK_EQ(evaluate("e"), M_E);
+    CHECK_EQ(evaluate("2 * pi"), 2.0 * M_PI);
+    CHECK_EQ(evaluate("sqrt(sin(90) * 4)"), 2.0);
+}
+
+TEST(variables) {
+    VariableTable variables = {{"x", 4.0}, {"rate", 0.5}};
+    CHECK_EQ(evaluate("x * 2", variables), 8.0);
+    CHECK_EQ(evaluate("x ^ 2 + x * rate", variables), 18.0);
+    CHECK_THROWS(evaluate("y + 1", variables));
+}
+
+TEST(syntaxErrors) {
+    CHECK_EQ(errorOf(""), "Empty expression");
+    CHECK_EQ(errorOf("   "), "Empty expression");
+    CHECK_EQ(errorOf("2 3"), "Unexpected '3'");
+    CHECK_EQ(errorOf("1 )"), "Unexpected ')'");
+    CHECK(!errorOf("1 +").empty());
+    CHECK(!errorOf("(1 + 2").empty());
+    CHECK(!errorOf("* 2").empty());
+    CHECK(!errorOf("sqrt 4").empty());
+    CHECK(!errorOf("sqrt(4").empty());
+    CHECK(!errorOf("1 $ 2").empty());
+    CHECK_EQ(errorOf("foo(1)"), "Unknown function: foo");
+}
+
+TEST(nestingLimit) {
+    CHECK_EQ(evaluate(string(254, '-') + "1"), 1.0);
+    CHECK_EQ(evaluate(string(255, '(') + "2" + string(255, ')')), 2.0);
+    CHECK_EQ(errorOf(string(50000, '-') + "1"), "Expression too deeply nested");
+    CHECK_EQ(errorOf(string(50000, '(') + "1" + string(50000, ')')), "Expression too deeply nested");
+    CHECK_EQ(errorOf("sqrt(" + string(300, '+') + "4)"), "Expression too deeply nested");
+    
+    // Long flat expressions are not nested
+    string sum = "1";
+    for (int i = 0; i < 10000; i++) {
+        sum += "+1";
+    }
+    CHECK_EQ(evaluate(sum), 10001.0);
+}
+
+TEST(domainErrors) {
+    CHECK(!errorOf("1 / 0").empty());
+    CHECK(!errorOf("sqrt(-1)").empty());
+    CHECK(!errorOf("ln(0)").empty());
+    CHECK(!errorOf("log10(-5)").empty());
+    CHECK(!errorOf("tan(90)").empty());
+    CHECK(!errorOf("(-1)!").empty());
+}
+
+TEST(cacheSharesProgramsBetweenLiterals) {
+    ExpressionCache cache;
+    VariableTable variables;
+    CHECK_EQ(cache.evaluate("1 + 2 * 3", variables), 7.0);
+    CHECK_EQ(cache.evaluate("4+5*6", variables), 34.0);
+    CHECK_EQ(cache.evaluate("1.5 + 2.5 * 2", variables), 6.5);
+    CHECK_EQ(cache.getMisses(), uint64_t(1));
+    CHECK_EQ(cache.getHits(), uint64_t(2));
+    CHECK_EQ(cache.size(), size_t(1));
+    
+    // Another shape is another program
+    CHECK_EQ(cache.evaluate("(1 + 2) * 3", variables), 9.0);
+    CHECK_EQ(cache.getMisses(), uint64_t(2));
+    
+    // A failed compilation is not cached
+    CHECK_THROWS(cache.evaluate("1 +", variables));
+    CHECK_EQ(cache.size(), size_t(2));
+}
+
+TEST(compiledExpressionRunsColumns) {
+    CompiledExpression expression("x * x + 1");
+    REQUIRE(expression.program.variables.size() == 1);
+    vector<double> inputs = {0.0, 1.0, 2.0, 3.0};
+    vector<double> outputs(inputs.size());
+    double unused = 0.0;
+    size_t failed = expression.program.runColumn(expression.literals.data(), &unused, 0,
+                                                 inputs.data(), outputs.data(), inputs.size());
+    CHECK_EQ(failed, size_t(0));
+    CHECK(outputs == vector<double>({1.0, 2.0, 5.0, 10.0}));
+}
+
+TEST_MAIN()
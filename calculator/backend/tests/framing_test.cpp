@@ -0,0 +1,370 @@
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "binary_protocol.h"
+#include "server_process.h"
+#include "test_support.h"
+#include "uring.h"
+
+using namespace std;
+
+// End-to-end checks of the framing modes against a running server, once
+// per event loop. The server binary is the first argument.
+
+static string server_path;
+
+static vector<string> backends() {
+    vector<string> names = {"epoll"};
+    string error;
+    if (IoUring::available(error)) {
+        names.push_back("uring");
+    } else {
+        cout << "io_uring unavailable (" << error << "), testing epoll only" << endl;
+    }
+    return names;
+}
+
+// Each check gets a fresh connection to a server started with --io <backend>
+static void forEachBackend(void (*check)(ServerProcess& server)) {
+    for (const string& backend : backends()) {
+        ServerProcess server(server_path, {"--io", backend, "--workers", "1"});
+        size_t before = testFailures();
+        check(server);
+        if (size_t(testFailures()) != before) {
+            cerr << "  (with --io " << backend << ")" << endl;
+        }
+        CHECK(server.running());
+    }
+}
+
+static void oneShot(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    string expected = "SUCCESS|2.000000 + 3.000000|5";
+    string response;
+    REQUIRE(client.send("ADD 2 3"));
+    CHECK(client.read(response, expected.size()));
+    CHECK_EQ(response, expected);
+    
+    // Trailing line ends and NULs are not part of the command
+    REQUIRE(client.send(string("MUL 4 5\r\n\0", 10)));
+    expected = "SUCCESS|4.000000 * 5.000000|20";
+    CHECK(client.read(response, expected.size()));
+    CHECK_EQ(response, expected);
+    
+    REQUIRE(client.send("EXIT"));
+    CHECK(client.read(response, 13));
+    CHECK_EQ(response, "EXIT|Goodbye!");
+    CHECK(client.closedByPeer());
+}
+
+static void linePipelining(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    // The switch and three commands in one segment, one with a CR
+    REQUIRE(client.send("PROTOCOL LINE\nADD 1 2\nMUL 2 3\r\nSUB 5 1\n"));
+    string line;
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "SUCCESS|Protocol|LINE|");
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "SUCCESS|1.000000 + 2.000000|3");
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "SUCCESS|2.000000 * 3.000000|6");
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "SUCCESS|5.000000 - 1.000000|4");
+    
+    // A command split over several segments is answered once complete
+    for (const char* part : {"AD", "D 7", " 8\nDIV", " 9 3", "\n"}) {
+        REQUIRE(client.send(part));
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "SUCCESS|7.000000 + 8.000000|15");
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "SUCCESS|9.000000 / 3.000000|3");
+    
+    REQUIRE(client.send("NOPE\nPROTOCOL SIDEWAYS\nEXIT\n"));
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "ERROR|||Unknown command: NOPE");
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "ERROR|||Unknown protocol: SIDEWAYS");
+    CHECK(client.readLine(line));
+    CHECK_EQ(line, "EXIT|Goodbye!");
+    CHECK(client.closedByPeer());
+}
+
+static void lengthFraming(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    REQUIRE(client.send("PROTOCOL LENGTH\n" + lengthFrame("ADD 1 1") + lengthFrame("SUB 1 1")));
+    string message;
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "SUCCESS|Protocol|LENGTH|");
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "SUCCESS|1.000000 + 1.000000|2");
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "SUCCESS|1.000000 - 1.000000|0");
+    
+    // Split inside the header and inside the payload
+    string frame = lengthFrame("MUL 6 7");
+    for (const string& part : {frame.substr(0, 2), frame.substr(2, 4), frame.substr(6)}) {
+        REQUIRE(client.send(part));
+        this_thread::sleep_for(chrono::milliseconds(20));
+    }
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "SUCCESS|6.000000 * 7.000000|42");
+    
+    // A frame is one command, newlines and all
+    REQUIRE(client.send(lengthFrame("ADD 1 2\nADD 3 4") + lengthFrame("SUB 3 4")));
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "SUCCESS|1.000000 + 2.000000|3");
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "SUCCESS|3.000000 - 4.000000|-1");
+    
+    // A frame over the limit is refused and the connection closed
+    REQUIRE(client.send(string("\x00\x10\x00\x01", 4)));
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message, "ERROR|||Command too long");
+    CHECK(client.closedByPeer());
+}
+
+static string binaryRequest(uint8_t opcode, uint32_t tag, double a, double b = 0.0,
+                            uint8_t flags = 0, uint16_t reserved = 0) {
+    BinaryRequest request = {opcode, flags, reserved, tag, {a, b}};
+    return string(reinterpret_cast<const char*>(&request), sizeof(request));
+}
+
+static bool readResponse(Client& client, BinaryResponse& response) {
+    string bytes;
+    if (!client.read(bytes, sizeof(response))) {
+        return false;
+    }
+    memcpy(&response, bytes.data(), sizeof(response));
+    return true;
+}
+
+static void binaryFraming(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    REQUIRE(client.send("PROTOCOL BINARY\n"));
+    BinaryResponse response;
+    REQUIRE(readResponse(client, response));
+    CHECK(response.status == BinaryStatus::OK);
+    CHECK_EQ(response.tag, uint32_t(0));
+    CHECK_EQ(response.result, double(BINARY_PROTOCOL_VERSION));
+    
+    // Pipelined, with a request split across two sends
+    string requests = binaryRequest(BINARY_OPCODE_ADD, 7, 2.0, 3.0) +
+                      binaryRequest(BINARY_OPCODE_DIV, 8, 1.0, 0.0) +
+                      binaryRequest(5, 9, 1.0, 1.0) +
+                      binaryRequest(BINARY_OPCODE_SQRT, 10, 16.0, 0.0, 0, 1) +
+                      binaryRequest(BINARY_OPCODE_FACT, 11, 5.0) +
+                      binaryRequest(BINARY_OPCODE_SIN, 12, 30.0, 0.0, BINARY_FLAG_NO_HISTORY) +
+                      binaryRequest(BINARY_OPCODE_MUL, 13, 6.0, 7.0, 0x80);
+    REQUIRE(client.send(requests.substr(0, 30)));
+    this_thread::sleep_for(chrono::milliseconds(20));
+    REQUIRE(client.send(requests.substr(30)));
+    
+    struct Expected {
+        BinaryStatus status;
+        uint8_t opcode;
+        double result;
+    };
+    const Expected expected[] = {
+        {BinaryStatus::OK, BINARY_OPCODE_ADD, 5.0},
+        {BinaryStatus::FAILURE, BINARY_OPCODE_DIV, 0.0},
+        {BinaryStatus::BAD_REQUEST, 5, 0.0},
+        {BinaryStatus::BAD_REQUEST, BINARY_OPCODE_SQRT, 0.0},
+        {BinaryStatus::OK, BINARY_OPCODE_FACT, 120.0},
+        {BinaryStatus::OK, BINARY_OPCODE_SIN, 0.5},
+        {BinaryStatus::BAD_REQUEST, BINARY_OPCODE_MUL, 0.0},
+    };
+    for (uint32_t i = 0; i < 7; i++) {
+        REQUIRE(readResponse(client, response));
+        CHECK(response.status == expected[i].status);
+        CHECK_EQ(response.opcode, expected[i].opcode);
+        CHECK_EQ(response.tag, 7 + i);
+        if (response.status == BinaryStatus::OK) {
+            CHECK_EQ(response.result, expected[i].result);
+        } else {
+            CHECK(std::isnan(response.result));
+        }
+    }
+    
+    REQUIRE(client.send(binaryRequest(BINARY_OPCODE_EXIT, 99, 0.0)));
+    REQUIRE(readResponse(client, response));
+    CHECK_EQ(response.tag, uint32_t(99));
+    CHECK(client.closedByPeer());
+}
+
+// Everything sent before the client's FIN is answered before the close
+static void answersBeforeEof(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    string commands = "PROTOCOL LINE\n";
+    for (int i = 0; i < 200; i++) {
+        commands += "ADD " + to_string(i) + " 1\n";
+    }
+    REQUIRE(client.send(commands));
+    client.shutdownWrite();
+    string line;
+    CHECK(client.readLine(line));
+    for (int i = 0; i < 200; i++) {
+        if (!client.readLine(line) || line.compare(0, 8, "SUCCESS|") != 0) {
+            reportFailure(__FILE__, __LINE__, "response " + to_string(i) + " missing");
+            break;
+        }
+    }
+    CHECK(client.closedByPeer());
+    
+    // Same in one-shot mode
+    REQUIRE(client.connectTcp(server.port()));
+    REQUIRE(client.send("ADD 2 2"));
+    client.shutdownWrite();
+    string expected = "SUCCESS|2.000000 + 2.000000|4";
+    CHECK(client.read(line, expected.size()));
+    CHECK_EQ(line, expected);
+    CHECK(client.closedByPeer());
+}
+
+// A client that sends much more than it reads still gets every response,
+// in order, while the server holds its input back
+static void backpressure(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    const int count = 100000;
+    thread writer([&]() {
+        string commands = "PROTOCOL LINE\n";
+        for (int i = 0; i < count; i++) {
+            commands += "NEGATE " + to_string(i) + "\n";
+        }
+        client.send(commands);
+    });
+    string line;
+    CHECK(client.readLine(line));
+    int received = 0;
+    while (received < count && client.readLine(line)) {
+        // NEGATE 0 is -0
+        string expected = "|-" + to_string(received);
+        if (line.size() < expected.size() ||
+            line.compare(line.size() - expected.size(), expected.size(), expected) != 0) {
+            reportFailure(__FILE__, __LINE__, "out of order: " + line);
+            break;
+        }
+        received++;
+    }
+    writer.join();
+    CHECK_EQ(received, count);
+}
+
+// Expressions nested past the parser's limit are refused like any other
+// syntax error, and the connection goes on
+static void deepNesting(ServerProcess& server) {
+    Client client;
+    REQUIRE(client.connectTcp(server.port()));
+    string parens = "EVAL " + string(500000, '(') + "1" + string(500000, ')');
+    REQUIRE(client.send("PROTOCOL LENGTH\n" + lengthFrame(parens) +
+                        lengthFrame("EVAL " + string(50000, '-') + "1") +
+                        lengthFrame("EVAL " + string(200, '(') + "1" + string(200, ')'))));
+    
+    // The error echoes the expression back
+    string error = "|Error: Expression too deeply nested";
+    string message;
+    CHECK(client.readFrame(message));
+    for (int i = 0; i < 2; i++) {
+        CHECK(client.readFrame(message));
+        CHECK_EQ(message.substr(0, 6), "ERROR|");
+        CHECK(message.size() > error.size() &&
+              message.compare(message.size() - error.size(), error.size(), error) == 0);
+    }
+    CHECK(client.readFrame(message));
+    CHECK_EQ(message.substr(message.size() - 3), "|1|");
+    CHECK(server.running());
+}
+
+TEST(oneShotFraming) { forEachBackend(oneShot); }
+TEST(lineFramingAndPipelining) { forEachBackend(linePipelining); }
+TEST(lengthFramingAndOversizedFrames) { forEachBackend(lengthFraming); }
+TEST(binaryFramingAndBadRequests) { forEachBackend(binaryFraming); }
+TEST(inputIsAnsweredBeforeEof) { forEachBackend(answersBeforeEof); }
+TEST(slowReaderGetsEveryResponse) { forEachBackend(backpressure); }
+TEST(deeplyNestedExpressions) { forEachBackend(deepNesting); }
+
+TEST(unixSocket) {
+    TempDir socket_dir;
+    string path = socket_dir.file("calculator.sock");
+    ServerProcess server(server_path, {"--unix", path});
+    Client client;
+    REQUIRE(client.connectUnix(path));
+    REQUIRE(client.send("PROTOCOL LINE\nPOW 2 10\n"));
+    string line;
+    CHECK(client.readLine(line));
+    CHECK(client.readLine(line));
+    CHECK_EQ(line.substr(line.rfind('|')), "|1024");
+}
+
+// Several workers answer every connection, over TCP and the Unix socket.
+// Where the main thread deals the connections out (epoll workers sharing
+// the TCP socket; io_uring workers and the Unix socket) they go round-robin,
+// and each worker keeps a history of its own.
+static void severalWorkers(const string& backend, bool reuse_port, bool unix_socket) {
+    TempDir socket_dir;
+    string path = socket_dir.file("calculator.sock");
+    vector<string> arguments = {"--io", backend, "--workers", "3", "--unix", path};
+    if (reuse_port) {
+        arguments.push_back("--reuseport");
+    }
+    ServerProcess server(server_path, arguments);
+    
+    const int count = 6;
+    vector<unique_ptr<Client>> clients;
+    for (int i = 0; i < count; i++) {
+        clients.push_back(make_unique<Client>());
+        REQUIRE(unix_socket ? clients[i]->connectUnix(path) : clients[i]->connectTcp(server.port()));
+        REQUIRE(clients[i]->send("PROTOCOL LINE\nADD " + to_string(i) + " 1000\n"));
+    }
+    string line;
+    for (int i = 0; i < count; i++) {
+        CHECK(clients[i]->readLine(line));
+        CHECK(clients[i]->readLine(line));
+        CHECK_EQ(line.substr(line.rfind('|')), "|" + to_string(1000 + i));
+    }
+    
+    bool dealt_out = unix_socket ? backend == "uring" || !reuse_port
+                                 : backend == "epoll" && !reuse_port;
+    if (dealt_out) {
+        for (int i = 0; i < count; i++) {
+            REQUIRE(clients[i]->send("HISTORY 100\n"));
+            CHECK(clients[i]->readLine(line));
+            CHECK_EQ(line.substr(0, 18), "SUCCESS|History|2|");
+        }
+    }
+    CHECK(server.running());
+}
+
+TEST(severalWorkersShareTheConnections) {
+    for (const string& backend : backends()) {
+        for (bool reuse_port : {false, true}) {
+            for (bool unix_socket : {false, true}) {
+                size_t before = testFailures();
+                severalWorkers(backend, reuse_port, unix_socket);
+                if (size_t(testFailures()) != before) {
+                    cerr << "  (with --io " << backend << (reuse_port ? " --reuseport" : "")
+                         << (unix_socket ? " over the Unix socket" : " over TCP") << ")" << endl;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <calculator_backend> [test name filter]" << endl;
+        return 2;
+    }
+    server_path = argv[1];
+    return runTests(argc - 1, argv + 1);
+}
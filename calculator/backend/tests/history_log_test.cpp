@@ -0,0 +1,495 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include "history_log.h"
+#include "test_support.h"
+
+#ifndef _WIN32
+    #include <csignal>
+    #include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// Layout of the file, as documented in history_log.h
+static const uint64_t HEADER_SIZE = 64;
+static const uint64_t RECORD_SIZE = 72;
+
+static uint64_t recordOffset(uint64_t index) {
+    return HEADER_SIZE + index * RECORD_SIZE;
+}
+
+// Entry #i of a test log: i + 1 = i + 1, so every record can be recognized
+static HistoryEntry entry(uint64_t i) {
+    return HistoryEntry(int64_t(i), Operation::ADD, double(i), 1.0, double(i + 1));
+}
+
+static void writeLog(const string& path, uint64_t first, uint64_t count,
+                     const HistoryLogOptions& options = HistoryLogOptions()) {
+    HistoryLog log(options);
+    HistoryBuffer history(16);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    for (uint64_t i = first; i < first + count; i++) {
+        log.append(entry(i));
+    }
+    log.close();
+}
+
+// Entries [first, first + count) in order
+static bool holds(const HistoryBuffer& history, uint64_t first, uint64_t count) {
+    if (history.size() != count) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (history[i].timestamp_ns != int64_t(first + i) || history[i].result != double(first + i + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void corruptByte(const string& path, uint64_t offset) {
+    fstream file(path, ios::in | ios::out | ios::binary);
+    file.seekg(offset);
+    char byte = 0;
+    file.read(&byte, 1);
+    byte ^= 0x5A;
+    file.seekp(offset);
+    file.write(&byte, 1);
+}
+
+TEST(reopenReplaysRecords) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 100);
+    CHECK_EQ(filesystem::file_size(path), recordOffset(100));
+    
+    HistoryLog log;
+    HistoryBuffer history(1000);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK(holds(history, 0, 100));
+    CHECK_EQ(log.getRecordCount(), uint64_t(100));
+    CHECK_EQ(log.getDroppedCount(), uint64_t(0));
+}
+
+TEST(reopenKeepsNewestThatFit) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 100);
+    
+    HistoryLog log;
+    HistoryBuffer history(10);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK(holds(history, 90, 10));
+    CHECK_EQ(log.getRecordCount(), uint64_t(100));
+}
+
+TEST(truncatedTailIsCut) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 10);
+    filesystem::resize_file(path, recordOffset(9) + 30);
+    
+    {
+        HistoryLog log;
+        HistoryBuffer history(100);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        CHECK(holds(history, 0, 9));
+        CHECK_EQ(log.getDroppedCount(), uint64_t(0));
+        CHECK_EQ(filesystem::file_size(path), recordOffset(9));
+        
+        // New records go right after the last whole one
+        log.append(entry(9));
+        log.close();
+    }
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK(holds(history, 0, 10));
+}
+
+TEST(headerOnlyLogIsEmpty) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 3);
+    filesystem::resize_file(path, recordOffset(0) + 5);
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK_EQ(history.size(), size_t(0));
+    CHECK_EQ(log.getRecordCount(), uint64_t(0));
+    CHECK_EQ(filesystem::file_size(path), recordOffset(0));
+}
+
+TEST(badChecksumAtTailIsCut) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 10);
+    corruptByte(path, recordOffset(9) + 8);
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK(holds(history, 0, 9));
+    CHECK_EQ(log.getDroppedCount(), uint64_t(0));
+    CHECK_EQ(log.getRecordCount(), uint64_t(9));
+    CHECK_EQ(filesystem::file_size(path), recordOffset(9));
+}
+
+TEST(badChecksumInMiddleIsSkipped) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 10);
+    // The stored checksum itself this time
+    corruptByte(path, recordOffset(4) + RECORD_SIZE - 1);
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK_EQ(history.size(), size_t(9));
+    CHECK_EQ(history[3].timestamp_ns, int64_t(3));
+    CHECK_EQ(history[4].timestamp_ns, int64_t(5));
+    CHECK_EQ(log.getDroppedCount(), uint64_t(1));
+    // The damaged record stays in the file and keeps its sequence number
+    CHECK_EQ(log.getRecordCount(), uint64_t(10));
+    CHECK_EQ(filesystem::file_size(path), recordOffset(10));
+    
+    uint64_t sequence = 0;
+    vector<HistoryEntry> entries;
+    CHECK_EQ(log.read(sequence, 100, entries), size_t(10));
+    CHECK_EQ(entries.size(), size_t(9));
+    CHECK_EQ(sequence, uint64_t(10));
+}
+
+TEST(foreignFileIsNotALog) {
+    TempDir dir;
+    string path = dir.file("history.txt");
+    {
+        ofstream file(path);
+        file << "2024-01-01 12:00:00|addition|1 + 1|2\n";
+    }
+    uintmax_t size = filesystem::file_size(path);
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    CHECK(log.open(path, history) == HistoryLog::OpenResult::NOT_A_LOG);
+    CHECK(!log.isOpen());
+    CHECK_EQ(filesystem::file_size(path), size);
+}
+
+TEST(readContinuesFromCursor) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 25);
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    uint64_t sequence = 0;
+    vector<HistoryEntry> entries;
+    vector<HistoryEntry> chunk;
+    size_t chunks = 0;
+    // Each read replaces the contents of chunk
+    while (log.read(sequence, 10, chunk) > 0) {
+        entries.insert(entries.end(), chunk.begin(), chunk.end());
+        chunks++;
+    }
+    CHECK_EQ(chunks, size_t(3));
+    CHECK_EQ(sequence, uint64_t(25));
+    REQUIRE(entries.size() == 25);
+    for (size_t i = 0; i < entries.size(); i++) {
+        CHECK_EQ(entries[i].timestamp_ns, int64_t(i));
+    }
+}
+
+// A crash in the middle of a compaction leaves the log as it was plus a
+// partial "<log>.compact" file, which must neither be read nor get in the
+// way of the next compaction
+TEST(interruptedCompactionIsHarmless) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    string temp_path = path + ".compact";
+    const uint64_t total = 1100;
+    writeLog(path, 0, total);
+    
+    // What a compaction killed while copying leaves behind: a header and
+    // part of the first record it was copying
+    {
+        ifstream source(path, ios::binary);
+        vector<char> partial(recordOffset(1) + 17);
+        source.read(partial.data(), partial.size());
+        ofstream temp(temp_path, ios::binary);
+        temp.write(partial.data(), partial.size());
+    }
+    
+    {
+        HistoryLog log;
+        HistoryBuffer history(2000);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        CHECK(holds(history, 0, total));
+        CHECK_EQ(log.getDroppedCount(), uint64_t(0));
+    }
+    
+    // Opening with a small retention compacts the log in the background;
+    // close() waits for it
+    HistoryLogOptions options;
+    options.retention = 10;
+    {
+        HistoryLog log(options);
+        HistoryBuffer history(2000);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        CHECK(holds(history, 0, total));
+        log.close();
+    }
+    CHECK(!filesystem::exists(temp_path));
+    CHECK_EQ(filesystem::file_size(path), recordOffset(10));
+    
+    HistoryLog log(options);
+    HistoryBuffer history(2000);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK(holds(history, total - 10, 10));
+    
+    // Sequence numbers survive: the first kept record is still #1090
+    uint64_t sequence = 0;
+    vector<HistoryEntry> entries;
+    CHECK_EQ(log.read(sequence, 100, entries), size_t(10));
+    CHECK_EQ(sequence, total);
+    REQUIRE(!entries.empty());
+    CHECK_EQ(entries[0].timestamp_ns, int64_t(total - 10));
+    
+    // And the log goes on from there
+    log.append(entry(total));
+    log.flush();
+    entries.clear();
+    CHECK_EQ(log.read(sequence, 100, entries), size_t(1));
+    CHECK_EQ(sequence, total + 1);
+}
+
+TEST(rewriteReplacesRecords) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 50);
+    
+    HistoryBuffer replacement(10);
+    for (uint64_t i = 100; i < 105; i++) {
+        replacement.push(entry(i));
+    }
+    {
+        HistoryLog log;
+        HistoryBuffer history(100);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        CHECK(log.rewrite(replacement.newest()));
+    }
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK(holds(history, 100, 5));
+}
+
+// Entry #i with an expression too long to inline: one record for the
+// entry, ceil(170 / 30) = 6 for the rest of its text
+static const uint64_t LONG_TEXT_RECORDS = 7;
+
+static string longText(uint64_t i) {
+    return "(" + to_string(i) + string(198 - to_string(i).size(), '+') + ")";
+}
+
+static HistoryEntry longEntry(uint64_t i) {
+    return HistoryEntry(int64_t(i), Operation::EXPRESSION, 0.0, 0.0, double(i + 1), longText(i));
+}
+
+TEST(longTextsSurviveReopen) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    {
+        HistoryLog log;
+        HistoryBuffer history(16);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        for (uint64_t i = 0; i < 4; i++) {
+            log.append(entry(2 * i));
+            log.append(longEntry(2 * i + 1), longText(2 * i + 1));
+        }
+        log.close();
+    }
+    CHECK_EQ(filesystem::file_size(path), recordOffset(4 + 4 * LONG_TEXT_RECORDS));
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    REQUIRE(history.size() == 8);
+    for (uint64_t i = 0; i < 8; i++) {
+        CHECK_EQ(history[i].timestamp_ns, int64_t(i));
+        CHECK_EQ(history.text(history[i]), i % 2 == 1 ? longText(i) : string());
+    }
+    CHECK_EQ(log.getDroppedCount(), uint64_t(0));
+    
+    // Reads never split a text, and only count the records they consume
+    uint64_t sequence = 0;
+    vector<HistoryEntry> entries;
+    vector<string> texts;
+    vector<string> all;
+    while (log.read(sequence, 3, entries, &texts) > 0) {
+        REQUIRE(texts.size() == entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            CHECK_EQ(entries[i].timestamp_ns, int64_t(all.size()));
+            all.push_back(texts[i]);
+        }
+    }
+    CHECK_EQ(all.size(), size_t(8));
+    CHECK_EQ(all[7], longText(7));
+    CHECK_EQ(sequence, 4 + 4 * LONG_TEXT_RECORDS);
+    
+    // A cursor in the middle of a text skips to the next entry
+    sequence = 2;
+    CHECK(log.read(sequence, 100, entries, &texts) > 0);
+    REQUIRE(!entries.empty());
+    CHECK_EQ(entries[0].timestamp_ns, int64_t(2));
+}
+
+TEST(damagedTextKeepsItsStart) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    {
+        HistoryLog log;
+        HistoryBuffer history(16);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        log.append(longEntry(0), longText(0));
+        log.append(entry(1));
+        log.close();
+    }
+    corruptByte(path, recordOffset(3) + 40);
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    REQUIRE(history.size() == 2);
+    CHECK_EQ(history.text(history[0]), longText(0).substr(0, HistoryEntry::TEXT_CAPACITY));
+    CHECK_EQ(history[1].timestamp_ns, int64_t(1));
+    CHECK_EQ(log.getDroppedCount(), uint64_t(1));
+}
+
+TEST(rewriteKeepsLongTexts) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    HistoryBuffer replacement(10);
+    replacement.push(longEntry(0), longText(0));
+    replacement.push(entry(1));
+    {
+        HistoryLog log;
+        HistoryBuffer history(100);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        CHECK(log.rewrite(replacement.newest()));
+        CHECK_EQ(log.getRecordCount(), 1 + LONG_TEXT_RECORDS);
+    }
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    REQUIRE(history.size() == 2);
+    CHECK_EQ(history.text(history[0]), longText(0));
+}
+
+// The writer only commits on request here: a flush makes everything
+// appended before it readable, and only a sync (or the EVERY_FLUSH
+// policy) reaches the disk
+TEST(flushWritesAndSyncSyncs) {
+    TempDir dir;
+    HistoryLogOptions options;
+    options.flush_interval_ms = 60000;
+    options.sync_interval_ms = 60000;
+    HistoryLog log(options);
+    HistoryBuffer history(100);
+    REQUIRE(log.open(dir.file("history.dat"), history) == HistoryLog::OpenResult::OPENED);
+    
+    for (uint64_t i = 0; i < 20; i++) {
+        log.append(entry(i));
+    }
+    log.flush();
+    uint64_t sequence = 0;
+    vector<HistoryEntry> entries;
+    CHECK_EQ(log.read(sequence, 100, entries), size_t(20));
+    CHECK_EQ(log.getRecordCount(), uint64_t(20));
+    HistoryWriterMetrics metrics = log.getMetrics();
+    CHECK_EQ(metrics.records_written, uint64_t(20));
+    CHECK_EQ(metrics.syncs, uint64_t(0));
+    
+    CHECK(log.sync());
+    CHECK_EQ(log.getMetrics().syncs, uint64_t(1));
+    // Nothing new to make durable
+    CHECK(log.sync());
+    CHECK_EQ(log.getMetrics().syncs, uint64_t(1));
+    
+    // Entries appended after a sync request are part of it too
+    log.append(entry(20));
+    CHECK(log.sync());
+    CHECK_EQ(log.getMetrics().syncs, uint64_t(2));
+    CHECK_EQ(log.read(sequence, 100, entries), size_t(1));
+    CHECK_EQ(sequence, uint64_t(21));
+}
+
+TEST(everyFlushPolicySyncsEachCommit) {
+    TempDir dir;
+    HistoryLogOptions options;
+    options.flush_interval_ms = 60000;
+    options.sync = HistoryLogOptions::Sync::EVERY_FLUSH;
+    HistoryLog log(options);
+    HistoryBuffer history(100);
+    REQUIRE(log.open(dir.file("history.dat"), history) == HistoryLog::OpenResult::OPENED);
+    
+    for (uint64_t i = 0; i < 3; i++) {
+        log.append(entry(i));
+        log.flush();
+        CHECK_EQ(log.getMetrics().syncs, i + 1);
+    }
+    CHECK_EQ(log.getMetrics().records_written, uint64_t(3));
+}
+
+#ifndef _WIN32
+// A write cut short (here by the file size limit) must not leave part of a
+// record behind for the next commit to append after
+TEST(failedWriteKeepsRecordsAligned) {
+    TempDir dir;
+    string path = dir.file("history.dat");
+    writeLog(path, 0, 10);
+    
+    signal(SIGXFSZ, SIG_IGN);
+    rlimit original;
+    REQUIRE(getrlimit(RLIMIT_FSIZE, &original) == 0);
+    {
+        HistoryLog log;
+        HistoryBuffer history(100);
+        REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+        
+        rlimit limited = original;
+        limited.rlim_cur = recordOffset(10) + 30;
+        REQUIRE(setrlimit(RLIMIT_FSIZE, &limited) == 0);
+        for (uint64_t i = 10; i < 15; i++) {
+            log.append(entry(i));
+        }
+        CHECK(!log.sync());
+        REQUIRE(setrlimit(RLIMIT_FSIZE, &original) == 0);
+        CHECK_EQ(filesystem::file_size(path), recordOffset(10));
+        
+        for (uint64_t i = 15; i < 20; i++) {
+            log.append(entry(i));
+        }
+        CHECK(log.sync());
+        CHECK_EQ(log.getRecordCount(), uint64_t(15));
+    }
+    
+    HistoryLog log;
+    HistoryBuffer history(100);
+    REQUIRE(log.open(path, history) == HistoryLog::OpenResult::OPENED);
+    CHECK_EQ(log.getDroppedCount(), uint64_t(0));
+    REQUIRE(history.size() == 15);
+    // 10..14 were lost with the failed write
+    for (uint64_t i = 0; i < 15; i++) {
+        CHECK_EQ(history[i].timestamp_ns, int64_t(i < 10 ? i : i + 5));
+    }
+}
+#endif
+
+TEST_MAIN()
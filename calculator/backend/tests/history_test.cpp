@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "history.h"
+#include "test_support.h"
+
+using namespace std;
+
+static HistoryEntry entry(int64_t i) {
+    return HistoryEntry(i, Operation::ADD, double(i), 1.0, double(i + 1));
+}
+
+static string longText(char fill, size_t size) {
+    string text = "(" + string(size - 2, fill) + ")";
+    return text;
+}
+
+TEST(ringKeepsNewestEntries) {
+    HistoryBuffer history(4);
+    for (int64_t i = 0; i < 10; i++) {
+        history.push(entry(i));
+    }
+    REQUIRE(history.size() == 4);
+    for (size_t i = 0; i < 4; i++) {
+        CHECK_EQ(history[i].timestamp_ns, int64_t(6 + i));
+    }
+    
+    HistoryView newest = history.newest(2);
+    REQUIRE(newest.size() == 2);
+    CHECK_EQ(newest[0].timestamp_ns, int64_t(8));
+    CHECK_EQ(newest[1].timestamp_ns, int64_t(9));
+    CHECK_EQ(history.newest(0).size(), size_t(4));
+    CHECK_EQ(history.newest(100).size(), size_t(4));
+    
+    history.clear();
+    CHECK(history.newest().empty());
+}
+
+TEST(shortTextsStayInline) {
+    string text = "1 + 2 * 3";
+    HistoryEntry stored(0, Operation::EXPRESSION, 0.0, 0.0, 7.0, text);
+    CHECK_EQ(stored.getText(), text);
+    CHECK(!stored.textContinues());
+    
+    string exact(HistoryEntry::TEXT_CAPACITY, '1');
+    HistoryEntry full(0, Operation::EXPRESSION, 0.0, 0.0, 1.0, exact);
+    CHECK_EQ(full.getText(), exact);
+    CHECK(!full.textContinues());
+}
+
+TEST(longTextsAreKeptWhole) {
+    string text = longText('7', 200);
+    HistoryEntry stored(0, Operation::EXPRESSION, 0.0, 0.0, 7.0, text);
+    CHECK(stored.textContinues());
+    CHECK_EQ(stored.getText(), text.substr(0, HistoryEntry::TEXT_CAPACITY));
+    
+    HistoryBuffer history(3);
+    history.push(stored, text);
+    history.push(entry(1));
+    CHECK_EQ(history.text(history[0]), text);
+    CHECK_EQ(history.newest().text(0), text);
+    CHECK_EQ(history.text(history[1]), string_view());
+    
+    // Without its text only the start is known
+    history.push(stored);
+    CHECK_EQ(history.text(history[2]), stored.getText());
+    
+    // An overwritten slot takes the text of the new entry
+    string other = longText('8', 100);
+    history.push(HistoryEntry(3, Operation::EXPRESSION, 0.0, 0.0, 8.0, other), other);
+    REQUIRE(history.size() == 3);
+    CHECK_EQ(history.text(history[2]), other);
+    history.push(entry(4));
+    history.push(entry(5));
+    CHECK_EQ(history.text(history[0]), other);
+    history.push(entry(6));
+    CHECK_EQ(history.text(history[2]), string_view());
+}
+
+// The matches a query must find, by looking at every entry
+static vector<const HistoryEntry*> scanAll(const HistoryBuffer& history, const HistoryQuery& query) {
+    vector<const HistoryEntry*> matches;
+    for (size_t i = 0; i < history.size(); i++) {
+        const HistoryEntry& candidate = history[i];
+        uint32_t bit = 1u << static_cast<unsigned>(candidate.operation);
+        if (candidate.timestamp_ns >= query.from_ns && candidate.timestamp_ns <= query.to_ns &&
+            candidate.result >= query.min_result && candidate.result <= query.max_result &&
+            (query.operations == 0 || (query.operations & bit) != 0)) {
+            matches.push_back(&candidate);
+        }
+    }
+    if (query.limit != 0 && matches.size() > query.limit) {
+        matches.erase(matches.begin(), matches.end() - query.limit);
+    }
+    return matches;
+}
+
+// Fill a ring that has wrapped several times, with timestamps in order or
+// shuffled, and check block pruning against a scan of every entry
+static void checkQueries(bool ordered) {
+    mt19937_64 random(ordered ? 1 : 2);
+    const Operation OPERATIONS[] = {Operation::ADD, Operation::DIVIDE, Operation::SINE, Operation::SQUARE_ROOT};
+    HistoryBuffer history(5 * HistoryBuffer::BLOCK_SIZE + 300);
+    for (int64_t i = 0; i < int64_t(23 * HistoryBuffer::BLOCK_SIZE); i++) {
+        int64_t timestamp = ordered ? i : int64_t(random() % 30000);
+        // Long runs of one operation, so some blocks lack some operations
+        Operation operation = OPERATIONS[(i / 700 + random() % 8 / 7) % 4];
+        double result = double(random() % 2000) - 1000.0;
+        history.push(HistoryEntry(timestamp, operation, 0.0, 0.0, result));
+    }
+    
+    // Bounds are taken from entries so that they land exactly on block
+    // edges now and then
+    auto someEntry = [&]() -> const HistoryEntry& { return history[random() % history.size()]; };
+    for (size_t round = 0; round < 2000; round++) {
+        HistoryQuery query;
+        if (random() % 2 == 0) {
+            query.from_ns = someEntry().timestamp_ns;
+            query.to_ns = max(query.from_ns, someEntry().timestamp_ns);
+        }
+        if (random() % 2 == 0) {
+            query.min_result = someEntry().result;
+            query.max_result = max(query.min_result, someEntry().result);
+        }
+        if (random() % 2 == 0) {
+            query.operations = 1u << static_cast<unsigned>(OPERATIONS[random() % 4]);
+        }
+        if (random() % 4 == 0) {
+            query.limit = random() % 50 + 1;
+        }
+        vector<const HistoryEntry*> matches;
+        history.query(query, matches);
+        if (matches != scanAll(history, query)) {
+            reportFailure(__FILE__, __LINE__, "query differs from a full scan, round " +
+                          to_string(round) + (ordered ? ", ordered" : ", shuffled"));
+            return;
+        }
+    }
+}
+
+TEST(queriesMatchFullScan) {
+    checkQueries(true);
+    checkQueries(false);
+}
+
+TEST_MAIN()
@@ -0,0 +1,134 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "logger.h"
+#include "test_support.h"
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+using namespace std;
+
+static string formatted(string_view value) {
+    char buffer[Logger::LINE_CAPACITY];
+    LogLine line(buffer, sizeof(buffer));
+    line.appendValue(value);
+    return string(buffer, line.size());
+}
+
+static string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    ostringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+TEST(valuesAreQuotedWhenNeeded) {
+    CHECK_EQ(formatted("client"), "client");
+    CHECK_EQ(formatted("/tmp/calc.sock"), "/tmp/calc.sock");
+    CHECK_EQ(formatted(""), "\"\"");
+    CHECK_EQ(formatted("client connected"), "\"client connected\"");
+    CHECK_EQ(formatted("a=b"), "\"a=b\"");
+    CHECK_EQ(formatted("say \"hi\"\\"), "\"say \\\"hi\\\"\\\\\"");
+    CHECK_EQ(formatted("two\nlines\r\x01"), "\"two\\nlines\\r?\"");
+}
+
+TEST(fieldsAreFormattedInPlace) {
+    char buffer[64];
+    LogLine line(buffer, sizeof(buffer));
+    line.appendField("fd", 7);
+    line.appendField("ok", true);
+    line.appendField("ratio", 0.25);
+    line.appendField("path", string("my file"));
+    CHECK_EQ(string(buffer, line.size()), " fd=7 ok=true ratio=0.25 path=\"my file\"");
+    
+    // Lines longer than the slot are cut short
+    char small[8];
+    LogLine cut(small, sizeof(small));
+    cut.append("0123456789");
+    CHECK_EQ(string(small, cut.size()), "01234567");
+}
+
+TEST(levelsByName) {
+    LogLevel level = LogLevel::INFO;
+    CHECK(parseLogLevel("error", level));
+    CHECK(level == LogLevel::ERR);
+    CHECK(parseLogLevel("debug", level));
+    CHECK(level == LogLevel::DEBUG);
+    CHECK(!parseLogLevel("ERROR", level));
+    CHECK(!parseLogLevel("verbose", level));
+    CHECK_EQ(string(logLevelName(LogLevel::WARN)), "warn");
+}
+
+TEST(samplerKeepsOneInEvery) {
+    LogSampler::configure(4, 0);
+    LogSampler sampler;
+    size_t sampled = 0;
+    for (int i = 0; i < 400; i++) {
+        sampled += sampler.sample() ? 1 : 0;
+    }
+    CHECK_EQ(sampled, size_t(100));
+    
+    // At most `limit` a second; a tight loop may straddle one boundary
+    LogSampler::configure(1, 3);
+    LogSampler limited;
+    sampled = 0;
+    for (int i = 0; i < 1000; i++) {
+        sampled += limited.sample() ? 1 : 0;
+    }
+    CHECK(sampled == 3 || sampled == 6);
+    LogSampler::configure(1, 1000);
+}
+
+#ifndef _WIN32
+// Lines reach stdout or stderr through the writer thread, errors and
+// warnings to stderr, and levels above the threshold are skipped
+TEST(linesReachTheirStream) {
+    TempDir dir;
+    string out_path = dir.file("out.log");
+    string err_path = dir.file("err.log");
+    
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = dup(STDOUT_FILENO);
+    int saved_err = dup(STDERR_FILENO);
+    int out = open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    int err = open(err_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    REQUIRE(saved_out >= 0 && saved_err >= 0 && out >= 0 && err >= 0);
+    dup2(out, STDOUT_FILENO);
+    dup2(err, STDERR_FILENO);
+    
+    Logger::setLevel(LogLevel::INFO);
+    logEvent(LogLevel::DEBUG, "skipped", "n", 1);
+    logEvent(LogLevel::INFO, "client connected", "worker", 0, "fd", 7);
+    logEvent(LogLevel::WARN, "slow client", "fd", 7);
+    
+    // Written within a flush interval or two
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (chrono::steady_clock::now() < deadline &&
+           (readFile(out_path).empty() || readFile(err_path).empty())) {
+        this_thread::sleep_for(chrono::milliseconds(Logger::FLUSH_INTERVAL_MS));
+    }
+    
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+    close(out);
+    close(err);
+    
+    string written = readFile(out_path);
+    string errors = readFile(err_path);
+    CHECK_EQ(written.compare(0, 3, "ts="), 0);
+    CHECK(written.find("Z level=info msg=\"client connected\" worker=0 fd=7\n") != string::npos);
+    CHECK(written.find("skipped") == string::npos);
+    CHECK(errors.find(" level=warn msg=\"slow client\" fd=7\n") != string::npos);
+    CHECK_EQ(Logger::instance().droppedLines(), uint64_t(0));
+}
+#endif
+
+TEST_MAIN()
@@ -0,0 +1,128 @@
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <string>
+#include "calculator.h"
+#include "test_support.h"
+
+using namespace std;
+
+// Doubles go out as the shortest to_chars text and come back in through
+// from_chars: every finite value must survive a trip through a command and
+// its response bit for bit
+
+static bool sameBits(double a, double b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static string shortest(double value) {
+    char buffer[32];
+    return string(buffer, to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+}
+
+// The result field of a SUCCESS response, parsed back
+static bool responseValue(const string& response, double& value) {
+    if (response.compare(0, 8, "SUCCESS|") != 0) {
+        return false;
+    }
+    size_t separator = response.rfind('|');
+    const char* end = response.data() + response.size();
+    auto parsed = from_chars(response.data() + separator + 1, end, value);
+    return parsed.ec == errc() && parsed.ptr == end;
+}
+
+// Random finite doubles, spread evenly over the bit patterns so every
+// exponent (subnormals included) turns up
+static double randomDouble(mt19937_64& random) {
+    while (true) {
+        uint64_t bits = random();
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (std::isfinite(value)) {
+            return value;
+        }
+    }
+}
+
+TEST(toCharsFromCharsRoundTrip) {
+    mt19937_64 random(99);
+    for (int i = 0; i < 1000000; i++) {
+        double value = randomDouble(random);
+        string text = shortest(value);
+        double parsed = 0.0;
+        auto result = from_chars(text.data(), text.data() + text.size(), parsed);
+        if (result.ec != errc() || !sameBits(parsed, value)) {
+            reportFailure(__FILE__, __LINE__, "round trip lost " + text);
+            break;
+        }
+    }
+}
+
+TEST(commandResponsesRoundTrip) {
+    TempDir dir;
+    HistoryLogOptions options;
+    options.sync = HistoryLogOptions::Sync::NONE;
+    CommandProcessor processor(dir.file("history.dat"), 1000, options);
+    
+    mt19937_64 random(7);
+    string response;
+    for (int i = 0; i < 100000; i++) {
+        double value = randomDouble(random);
+        response.clear();
+        processor.processCommand("NEGATE " + shortest(value), response);
+        double result = 0.0;
+        if (!responseValue(response, result) || !sameBits(result, -value)) {
+            reportFailure(__FILE__, __LINE__, "NEGATE " + shortest(value) + " answered " + response);
+            break;
+        }
+    }
+}
+
+TEST(specialValues) {
+    const double values[] = {
+        0.0, -0.0, 0.1, 1.0 / 3.0, 1e23, 5e-324, -5e-324,
+        numeric_limits<double>::min(), numeric_limits<double>::max(),
+        numeric_limits<double>::lowest(), numeric_limits<double>::epsilon(),
+        9007199254740993.0, 123456789012345678.0
+    };
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    for (double value : values) {
+        string response;
+        processor.processCommand("MUL " + shortest(value) + " 1", response);
+        double result = 0.0;
+        CHECK(responseValue(response, result));
+        CHECK(sameBits(result, value));
+    }
+}
+
+TEST(shortestSpelling) {
+    CHECK_EQ(shortest(0.1), "0.1");
+    CHECK_EQ(shortest(0.1 + 0.2), "0.30000000000000004");
+    CHECK_EQ(shortest(1e23), "1e+23");
+    CHECK_EQ(shortest(5e-324), "5e-324");
+    CHECK_EQ(shortest(-0.0), "-0");
+    
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    string response;
+    processor.processCommand("ADD 0.1 0.2", response);
+    CHECK_EQ(response.substr(response.rfind('|') + 1), "0.30000000000000004");
+    response.clear();
+    processor.processCommand("DIV 1 3", response);
+    CHECK_EQ(response.substr(response.rfind('|') + 1), "0.3333333333333333");
+}
+
+TEST(malformedNumbers) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    for (const char* command : {"NEGATE abc", "NEGATE x1", "NEGATE", "NEGATE 1e999", "ADD 1"}) {
+        string response;
+        processor.processCommand(command, response);
+        CHECK_EQ(response.compare(0, 8, "ERROR|||"), 0);
+    }
+}
+
+TEST_MAIN()
@@ -0,0 +1,90 @@
+#include <string>
+#include "calculator.h"
+#include "result_cache.h"
+#include "test_support.h"
+
+using namespace std;
+
+// Miss with keys that were never stored until the bypass is armed
+static void missRun(ResultCache& cache, size_t misses, double first) {
+    double result = 0;
+    for (size_t i = 0; i < misses; i++) {
+        cache.lookup(Operation::POWER, first + double(i), 2.0, result);
+    }
+}
+
+TEST(storedResultsHit) {
+    ResultCache cache(64);
+    double result = 0;
+    CHECK(!cache.lookup(Operation::POWER, 2.0, 10.0, result));
+    cache.store(Operation::POWER, 2.0, 10.0, 1024.0);
+    REQUIRE(cache.lookup(Operation::POWER, 2.0, 10.0, result));
+    CHECK_EQ(result, 1024.0);
+    CHECK_EQ(cache.getHits(), uint64_t(1));
+    CHECK_EQ(cache.getMisses(), uint64_t(1));
+    
+    // Keyed by the operation and the exact bits of the operands
+    CHECK(!cache.lookup(Operation::SINE, 2.0, 10.0, result));
+    CHECK(!cache.lookup(Operation::POWER, 10.0, 2.0, result));
+    cache.store(Operation::SINE, 0.0, 0.0, 0.0);
+    CHECK(!cache.lookup(Operation::SINE, -0.0, 0.0, result));
+    
+    cache.clear();
+    CHECK(!cache.lookup(Operation::POWER, 2.0, 10.0, result));
+    CHECK_EQ(cache.getHits(), uint64_t(0));
+}
+
+TEST(capacityIsRoundedUp) {
+    CHECK_EQ(ResultCache(1).capacity(), size_t(1));
+    CHECK_EQ(ResultCache(100).capacity(), size_t(128));
+    CHECK_EQ(ResultCache(4096).capacity(), size_t(4096));
+    
+    ResultCache off(0);
+    CHECK(!off.isEnabled());
+    CHECK(off.skipped());
+    off.setEnabled(true);
+    CHECK(!off.skipped());
+}
+
+// A run of misses steps the table aside for a while; a hit in between
+// starts the run over
+TEST(missRunArmsBypass) {
+    ResultCache cache(4096);
+    double result = 0;
+    cache.store(Operation::POWER, -1.0, 2.0, 1.0);
+    missRun(cache, 63, 0.0);
+    CHECK(cache.lookup(Operation::POWER, -1.0, 2.0, result));
+    missRun(cache, 63, 100.0);
+    CHECK(!cache.skipped());
+    
+    missRun(cache, 1, 200.0);
+    size_t skipped = 0;
+    while (cache.skipped()) {
+        skipped++;
+    }
+    CHECK_EQ(skipped, size_t(4096));
+    CHECK_EQ(cache.getBypassed(), uint64_t(4096));
+    CHECK(cache.lookup(Operation::POWER, -1.0, 2.0, result));
+}
+
+// MEMO through the command processor: repeats hit, OFF computes directly
+TEST(memoCommandReportsHits) {
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    string response;
+    for (const char* command : {"SIN 30", "SIN 30", "SIN 30", "SIN 30", "MEMO"}) {
+        response.clear();
+        processor.processCommand(command, response);
+    }
+    CHECK_EQ(response, "SUCCESS|Memo Cache|0.75|enabled=1;capacity=4096;hits=3;misses=1;"
+                       "bypassed=0;hit_rate=0.75;");
+    
+    for (const char* command : {"MEMO OFF", "SIN 30", "MEMO"}) {
+        response.clear();
+        processor.processCommand(command, response);
+    }
+    CHECK_EQ(response, "SUCCESS|Memo Cache|0.75|enabled=0;capacity=4096;hits=3;misses=1;"
+                       "bypassed=0;hit_rate=0.75;");
+}
+
+TEST_MAIN()
@@ -0,0 +1,283 @@
+#ifndef SERVER_PROCESS_H
+#define SERVER_PROCESS_H
+
+// A calculator_backend child process and blocking socket clients for it,
+// for the end-to-end tests and the transport benchmarks (Linux)
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "test_support.h"
+
+// A TCP port nobody listens on right now
+inline int freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        close(fd);
+        throw std::runtime_error("no free port");
+    }
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+// Blocking client socket whose reads give up after a timeout. With a
+// timeout set, a call interrupted by the process being stopped and resumed
+// fails with EINTR even without signal handlers; such calls are retried.
+class Client {
+private:
+    int fd;
+    std::string buffered;
+    
+    void setTimeout(int fd, int seconds) {
+        timeval timeout = {seconds, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    
+public:
+    static const int TIMEOUT_SECONDS = 10;
+    
+    Client() : fd(-1) {}
+    ~Client() { disconnect(); }
+    
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+    
+    bool connectTcp(int port) {
+        disconnect();
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            disconnect();
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setTimeout(fd, TIMEOUT_SECONDS);
+        return true;
+    }
+    
+    bool connectUnix(const std::string& path) {
+        disconnect();
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            disconnect();
+            return false;
+        }
+        setTimeout(fd, TIMEOUT_SECONDS);
+        return true;
+    }
+    
+    void disconnect() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        buffered.clear();
+    }
+    
+    int descriptor() const { return fd; }
+    
+    // No more requests; responses can still be read
+    void shutdownWrite() { shutdown(fd, SHUT_WR); }
+    
+    bool send(std::string_view data) {
+        while (!data.empty()) {
+            ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            data.remove_prefix(sent);
+        }
+        return true;
+    }
+    
+    // Exactly size bytes; false on timeout or end of stream
+    bool read(std::string& out, size_t size) {
+        while (buffered.size() < size) {
+            char chunk[65536];
+            ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return false;
+            }
+            buffered.append(chunk, received);
+        }
+        out.assign(buffered, 0, size);
+        buffered.erase(0, size);
+        return true;
+    }
+    
+    // One '\n'-terminated line, without the terminator
+    bool readLine(std::string& line) {
+        size_t newline;
+        while ((newline = buffered.find('\n')) == std::string::npos) {
+            char chunk[65536];
+            ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return false;
+            }
+            buffered.append(chunk, received);
+        }
+        line.assign(buffered, 0, newline);
+        buffered.erase(0, newline + 1);
+        return true;
+    }
+    
+    // One LENGTH-framed message
+    bool readFrame(std::string& message) {
+        std::string header;
+        if (!read(header, 4)) {
+            return false;
+        }
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(header.data());
+        size_t length = (size_t(bytes[0]) << 24) | (size_t(bytes[1]) << 16) |
+                        (size_t(bytes[2]) << 8) | size_t(bytes[3]);
+        return read(message, length);
+    }
+    
+    // True once the server has closed the connection and nothing is left
+    bool closedByPeer() {
+        if (!buffered.empty()) {
+            return false;
+        }
+        char byte;
+        ssize_t received;
+        do {
+            received = recv(fd, &byte, 1, 0);
+        } while (received < 0 && errno == EINTR);
+        return received == 0;
+    }
+};
+
+inline std::string lengthFrame(std::string_view message) {
+    uint32_t length = message.size();
+    std::string frame = {char(length >> 24), char(length >> 16), char(length >> 8), char(length)};
+    frame.append(message.data(), message.size());
+    return frame;
+}
+
+// calculator_backend running in a directory of its own (for its history
+// files) on a free port, killed when this goes out of scope
+class ServerProcess {
+private:
+    TempDir dir;
+    pid_t pid;
+    int tcp_port;
+    
+public:
+    ServerProcess(const std::string& server, std::vector<std::string> arguments) : pid(-1) {
+        tcp_port = freePort();
+        // The child runs in the temporary directory, so a relative path
+        // would no longer lead to the binary
+        std::string path = std::filesystem::absolute(server).string();
+        arguments.insert(arguments.begin(), {path, "--port", std::to_string(tcp_port),
+                                             "--log-level", "warn"});
+        std::vector<char*> argv;
+        for (std::string& argument : arguments) {
+            argv.push_back(&argument[0]);
+        }
+        argv.push_back(nullptr);
+        
+        // The child reports a failed exec through the pipe, which closes
+        // without a word once the exec succeeds
+        int status_pipe[2];
+        if (pipe2(status_pipe, O_CLOEXEC) != 0) {
+            throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+        }
+        std::string log_path = dir.file("server.log");
+        pid = fork();
+        if (pid == 0) {
+            close(status_pipe[0]);
+            int log = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            if (chdir(dir.str().c_str()) == 0) {
+                execv(argv[0], argv.data());
+            }
+            int error = errno;
+            ssize_t written = write(status_pipe[1], &error, sizeof(error));
+            (void)written;
+            _exit(127);
+        }
+        int exec_error = pid < 0 ? errno : 0;
+        close(status_pipe[1]);
+        if (pid > 0 && ::read(status_pipe[0], &exec_error, sizeof(exec_error)) > 0) {
+            waitpid(pid, nullptr, 0);
+            pid = -1;
+        }
+        close(status_pipe[0]);
+        if (exec_error != 0) {
+            throw std::runtime_error("cannot run " + path + ": " + strerror(exec_error));
+        }
+        
+        // Ready once it accepts connections
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        Client probe;
+        while (!probe.connectTcp(tcp_port)) {
+            int status;
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                pid = -1;
+                throw std::runtime_error("server exited at startup");
+            }
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("server did not start");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+    
+    ~ServerProcess() {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    
+    ServerProcess(const ServerProcess&) = delete;
+    ServerProcess& operator=(const ServerProcess&) = delete;
+    
+    int port() const { return tcp_port; }
+    std::string file(const std::string& name) const { return dir.file(name); }
+    
+    bool running() {
+        int status;
+        return pid > 0 && waitpid(pid, &status, WNOHANG) == 0;
+    }
+};
+
+#endif // SERVER_PROCESS_H
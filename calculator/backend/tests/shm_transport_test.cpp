@@ -0,0 +1,180 @@
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "binary_protocol.h"
+#include "shm_transport.h"
+#include "test_support.h"
+
+using namespace std;
+
+// The rings on their own, then a server in this process with clients
+// talking to it through a segment of its own
+
+static string segmentName() {
+    static int segments = 0;
+    return "calculator_test_" + to_string(getpid()) + "_" + to_string(segments++);
+}
+
+static unique_ptr<CommandProcessor> processor(const TempDir& dir) {
+    return make_unique<CommandProcessor>(dir.file("history.dat"), 100);
+}
+
+TEST(ringWrapsAround) {
+    ShmRingIndex index;
+    index.head = 0;
+    index.tail = 0;
+    char data[64];
+    ShmRing ring(&index, data, sizeof(data));
+    CHECK_EQ(ShmRing::recordSize(0), uint64_t(8));
+    CHECK_EQ(ShmRing::recordSize(1), uint64_t(16));
+    CHECK_EQ(ShmRing::recordSize(8), uint64_t(16));
+    
+    string first = "abcd";
+    string second(20, 'b');
+    CHECK(ring.write(first));
+    CHECK(ring.write(second));
+    CHECK(!ring.write(string(20, 'c')));
+    
+    string scratch;
+    string_view message;
+    REQUIRE(ring.peek(message, scratch));
+    CHECK_EQ(message, first);
+    ring.pop(message.size());
+    
+    // The next message runs past the end and is read back through scratch
+    string third = "0123456789abcdefghij";
+    CHECK(ring.write(third));
+    REQUIRE(ring.peek(message, scratch));
+    CHECK_EQ(message, second);
+    ring.pop(message.size());
+    REQUIRE(ring.peek(message, scratch));
+    CHECK_EQ(message, third);
+    CHECK(message.data() == scratch.data());
+    ring.pop(message.size());
+    CHECK(ring.empty());
+    CHECK(!ring.peek(message, scratch));
+    
+    CHECK(!ring.write(string(57, 'x')));
+}
+
+// A length the other side could not have written is not trusted
+TEST(corruptLengthIsRejected) {
+    ShmRingIndex index;
+    index.head = 0;
+    index.tail = 0;
+    char data[64];
+    ShmRing ring(&index, data, sizeof(data));
+    CHECK(ring.write("hello"));
+    uint64_t length = 1000;
+    memcpy(data, &length, sizeof(length));
+    string scratch;
+    string_view message;
+    CHECK(!ring.peek(message, scratch));
+    CHECK(!ring.empty());
+}
+
+TEST(textAndBinaryChannels) {
+    TempDir dir;
+    string name = segmentName();
+    ShmServer server(name, ShmOptions(), processor(dir));
+    REQUIRE(server.start());
+    
+    ShmClient text;
+    string error;
+    REQUIRE(text.connect(name, ShmMode::TEXT, 0, error));
+    string response;
+    REQUIRE(text.call("ADD 1 2", response));
+    CHECK_EQ(response, "SUCCESS|1.000000 + 2.000000|3");
+    
+    // Pipelined requests are answered in order
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(text.send("MUL " + to_string(i) + " 2"));
+    }
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(text.receive(response));
+        CHECK_EQ(response.substr(response.rfind('|') + 1), to_string(2 * i));
+    }
+    
+    ShmClient binary;
+    REQUIRE(binary.connect(name, ShmMode::BINARY, 0, error));
+    BinaryRequest requests[2] = {{BINARY_OPCODE_SQRT, 0, 0, 7, {16.0, 0.0}},
+                                 {BINARY_OPCODE_DIV, 0, 0, 8, {1.0, 0.0}}};
+    REQUIRE(binary.call(string_view(reinterpret_cast<const char*>(requests), sizeof(requests)),
+                        response));
+    REQUIRE(response.size() == 2 * sizeof(BinaryResponse));
+    BinaryResponse answers[2];
+    memcpy(answers, response.data(), sizeof(answers));
+    CHECK(answers[0].status == BinaryStatus::OK);
+    CHECK_EQ(answers[0].tag, uint32_t(7));
+    CHECK_EQ(answers[0].result, 4.0);
+    CHECK(answers[1].status == BinaryStatus::FAILURE);
+    CHECK_EQ(answers[1].tag, uint32_t(8));
+    server.stop();
+}
+
+// Responses wait for room in a small ring, and one that can never fit is
+// replaced by an error
+TEST(smallRingsStillDeliver) {
+    TempDir dir;
+    string name = segmentName();
+    ShmOptions options;
+    options.ring_bytes = 4096;
+    ShmServer server(name, options, processor(dir));
+    REQUIRE(server.start());
+    
+    ShmClient client;
+    string error;
+    REQUIRE(client.connect(name, ShmMode::TEXT, 0, error));
+    for (int i = 0; i < 20; i++) {
+        REQUIRE(client.send("FACT 400"));
+    }
+    string response;
+    for (int i = 0; i < 20; i++) {
+        REQUIRE(client.receive(response));
+        CHECK_EQ(response.compare(0, 13, "SUCCESS|400!|"), 0);
+        CHECK_EQ(response.size(), size_t(13 + 869));
+    }
+    REQUIRE(client.call("FACT 2000", response));
+    CHECK_EQ(response, "ERROR|||Response too large for the shared memory ring");
+    server.stop();
+}
+
+TEST(channelsAreHandedBack) {
+    TempDir dir;
+    string name = segmentName();
+    ShmOptions options;
+    options.channels = 2;
+    ShmServer server(name, options, processor(dir));
+    REQUIRE(server.start());
+    
+    ShmClient clients[3];
+    string error;
+    REQUIRE(clients[0].connect(name, ShmMode::TEXT, 0, error));
+    REQUIRE(clients[1].connect(name, ShmMode::TEXT, 0, error));
+    CHECK(!clients[2].connect(name, ShmMode::TEXT, 0, error));
+    CHECK_EQ(error, "all 2 channels are in use");
+    
+    // The server frees a closed channel once it notices
+    clients[0].close();
+    bool connected = false;
+    for (int attempt = 0; attempt < 200 && !connected; attempt++) {
+        connected = clients[2].connect(name, ShmMode::TEXT, 0, error);
+        if (!connected) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+    REQUIRE(connected);
+    string response;
+    REQUIRE(clients[2].call("SUB 5 1", response));
+    CHECK_EQ(response, "SUCCESS|5.000000 - 1.000000|4");
+    
+    // Once the server stops, waiting clients give up and new ones fail
+    server.stop();
+    CHECK(!clients[1].receive(response));
+    CHECK(!ShmClient().connect(name, ShmMode::TEXT, 0, error));
+}
+
+TEST_MAIN()
@@ -0,0 +1,95 @@
+#include <string>
+#include "calculator.h"
+#include "stats.h"
+#include "test_support.h"
+
+using namespace std;
+
+static string run(CommandProcessor& processor, const string& command) {
+    string response;
+    processor.processCommand(command, response);
+    return response;
+}
+
+static bool contains(const string& text, const string& part) {
+    return text.find(part) != string::npos;
+}
+
+// Every value lands in a bucket that starts at most 1/16 below it
+TEST(bucketsStayWithinOneSixteenth) {
+    for (uint64_t value = 1; value < (uint64_t(1) << 40); value += value / 7 + 1) {
+        size_t bucket = LatencyHistogram::bucketOf(value);
+        uint64_t start = LatencyHistogram::bucketStart(bucket);
+        if (start > value || value - start > value / 16) {
+            reportFailure(__FILE__, __LINE__, to_string(value) + " fell in a bucket from " +
+                          to_string(start));
+            return;
+        }
+    }
+    CHECK_EQ(LatencyHistogram::bucketOf(0), size_t(0));
+    CHECK_EQ(LatencyHistogram::bucketOf(~uint64_t(0)), LatencyHistogram::BUCKETS - 1);
+}
+
+TEST(quantilesOfRecordedValues) {
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 1000; value++) {
+        histogram.record(value);
+    }
+    HistogramSnapshot snapshot;
+    histogram.addTo(snapshot);
+    CHECK_EQ(snapshot.count, uint64_t(1000));
+    CHECK_EQ(snapshot.sum, uint64_t(500500));
+    CHECK_EQ(snapshot.max, uint64_t(1000));
+    // The middle of the bucket holding the rank
+    uint64_t median = snapshot.quantile(0.5);
+    CHECK(median >= 500 - 500 / 16 && median <= 500 + 500 / 16);
+    uint64_t p99 = snapshot.quantile(0.99);
+    CHECK(p99 >= 990 - 990 / 16 && p99 <= 990 + 990 / 16);
+    CHECK_EQ(snapshot.quantile(1.0), uint64_t(1000));
+    
+    histogram.clear();
+    HistogramSnapshot cleared;
+    histogram.addTo(cleared);
+    CHECK_EQ(cleared.count, uint64_t(0));
+}
+
+// STATS counts every request by command, errors and unknown names
+// included; OFF stops counting and RESET starts over. A request is counted
+// once it has been answered, so STATS does not see itself.
+TEST(statsCommandCountsRequests) {
+    RequestStats::setSampleInterval(1);
+    TempDir dir;
+    CommandProcessor processor(dir.file("history.dat"), 100);
+    for (int i = 0; i < 3; i++) {
+        run(processor, "ADD 1 2");
+    }
+    run(processor, "DIV 1 0");
+    run(processor, "NOPE");
+    
+    string stats = run(processor, "STATS");
+    CHECK(contains(stats, "SUCCESS|Stats|5|enabled=1;sample_interval=1;requests=5;errors=2;"));
+    CHECK(contains(stats, ";ADD.requests=3;ADD.errors=0;"));
+    CHECK(contains(stats, ";DIV.requests=1;DIV.errors=1;"));
+    CHECK(contains(stats, ";UNKNOWN.requests=1;UNKNOWN.errors=1;"));
+    CHECK(!contains(stats, "SUB."));
+    // Sampling every request gives ADD three timings
+    CHECK(!contains(stats, "ADD.total_max_ns=0;"));
+    
+    string metrics = RequestStats::collect().prometheus();
+    CHECK(contains(metrics, "calculator_requests_total{command=\"ADD\"} 3\n"));
+    CHECK(contains(metrics, "calculator_errors_total{command=\"DIV\"} 1\n"));
+    
+    run(processor, "STATS OFF");
+    run(processor, "ADD 1 2");
+    CHECK(contains(run(processor, "STATS"), "|enabled=0;sample_interval=1;requests=7;"));
+    run(processor, "STATS ON");
+    CHECK_EQ(run(processor, "STATS RESET"), "SUCCESS|Stats|0|enabled=1;sample_interval=1;requests=0;"
+                                            "errors=0;sends=0;send_p50_ns=0;send_p99_ns=0;send_max_ns=0;");
+    stats = run(processor, "STATS");
+    CHECK(contains(stats, "|enabled=1;sample_interval=1;requests=1;errors=0;"));
+    CHECK(contains(stats, ";STATS.requests=1;"));
+    CHECK(!contains(stats, "ADD."));
+    RequestStats::setSampleInterval(DEFAULT_STATS_SAMPLE_INTERVAL);
+}
+
+TEST_MAIN()
@@ -0,0 +1,156 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+// Minimal harness for the backend tests. Every test file is an executable
+// of its own: TEST(name) defines a case, CHECK and CHECK_EQ report a
+// failure and go on, REQUIRE ends the case, and TEST_MAIN() runs every
+// case (or those whose name contains the first argument).
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<TestCase>& testCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+inline int& testFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+struct TestRegistration {
+    TestRegistration(const char* name, void (*run)()) {
+        testCases().push_back({name, run});
+    }
+};
+
+// Thrown by REQUIRE to leave the current case
+struct TestAbort {};
+
+inline void reportFailure(const char* file, int line, const std::string& message) {
+    testFailures()++;
+    std::cerr << file << ":" << line << ": " << message << std::endl;
+}
+
+template <typename T>
+std::string describe(const T& value) {
+    std::ostringstream out;
+    out.precision(17);
+    out << value;
+    return out.str();
+}
+
+inline std::string describe(uint8_t value) { return std::to_string(value); }
+inline std::string describe(std::string_view value) { return "\"" + std::string(value) + "\""; }
+inline std::string describe(const std::string& value) { return describe(std::string_view(value)); }
+inline std::string describe(const char* value) { return describe(std::string_view(value)); }
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistration name##_registration(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            reportFailure(__FILE__, __LINE__, "CHECK(" #condition ") failed"); \
+        } \
+    } while (0)
+
+#define REQUIRE(condition) \
+    do { \
+        if (!(condition)) { \
+            reportFailure(__FILE__, __LINE__, "REQUIRE(" #condition ") failed"); \
+            throw TestAbort(); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        const auto& actual_value = (actual); \
+        const auto& expected_value = (expected); \
+        if (!(actual_value == expected_value)) { \
+            reportFailure(__FILE__, __LINE__, "CHECK_EQ(" #actual ", " #expected "): got " + \
+                          describe(actual_value) + ", expected " + describe(expected_value)); \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(statement) \
+    do { \
+        bool threw = false; \
+        try { \
+            statement; \
+        } catch (const std::exception&) { \
+            threw = true; \
+        } \
+        if (!threw) { \
+            reportFailure(__FILE__, __LINE__, "CHECK_THROWS(" #statement ") did not throw"); \
+        } \
+    } while (0)
+
+inline int runTests(int argc, char** argv) {
+    std::string_view filter = argc > 1 ? argv[1] : "";
+    int failed_cases = 0;
+    for (const TestCase& test : testCases()) {
+        if (std::string_view(test.name).find(filter) == std::string_view::npos) {
+            continue;
+        }
+        int before = testFailures();
+        try {
+            test.run();
+        } catch (const TestAbort&) {
+        } catch (const std::exception& e) {
+            reportFailure(__FILE__, __LINE__, std::string("unexpected exception: ") + e.what());
+        }
+        bool passed = testFailures() == before;
+        failed_cases += passed ? 0 : 1;
+        std::cout << (passed ? "[  OK  ] " : "[ FAIL ] ") << test.name << std::endl;
+    }
+    std::cout << failed_cases << " of " << testCases().size() << " cases failed" << std::endl;
+    return failed_cases == 0 ? 0 : 1;
+}
+
+#define TEST_MAIN() \
+    int main(int argc, char** argv) { return runTests(argc, argv); }
+
+// Directory removed with everything in it when the test is done
+class TempDir {
+private:
+    std::filesystem::path path;
+    
+public:
+    TempDir() {
+        std::random_device random;
+        path = std::filesystem::temp_directory_path() /
+               ("calculator_test_" + std::to_string(random()) + std::to_string(random()));
+        std::filesystem::create_directories(path);
+    }
+    
+    ~TempDir() {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+    
+    TempDir(const TempDir&) = delete;
+    TempDir& operator=(const TempDir&) = delete;
+    
+    std::string str() const { return path.string(); }
+    std::string file(const std::string& name) const { return (path / name).string(); }
+};
+
+#endif // TEST_SUPPORT_H
@@ -0,0 +1,318 @@
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int uringSetup(unsigned entries, io_uring_params& params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+static int uringEnter(int fd, unsigned to_submit, unsigned wait_for, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, wait_for, flags,
+                                    nullptr, 0));
+}
+
+static int uringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+IoUring::IoUring()
+    : ring_fd(-1), ring_memory(MAP_FAILED), ring_length(0), sqes(nullptr), sqes_length(0),
+      sq_head(nullptr), sq_tail(nullptr), sq_mask(0), sq_entries(0), sqe_tail(0),
+      cq_head(nullptr), cq_tail(nullptr), cq_mask(0), cqes(nullptr),
+      buffers(nullptr), buffer_ring(nullptr), buffer_ring_length(0), buffer_tail(0) {}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    if (ring_fd >= 0) {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+    if (ring_memory != MAP_FAILED) {
+        munmap(ring_memory, ring_length);
+        ring_memory = MAP_FAILED;
+    }
+    if (sqes != nullptr) {
+        munmap(sqes, sqes_length);
+        sqes = nullptr;
+    }
+    if (buffer_ring != nullptr) {
+        munmap(buffer_ring, buffer_ring_length);
+        buffer_ring = nullptr;
+    }
+    if (buffers != nullptr) {
+        munmap(buffers, size_t(BUFFER_COUNT) * BUFFER_SIZE);
+        buffers = nullptr;
+    }
+}
+
+bool IoUring::init(unsigned entries, string& error) {
+    // Only the loop thread submits, and completions are only needed when it
+    // asks for them: the kernel may defer its work until then instead of
+    // interrupting the thread. DEFER_TASKRUN and SINGLE_ISSUER are 6.1.
+    unsigned flags = IORING_SETUP_R_DISABLED | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    if (!setup(entries, flags | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, error) &&
+        !setup(entries, flags, error)) {
+        return false;
+    }
+    return registerBuffers(error);
+}
+
+bool IoUring::setup(unsigned entries, unsigned flags, string& error) {
+    release();
+    
+    io_uring_params params = {};
+    params.flags = flags;
+    ring_fd = uringSetup(entries, params);
+    if (ring_fd < 0) {
+        error = string("io_uring_setup: ") + strerror(errno);
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        error = "io_uring too old";
+        release();
+        return false;
+    }
+    
+    // Submission and completion rings share one mapping
+    ring_length = max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_memory = mmap(nullptr, ring_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd, IORING_OFF_SQ_RING);
+    sqes_length = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqe_memory = mmap(nullptr, sqes_length, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (ring_memory == MAP_FAILED || sqe_memory == MAP_FAILED) {
+        error = string("io_uring mmap: ") + strerror(errno);
+        if (sqe_memory != MAP_FAILED) {
+            munmap(sqe_memory, sqes_length);
+        }
+        release();
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqe_memory);
+    
+    char* base = static_cast<char*>(ring_memory);
+    sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+    unsigned* sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; i++) {
+        sq_array[i] = i;
+    }
+    cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    
+    // Multishot recv came with zero-copy send in 6.0; the probe has no
+    // entry for it of its own
+    for (uint8_t opcode : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SEND_ZC}) {
+        if (!supports(opcode)) {
+            error = "io_uring lacks multishot recv (needs Linux 6.0)";
+            release();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IoUring::available(string& error) {
+    IoUring probe;
+    return probe.init(8, error);
+}
+
+bool IoUring::enable() {
+    return uringRegister(ring_fd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) == 0;
+}
+
+bool IoUring::supports(uint8_t opcode) const {
+    const unsigned OPS = 256;
+    size_t size = sizeof(io_uring_probe) + OPS * sizeof(io_uring_probe_op);
+    io_uring_probe* probe = static_cast<io_uring_probe*>(calloc(1, size));
+    bool supported = probe != nullptr &&
+                     uringRegister(ring_fd, IORING_REGISTER_PROBE, probe, OPS) == 0 &&
+                     opcode < probe->ops_len &&
+                     (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+}
+
+// Buffers
+//
+// The buffers, and the buffer ring's entries, live in our own memory. The
+// kernel is told where the ring is once and takes buffers from it as data
+// arrives, in the order we put them back.
+bool IoUring::registerBuffers(string& error) {
+    void* data = mmap(nullptr, size_t(BUFFER_COUNT) * BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        error = string("io_uring buffers: ") + strerror(errno);
+        release();
+        return false;
+    }
+    buffers = static_cast<char*>(data);
+    
+    buffer_ring_length = (BUFFER_COUNT * sizeof(io_uring_buf) + 4095) & ~size_t(4095);
+    void* ring = mmap(nullptr, buffer_ring_length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        error = string("io_uring buffer ring: ") + strerror(errno);
+        release();
+        return false;
+    }
+    buffer_ring = static_cast<io_uring_buf_ring*>(ring);
+    
+    io_uring_buf_reg registration = {};
+    registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+    registration.ring_entries = BUFFER_COUNT;
+    registration.bgid = BUFFER_GROUP;
+    if (uringRegister(ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        error = string("io_uring buffer ring: ") + strerror(errno);
+        release();
+        return false;
+    }
+    
+    buffer_tail = 0;
+    for (unsigned i = 0; i < BUFFER_COUNT; i++) {
+        recycle(static_cast<uint16_t>(i));
+    }
+    publishBuffers();
+    return true;
+}
+
+void IoUring::recycle(uint16_t id) {
+    // Entry 0 overlaps the ring's tail, so only the fields of the entry are
+    // written, never the whole struct. The entries are addressed from the
+    // start of the ring rather than through bufs[], which C++ compilers lay
+    // out 8 bytes further on (the header's flexible array member is wrapped
+    // in a struct with an empty member there).
+    io_uring_buf* entries = reinterpret_cast<io_uring_buf*>(buffer_ring);
+    io_uring_buf& entry = entries[buffer_tail & (BUFFER_COUNT - 1)];
+    entry.addr = reinterpret_cast<uint64_t>(buffers + size_t(id) * BUFFER_SIZE);
+    entry.len = BUFFER_SIZE;
+    entry.bid = id;
+    buffer_tail++;
+}
+
+void IoUring::publishBuffers() {
+    __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+}
+
+// Submission
+io_uring_sqe* IoUring::nextSqe() {
+    if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        submit(0);
+        if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            return nullptr;
+        }
+    }
+    io_uring_sqe* sqe = &sqes[sqe_tail & sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe_tail++;
+    return sqe;
+}
+
+// One accept request keeps accepting until it fails; the sockets it
+// produces are blocking, which io_uring handles by polling internally
+bool IoUring::queueAccept(int listen_fd, uint64_t user_data) {
+    io_uring_sqe* sqe = nextSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+    return true;
+}
+
+// Likewise one recv keeps receiving, each completion into a provided
+// buffer of its own
+bool IoUring::queueRecv(int fd, uint64_t user_data) {
+    io_uring_sqe* sqe = nextSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = user_data;
+    return true;
+}
+
+// The data must stay put until the send completes
+bool IoUring::queueSend(int fd, const char* data, size_t length, uint64_t user_data) {
+    io_uring_sqe* sqe = nextSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(min<size_t>(length, UINT32_MAX));
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return true;
+}
+
+// A plain read, into memory that must stay put until it completes
+bool IoUring::queueRead(int fd, void* data, size_t length, uint64_t user_data) {
+    io_uring_sqe* sqe = nextSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data);
+    sqe->len = static_cast<uint32_t>(min<size_t>(length, UINT32_MAX));
+    sqe->off = uint64_t(-1);
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IoUring::queueCancel(uint64_t target) {
+    io_uring_sqe* sqe = nextSqe();
+    if (sqe == nullptr) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = INTERNAL_USER_DATA;
+    return true;
+}
+
+int IoUring::submit(unsigned wait_for) {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && flags == 0) {
+        return 0;
+    }
+    if (uringEnter(ring_fd, to_submit, wait_for, flags) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+#endif // __linux__
@@ -0,0 +1,119 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Minimal io_uring interface for the event loop, straight over the system
+// calls (the kernel headers give the ABI; there is no liburing).
+//
+// Requests are queued in the submission ring without a system call and
+// submitted all at once by submit(), which also waits for completions, so
+// a busy loop makes one io_uring_enter per turn however many connections
+// it serves. Receives draw from buffers registered with the kernel up
+// front as a provided buffer ring, which is what lets a single multishot
+// recv keep a connection readable without being re-armed; they go back to
+// the kernel through the ring's shared tail, without a system call.
+// (Fixed buffers, IORING_REGISTER_BUFFERS, cannot be used here: a recv
+// only takes a buffer of its own choosing from a provided group, and a
+// fixed one would tie a buffer to every idle connection.)
+//
+// Linux only, like the epoll event loop.
+
+#ifdef __linux__
+
+#include <linux/io_uring.h>
+
+class IoUring {
+public:
+    // Receive buffers, a power of two of each
+    static const unsigned BUFFER_COUNT = 1024;
+    static const unsigned BUFFER_SIZE = 4096;
+    
+    IoUring();
+    ~IoUring();
+    
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    
+    // Set up a ring of `entries` submission slots and its receive buffers.
+    // False, with the reason, if the kernel lacks anything the event loop
+    // relies on (multishot accept and recv, provided buffer rings: 6.0).
+    // The ring starts disabled; enable() it on the thread that submits.
+    bool init(unsigned entries, std::string& error);
+    // Whether init() would work here, tried on a small ring
+    static bool available(std::string& error);
+    bool enable();
+    
+    // Queue requests; false if the submission ring is full even after
+    // submitting what it holds
+    bool queueAccept(int listen_fd, uint64_t user_data);
+    bool queueRecv(int fd, uint64_t user_data);
+    bool queueSend(int fd, const char* data, size_t length, uint64_t user_data);
+    bool queueRead(int fd, void* data, size_t length, uint64_t user_data);
+    // Cancel the request queued with user_data, which then completes
+    // with -ECANCELED (a multishot one for the last time)
+    bool queueCancel(uint64_t target);
+    
+    // Submit everything queued and wait until at least wait_for requests
+    // have completed. 0 or -errno.
+    int submit(unsigned wait_for);
+    
+    // Hand every completion posted so far to handler(const io_uring_cqe&)
+    template <typename Handler>
+    void forEachCompletion(Handler handler) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            if (cqes[head & cq_mask].user_data != INTERNAL_USER_DATA) {
+                handler(cqes[head & cq_mask]);
+            }
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+    
+    // The buffer a receive completion's data is in (flags >> IORING_CQE_BUFFER_SHIFT)
+    const char* buffer(uint16_t id) const { return buffers + size_t(id) * BUFFER_SIZE; }
+    // Give a buffer back; the kernel sees it after publishBuffers()
+    void recycle(uint16_t id);
+    void publishBuffers();
+    
+private:
+    int ring_fd;
+    void* ring_memory;
+    size_t ring_length;
+    io_uring_sqe* sqes;
+    size_t sqes_length;
+    
+    unsigned* sq_head;          // Advanced by the kernel
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sqe_tail;          // Queued up to here, published by submit()
+    
+    unsigned* cq_head;
+    unsigned* cq_tail;          // Advanced by the kernel
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+    
+    char* buffers;
+    io_uring_buf_ring* buffer_ring;
+    size_t buffer_ring_length;
+    uint16_t buffer_tail;       // Recycled up to here, published by publishBuffers()
+    
+    static const uint16_t BUFFER_GROUP = 0;
+    // The ring's own requests (cancel) only complete on failure, and
+    // nobody waits for them
+    static const uint64_t INTERNAL_USER_DATA = ~uint64_t(0);
+    
+    bool setup(unsigned entries, unsigned flags, std::string& error);
+    io_uring_sqe* nextSqe();
+    bool supports(uint8_t opcode) const;
+    bool registerBuffers(std::string& error);
+    void release();
+};
+
+#endif // __linux__
+
+#endif // URING_H